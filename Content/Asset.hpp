@@ -1,6 +1,13 @@
 #pragma once
 
+#include <cstdint>
+
 class Asset {
 public:
 	virtual ~Asset() {}
+
+	/// Bytes of device memory the asset holds, counted against AssetManager's device memory budget
+	inline virtual uint64_t DeviceMemorySize() const { return 0; }
+	/// Bytes of host memory the asset holds, counted against AssetManager's host memory budget
+	inline virtual uint64_t HostMemorySize() const { return 0; }
 };
\ No newline at end of file
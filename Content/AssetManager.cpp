@@ -1,49 +1,307 @@
 #include <Content/AssetManager.hpp>
 #include <Content/Font.hpp>
+#include <Content/Ktx2.hpp>
 #include <Content/Mesh.hpp>
 #include <Content/Texture.hpp>
 #include <Content/Shader.hpp>
+#include <Util/Profiler.hpp>
+#include <Util/ThreadPool.hpp>
 
 using namespace std;
 
-AssetManager::AssetManager(Device* device) : mDevice(device) {}
+// without an explicit budget, unreferenced assets are evicted once the process uses this much of the driver's device memory budget,
+// leaving room for render targets and buffers that aren't assets
+#define DEVICE_BUDGET_FRACTION .9
+
+AssetManager::AssetManager(Device* device) : mDevice(device), mDeviceMemory(0), mHostMemory(0), mDeviceMemoryBudget(0), mHostMemoryBudget(0) {
+	uint8_t pixel[4] { 128, 128, 128, 255 };
+	mPlaceholder = new Texture("Placeholder", mDevice, pixel, sizeof(pixel), 1, 1, 1, VK_FORMAT_R8G8B8A8_UNORM, 1);
+}
 AssetManager::~AssetManager() {
+	// assets that are still being loaded may add streamed textures
+	for (auto& asset : mAssets)
+		asset.second.mAsset.wait();
+	// textures can't be deleted while a worker is decoding into them, or the GPU is copying into them
+	for (PendingTexture& p : mPendingTextures)
+		if (p.mUpload.valid()) p.mUpload.wait();
+	mDevice->UploadQueue()->Flush();
+
 	for (auto& asset : mAssets)
-		delete asset.second;
+		delete asset.second.mAsset.get();
+	safe_delete(mPlaceholder);
+}
+
+template<class T, typename F>
+T* AssetManager::Load(const string& key, F create, Entry** acquired) {
+	promise<Asset*> created;
+	shared_future<Asset*> future;
+	Entry* entry;
+	bool creator = false;
+	{
+		lock_guard lock(mMutex);
+		auto it = mAssets.find(key);
+		if (it == mAssets.end()) {
+			entry = &mAssets[key];
+			entry->mAsset = created.get_future().share();
+			entry->mRefCount = 0;
+			entry->mPinned = false;
+			entry->mDeviceMemory = 0;
+			entry->mHostMemory = 0;
+			entry->mCreator = this_thread::get_id();
+			creator = true;
+		} else {
+			entry = &it->second;
+			// create() is still running further up this thread's stack, the asset can't be constructed while this thread waits for it
+			if (entry->mCreator == this_thread::get_id()) {
+				fprintf_color(COLOR_RED, stderr, "%s was requested while it was being loaded on the same thread\n", key.c_str());
+				throw;
+			}
+		}
+		// referenced before the lock is released, so the asset can't be evicted before it's returned
+		if (acquired) entry->mRefCount++;
+		else entry->mPinned = true;
+		entry->mLastUsed = mDevice->Instance()->FrameCount();
+		future = entry->mAsset;
+	}
+
+	if (creator) {
+		Asset* asset;
+		try {
+			asset = create();
+		} catch (...) {
+			// the next request tries again, the ones waiting now get the exception
+			{
+				lock_guard lock(mMutex);
+				mAssets.erase(key);
+			}
+			created.set_exception(current_exception());
+			throw;
+		}
+		if (!asset) {
+			{
+				lock_guard lock(mMutex);
+				mAssets.erase(key);
+			}
+			created.set_value(nullptr);
+			return nullptr;
+		}
+		{
+			lock_guard lock(mMutex);
+			entry->mDeviceMemory = asset->DeviceMemorySize();
+			entry->mHostMemory = asset->HostMemorySize();
+			entry->mCreator = thread::id();
+			mDeviceMemory += entry->mDeviceMemory;
+			mHostMemory += entry->mHostMemory;
+		}
+		created.set_value(asset);
+		Profiler::AddCounter("Asset Loads");
+	}
+	if (acquired) *acquired = entry;
+	// another thread is constructing the asset. No pool tasks are run while waiting: one could request an asset this thread is
+	// constructing further up its stack. The constructing thread runs the tasks its constructor waits on itself
+	return (T*)future.get();
+}
+template<class T, typename F>
+shared_ptr<T> AssetManager::Acquire(const string& key, F create) {
+	Entry* entry;
+	T* asset = Load<T>(key, create, &entry);
+	// the entry was removed when create() failed
+	if (!asset) return nullptr;
+	// releases the reference instead of deleting the asset
+	return shared_ptr<T>(asset, [this, entry](T*) { Release(entry); });
+}
+void AssetManager::Release(Entry* entry) {
+	lock_guard lock(mMutex);
+	if (--entry->mRefCount == 0) entry->mLastUsed = mDevice->Instance()->FrameCount();
 }
 
 Shader* AssetManager::LoadShader(const string& filename) {
-	mMutex.lock();
-	Asset*& asset = mAssets[filename];
-	if (!asset) asset = new Shader(filename, mDevice, filename);
-	mMutex.unlock();
-	return (Shader*)asset;
+	return Load<Shader>(filename, [&]() { return new Shader(filename, mDevice, filename); });
+}
+string AssetManager::TextureFile(const string& filename, bool srgb) {
+	if (!mDevice->TextureCompressionBCSupported()) return filename;
+	fs::path compressed = fs::path(filename).replace_extension(".ktx2");
+	if (compressed == fs::path(filename)) return filename;
+
+	error_code ec;
+	if (!fs::exists(compressed, ec)) return filename;
+	// an image that was edited after it was converted is loaded instead
+	if (fs::exists(filename, ec) && fs::last_write_time(compressed, ec) < fs::last_write_time(filename, ec)) return filename;
+
+	// a texture converted for the other transfer function would sample wrong, so the image is loaded instead
+	Ktx2Header header;
+	ifstream file(compressed, ios::binary);
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(Ktx2Header)) || memcmp(header.mIdentifier, Ktx2Identifier, KTX2_IDENTIFIER_SIZE)) return filename;
+	if (!Ktx2MatchesEncoding(header.mFormat, srgb)) {
+		if (fs::exists(filename, ec)) return filename;
+		fprintf_color(COLOR_YELLOW, stderr, "%s: Texture was converted %s, but is loaded %s\n", compressed.string().c_str(), srgb ? "linear" : "as sRGB", srgb ? "as sRGB" : "linear");
+	}
+	return compressed.string();
 }
+
 Texture* AssetManager::LoadTexture(const string& filename, bool srgb) {
-	mMutex.lock();
-	Asset*& asset = mAssets[filename];
-	if (!asset) asset = new Texture(filename, mDevice, filename, srgb);
-	mMutex.unlock();
-	return (Texture*)asset;
+	return Load<Texture>(filename, [&]() { return new Texture(filename, mDevice, TextureFile(filename, srgb), srgb); });
+}
+Texture* AssetManager::LoadTextureStreamed(const string& filename, bool srgb) {
+	return Load<Texture>(filename, [&]() {
+		string file = TextureFile(filename, srgb);
+		Texture* texture = new Texture(filename, mDevice, file, srgb, mPlaceholder);
+
+		PendingTexture pending = {};
+		pending.mTexture = texture;
+		pending.mUpload = mDevice->Instance()->ThreadPool()->EnqueueBackground([=]() { return texture->UploadAsync(file); });
+		lock_guard lock(mPendingMutex);
+		mPendingTextures.push_back(move(pending));
+		return texture;
+	});
 }
 Texture* AssetManager::LoadCubemap(const string& posx, const string& negx, const string& posy, const string& negy, const string& posz, const string& negz, bool srgb) {
-	mMutex.lock();
-	Asset*& asset = mAssets[negx + posx + negy + posy + negz + posz];
-	if (!asset) asset = new Texture(negx + " Cube", mDevice, posx, negx, posy, negy, posz, negz, srgb);
-	mMutex.unlock();
-	return (Texture*)asset;
+	return Load<Texture>(negx + posx + negy + posy + negz + posz, [&]() { return new Texture(negx + " Cube", mDevice, posx, negx, posy, negy, posz, negz, srgb); });
 }
 Mesh* AssetManager::LoadMesh(const string& filename, float scale) {
-	mMutex.lock();
-	Asset*& asset = mAssets[filename];
-	if (!asset) asset = new Mesh(filename, mDevice, filename, scale);
-	mMutex.unlock();
-	return (Mesh*)asset;
+	return Load<Mesh>(filename, [&]() { return new Mesh(filename, mDevice, filename, scale); });
 }
 Font* AssetManager::LoadFont(const string& filename, uint32_t pixelHeight) {
-	mMutex.lock();
-	Asset*& asset = mAssets[filename + to_string(pixelHeight)];
-	if (!asset) asset = new Font(filename, mDevice, filename, (float)pixelHeight, 1.f / pixelHeight);
-	mMutex.unlock();
-	return (Font*)asset;
+	return Load<Font>(filename + to_string(pixelHeight), [&]() { return new Font(filename, mDevice, filename, (float)pixelHeight, 1.f / pixelHeight); });
+}
+
+shared_ptr<Shader> AssetManager::AcquireShader(const string& filename) {
+	return Acquire<Shader>(filename, [&]() { return new Shader(filename, mDevice, filename); });
+}
+shared_ptr<Texture> AssetManager::AcquireTexture(const string& filename, bool srgb) {
+	return Acquire<Texture>(filename, [&]() { return new Texture(filename, mDevice, TextureFile(filename, srgb), srgb); });
+}
+shared_ptr<Mesh> AssetManager::AcquireMesh(const string& filename, float scale) {
+	return Acquire<Mesh>(filename, [&]() { return new Mesh(filename, mDevice, filename, scale); });
+}
+shared_ptr<Asset> AssetManager::AcquireAsset(const string& key, const function<Asset*()>& create) {
+	return Acquire<Asset>(key, create);
+}
+
+future<shared_ptr<Shader>> AssetManager::AcquireShaderAsync(const string& filename) {
+	return mDevice->Instance()->ThreadPool()->EnqueueBackground([=]() { return AcquireShader(filename); });
+}
+future<shared_ptr<Texture>> AssetManager::AcquireTextureAsync(const string& filename, bool srgb) {
+	return mDevice->Instance()->ThreadPool()->EnqueueBackground([=]() { return AcquireTexture(filename, srgb); });
+}
+future<shared_ptr<Mesh>> AssetManager::AcquireMeshAsync(const string& filename, float scale) {
+	return mDevice->Instance()->ThreadPool()->EnqueueBackground([=]() { return AcquireMesh(filename, scale); });
+}
+
+future<Shader*> AssetManager::LoadShaderAsync(const string& filename) {
+	return mDevice->Instance()->ThreadPool()->EnqueueBackground([=]() { return LoadShader(filename); });
+}
+future<Texture*> AssetManager::LoadTextureAsync(const string& filename, bool srgb) {
+	return mDevice->Instance()->ThreadPool()->EnqueueBackground([=]() { return LoadTexture(filename, srgb); });
+}
+future<Mesh*> AssetManager::LoadMeshAsync(const string& filename, float scale) {
+	return mDevice->Instance()->ThreadPool()->EnqueueBackground([=]() { return LoadMesh(filename, scale); });
+}
+future<Font*> AssetManager::LoadFontAsync(const string& filename, uint32_t pixelHeight) {
+	return mDevice->Instance()->ThreadPool()->EnqueueBackground([=]() { return LoadFont(filename, pixelHeight); });
+}
+
+void AssetManager::Update() {
+	lock_guard lock(mPendingMutex);
+
+	shared_ptr<CommandBuffer> commandBuffer;
+	for (auto it = mPendingTextures.begin(); it != mPendingTextures.end();) {
+		if (it->mUpload.valid()) {
+			if (it->mUpload.wait_for(chrono::seconds(0)) != future_status::ready) { it++; continue; }
+			it->mTicket = it->mUpload.get();
+			if (it->mTicket == 0) {
+				// the image failed to decode, leave the placeholder in place
+				it = mPendingTextures.erase(it);
+				continue;
+			}
+		}
+		if (!mDevice->UploadQueue()->Finished(it->mTicket)) { it++; continue; }
+
+		if (!commandBuffer) commandBuffer = mDevice->GetCommandBuffer("Finish Texture Uploads");
+		it->mTexture->FinishUpload(commandBuffer.get());
+		printf("Loaded %s: %dx%d %s\n", it->mTexture->mName.c_str(), it->mTexture->Width(), it->mTexture->Height(), FormatToString(it->mTexture->Format()));
+		it = mPendingTextures.erase(it);
+	}
+
+	// submitted ahead of the frame's command buffers, so the mips are done before anything samples them
+	if (commandBuffer) mDevice->Execute(commandBuffer, false);
+
+	unordered_set<Asset*> uploading;
+	for (const PendingTexture& p : mPendingTextures)
+		uploading.insert(p.mTexture);
+	Evict(uploading);
+
+	Stats stats = GetStats();
+	Profiler::SetCounter("Asset Device Memory", stats.mDeviceMemory);
+	Profiler::SetCounter("Asset Host Memory", stats.mHostMemory);
+	Profiler::SetCounter("Unreferenced Assets", stats.mUnreferencedCount);
+}
+
+void AssetManager::Evict(const unordered_set<Asset*>& uploading) {
+	uint64_t deviceExcess = 0;
+	uint64_t hostExcess = 0;
+	{
+		lock_guard lock(mMutex);
+		if (mDeviceMemoryBudget && mDeviceMemory > mDeviceMemoryBudget) deviceExcess = mDeviceMemory - mDeviceMemoryBudget;
+		if (mHostMemoryBudget && mHostMemory > mHostMemoryBudget) hostExcess = mHostMemory - mHostMemoryBudget;
+	}
+	VkDeviceSize usage, budget;
+	if (!mDeviceMemoryBudget && mDevice->DeviceMemoryBudget(usage, budget)) {
+		// memory freed into the allocator's blocks is still counted as used by the driver, but new allocations can reuse it
+		VkDeviceSize freeBytes = mDevice->MemoryAllocator()->GetStats().mBytesFree;
+		usage = usage > freeBytes ? usage - freeBytes : 0;
+		VkDeviceSize limit = (VkDeviceSize)(budget * DEVICE_BUDGET_FRACTION);
+		if (usage > limit) deviceExcess = usage - limit;
+	}
+	if (!deviceExcess && !hostExcess) return;
+
+	PROFILER_BEGIN("Evict Assets");
+	vector<Asset*> evicted;
+	uint64_t evictedBytes = 0;
+	{
+		lock_guard lock(mMutex);
+		uint64_t frame = mDevice->Instance()->FrameCount();
+		vector<unordered_map<string, Entry>::iterator> candidates;
+		for (auto it = mAssets.begin(); it != mAssets.end(); it++) {
+			const Entry& e = it->second;
+			if (e.mPinned || e.mRefCount || e.mAsset.wait_for(chrono::seconds(0)) != future_status::ready) continue;
+			// frames still in flight may use the asset
+			if (e.mLastUsed + mDevice->MaxFramesInFlight() >= frame) continue;
+			if (uploading.count(e.mAsset.get())) continue;
+			candidates.push_back(it);
+		}
+		sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) { return a->second.mLastUsed < b->second.mLastUsed; });
+
+		for (const auto& it : candidates) {
+			if (!deviceExcess && !hostExcess) break;
+			Entry& e = it->second;
+			// only assets that hold memory that's over budget
+			if ((!deviceExcess || !e.mDeviceMemory) && (!hostExcess || !e.mHostMemory)) continue;
+			deviceExcess -= min(deviceExcess, e.mDeviceMemory);
+			hostExcess -= min(hostExcess, e.mHostMemory);
+			mDeviceMemory -= e.mDeviceMemory;
+			mHostMemory -= e.mHostMemory;
+			evictedBytes += e.mDeviceMemory + e.mHostMemory;
+			evicted.push_back(e.mAsset.get());
+			mAssets.erase(it);
+		}
+	}
+	for (Asset* asset : evicted)
+		delete asset;
+	PROFILER_END;
+
+	Profiler::AddCounter("Asset Evictions", evicted.size());
+	Profiler::AddCounter("Asset Bytes Evicted", evictedBytes);
+}
+
+AssetManager::Stats AssetManager::GetStats() {
+	lock_guard lock(mMutex);
+	Stats stats = {};
+	stats.mDeviceMemory = mDeviceMemory;
+	stats.mHostMemory = mHostMemory;
+	for (const auto& asset : mAssets) {
+		stats.mAssetCount++;
+		if (!asset.second.mPinned && !asset.second.mRefCount) stats.mUnreferencedCount++;
+	}
+	return stats;
 }
\ No newline at end of file
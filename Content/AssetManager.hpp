@@ -1,5 +1,9 @@
 #pragma once
 
+#include <functional>
+#include <future>
+#include <unordered_set>
+
 #include <Core/Device.hpp>
 #include <Util/Util.hpp>
 #include <Content/Asset.hpp>
@@ -12,19 +16,116 @@ class Instance;
 
 class AssetManager {
 public:
+	struct Stats {
+		uint32_t mAssetCount;
+		// assets that nothing references, which can be evicted
+		uint32_t mUnreferencedCount;
+		uint64_t mDeviceMemory;
+		uint64_t mHostMemory;
+	};
+
 	ENGINE_EXPORT ~AssetManager();
 
+	/// Loads an asset, or returns the one that was already loaded from the same file. Loads of different files run concurrently,
+	/// a load of a file that's already being loaded on another thread waits for it.
+	/// Assets returned as raw pointers stay loaded until the AssetManager is destroyed
 	ENGINE_EXPORT Shader*	LoadShader	(const std::string& filename);
+	/// Loads the .ktx2 file that TextureConverter writes next to the image instead, if there is an up to date one and the device supports BCn
 	ENGINE_EXPORT Texture*	LoadTexture	(const std::string& filename, bool srgb = true);
 	ENGINE_EXPORT Texture*  LoadCubemap (const std::string& posx, const std::string& negx, const std::string& posy, const std::string& negy, const std::string& posz, const std::string& negz, bool srgb = true);
 	ENGINE_EXPORT Mesh*		LoadMesh	(const std::string& filename, float scale = 1.f);
 	ENGINE_EXPORT Font*		LoadFont	(const std::string& filename, uint32_t pixelHeight);
 
+	/// Start loading an asset on the thread pool's background threads. The futures must be waited on before the AssetManager is destroyed
+	ENGINE_EXPORT std::future<Shader*>	LoadShaderAsync	(const std::string& filename);
+	ENGINE_EXPORT std::future<Texture*>	LoadTextureAsync(const std::string& filename, bool srgb = true);
+	ENGINE_EXPORT std::future<Mesh*>	LoadMeshAsync	(const std::string& filename, float scale = 1.f);
+	ENGINE_EXPORT std::future<Font*>	LoadFontAsync	(const std::string& filename, uint32_t pixelHeight);
+
+	/// Reference counted versions of the Load functions. Once the last copy of the returned pointer is released, the asset stays
+	/// loaded until assets are over budget, when the least recently used unreferenced assets are evicted. An evicted asset is loaded
+	/// again the next time it's requested. The pointers must be released before the AssetManager is destroyed
+	ENGINE_EXPORT std::shared_ptr<Shader>	AcquireShader	(const std::string& filename);
+	ENGINE_EXPORT std::shared_ptr<Texture>	AcquireTexture	(const std::string& filename, bool srgb = true);
+	ENGINE_EXPORT std::shared_ptr<Mesh>		AcquireMesh		(const std::string& filename, float scale = 1.f);
+	ENGINE_EXPORT std::future<std::shared_ptr<Shader>>	AcquireShaderAsync	(const std::string& filename);
+	ENGINE_EXPORT std::future<std::shared_ptr<Texture>>	AcquireTextureAsync	(const std::string& filename, bool srgb = true);
+	ENGINE_EXPORT std::future<std::shared_ptr<Mesh>>	AcquireMeshAsync	(const std::string& filename, float scale = 1.f);
+	/// Reference counts an asset that isn't loaded from a single file, like a sub-mesh of a model or a volume assembled from a folder of slices.
+	/// create() is called to make the asset if nothing is stored under key, and may return nullptr if it can't, which is returned and not stored
+	ENGINE_EXPORT std::shared_ptr<Asset> AcquireAsset(const std::string& key, const std::function<Asset*()>& create);
+	template<class T>
+	inline std::shared_ptr<T> AcquireAsset(const std::string& key, const std::function<T*()>& create) {
+		return std::static_pointer_cast<T>(AcquireAsset(key, std::function<Asset*()>([&]() { return (Asset*)create(); })));
+	}
+
+	/// Bytes of device memory that assets can use before unreferenced ones are evicted. 0 evicts when the device memory the process uses
+	/// nears the budget the driver reports through VK_EXT_memory_budget instead, or never if the extension isn't supported
+	inline void DeviceMemoryBudget(uint64_t bytes) { mDeviceMemoryBudget = bytes; }
+	inline uint64_t DeviceMemoryBudget() const { return mDeviceMemoryBudget; }
+	/// Bytes of host memory that assets can use before unreferenced ones are evicted, 0 for no limit
+	inline void HostMemoryBudget(uint64_t bytes) { mHostMemoryBudget = bytes; }
+	inline uint64_t HostMemoryBudget() const { return mHostMemoryBudget; }
+	ENGINE_EXPORT Stats GetStats();
+
+	/// Returns as soon as the image's header is read. The texture samples a placeholder until it's decoded on the thread pool,
+	/// uploaded on the transfer queue, and finished by Update(). Materials switch to the real image by themselves
+	ENGINE_EXPORT Texture*	LoadTextureStreamed(const std::string& filename, bool srgb = true);
+
+	/// Finishes streamed textures whose uploads are complete, evicts assets if they're over budget, and sets the "Asset Device Memory",
+	/// "Asset Host Memory" and "Unreferenced Assets" profiler counters. Called on the main thread every frame, before the scene is rendered
+	ENGINE_EXPORT void Update();
+
 private:
+	struct Entry {
+		// resolved once the asset is constructed, by the thread that first requested it
+		std::shared_future<Asset*> mAsset;
+		// thread that is running create(), cleared once the asset is constructed
+		std::thread::id mCreator;
+		// pointers from the Acquire functions that are still alive. Entries are guarded by mMutex
+		uint32_t mRefCount;
+		// the asset was returned as a raw pointer, which can't be tracked, so it's never evicted
+		bool mPinned;
+		// frame the asset was last acquired or released in
+		uint64_t mLastUsed;
+		uint64_t mDeviceMemory;
+		uint64_t mHostMemory;
+	};
+	struct PendingTexture {
+		Texture* mTexture;
+		// resolves to the upload's ticket once the texture is decoded and submitted
+		std::future<uint64_t> mUpload;
+		uint64_t mTicket;
+	};
+
 	friend class Stratum;
 	ENGINE_EXPORT AssetManager(Device* device);
 
+	/// Returns the file to load a texture from: filename, or its compressed .ktx2 version if that was converted with the same encoding
+	ENGINE_EXPORT std::string TextureFile(const std::string& filename, bool srgb);
+	/// Returns the asset stored under key, calling create() to make it on this thread if it isn't loaded or being loaded yet.
+	/// mMutex is only held to look up and insert the asset's entry. The asset is pinned, or referenced if acquired isn't nullptr.
+	/// If create() returns nullptr, the entry is removed again and nullptr is returned to every request that waited on it
+	template<class T, typename F>
+	T* Load(const std::string& key, F create, Entry** acquired = nullptr);
+	template<class T, typename F>
+	std::shared_ptr<T> Acquire(const std::string& key, F create);
+	ENGINE_EXPORT void Release(Entry* entry);
+	/// Deletes the least recently used unreferenced assets until assets are within budget. Streamed textures that are still uploading are kept
+	ENGINE_EXPORT void Evict(const std::unordered_set<Asset*>& uploading);
+
 	Device* mDevice;
-	std::unordered_map<std::string, Asset*> mAssets;
+	// entries are only erased when they're unreferenced, so Entry pointers stay valid while an asset is referenced
+	std::unordered_map<std::string, Entry> mAssets;
 	std::mutex mMutex;
+	// sizes of every constructed asset
+	uint64_t mDeviceMemory;
+	uint64_t mHostMemory;
+	uint64_t mDeviceMemoryBudget;
+	uint64_t mHostMemoryBudget;
+
+	// sampled by streamed textures until they're ready
+	Texture* mPlaceholder;
+	std::vector<PendingTexture> mPendingTextures;
+	std::mutex mPendingMutex;
 };
\ No newline at end of file
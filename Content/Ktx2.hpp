@@ -0,0 +1,120 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+// Layout of KTX2 containers (https://github.khronos.org/KTX-Specification/), shared by Texture and TextureConverter.
+// Only single layer 2D and cube textures of BCn blocks without supercompression are used
+
+#define KTX2_IDENTIFIER_SIZE 12
+static const uint8_t Ktx2Identifier[KTX2_IDENTIFIER_SIZE] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+// Khronos data format descriptor color models and channels of the block compressed formats
+#define KHR_DF_MODEL_BC1A 128
+#define KHR_DF_MODEL_BC3 130
+#define KHR_DF_MODEL_BC4 131
+#define KHR_DF_MODEL_BC5 132
+#define KHR_DF_MODEL_BC6H 133
+#define KHR_DF_MODEL_BC7 134
+#define KHR_DF_CHANNEL_COLOR 0
+#define KHR_DF_CHANNEL_GREEN 1
+#define KHR_DF_CHANNEL_ALPHA 15
+#define KHR_DF_SAMPLE_DATATYPE_FLOAT 0x80
+#define KHR_DF_PRIMARIES_BT709 1
+#define KHR_DF_TRANSFER_LINEAR 1
+#define KHR_DF_TRANSFER_SRGB 2
+
+#pragma pack(push)
+#pragma pack(1)
+struct Ktx2Header {
+	uint8_t mIdentifier[KTX2_IDENTIFIER_SIZE];
+	VkFormat mFormat;
+	uint32_t mTypeSize;
+	uint32_t mPixelWidth;
+	uint32_t mPixelHeight;
+	uint32_t mPixelDepth;
+	uint32_t mLayerCount;
+	uint32_t mFaceCount;
+	uint32_t mLevelCount;
+	uint32_t mSupercompressionScheme;
+
+	uint32_t mDfdByteOffset;
+	uint32_t mDfdByteLength;
+	uint32_t mKvdByteOffset;
+	uint32_t mKvdByteLength;
+	uint64_t mSgdByteOffset;
+	uint64_t mSgdByteLength;
+};
+/// Follows the header, one per mip level starting with the largest
+struct Ktx2Level {
+	uint64_t mByteOffset;
+	uint64_t mByteLength;
+	uint64_t mUncompressedByteLength;
+};
+#pragma pack(pop)
+
+/// Bytes per 4x4 block of a BCn format, or 0 for other formats
+inline uint32_t BlockCompressedSize(VkFormat format) {
+	switch (format) {
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+		return 8;
+	case VK_FORMAT_BC2_UNORM_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+/// Whether a texture requested with or without the sRGB decode can be loaded from a file of this format. BC1, BC3 and BC7 store
+/// either encoding and the format says which, BC4 and BC5 only store linear data, and BC6H stores HDR values that are never sRGB encoded
+inline bool Ktx2MatchesEncoding(VkFormat format, bool srgb) {
+	switch (format) {
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC2_SRGB_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return srgb;
+	case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+	case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+		return true;
+	default:
+		return !srgb;
+	}
+}
+
+/// Validates a KTX2 file in memory and returns its header, or nullptr if it isn't a KTX2 file with a block compressed payload
+/// whose levels are all aligned and lie within the file
+inline const Ktx2Header* ReadKtx2Header(const uint8_t* data, size_t size) {
+	if (size < sizeof(Ktx2Header) || memcmp(data, Ktx2Identifier, KTX2_IDENTIFIER_SIZE)) return nullptr;
+	const Ktx2Header* header = (const Ktx2Header*)data;
+	if (header->mSupercompressionScheme != 0 || BlockCompressedSize(header->mFormat) == 0) return nullptr;
+	if (header->mPixelWidth == 0 || header->mPixelHeight == 0 || header->mPixelDepth > 1 || header->mLayerCount > 1) return nullptr;
+	if (header->mFaceCount != 1 && header->mFaceCount != 6) return nullptr;
+
+	uint32_t levelCount = std::max(header->mLevelCount, 1u);
+	if (size < sizeof(Ktx2Header) + sizeof(Ktx2Level) * levelCount) return nullptr;
+	const Ktx2Level* levels = (const Ktx2Level*)(data + sizeof(Ktx2Header));
+	for (uint32_t i = 0; i < levelCount; i++) {
+		uint64_t blocksX = (std::max(header->mPixelWidth >> i, 1u) + 3) / 4;
+		uint64_t blocksY = (std::max(header->mPixelHeight >> i, 1u) + 3) / 4;
+		if (levels[i].mByteLength < blocksX * blocksY * header->mFaceCount * BlockCompressedSize(header->mFormat)) return nullptr;
+		// copies out of the file need block aligned offsets
+		if (levels[i].mByteOffset % BlockCompressedSize(header->mFormat)) return nullptr;
+		if (levels[i].mByteOffset > size || levels[i].mByteLength > size - levels[i].mByteOffset) return nullptr;
+	}
+	return header;
+}
\ No newline at end of file
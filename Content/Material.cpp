@@ -7,11 +7,14 @@
 
 using namespace std;
 
+static IdPool gSortIds;
+
 Material::Material(const string& name, ::Shader* shader)
-	: mName(name), mShader(shader), mDevice(shader->Device()), mCullMode(VK_CULL_MODE_FLAG_BITS_MAX_ENUM), mBlendMode(BLEND_MODE_MAX_ENUM), mRenderQueue(~0), mPassMask(PASS_MASK_MAX_ENUM) {}
+	: mName(name), mSortId(gSortIds.Allocate()), mShader(shader), mDevice(shader->Device()), mCullMode(VK_CULL_MODE_FLAG_BITS_MAX_ENUM), mBlendMode(BLEND_MODE_MAX_ENUM), mRenderQueue(~0), mPassMask(PASS_MASK_MAX_ENUM), mTextureGeneration(0) {}
 Material::Material(const string& name, shared_ptr<::Shader> shader)
-	: mName(name), mShader(shader), mDevice(shader->Device()), mCullMode(VK_CULL_MODE_FLAG_BITS_MAX_ENUM), mBlendMode(BLEND_MODE_MAX_ENUM), mRenderQueue(~0), mPassMask(PASS_MASK_MAX_ENUM) {}
+	: mName(name), mSortId(gSortIds.Allocate()), mShader(shader), mDevice(shader->Device()), mCullMode(VK_CULL_MODE_FLAG_BITS_MAX_ENUM), mBlendMode(BLEND_MODE_MAX_ENUM), mRenderQueue(~0), mPassMask(PASS_MASK_MAX_ENUM), mTextureGeneration(0) {}
 Material::~Material() {
+	gSortIds.Release(mSortId);
 	for (auto& kp : mVariantData) {
 		for (uint32_t i = 0; i < mDevice->MaxFramesInFlight(); i++)
 			safe_delete(kp.second->mDescriptorSets[i]);
@@ -87,14 +90,41 @@ GraphicsShader* Material::GetShader(PassType pass) {
 	return GetData(pass)->mShaderVariant;
 }
 
-void Material::SetDescriptorParameters(CommandBuffer* commandBuffer, Camera* camera, VariantData* data) {
+void Material::UpdateDescriptorSets(PassType pass) {
+	if (VariantData* data = GetData(pass))
+		UpdateDescriptorSet(data);
+}
+
+uint32_t Material::TextureGeneration() const {
+	uint32_t generation = 0;
+	auto Add = [&](const Texture* texture) { if (texture) generation += texture->ViewGeneration(); };
+	for (const auto& p : mParameters) {
+		if (p.second.index() == 0) Add(get<shared_ptr<Texture>>(p.second).get());
+		else if (p.second.index() == 2) Add(get<Texture*>(p.second));
+	}
+	for (const auto& a : mArrayParameters)
+		for (const auto& p : a.second)
+			Add(p.second.index() == 0 ? get<shared_ptr<Texture>>(p.second).get() : get<Texture*>(p.second));
+	return generation;
+}
+
+DescriptorSet* Material::UpdateDescriptorSet(VariantData* data) {
+	// one of our textures finished loading and is still bound as its placeholder. Generations only increase, so their sum
+	// changes too, and rebinding a texture marks the descriptor sets dirty anyway
+	uint32_t textureGeneration = TextureGeneration();
+	if (mTextureGeneration != textureGeneration) {
+		mTextureGeneration = textureGeneration;
+		for (auto& d : mVariantData)
+			memset(d.second->mDirty, true, sizeof(bool) * mDevice->MaxFramesInFlight());
+	}
+
 	GraphicsShader* shader = data->mShaderVariant;
 	if (shader->mDescriptorSetLayouts.size() > PER_MATERIAL&& shader->mDescriptorBindings.size()) {
-		uint32_t frameContextIndex = commandBuffer->Device()->FrameContextIndex();
+		uint32_t frameContextIndex = mDevice->FrameContextIndex();
 		DescriptorSet*& ds = data->mDescriptorSets[frameContextIndex];
 		if (!ds || (ds->Layout() != shader->mDescriptorSetLayouts[PER_MATERIAL])) {
 			safe_delete(ds);
-			ds = new DescriptorSet(mName + " DescriptorSet", commandBuffer->Device(), shader->mDescriptorSetLayouts[PER_MATERIAL]);
+			ds = new DescriptorSet(mName + " DescriptorSet", mDevice, shader->mDescriptorSetLayouts[PER_MATERIAL]);
 			data->mDirty[frameContextIndex] = true;
 		}
 
@@ -142,7 +172,14 @@ void Material::SetDescriptorParameters(CommandBuffer* commandBuffer, Camera* cam
 			data->mDirty[frameContextIndex] = false;
 			PROFILER_END;
 		}
+		return ds;
+	}
+	return nullptr;
+}
 
+void Material::SetDescriptorParameters(CommandBuffer* commandBuffer, Camera* camera, VariantData* data) {
+	GraphicsShader* shader = data->mShaderVariant;
+	if (DescriptorSet* ds = UpdateDescriptorSet(data)) {
 		PROFILER_BEGIN("Bind Descriptor Sets");
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shader->mPipelineLayout, PER_MATERIAL, 1, *ds, 0, nullptr);
 		PROFILER_END;
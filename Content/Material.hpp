@@ -44,6 +44,9 @@ public:
 	inline void RenderQueue(uint32_t q) { mRenderQueue = q; }
 	inline uint32_t RenderQueue() const { return mRenderQueue == ~0 ? Shader()->RenderQueue() : mRenderQueue; }
 
+	/// Id used to group draws by material when sorting render lists, unique among live materials. Ids of destroyed materials are reused
+	inline uint32_t SortId() const { return mSortId; }
+
 	inline void CullMode(VkCullModeFlags c) { mCullMode = c; }
 	inline VkCullModeFlags CullMode() const { return mCullMode; }
 
@@ -60,6 +63,10 @@ public:
 	ENGINE_EXPORT void EnableKeyword(const std::string& kw);
 	ENGINE_EXPORT void DisableKeyword(const std::string& kw);
 
+	/// Resolves the shader variant for pass and writes any pending descriptor updates, so that binding the material
+	/// while recording on other threads only reads its state
+	ENGINE_EXPORT void UpdateDescriptorSets(PassType pass);
+
 private:
 	struct VariantData {
 		GraphicsShader* mShaderVariant;
@@ -68,12 +75,17 @@ private:
 	};
 
 	friend class CommandBuffer;
+	// returns the up to date per-material descriptor set, or nullptr if the shader has none
+	ENGINE_EXPORT DescriptorSet* UpdateDescriptorSet(VariantData* data);
 	ENGINE_EXPORT void SetDescriptorParameters(CommandBuffer* commandBuffer, Camera* camera, VariantData* data);
 	ENGINE_EXPORT void SetPushConstantParameters(CommandBuffer* commandBuffer, Camera* camera, VariantData* data);
 
 	ENGINE_EXPORT VariantData* GetData(PassType pass);
+	// sum of the ViewGeneration() of every bound texture, which changes when one of them finishes loading
+	ENGINE_EXPORT uint32_t TextureGeneration() const;
 
 	Device* mDevice;
+	uint32_t mSortId;
 
 	std::variant<::Shader*, std::shared_ptr<::Shader>> mShader;
 	std::set<std::string> mShaderKeywords;
@@ -87,4 +99,6 @@ private:
 	std::unordered_map<std::string, std::unordered_map<uint32_t, std::variant<std::shared_ptr<Texture>, Texture*>>> mArrayParameters;
 
 	std::unordered_map<PassType, VariantData*> mVariantData;
+	// TextureGeneration() when the descriptor sets were last marked dirty
+	uint32_t mTextureGeneration;
 };
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <Content/Mesh.hpp>
+#include <Content/MeshCache.hpp>
 
 #include <regex>
 #include <thread>
@@ -16,6 +17,10 @@
 
 using namespace std;
 
+#define MESH_IMPORT_FLAGS (aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_FlipUVs | aiProcess_MakeLeftHanded)
+
+static IdPool gSortIds;
+
 const ::VertexInput StdVertex::VertexInput {
 	{
 		0, // binding
@@ -152,208 +157,230 @@ Bone* AddBone(AnimationRig& rig, aiNode* node, const aiScene* scene, aiNode* roo
 	return bone;
 }
 
-Mesh::Mesh(const string& name) : mName(name), mVertexInput(nullptr), mBvh(nullptr), mIndexCount(0), mVertexCount(0), mBaseVertex(0), mBaseIndex(0), mIndexType(VK_INDEX_TYPE_UINT16) {}
+Mesh::Mesh(const string& name) : mName(name), mSortId(gSortIds.Allocate()), mVertexInput(nullptr), mBvh(nullptr), mIndexCount(0), mVertexCount(0), mBaseVertex(0), mBaseIndex(0), mIndexType(VK_INDEX_TYPE_UINT16) {}
 Mesh::Mesh(const string& name, ::Device* device, const string& filename, float scale)
-	: mName(name), mVertexInput(nullptr), mBvh(nullptr), mBaseVertex(0), mBaseIndex(0), mTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST) {
+	: mName(name), mSortId(gSortIds.Allocate()), mVertexInput(nullptr), mBvh(nullptr), mBaseVertex(0), mBaseIndex(0), mTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST) {
 
-	const aiScene* scene = aiImportFile(filename.c_str(), aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_FlipUVs | aiProcess_MakeLeftHanded);
-	if (!scene) {
-		fprintf_color(COLOR_RED, stderr, "Failed to open %s: %s\n", filename.c_str(), aiGetErrorString());
-		throw;
-	}
 	vector<StdVertex> vertices;
 	vector<uint16_t> indices16;
 	vector<uint32_t> indices32;
-	float3 mn, mx;
+	vector<VertexWeight> vertexWeights;
+
+	// point into the mapped cache file, or into the vectors above after an import
+	const StdVertex* vertexData;
+	const void* indexData;
+	const VertexWeight* weightData = nullptr;
+
+	MeshCache cache(device->CacheDirectory(), filename, scale, MESH_IMPORT_FLAGS);
+	if (cache.IsValid()) {
+		mVertexCount = cache.VertexCount();
+		mIndexCount = cache.IndexCount();
+		mIndexType = cache.IndexType();
+		mBounds = cache.SubMeshes().size() ? cache.SubMeshes()[0].mBounds : AABB();
+		vertexData = cache.Vertices();
+		indexData = cache.Indices();
+		weightData = cache.Weights();
+	} else {
+		const aiScene* scene = aiImportFile(filename.c_str(), MESH_IMPORT_FLAGS);
+		if (!scene) {
+			fprintf_color(COLOR_RED, stderr, "Failed to open %s: %s\n", filename.c_str(), aiGetErrorString());
+			throw;
+		}
+		float3 mn, mx;
 
-	vector<AIWeight> weights;
-	unordered_map<string, aiBone*> uniqueBones;
+		vector<AIWeight> weights;
+		unordered_map<string, aiBone*> uniqueBones;
 
-	uint32_t vertexCount = 0;
-	for (uint32_t m = 0; m < scene->mNumMeshes; m++)
-		vertexCount += scene->mMeshes[m]->mNumVertices;
-	bool use32bit = vertexCount > 0xFFFF;
+		uint32_t vertexCount = 0;
+		for (uint32_t m = 0; m < scene->mNumMeshes; m++)
+			vertexCount += scene->mMeshes[m]->mNumVertices;
+		bool use32bit = vertexCount > 0xFFFF;
 
-	// append vertices, keep track of bounding box
-	for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
-		const aiMesh* mesh = scene->mMeshes[i];
-		uint32_t baseIndex = (uint32_t)vertices.size();
+		// append vertices, keep track of bounding box
+		for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+			const aiMesh* mesh = scene->mMeshes[i];
+			uint32_t baseIndex = (uint32_t)vertices.size();
 		
-		if ((mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) == 0) continue;
-
-		for (uint32_t i = 0; i < mesh->mNumVertices; i++) {
-			StdVertex vertex = {};
-			memset(&vertex, 0, sizeof(StdVertex));
-
-			vertex.position = { (float)mesh->mVertices[i].x, (float)mesh->mVertices[i].y, (float)mesh->mVertices[i].z };
-			if (mesh->HasNormals()) vertex.normal = { (float)mesh->mNormals[i].x, (float)mesh->mNormals[i].y, (float)mesh->mNormals[i].z };
-			if (mesh->HasTangentsAndBitangents()) {
-				vertex.tangent = { (float)mesh->mTangents[i].x, (float)mesh->mTangents[i].y, (float)mesh->mTangents[i].z, 1.f };
-				float3 bt = float3((float)mesh->mBitangents[i].x, (float)mesh->mBitangents[i].y, (float)mesh->mBitangents[i].z);
-				vertex.tangent.w = dot(cross(vertex.tangent.xyz, vertex.normal), bt) > 0.f ? 1.f : -1.f;
-			}
-			if (mesh->HasTextureCoords(0)) vertex.uv = { (float)mesh->mTextureCoords[0][i].x, (float)mesh->mTextureCoords[0][i].y };
-			vertex.position *= scale;
-
-			if (i == 0) {
-				mn = vertex.position;
-				mx = vertex.position;
-			} else {
-				mn = min(vertex.position, mn);
-				mx = max(vertex.position, mx);
-			}
+			if ((mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) == 0) continue;
+
+			for (uint32_t i = 0; i < mesh->mNumVertices; i++) {
+				StdVertex vertex = {};
+				memset(&vertex, 0, sizeof(StdVertex));
+
+				vertex.position = { (float)mesh->mVertices[i].x, (float)mesh->mVertices[i].y, (float)mesh->mVertices[i].z };
+				if (mesh->HasNormals()) vertex.normal = { (float)mesh->mNormals[i].x, (float)mesh->mNormals[i].y, (float)mesh->mNormals[i].z };
+				if (mesh->HasTangentsAndBitangents()) {
+					vertex.tangent = { (float)mesh->mTangents[i].x, (float)mesh->mTangents[i].y, (float)mesh->mTangents[i].z, 1.f };
+					float3 bt = float3((float)mesh->mBitangents[i].x, (float)mesh->mBitangents[i].y, (float)mesh->mBitangents[i].z);
+					vertex.tangent.w = dot(cross(vertex.tangent.xyz, vertex.normal), bt) > 0.f ? 1.f : -1.f;
+				}
+				if (mesh->HasTextureCoords(0)) vertex.uv = { (float)mesh->mTextureCoords[0][i].x, (float)mesh->mTextureCoords[0][i].y };
+				vertex.position *= scale;
+
+				if (i == 0) {
+					mn = vertex.position;
+					mx = vertex.position;
+				} else {
+					mn = min(vertex.position, mn);
+					mx = max(vertex.position, mx);
+				}
 
-			vertices.push_back(vertex);
-			weights.push_back(AIWeight());
-		}
+				vertices.push_back(vertex);
+				weights.push_back(AIWeight());
+			}
 
-		if (use32bit)
-			for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
-				const aiFace& f = mesh->mFaces[i];
-				if (f.mNumIndices == 0) continue;
-				indices32.push_back(f.mIndices[0]);
-				if (f.mNumIndices == 2) indices32.push_back(f.mIndices[1]);
-				for (uint32_t j = 2; j < f.mNumIndices; j++) {
-					indices32.push_back(f.mIndices[j - 1]);
-					indices32.push_back(f.mIndices[j]);
-				}
-			} else {
+			if (use32bit)
 				for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
 					const aiFace& f = mesh->mFaces[i];
 					if (f.mNumIndices == 0) continue;
-					indices16.push_back(f.mIndices[0]);
-					if (f.mNumIndices == 2) indices16.push_back(f.mIndices[1]);
+					indices32.push_back(f.mIndices[0]);
+					if (f.mNumIndices == 2) indices32.push_back(f.mIndices[1]);
 					for (uint32_t j = 2; j < f.mNumIndices; j++) {
-						indices16.push_back(f.mIndices[j - 1]);
-						indices16.push_back(f.mIndices[j]);
+						indices32.push_back(f.mIndices[j - 1]);
+						indices32.push_back(f.mIndices[j]);
+					}
+				} else {
+					for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
+						const aiFace& f = mesh->mFaces[i];
+						if (f.mNumIndices == 0) continue;
+						indices16.push_back(f.mIndices[0]);
+						if (f.mNumIndices == 2) indices16.push_back(f.mIndices[1]);
+						for (uint32_t j = 2; j < f.mNumIndices; j++) {
+							indices16.push_back(f.mIndices[j - 1]);
+							indices16.push_back(f.mIndices[j]);
+						}
 					}
 				}
-			}
 
-		if (mesh->HasBones())
-			for (uint16_t c = 0; c < mesh->mNumBones; c++) {
-				aiBone* bone = mesh->mBones[c];
-				for (uint32_t i = 0; i < bone->mNumWeights; i++) {
-					uint32_t index = baseIndex + bone->mWeights[i].mVertexId;
-					weights[index].SetWeight(bone->mName.C_Str(), (float)bone->mWeights[i].mWeight);
+			if (mesh->HasBones())
+				for (uint16_t c = 0; c < mesh->mNumBones; c++) {
+					aiBone* bone = mesh->mBones[c];
+					for (uint32_t i = 0; i < bone->mNumWeights; i++) {
+						uint32_t index = baseIndex + bone->mWeights[i].mVertexId;
+						weights[index].SetWeight(bone->mName.C_Str(), (float)bone->mWeights[i].mWeight);
+					}
+
+					if (uniqueBones.count(bone->mName.C_Str()) == 0)
+						uniqueBones.emplace(bone->mName.C_Str(), bone);
 				}
+		}
 
-				if (uniqueBones.count(bone->mName.C_Str()) == 0)
-					uniqueBones.emplace(bone->mName.C_Str(), bone);
-			}
-	}
+		if (uniqueBones.size()) {
+			unordered_map<aiNode*, Bone*> boneMap;
 
-	if (uniqueBones.size()) {
-		unordered_map<aiNode*, Bone*> boneMap;
-
-		// find animation root
-		aiNode* root = scene->mRootNode;
-		uint32_t rootDepth = 0xFFFF;
-		for (auto& b : uniqueBones) {
-			aiNode* node = scene->mRootNode->FindNode(b.second->mName);
-			while (node&& node->mName == aiString(""))
-				node = node->mParent;
-			uint32_t d = GetDepth(node);
-			if (d < rootDepth) {
-				rootDepth = d;
-
-				while (node->mParent&& node->mParent->mName == aiString(""))
+			// find animation root
+			aiNode* root = scene->mRootNode;
+			uint32_t rootDepth = 0xFFFF;
+			for (auto& b : uniqueBones) {
+				aiNode* node = scene->mRootNode->FindNode(b.second->mName);
+				while (node&& node->mName == aiString(""))
 					node = node->mParent;
-				root = node->mParent;
+				uint32_t d = GetDepth(node);
+				if (d < rootDepth) {
+					rootDepth = d;
+
+					while (node->mParent&& node->mParent->mName == aiString(""))
+						node = node->mParent;
+					root = node->mParent;
+				}
 			}
-		}
 
-		AnimationRig rig;
-
-		// compute bone matrices and bonesByName
-		unordered_map<string, uint32_t> bonesByName;
-		for (auto& b : uniqueBones) {
-			aiNode* node = scene->mRootNode->FindNode(b.second->mName);
-			Bone* bone = AddBone(rig, node, scene, root, boneMap, scale);
-			if (!bone) continue;
-			BoneTransform bt;
-			ConvertMatrix(b.second->mOffsetMatrix).Decompose(&bt.mPosition, &bt.mRotation, &bt.mScale);
-			bt.mPosition *= scale;
-			bone->mInverseBind = inverse(float4x4::TRS(bt.mPosition, bt.mRotation, bt.mScale));
-			bonesByName.emplace(b.second->mName.C_Str(), bone->mBoneIndex);
-		}
+			AnimationRig rig;
+
+			// compute bone matrices and bonesByName
+			unordered_map<string, uint32_t> bonesByName;
+			for (auto& b : uniqueBones) {
+				aiNode* node = scene->mRootNode->FindNode(b.second->mName);
+				Bone* bone = AddBone(rig, node, scene, root, boneMap, scale);
+				if (!bone) continue;
+				BoneTransform bt;
+				ConvertMatrix(b.second->mOffsetMatrix).Decompose(&bt.mPosition, &bt.mRotation, &bt.mScale);
+				bt.mPosition *= scale;
+				bone->mInverseBind = inverse(float4x4::TRS(bt.mPosition, bt.mRotation, bt.mScale));
+				bonesByName.emplace(b.second->mName.C_Str(), bone->mBoneIndex);
+			}
 
-		float4x4 rootTransform(1.f);
-		while (root) {
-			rootTransform = rootTransform * ConvertMatrix(root->mTransformation);
-			root = root->mParent;
-		}
-		BoneTransform roott;
-		rootTransform.Decompose(&roott.mPosition, &roott.mRotation, &roott.mScale);
-		roott.mPosition *= scale;
-
-		for (auto& b : rig) {
-			if (!b->Parent()) {
-				BoneTransform bt {
-					b->LocalPosition(),
-					b->LocalRotation(),
-					b->LocalScale()
-				};
-				bt = roott * bt;
-				b->LocalPosition(bt.mPosition);
-				b->LocalRotation(bt.mRotation);
-				b->LocalScale(bt.mScale);
+			float4x4 rootTransform(1.f);
+			while (root) {
+				rootTransform = rootTransform * ConvertMatrix(root->mTransformation);
+				root = root->mParent;
+			}
+			BoneTransform roott;
+			rootTransform.Decompose(&roott.mPosition, &roott.mRotation, &roott.mScale);
+			roott.mPosition *= scale;
+
+			for (auto& b : rig) {
+				if (!b->Parent()) {
+					BoneTransform bt {
+						b->LocalPosition(),
+						b->LocalRotation(),
+						b->LocalScale()
+					};
+					bt = roott * bt;
+					b->LocalPosition(bt.mPosition);
+					b->LocalRotation(bt.mRotation);
+					b->LocalScale(bt.mScale);
+				}
 			}
-		}
 
-		for (uint32_t i = 0; i < scene->mNumAnimations; i++) {
-			const aiAnimation* anim = scene->mAnimations[i];
-			throw;
-			//mAnimations.emplace(anim->mName.C_Str(), new Animation(anim, bonesByName, scale));
-		}
+			for (uint32_t i = 0; i < scene->mNumAnimations; i++) {
+				const aiAnimation* anim = scene->mAnimations[i];
+				throw;
+				//mAnimations.emplace(anim->mName.C_Str(), new Animation(anim, bonesByName, scale));
+			}
 
-		vector<VertexWeight> vertexWeights(vertices.size());
-		for (uint32_t i = 0; i < vertices.size(); i++) {
-			weights[i].NormalizeWeights();
-			for (unsigned int j = 0; j < 4; j++) {
-				if (bonesByName.count(weights[i].bones[j])) {
-					vertexWeights[i].Indices[j] = bonesByName.at(weights[i].bones[j]);
-					vertexWeights[i].Weights[j] = weights[i].weights[j];
+			vertexWeights.resize(vertices.size());
+			for (uint32_t i = 0; i < vertices.size(); i++) {
+				weights[i].NormalizeWeights();
+				for (unsigned int j = 0; j < 4; j++) {
+					if (bonesByName.count(weights[i].bones[j])) {
+						vertexWeights[i].Indices[j] = bonesByName.at(weights[i].bones[j]);
+						vertexWeights[i].Weights[j] = weights[i].weights[j];
+					}
 				}
 			}
+			weightData = vertexWeights.data();
 		}
-
-		mWeightBuffer = make_shared<Buffer>(mName + " Weights", device, vertexWeights.size() * sizeof(VertexWeight), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	}
 	
-	if (use32bit) {
-		mIndexCount = (uint32_t)indices32.size();
-		mIndexType = VK_INDEX_TYPE_UINT32;
-	} else {
-		mIndexCount = (uint32_t)indices16.size();
-		mIndexType = VK_INDEX_TYPE_UINT16;
-	}
+		if (use32bit) {
+			mIndexCount = (uint32_t)indices32.size();
+			mIndexType = VK_INDEX_TYPE_UINT32;
+		} else {
+			mIndexCount = (uint32_t)indices16.size();
+			mIndexType = VK_INDEX_TYPE_UINT16;
+		}
 
-	aiReleaseImport(scene);
+		aiReleaseImport(scene);
+
+		mVertexCount = (uint32_t)vertices.size();
+		mBounds = AABB(mn, mx);
+		vertexData = vertices.data();
+		indexData = use32bit ? (const void*)indices32.data() : (const void*)indices16.data();
+
+		MeshCache::SubMesh subMesh = { mName, 0, mVertexCount, 0, mIndexCount, 0, mTopology, mBounds, nullptr, 0, nullptr, 0 };
+		MeshCache::Write(device->CacheDirectory(), filename, scale, MESH_IMPORT_FLAGS, nullptr, vertexData, mVertexCount, indexData, mIndexCount, mIndexType, weightData, { subMesh });
+	}
 
-	mVertexCount = (uint32_t)vertices.size();
-	mBounds = AABB(mn, mx);
 	mVertexInput = &StdVertex::VertexInput;
 
-	if (!uniqueBones.size())
-		mWeightBuffer = nullptr;
-	mVertexBuffer = make_shared<Buffer>(name + " Vertex Buffer", device, vertices.data(), sizeof(StdVertex) * vertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | (uniqueBones.size() ? VK_BUFFER_USAGE_TRANSFER_SRC_BIT : 0));
-	if (use32bit)
-		mIndexBuffer = make_shared<Buffer>(name + " Index Buffer", device, indices32.data(), sizeof(uint32_t) * indices32.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
-	else
-		mIndexBuffer = make_shared<Buffer>(name + " Index Buffer", device, indices16.data(), sizeof(uint16_t) * indices16.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+	uint32_t indexSize = mIndexType == VK_INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t);
+	if (weightData)
+		mWeightBuffer = make_shared<Buffer>(mName + " Weights", device, weightData, sizeof(VertexWeight) * mVertexCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	mVertexBuffer = make_shared<Buffer>(name + " Vertex Buffer", device, vertexData, sizeof(StdVertex) * mVertexCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | (weightData ? VK_BUFFER_USAGE_TRANSFER_SRC_BIT : 0));
+	mIndexBuffer = make_shared<Buffer>(name + " Index Buffer", device, indexData, indexSize * mIndexCount, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
 
-	printf("Loaded %s / %d verts %d tris / %.2fx%.2fx%.2f\n", filename.c_str(), (int)vertices.size(), (int)(use32bit ? indices32.size() : indices16.size()) / 3, mx.x - mn.x, mx.y - mn.y, mx.z - mn.z);
+	float3 size = mBounds.mMax - mBounds.mMin;
+	printf("Loaded %s%s / %d verts %d tris / %.2fx%.2fx%.2f\n", filename.c_str(), cache.IsValid() ? " from cache" : "", (int)mVertexCount, (int)mIndexCount / 3, size.x, size.y, size.z);
 }
 Mesh::Mesh(const string& name, ::Device* device, const AABB& bounds, TriangleBvh2* bvh, shared_ptr<Buffer> vertexBuffer, shared_ptr<Buffer> indexBuffer,
 	uint32_t baseVertex, uint32_t vertexCount, uint32_t baseIndex, uint32_t indexCount, const ::VertexInput* vertexInput, VkIndexType indexType, VkPrimitiveTopology topology)
-	: mName(name), mVertexInput(vertexInput), mBvh(bvh), mBaseIndex(baseIndex), mIndexCount(indexCount), mIndexType(indexType), mBaseVertex(baseVertex), mVertexCount(vertexCount), mBounds(bounds), mTopology(topology) {
+	: mName(name), mSortId(gSortIds.Allocate()), mVertexInput(vertexInput), mBvh(bvh), mBaseIndex(baseIndex), mIndexCount(indexCount), mIndexType(indexType), mBaseVertex(baseVertex), mVertexCount(vertexCount), mBounds(bounds), mTopology(topology) {
 	
 	mVertexBuffer = vertexBuffer;
 	mIndexBuffer = indexBuffer;
 }
 Mesh::Mesh(const string& name, ::Device* device, const void* vertices, const void* indices, uint32_t vertexCount, uint32_t vertexSize, uint32_t indexCount, const ::VertexInput* vertexInput, VkIndexType indexType, VkPrimitiveTopology topology)
-	: mName(name), mVertexInput(vertexInput), mBvh(nullptr), mIndexCount(indexCount), mIndexType(indexType), mVertexCount(vertexCount), mBaseVertex(0), mBaseIndex(0), mTopology(topology) {
+	: mName(name), mSortId(gSortIds.Allocate()), mVertexInput(vertexInput), mBvh(nullptr), mIndexCount(indexCount), mIndexType(indexType), mVertexCount(vertexCount), mBaseVertex(0), mBaseIndex(0), mTopology(topology) {
 	
 	float3 mn, mx;
 	for (uint32_t i = 0; i < indexCount; i++) {
@@ -379,7 +406,7 @@ Mesh::Mesh(const string& name, ::Device* device, const void* vertices, const voi
 	mIndexBuffer  = make_shared<Buffer>(name + " Index Buffer", device, indices, indexSize * indexCount, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
 }
 Mesh::Mesh(const string& name, ::Device* device, const void* vertices, const VertexWeight* weights, const vector<pair<string, const void*>>&  shapeKeys, const void* indices, uint32_t vertexCount, uint32_t vertexSize, uint32_t indexCount, const ::VertexInput* vertexInput, VkIndexType indexType, VkPrimitiveTopology topology)
-	: mName(name), mVertexInput(vertexInput), mBvh(nullptr), mIndexCount(indexCount), mIndexType(indexType), mVertexCount(vertexCount), mBaseVertex(0), mBaseIndex(0), mTopology(topology) {
+	: mName(name), mSortId(gSortIds.Allocate()), mVertexInput(vertexInput), mBvh(nullptr), mIndexCount(indexCount), mIndexType(indexType), mVertexCount(vertexCount), mBaseVertex(0), mBaseIndex(0), mTopology(topology) {
 
 	float3 mn, mx;
 	for (uint32_t i = 0; i < indexCount; i++) {
@@ -476,7 +503,22 @@ bool Mesh::Intersect(const Ray& ray, float* t, bool any) {
 }
 
 Mesh::~Mesh() {
+	gSortIds.Release(mSortId);
 	for (auto kp : mAnimations)
 		safe_delete(kp.second);
 	safe_delete(mBvh);
+}
+uint64_t Mesh::DeviceMemorySize() const {
+	uint64_t size = 0;
+	// vertex and index buffers can be shared between the meshes of a model, so only the mesh's own range of them is counted
+	if (mVertexBuffer) size += mVertexInput ? min<uint64_t>(mVertexBuffer->Size(), (uint64_t)mVertexCount * mVertexInput->mBinding.stride) : mVertexBuffer->Size();
+	if (mIndexBuffer) size += min<uint64_t>(mIndexBuffer->Size(), (uint64_t)mIndexCount * (mIndexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t)));
+	if (mWeightBuffer) size += mWeightBuffer->Size();
+	for (const auto& kp : mShapeKeys)
+		if (kp.second) size += kp.second->Size();
+	return size;
+}
+uint64_t Mesh::HostMemorySize() const {
+	if (!mBvh) return 0;
+	return mBvh->Nodes().size() * sizeof(TriangleBvh2::Node) + mBvh->Triangles().size() * sizeof(uint3);
 }
\ No newline at end of file
@@ -75,15 +75,24 @@ public:
 	inline TriangleBvh2* BVH() const { return mBvh; }
 	ENGINE_EXPORT bool Intersect(const Ray& ray, float* t, bool any);
 
+	/// The mesh's range of the vertex and index buffers, and the weight and shape key buffers
+	ENGINE_EXPORT uint64_t DeviceMemorySize() const override;
+	/// The BVH
+	ENGINE_EXPORT uint64_t HostMemorySize() const override;
+
 	inline const ::VertexInput* VertexInput() const { return mVertexInput; }
 
 	inline AABB Bounds() const { return mBounds; }
 	inline void Bounds(const AABB& b) { mBounds = b; }
 
+	/// Id used to group draws by mesh when sorting render lists, unique among live meshes. Ids of destroyed meshes are reused
+	inline uint32_t SortId() const { return mSortId; }
+
 private:
 	friend class AssetManager;
 	ENGINE_EXPORT Mesh(const std::string& name, ::Device* device, const std::string& filename, float scale = 1.f);
 
+	uint32_t mSortId;
 	TriangleBvh2* mBvh;
 
 	const ::VertexInput* mVertexInput;
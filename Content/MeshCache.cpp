@@ -0,0 +1,344 @@
+#include <Content/MeshCache.hpp>
+#include <Stratum/ShaderCompiler.hpp>
+#include <Util/MappedFile.hpp>
+
+#include <assimp/scene.h>
+#include <assimp/material.h>
+
+using namespace std;
+
+#define MESH_CACHE_MAGIC 0x484D5453 // STMH
+// increment whenever the layout of the file, StdVertex, VertexWeight or TriangleBvh2::Node changes
+#define MESH_CACHE_VERSION 1
+// arrays are aligned in the file so they can be used from the mapping as-is
+#define MESH_CACHE_ALIGNMENT 16
+
+struct MeshCacheHeader {
+	uint32_t mMagic;
+	uint32_t mVersion;
+	uint64_t mSourceSize;
+	int64_t mSourceTime;
+	float mScale;
+	uint32_t mImportFlags;
+	uint32_t mVertexCount;
+	uint32_t mIndexCount;
+	uint32_t mIndexType;
+	uint32_t mHasWeights;
+	uint32_t mSubMeshCount;
+	uint32_t mHasScene;
+};
+
+template<typename T>
+inline void WriteValue(ofstream& file, const T& value) { file.write(reinterpret_cast<const char*>(&value), sizeof(T)); }
+inline void WriteString(ofstream& file, const string& str) {
+	WriteValue(file, (uint32_t)str.length());
+	file.write(str.data(), str.length());
+}
+inline void WriteArray(ofstream& file, const void* data, size_t size) {
+	static const char padding[MESH_CACHE_ALIGNMENT] = {};
+	size_t offset = (size_t)file.tellp();
+	file.write(padding, AlignUp(offset, MESH_CACHE_ALIGNMENT) - offset);
+	if (size) file.write(reinterpret_cast<const char*>(data), size);
+}
+
+template<typename T>
+inline bool ReadValue(MemoryStream& stream, T& value) { return (bool)stream.read(reinterpret_cast<char*>(&value), sizeof(T)); }
+inline string ReadString(MemoryStream& stream) {
+	uint32_t length;
+	if (!ReadValue(stream, length)) return "";
+	const uint8_t* data = stream.Skip(length);
+	return data ? string(reinterpret_cast<const char*>(data), length) : "";
+}
+inline const void* ReadArray(MemoryStream& stream, size_t size) {
+	stream.Skip(AlignUp(stream.mOffset, MESH_CACHE_ALIGNMENT) - stream.mOffset);
+	return stream.Skip(size);
+}
+
+inline void SourceInfo(const string& filename, uint64_t& size, int64_t& time) {
+	error_code ec;
+	size = (uint64_t)fs::file_size(filename, ec);
+	if (ec) size = 0;
+	time = (int64_t)fs::last_write_time(filename, ec).time_since_epoch().count();
+	if (ec) time = 0;
+}
+
+string MeshCache::CachePath(const string& cacheDirectory, const string& filename, float scale, uint32_t importFlags) {
+	// FNV-1a over the path and import settings, so the same file imported differently gets its own cache file
+	uint64_t hash = 0xcbf29ce484222325ull;
+	auto HashBytes = [&](const void* data, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			hash ^= ((const uint8_t*)data)[i];
+			hash *= 0x100000001b3ull;
+		}
+	};
+	HashBytes(filename.data(), filename.length());
+	HashBytes(&scale, sizeof(float));
+	HashBytes(&importFlags, sizeof(uint32_t));
+
+	char name[32];
+	snprintf(name, 32, "_%016llx.stmesh", (unsigned long long)hash);
+	return cacheDirectory + fs::path(filename).stem().string() + name;
+}
+
+MeshCache::MeshCache(const string& cacheDirectory, const string& filename, float scale, uint32_t importFlags)
+	: mFile(nullptr), mValid(false), mVertices(nullptr), mVertexCount(0), mIndices(nullptr), mIndexCount(0), mIndexType(VK_INDEX_TYPE_UINT32), mWeights(nullptr), mSceneOffset(0) {
+	string path = CachePath(cacheDirectory, filename, scale, importFlags);
+	if (!fs::exists(path)) return;
+
+	mFile = new MappedFile(path);
+	if (mFile->IsOpen() && Read(filename, scale, importFlags))
+		mValid = true;
+	else {
+		fprintf_color(COLOR_YELLOW, stderr, "Discarding outdated mesh cache %s\n", path.c_str());
+		mSubMeshes.clear();
+		safe_delete(mFile);
+	}
+}
+MeshCache::~MeshCache() {
+	safe_delete(mFile);
+}
+
+bool MeshCache::Read(const string& filename, float scale, uint32_t importFlags) {
+	MemoryStream stream(mFile->Data(), mFile->Size());
+
+	MeshCacheHeader header;
+	if (!ReadValue(stream, header) || header.mMagic != MESH_CACHE_MAGIC || header.mVersion != MESH_CACHE_VERSION) return false;
+	if (header.mScale != scale || header.mImportFlags != importFlags || ReadString(stream) != filename) return false;
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	SourceInfo(filename, sourceSize, sourceTime);
+	if (header.mSourceSize != sourceSize || header.mSourceTime != sourceTime) return false;
+
+	mVertexCount = header.mVertexCount;
+	mIndexCount = header.mIndexCount;
+	mIndexType = (VkIndexType)header.mIndexType;
+	mVertices = (const StdVertex*)ReadArray(stream, sizeof(StdVertex) * mVertexCount);
+	mIndices = ReadArray(stream, (mIndexType == VK_INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t)) * mIndexCount);
+	if (header.mHasWeights) mWeights = (const VertexWeight*)ReadArray(stream, sizeof(VertexWeight) * mVertexCount);
+
+	mSubMeshes.resize(header.mSubMeshCount);
+	for (SubMesh& m : mSubMeshes) {
+		m.mName = ReadString(stream);
+		ReadValue(stream, m.mBaseVertex);
+		ReadValue(stream, m.mVertexCount);
+		ReadValue(stream, m.mBaseIndex);
+		ReadValue(stream, m.mIndexCount);
+		ReadValue(stream, m.mMaterialIndex);
+		ReadValue(stream, m.mTopology);
+		ReadValue(stream, m.mBounds);
+		ReadValue(stream, m.mBvhNodeCount);
+		ReadValue(stream, m.mBvhTriangleCount);
+		m.mBvhNodes = (const TriangleBvh2::Node*)ReadArray(stream, sizeof(TriangleBvh2::Node) * m.mBvhNodeCount);
+		m.mBvhTriangles = (const uint3*)ReadArray(stream, sizeof(uint3) * m.mBvhTriangleCount);
+		if (!stream) return false;
+		if (m.mBaseVertex + m.mVertexCount > mVertexCount || m.mBaseIndex + m.mIndexCount > mIndexCount) return false;
+	}
+
+	// the scene is only parsed by CreateScene()
+	if (header.mHasScene) mSceneOffset = stream.mOffset;
+	return (bool)stream;
+}
+
+bool MeshCache::Write(const string& cacheDirectory, const string& filename, float scale, uint32_t importFlags, const aiScene* scene,
+	const StdVertex* vertices, uint32_t vertexCount, const void* indices, uint32_t indexCount, VkIndexType indexType, const VertexWeight* weights,
+	const vector<SubMesh>& subMeshes) {
+
+	error_code ec;
+	fs::create_directories(cacheDirectory, ec);
+	// write to a temporary file first, so a crash while writing can't leave a truncated cache behind
+	string path = CachePath(cacheDirectory, filename, scale, importFlags);
+	string tmp = path + ".tmp";
+	ofstream file(tmp, ios::binary);
+	if (!file.is_open()) {
+		fprintf_color(COLOR_YELLOW, stderr, "Could not write mesh cache: %s\n", tmp.c_str());
+		return false;
+	}
+
+	MeshCacheHeader header = {};
+	header.mMagic = MESH_CACHE_MAGIC;
+	header.mVersion = MESH_CACHE_VERSION;
+	SourceInfo(filename, header.mSourceSize, header.mSourceTime);
+	header.mScale = scale;
+	header.mImportFlags = importFlags;
+	header.mVertexCount = vertexCount;
+	header.mIndexCount = indexCount;
+	header.mIndexType = (uint32_t)indexType;
+	header.mHasWeights = weights ? 1 : 0;
+	header.mSubMeshCount = (uint32_t)subMeshes.size();
+	header.mHasScene = scene ? 1 : 0;
+	WriteValue(file, header);
+	WriteString(file, filename);
+
+	WriteArray(file, vertices, sizeof(StdVertex) * vertexCount);
+	WriteArray(file, indices, (indexType == VK_INDEX_TYPE_UINT32 ? sizeof(uint32_t) : sizeof(uint16_t)) * indexCount);
+	if (weights) WriteArray(file, weights, sizeof(VertexWeight) * vertexCount);
+
+	for (const SubMesh& m : subMeshes) {
+		WriteString(file, m.mName);
+		WriteValue(file, m.mBaseVertex);
+		WriteValue(file, m.mVertexCount);
+		WriteValue(file, m.mBaseIndex);
+		WriteValue(file, m.mIndexCount);
+		WriteValue(file, m.mMaterialIndex);
+		WriteValue(file, m.mTopology);
+		WriteValue(file, m.mBounds);
+		WriteValue(file, m.mBvhNodeCount);
+		WriteValue(file, m.mBvhTriangleCount);
+		WriteArray(file, m.mBvhNodes, sizeof(TriangleBvh2::Node) * m.mBvhNodeCount);
+		WriteArray(file, m.mBvhTriangles, sizeof(uint3) * m.mBvhTriangleCount);
+	}
+
+	if (scene) {
+		// nodes depth-first, so every node's parent comes before it
+		vector<pair<const aiNode*, int32_t>> nodes;
+		vector<pair<const aiNode*, int32_t>> todo = { { scene->mRootNode, -1 } };
+		while (todo.size()) {
+			auto n = todo.back();
+			todo.pop_back();
+			int32_t index = (int32_t)nodes.size();
+			nodes.push_back(n);
+			for (int32_t i = (int32_t)n.first->mNumChildren - 1; i >= 0; i--)
+				todo.push_back({ n.first->mChildren[i], index });
+		}
+		WriteValue(file, (uint32_t)nodes.size());
+		for (const auto& n : nodes) {
+			WriteString(file, n.first->mName.C_Str());
+			WriteValue(file, n.second);
+			WriteValue(file, n.first->mTransformation);
+			WriteValue(file, n.first->mNumMeshes);
+			for (uint32_t i = 0; i < n.first->mNumMeshes; i++)
+				WriteValue(file, n.first->mMeshes[i]);
+		}
+
+		// every material property is kept, since the material setup callbacks can query any of them
+		WriteValue(file, scene->mNumMaterials);
+		for (uint32_t m = 0; m < scene->mNumMaterials; m++) {
+			const aiMaterial* material = scene->mMaterials[m];
+			WriteValue(file, material->mNumProperties);
+			for (uint32_t i = 0; i < material->mNumProperties; i++) {
+				const aiMaterialProperty* p = material->mProperties[i];
+				WriteString(file, p->mKey.C_Str());
+				WriteValue(file, p->mSemantic);
+				WriteValue(file, p->mIndex);
+				WriteValue(file, (uint32_t)p->mType);
+				WriteValue(file, p->mDataLength);
+				file.write(p->mData, p->mDataLength);
+			}
+		}
+
+		WriteValue(file, scene->mNumLights);
+		for (uint32_t i = 0; i < scene->mNumLights; i++) {
+			const aiLight* l = scene->mLights[i];
+			WriteString(file, l->mName.C_Str());
+			WriteValue(file, (uint32_t)l->mType);
+			WriteValue(file, l->mPosition);
+			WriteValue(file, l->mDirection);
+			WriteValue(file, l->mAttenuationConstant);
+			WriteValue(file, l->mAttenuationLinear);
+			WriteValue(file, l->mAttenuationQuadratic);
+			WriteValue(file, l->mColorDiffuse);
+			WriteValue(file, l->mColorSpecular);
+			WriteValue(file, l->mColorAmbient);
+			WriteValue(file, l->mAngleInnerCone);
+			WriteValue(file, l->mAngleOuterCone);
+		}
+	}
+
+	bool success = (bool)file;
+	file.close();
+	if (success) fs::rename(tmp, path, ec);
+	if (!success || ec) {
+		fprintf_color(COLOR_YELLOW, stderr, "Could not write mesh cache: %s\n", path.c_str());
+		fs::remove(tmp, ec);
+		return false;
+	}
+	return true;
+}
+
+aiScene* MeshCache::CreateScene() const {
+	if (!mValid || !mSceneOffset) return nullptr;
+	MemoryStream stream(mFile->Data(), mFile->Size());
+	stream.mOffset = mSceneOffset;
+
+	aiScene* scene = new aiScene();
+
+	scene->mNumMeshes = (uint32_t)mSubMeshes.size();
+	scene->mMeshes = new aiMesh*[scene->mNumMeshes];
+	for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+		scene->mMeshes[i] = new aiMesh();
+		scene->mMeshes[i]->mName.Set(mSubMeshes[i].mName);
+		scene->mMeshes[i]->mMaterialIndex = mSubMeshes[i].mMaterialIndex;
+	}
+
+	uint32_t nodeCount = 0;
+	ReadValue(stream, nodeCount);
+	vector<aiNode*> nodes(nodeCount);
+	vector<vector<aiNode*>> children(nodeCount);
+	for (uint32_t i = 0; i < nodeCount && stream; i++) {
+		nodes[i] = new aiNode(ReadString(stream));
+		int32_t parent;
+		ReadValue(stream, parent);
+		ReadValue(stream, nodes[i]->mTransformation);
+		ReadValue(stream, nodes[i]->mNumMeshes);
+		if (nodes[i]->mNumMeshes) {
+			nodes[i]->mMeshes = new uint32_t[nodes[i]->mNumMeshes];
+			for (uint32_t m = 0; m < nodes[i]->mNumMeshes; m++)
+				ReadValue(stream, nodes[i]->mMeshes[m]);
+		}
+		if (parent >= 0 && parent < (int32_t)i) {
+			nodes[i]->mParent = nodes[parent];
+			children[parent].push_back(nodes[i]);
+		}
+	}
+	for (uint32_t i = 0; i < nodeCount; i++) {
+		if (!nodes[i] || children[i].empty()) continue;
+		nodes[i]->mNumChildren = (uint32_t)children[i].size();
+		nodes[i]->mChildren = new aiNode*[nodes[i]->mNumChildren];
+		memcpy(nodes[i]->mChildren, children[i].data(), sizeof(aiNode*) * nodes[i]->mNumChildren);
+	}
+	scene->mRootNode = nodeCount ? nodes[0] : new aiNode();
+
+	ReadValue(stream, scene->mNumMaterials);
+	if (!stream) scene->mNumMaterials = 0;
+	scene->mMaterials = new aiMaterial*[scene->mNumMaterials];
+	for (uint32_t m = 0; m < scene->mNumMaterials; m++) {
+		aiMaterial* material = new aiMaterial();
+		scene->mMaterials[m] = material;
+		uint32_t propertyCount = 0;
+		ReadValue(stream, propertyCount);
+		for (uint32_t i = 0; i < propertyCount && stream; i++) {
+			string key = ReadString(stream);
+			uint32_t semantic, index, type, length;
+			ReadValue(stream, semantic);
+			ReadValue(stream, index);
+			ReadValue(stream, type);
+			ReadValue(stream, length);
+			const uint8_t* data = stream.Skip(length);
+			if (data) material->AddBinaryProperty(data, length, key.c_str(), semantic, index, (aiPropertyTypeInfo)type);
+		}
+	}
+
+	ReadValue(stream, scene->mNumLights);
+	if (!stream) scene->mNumLights = 0;
+	scene->mLights = new aiLight*[scene->mNumLights];
+	for (uint32_t i = 0; i < scene->mNumLights; i++) {
+		aiLight* l = new aiLight();
+		scene->mLights[i] = l;
+		l->mName.Set(ReadString(stream));
+		uint32_t type = 0;
+		ReadValue(stream, type);
+		l->mType = (aiLightSourceType)type;
+		ReadValue(stream, l->mPosition);
+		ReadValue(stream, l->mDirection);
+		ReadValue(stream, l->mAttenuationConstant);
+		ReadValue(stream, l->mAttenuationLinear);
+		ReadValue(stream, l->mAttenuationQuadratic);
+		ReadValue(stream, l->mColorDiffuse);
+		ReadValue(stream, l->mColorSpecular);
+		ReadValue(stream, l->mColorAmbient);
+		ReadValue(stream, l->mAngleInnerCone);
+		ReadValue(stream, l->mAngleOuterCone);
+	}
+
+	return scene;
+}
\ No newline at end of file
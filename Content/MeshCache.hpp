@@ -0,0 +1,70 @@
+#pragma once
+
+#include <Content/Mesh.hpp>
+
+struct aiScene;
+class MappedFile;
+
+/// The final geometry of an imported model file: vertices, indices, bone weights and the range, bounds and triangle BVH of each mesh,
+/// along with the scene's nodes, materials and lights. Written to the cache directory as a .stmesh file and memory-mapped on later loads,
+/// so the data can be uploaded from the mapping without running Assimp's import and post-processing, or the BVH builds, again
+class MeshCache {
+public:
+	struct SubMesh {
+		std::string mName;
+		uint32_t mBaseVertex;
+		uint32_t mVertexCount;
+		uint32_t mBaseIndex;
+		uint32_t mIndexCount;
+		uint32_t mMaterialIndex;
+		VkPrimitiveTopology mTopology;
+		AABB mBounds;
+		// TriangleBvh2::Nodes() and Triangles() of the mesh's BVH, or empty if it doesn't have one
+		const TriangleBvh2::Node* mBvhNodes;
+		uint32_t mBvhNodeCount;
+		const uint3* mBvhTriangles;
+		uint32_t mBvhTriangleCount;
+	};
+
+	/// Maps the cache file of filename. Check IsValid(): the cache isn't used if it doesn't exist, was written by a different version,
+	/// with a different scale or import flags, or if the source file has changed since
+	ENGINE_EXPORT MeshCache(const std::string& cacheDirectory, const std::string& filename, float scale, uint32_t importFlags);
+	ENGINE_EXPORT ~MeshCache();
+
+	/// Writes the cache file of filename. scene supplies the nodes, materials and lights and may be nullptr. weights is nullptr or one per vertex
+	ENGINE_EXPORT static bool Write(const std::string& cacheDirectory, const std::string& filename, float scale, uint32_t importFlags, const aiScene* scene,
+		const StdVertex* vertices, uint32_t vertexCount, const void* indices, uint32_t indexCount, VkIndexType indexType, const VertexWeight* weights,
+		const std::vector<SubMesh>& subMeshes);
+
+	/// Creates an aiScene with the cached nodes, materials and lights, and a mesh for each SubMesh with only its name and material index set.
+	/// Returns nullptr if no scene was cached. The scene must be freed with delete, not aiReleaseImport()
+	ENGINE_EXPORT aiScene* CreateScene() const;
+
+	inline bool IsValid() const { return mValid; }
+	inline const StdVertex* Vertices() const { return mVertices; }
+	inline uint32_t VertexCount() const { return mVertexCount; }
+	inline const void* Indices() const { return mIndices; }
+	inline uint32_t IndexCount() const { return mIndexCount; }
+	inline VkIndexType IndexType() const { return mIndexType; }
+	/// One per vertex, or nullptr if the model has no bones
+	inline const VertexWeight* Weights() const { return mWeights; }
+	/// The BVH pointers point into the mapped file, and are valid until the MeshCache is destroyed
+	inline const std::vector<SubMesh>& SubMeshes() const { return mSubMeshes; }
+
+private:
+	ENGINE_EXPORT static std::string CachePath(const std::string& cacheDirectory, const std::string& filename, float scale, uint32_t importFlags);
+	ENGINE_EXPORT bool Read(const std::string& filename, float scale, uint32_t importFlags);
+
+	MappedFile* mFile;
+	bool mValid;
+
+	const StdVertex* mVertices;
+	uint32_t mVertexCount;
+	const void* mIndices;
+	uint32_t mIndexCount;
+	VkIndexType mIndexType;
+	const VertexWeight* mWeights;
+	std::vector<SubMesh> mSubMeshes;
+	// offset of the serialized scene in the mapped file, or 0 if there is none
+	size_t mSceneOffset;
+};
\ No newline at end of file
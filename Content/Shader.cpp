@@ -1,10 +1,26 @@
 #include <Content/Shader.hpp>
 #include <Stratum/ShaderCompiler.hpp>
+#include <Shaders/include/shadercompat.h>
+#include <Util/MappedFile.hpp>
+#include <Util/Profiler.hpp>
+#include <Util/ThreadPool.hpp>
 
+#include <sstream>
 #include <string>
 
 using namespace std;
 
+#define PIPELINE_MANIFEST_MAGIC 0x4D505453 // STPM
+#define PIPELINE_MANIFEST_VERSION 2
+
+// last frame that drew with a fallback pipeline, or skipped a draw waiting on one
+static atomic<uint64_t> gLastFallbackFrame(~0ull);
+
+template<typename T>
+inline void WriteValue(ofstream& file, const T& value) { file.write(reinterpret_cast<const char*>(&value), sizeof(T)); }
+template<typename T>
+inline bool ReadValue(ifstream& file, T& value) { return (bool)file.read(reinterpret_cast<char*>(&value), sizeof(T)); }
+
 bool PipelineInstance::operator==(const PipelineInstance& rhs) const {
 	return rhs.mRenderPass == mRenderPass &&
 		((!rhs.mVertexInput && !mVertexInput) || (rhs.mVertexInput && mVertexInput && *rhs.mVertexInput == *mVertexInput)) &&
@@ -15,183 +31,50 @@ bool PipelineInstance::operator==(const PipelineInstance& rhs) const {
 }
 
 Shader::Shader(const string& name, ::Device* device, const string& filename)
-	: mName(name), mDevice(device), mViewportState({}), mRasterizationState({}), mDynamicState({}), mBlendMode(BLEND_MODE_OPAQUE), mDepthStencilState({}), mPassMask(PASS_MAIN) {
-	ifstream file(filename, ios::binary);
-	if (!file.is_open()) {
+	: mName(name), mDevice(device), mViewportState({}), mRasterizationState({}), mDynamicState({}), mBlendMode(BLEND_MODE_OPAQUE), mDepthStencilState({}), mPassMask(PASS_MAIN), mFile(nullptr), mCompiled(nullptr), mManifestDirty(false) {
+	mFile = new MappedFile(filename);
+	if (!mFile->IsOpen()) {
 		fprintf_color(COLOR_RED_BOLD, stderr, "Could not load shader: %s\n", filename.c_str());
 		throw;
 	}
 
-	CompiledShader compiled(file);
-
-	// create shader modules
-	uint32_t mc = 1;
-	fprintf_color(COLOR_GREEN, stderr, "%s: Compiling shader modules  %d/%d", filename.c_str(), mc, (uint32_t)compiled.mModules.size());
-	vector<VkShaderModule> modules;
-	for (SpirvModule& sm : compiled.mModules) {
-		VkShaderModuleCreateInfo module = {};
-		module.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		module.codeSize = sm.mSpirv.size() * sizeof(uint32_t);
-		module.pCode = sm.mSpirv.data();
-		VkShaderModule m;
-		vkCreateShaderModule(*mDevice, &module, nullptr, &m);
-		modules.push_back(m);
-		mc++;
-		fprintf_color(COLOR_GREEN, stderr, "\r%s: Compiling shader modules  %d/%d", filename.c_str(), mc, (uint32_t)compiled.mModules.size());
+	// the SPIR-V is left in the mapping, it's only read when a variant that uses it is created
+	MemoryStream stream(mFile->Data(), mFile->Size());
+	mCompiled = new CompiledShader(stream);
+	if (stream && mCompiled->mVersion != COMPILED_SHADER_VERSION) {
+		fprintf_color(COLOR_RED_BOLD, stderr, "Could not load shader: %s was written by another version of the ShaderCompiler, recompile it\n", filename.c_str());
+		throw;
 	}
-	fprintf_color(COLOR_GREEN, stderr, "\r%s: Compiled %d shader modules                \n", filename.c_str(), (uint32_t)compiled.mModules.size());
+	if (!stream) {
+		fprintf_color(COLOR_RED_BOLD, stderr, "Could not load shader: %s is truncated\n", filename.c_str());
+		throw;
+	}
+	mModules.resize(mCompiled->mModules.size(), VK_NULL_HANDLE);
 
 	mPassMask = (PassType)0;
 
-	// Read shader variants
-	// A variant is a shader compiled with a unique set of keywords
-	mc = 1;
-	fprintf_color(COLOR_GREEN, stderr, "%s: Reading variants  %d/%d", filename.c_str(), mc, (uint32_t)compiled.mVariants.size());
-	for (uint32_t v = 0; v < compiled.mVariants.size(); v++) {
-		set<string> keywords;
-
-		// Read keywords for this variant
-		for (uint32_t i = 0; i < compiled.mVariants[v].mKeywords.size(); i++) {
-			string keyword = compiled.mVariants[v].mKeywords[i];
-			keywords.insert(keyword);
-			mKeywords.insert(keyword);
-		}
+	// Index shader variants
+	// A variant is a shader compiled with a unique set of keywords, it's created the first time it's requested
+	for (uint32_t v = 0; v < mCompiled->mVariants.size(); v++) {
+		const CompiledVariant& compiled = mCompiled->mVariants[v];
+		mKeywords.insert(compiled.mKeywords.begin(), compiled.mKeywords.end());
 
 		// Make unique keyword string by appending the keywords in alphabetical order
+		set<string> keywords(compiled.mKeywords.begin(), compiled.mKeywords.end());
 		string kw = "";
 		for (const auto& k : keywords)
 			kw += k + " ";
 
-		mPassMask = (PassType)(mPassMask | compiled.mVariants[v].mPass);
-
-		ShaderVariant* var;
-
-		if (compiled.mVariants[v].mPass == 0) {
-			// compute shader
-			ComputeShader*& cv = mComputeVariants[compiled.mVariants[v].mEntryPoints[0]][kw];
-			if (!cv) cv = new ComputeShader();
-
-			cv->mEntryPoint = compiled.mVariants[v].mEntryPoints[0];
-
-			cv->mStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-			cv->mStage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-			cv->mStage.pName = cv->mEntryPoint.c_str();
-			cv->mStage.module = modules[compiled.mVariants[v].mModules[0]];
-
-			cv->mWorkgroupSize = compiled.mVariants[v].mWorkgroupSize;
-
-			var = cv;
-		} else {
-			// graphics shader
-			GraphicsShader*& gv = mGraphicsVariants[compiled.mVariants[v].mPass][kw];
-			if (!gv) gv = new GraphicsShader();
+		mPassMask = (PassType)(mPassMask | compiled.mPass);
 
-			gv->mShader = this;
-			gv->mEntryPoints[0] = compiled.mVariants[v].mEntryPoints[0];
-			gv->mEntryPoints[1] = compiled.mVariants[v].mEntryPoints[1];
-
-			gv->mStages[0] = {};
-			gv->mStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-			gv->mStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-			gv->mStages[0].pName = gv->mEntryPoints[0].c_str();
-			gv->mStages[0].module = modules[compiled.mVariants[v].mModules[0]];
-
-			gv->mStages[1] = {};
-			gv->mStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-			gv->mStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-			gv->mStages[1].pName = gv->mEntryPoints[1].c_str();
-			gv->mStages[1].module = modules[compiled.mVariants[v].mModules[1]];
-
-			var = gv;
-		}
-
-		var->mDescriptorBindings = compiled.mVariants[v].mDescriptorBindings;
-		var->mPushConstants = compiled.mVariants[v].mPushConstants;
-
-		// create DescriptorSetLayout bindings
-		// bindings[descriptorset][binding] = VkDescriptorSetLayoutBinding
-		vector<vector<VkDescriptorSetLayoutBinding>> bindings;
-		vector<vector<VkDescriptorBindingFlagsEXT>> bindingFlags;
-		for (auto& b : var->mDescriptorBindings) {
-			if (bindings.size() <= b.second.first) bindings.resize((size_t)b.second.first + 1);
-			if (bindingFlags.size() <= b.second.first) bindingFlags.resize((size_t)b.second.first + 1);
-
-			bindings[b.second.first].push_back(b.second.second);
-			bindingFlags[b.second.first].push_back(b.second.second.descriptorCount > 1 ? VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT : 0);
-
-			// read static samplers
-			for (const auto& s : compiled.mVariants[v].mStaticSamplers) {
-				if (b.first == s.first) {
-					Sampler* sampler = new Sampler(mName + " " + b.first, mDevice, s.second);
-					b.second.second.pImmutableSamplers = &sampler->VkSampler();
-					bindings[b.second.first].back().pImmutableSamplers = &sampler->VkSampler();
-					mStaticSamplers.push_back(sampler);
-				}
-			}
-		}
-
-		// create DescriptorSetLayouts
-		var->mDescriptorSetLayouts.resize(bindings.size());
-		for (uint32_t b = 0; b < bindings.size(); b++) {			
-			VkDescriptorSetLayoutBindingFlagsCreateInfoEXT extendedInfo = {};
-			extendedInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
-			extendedInfo.bindingCount = (uint32_t)bindingFlags[b].size();
-			extendedInfo.pBindingFlags = bindingFlags[b].data();
-
-			VkDescriptorSetLayoutCreateInfo descriptorSetLayout = {};
-			descriptorSetLayout.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-			descriptorSetLayout.pNext = &extendedInfo;
-			descriptorSetLayout.bindingCount = (uint32_t)bindings[b].size();
-			descriptorSetLayout.pBindings = bindings[b].data();
-			vkCreateDescriptorSetLayout(*mDevice, &descriptorSetLayout, nullptr, &var->mDescriptorSetLayouts[b]);
-			mDevice->SetObjectName(var->mDescriptorSetLayouts[b], mName + " DescriptorSetLayout", VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT);
-		}
-
-		// Create PipelineLayout
-		vector<VkPushConstantRange> constants;
-		unordered_map<VkShaderStageFlags, uint2> ranges;
-		for (const auto& b : var->mPushConstants) {
-			if (ranges.count(b.second.stageFlags) == 0)
-				ranges[b.second.stageFlags] = uint2(b.second.offset, b.second.offset + b.second.size);
-			else {
-				ranges[b.second.stageFlags].x = min(ranges[b.second.stageFlags].x, b.second.offset);
-				ranges[b.second.stageFlags].y = max(ranges[b.second.stageFlags].y, b.second.offset + b.second.size);
-			}
-		}
-		for (auto r : ranges) {
-			constants.push_back({});
-			constants.back().stageFlags = r.first;
-			constants.back().offset = r.second.x;
-			constants.back().size = r.second.y - r.second.x;
-		}
-
-		VkPipelineLayoutCreateInfo layout = {};
-		layout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-		layout.setLayoutCount = (uint32_t)var->mDescriptorSetLayouts.size();
-		layout.pSetLayouts = var->mDescriptorSetLayouts.data();
-		layout.pushConstantRangeCount = (uint32_t)constants.size();
-		layout.pPushConstantRanges = constants.data();
-		vkCreatePipelineLayout(*mDevice, &layout, nullptr, &var->mPipelineLayout);
-		mDevice->SetObjectName(var->mPipelineLayout, mName + " PipelineLayout", VK_OBJECT_TYPE_PIPELINE_LAYOUT);
-
-		// Create compute pipeline
-		if (compiled.mVariants[v].mPass == 0) {
-			ComputeShader* cv = dynamic_cast<ComputeShader*>(var);
-			VkComputePipelineCreateInfo pipeline = {};
-			pipeline.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-			pipeline.stage = cv->mStage;
-			pipeline.layout = cv->mPipelineLayout;
-			pipeline.basePipelineIndex = -1;
-			pipeline.basePipelineHandle = VK_NULL_HANDLE;
-			vkCreateComputePipelines(*mDevice, mDevice->PipelineCache(), 1, &pipeline, nullptr, &cv->mPipeline);
-			mDevice->SetObjectName(cv->mPipeline, mName, VK_OBJECT_TYPE_PIPELINE);
-		}
-		
-
-		mc++;
-		fprintf_color(COLOR_GREEN, stderr, "\r%s: Reading variants  %d/%d", filename.c_str(), mc, (uint32_t)compiled.mVariants.size());
+		if (compiled.mPass == 0)
+			mComputeVariantIndices[compiled.mEntryPoints[0]][kw] = v;
+		else
+			mGraphicsVariantIndices[compiled.mPass][kw] = v;
 	}
-	fprintf_color(COLOR_GREEN, stderr, "\r%s: Read %d variants                  \n", filename.c_str(), (uint32_t)compiled.mVariants.size());
+	// specialization keywords select constants of the compiled variants, see FindGraphics
+	mKeywords.insert(mCompiled->mSpecializationKeywords.begin(), mCompiled->mSpecializationKeywords.end());
+	fprintf_color(COLOR_GREEN, stderr, "%s: Mapped %u variants, %u shader modules, %.1f KiB\n", filename.c_str(), (uint32_t)mCompiled->mVariants.size(), (uint32_t)mCompiled->mModules.size(), mFile->Size() / 1024.f);
 
 	mViewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	mViewportState.viewportCount = 1;
@@ -209,14 +92,29 @@ Shader::Shader(const string& name, ::Device* device, const string& filename)
 	mDynamicState.dynamicStateCount = (uint32_t)mDynamicStates.size();
 	mDynamicState.pDynamicStates = mDynamicStates.data();
 
-	mRenderQueue = compiled.mRenderQueue;
-	mColorMask = compiled.mColorMask;
-	mRasterizationState.cullMode = compiled.mCullMode;
-	mRasterizationState.polygonMode = compiled.mFillMode;
-	mBlendMode = compiled.mBlendMode;
-	mDepthStencilState = compiled.mDepthStencilState;
+	mRenderQueue = mCompiled->mRenderQueue;
+	mColorMask = mCompiled->mColorMask;
+	mRasterizationState.cullMode = mCompiled->mCullMode;
+	mRasterizationState.polygonMode = mCompiled->mFillMode;
+	mBlendMode = mCompiled->mBlendMode;
+	mDepthStencilState = mCompiled->mDepthStencilState;
+
+	CreateManifestPipelines();
 }
 Shader::~Shader() {
+	// pipelines still being created reference the variants
+	for (auto& g : mGraphicsVariants)
+		for (auto& v : g.second) {
+			vector<shared_future<VkPipeline>> pending;
+			{
+				lock_guard lock(v.second->mPipelineMutex);
+				for (auto& p : v.second->mPendingPipelines) pending.push_back(p.second);
+			}
+			for (auto& p : pending) mDevice->Instance()->ThreadPool()->Wait(p);
+		}
+
+	if (mManifestDirty) WritePipelineManifest();
+
 	for (auto& g : mStaticSamplers)
 		safe_delete(g);
 
@@ -224,184 +122,644 @@ Shader::~Shader() {
 		for (auto& v : g.second) {
 			for (auto& s : v.second->mPipelines)
 				vkDestroyPipeline(*mDevice, s.second, nullptr);
-			for (auto& s : v.second->mDescriptorSetLayouts)
-				vkDestroyDescriptorSetLayout(*mDevice, s, nullptr);
-			vkDestroyPipelineLayout(*mDevice, v.second->mPipelineLayout, nullptr);
-			for (auto& s : v.second->mStages)
-				vkDestroyShaderModule(*mDevice, s.module, nullptr);
+			// specialized variants share the layouts of their base variant
+			if (!v.second->mBaseVariant) {
+				for (auto& s : v.second->mDescriptorSetLayouts)
+					vkDestroyDescriptorSetLayout(*mDevice, s, nullptr);
+				vkDestroyPipelineLayout(*mDevice, v.second->mPipelineLayout, nullptr);
+			}
 			safe_delete(v.second);
 		}
 	}
 	for (auto& s : mComputeVariants) {
 		for (auto& v : s.second) {
-			for (auto& l : v.second->mDescriptorSetLayouts)
-				vkDestroyDescriptorSetLayout(*mDevice, l, nullptr);
 			vkDestroyPipeline(*mDevice, v.second->mPipeline, nullptr);
-			vkDestroyPipelineLayout(*mDevice, v.second->mPipelineLayout, nullptr);
-			vkDestroyShaderModule(*mDevice, v.second->mStage.module, nullptr);
+			if (!v.second->mBaseVariant) {
+				for (auto& l : v.second->mDescriptorSetLayouts)
+					vkDestroyDescriptorSetLayout(*mDevice, l, nullptr);
+				vkDestroyPipelineLayout(*mDevice, v.second->mPipelineLayout, nullptr);
+			}
 			safe_delete(v.second);
 		}
 	}
+	// variants share modules
+	for (VkShaderModule m : mModules)
+		if (m != VK_NULL_HANDLE) vkDestroyShaderModule(*mDevice, m, nullptr);
+	for (VertexInput* v : mVertexInputs)
+		safe_delete(v);
+
+	safe_delete(mCompiled);
+	safe_delete(mFile);
+}
+
+string Shader::PipelineManifestPath() const {
+	string name = mName;
+	for (char& c : name)
+		if (c == '/' || c == '\\' || c == ':') c = '_';
+	return mDevice->CacheDirectory() + name + ".pipelines";
+}
+
+void Shader::CreateManifestPipelines() {
+	ifstream file(PipelineManifestPath(), ios::binary);
+	if (!file.is_open()) return;
+
+	uint32_t magic, version, count;
+	if (!ReadValue(file, magic) || !ReadValue(file, version) || !ReadValue(file, count) || magic != PIPELINE_MANIFEST_MAGIC || version != PIPELINE_MANIFEST_VERSION) {
+		mManifestDirty = true;
+		return;
+	}
+
+	vector<PipelineRecord> records(count);
+	for (PipelineRecord& r : records) {
+		uint32_t length, colorCount, attributeCount;
+		ReadValue(file, r.mPass);
+		ReadValue(file, length);
+		r.mKeywords.resize(length);
+		if (length) file.read(r.mKeywords.data(), length);
+		ReadValue(file, colorCount);
+		r.mRenderPass.mColorFormats.resize(colorCount);
+		if (colorCount) file.read(reinterpret_cast<char*>(r.mRenderPass.mColorFormats.data()), colorCount * sizeof(VkFormat));
+		ReadValue(file, r.mRenderPass.mDepthFormat);
+		ReadValue(file, r.mRenderPass.mSampleCount);
+		ReadValue(file, r.mRenderPass.mViewCount);
+		ReadValue(file, r.mHasVertexInput);
+		if (r.mHasVertexInput) {
+			ReadValue(file, r.mBinding);
+			ReadValue(file, attributeCount);
+			r.mAttributes.resize(attributeCount);
+			if (attributeCount) file.read(reinterpret_cast<char*>(r.mAttributes.data()), attributeCount * sizeof(VkVertexInputAttributeDescription));
+		}
+		ReadValue(file, r.mTopology);
+		ReadValue(file, r.mCullMode);
+		ReadValue(file, r.mBlendMode);
+		if (!ReadValue(file, r.mPolygonMode)) {
+			fprintf_color(COLOR_YELLOW, stderr, "%s: Discarding truncated pipeline manifest\n", mName.c_str());
+			mManifestDirty = true;
+			return;
+		}
+	}
+	file.close();
+
+	// GetPipeline records the pipelines again as they're created, which drops records of variants that no longer exist
+	for (const PipelineRecord& r : records) {
+		GraphicsShader* variant;
+		{
+			lock_guard lock(mVariantMutex);
+			variant = FindGraphics(r.mPass, r.mKeywords);
+		}
+		if (!variant) continue;
+
+		VertexInput input(r.mBinding, r.mAttributes);
+		variant->GetPipeline(mDevice->CompatibleRenderPass(r.mRenderPass), r.mHasVertexInput ? &input : nullptr, r.mTopology, r.mCullMode, r.mBlendMode, r.mPolygonMode, true);
+	}
+	// only rewrite the manifest if records were dropped, or when new pipelines are created
+	mManifestDirty = mManifest.size() != records.size();
+}
+
+void Shader::WritePipelineManifest() {
+	lock_guard lock(mManifestMutex);
+	error_code ec;
+	fs::create_directories(mDevice->CacheDirectory(), ec);
+	ofstream file(PipelineManifestPath(), ios::binary);
+	if (!file.is_open()) {
+		fprintf_color(COLOR_YELLOW, stderr, "%s: Could not write pipeline manifest\n", mName.c_str());
+		return;
+	}
+
+	WriteValue(file, (uint32_t)PIPELINE_MANIFEST_MAGIC);
+	WriteValue(file, (uint32_t)PIPELINE_MANIFEST_VERSION);
+	WriteValue(file, (uint32_t)mManifest.size());
+	for (const PipelineRecord& r : mManifest) {
+		WriteValue(file, r.mPass);
+		WriteValue(file, (uint32_t)r.mKeywords.length());
+		file.write(r.mKeywords.data(), r.mKeywords.length());
+		WriteValue(file, (uint32_t)r.mRenderPass.mColorFormats.size());
+		file.write(reinterpret_cast<const char*>(r.mRenderPass.mColorFormats.data()), r.mRenderPass.mColorFormats.size() * sizeof(VkFormat));
+		WriteValue(file, r.mRenderPass.mDepthFormat);
+		WriteValue(file, r.mRenderPass.mSampleCount);
+		WriteValue(file, r.mRenderPass.mViewCount);
+		WriteValue(file, r.mHasVertexInput);
+		if (r.mHasVertexInput) {
+			WriteValue(file, r.mBinding);
+			WriteValue(file, (uint32_t)r.mAttributes.size());
+			file.write(reinterpret_cast<const char*>(r.mAttributes.data()), r.mAttributes.size() * sizeof(VkVertexInputAttributeDescription));
+		}
+		WriteValue(file, r.mTopology);
+		WriteValue(file, r.mCullMode);
+		WriteValue(file, r.mBlendMode);
+		WriteValue(file, r.mPolygonMode);
+	}
+	mManifestDirty = false;
+}
+
+void Shader::RecordPipeline(GraphicsShader* variant, RenderPass* renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, ::BlendMode blendMode, VkPolygonMode polyMode) {
+	PipelineRecord r = {};
+	r.mPass = variant->mPass;
+	r.mKeywords = variant->mKeywords;
+	r.mRenderPass = renderPass->Layout();
+	r.mHasVertexInput = vertexInput != nullptr;
+	if (vertexInput) {
+		r.mBinding = vertexInput->mBinding;
+		r.mAttributes = vertexInput->mAttributes;
+	}
+	r.mTopology = topology;
+	r.mCullMode = cullMode;
+	r.mBlendMode = blendMode;
+	r.mPolygonMode = polyMode;
+
+	lock_guard lock(mManifestMutex);
+	mManifest.push_back(r);
+	mManifestDirty = true;
+}
+
+const VertexInput* Shader::StoredVertexInput(const VertexInput* vertexInput) {
+	if (!vertexInput) return nullptr;
+	lock_guard lock(mVertexInputMutex);
+	for (VertexInput* v : mVertexInputs)
+		if (*v == *vertexInput) return v;
+	mVertexInputs.push_back(new VertexInput(*vertexInput));
+	return mVertexInputs.back();
 }
 
 VkPipeline GraphicsShader::GetPipeline(RenderPass* renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode) {
-	BlendMode blend = blendMode == BLEND_MODE_MAX_ENUM ? mShader->mBlendMode : blendMode;
+	return GetPipeline(renderPass, vertexInput, topology, cullMode, blendMode, polyMode, false);
+}
+VkPipeline GraphicsShader::GetPipeline(RenderPass* renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode, bool replay) {
 	VkCullModeFlags cull = cullMode == VK_CULL_MODE_FLAG_BITS_MAX_ENUM ? mShader->mRasterizationState.cullMode : cullMode;
 	VkPolygonMode poly = polyMode == VK_POLYGON_MODE_MAX_ENUM ? mShader->mRasterizationState.polygonMode : polyMode;
-	PipelineInstance instance(*renderPass, vertexInput, topology, cull, blendMode, poly);
+	PipelineInstance instance(renderPass->LayoutHash(), vertexInput, topology, cull, blendMode, poly);
+
+	shared_future<VkPipeline> pending;
+	promise<VkPipeline> created;
+	{
+		lock_guard lock(mPipelineMutex);
+		if (mPipelines.count(instance))
+			return mPipelines.at(instance);
+
+		auto it = mPendingPipelines.find(instance);
+		if (it != mPendingPipelines.end())
+			pending = it->second;
+		else {
+			// published as pending like GetPipelineAsync's pipelines, so mPipelineMutex isn't held while the pipeline compiles.
+			// The key outlives the caller's vertex input
+			instance.mVertexInput = mShader->StoredVertexInput(vertexInput);
+			mPendingPipelines.emplace(instance, created.get_future().share());
+		}
+	}
+	// GetPipelineAsync or another thread is already creating the pipeline, help the pool out until it's done
+	if (pending.valid()) return mShader->mDevice->Instance()->ThreadPool()->Wait(pending);
+
+	Profiler::AddCounter(replay ? "Pipeline Manifest Loads" : "Pipeline Misses");
+	auto start = chrono::high_resolution_clock::now();
+	VkPipeline p;
+	try {
+		p = CreatePipeline(renderPass, vertexInput, topology, cullMode, blendMode, polyMode);
+	} catch (...) {
+		{
+			lock_guard lock(mPipelineMutex);
+			mPendingPipelines.erase(instance);
+		}
+		created.set_exception(current_exception());
+		throw;
+	}
+	Profiler::AddCounter("Pipeline Compile Time (us)", chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start).count());
 
+	{
+		lock_guard lock(mPipelineMutex);
+		mPipelines.emplace(instance, p);
+		mPendingPipelines.erase(instance);
+		mShader->RecordPipeline(this, renderPass, vertexInput, topology, cullMode, blendMode, polyMode);
+	}
+	created.set_value(p);
+	return p;
+}
+
+VkPipeline GraphicsShader::GetPipelineAsync(RenderPass* renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode) {
+	::ThreadPool* threadPool = mShader->mDevice->Instance()->ThreadPool();
+	// without background threads the task would run inline while mPipelineMutex is held
+	if (threadPool->BackgroundThreadCount() == 0) return GetPipeline(renderPass, vertexInput, topology, cullMode, blendMode, polyMode);
+
+	VkCullModeFlags cull = cullMode == VK_CULL_MODE_FLAG_BITS_MAX_ENUM ? mShader->mRasterizationState.cullMode : cullMode;
+	VkPolygonMode poly = polyMode == VK_POLYGON_MODE_MAX_ENUM ? mShader->mRasterizationState.polygonMode : polyMode;
+	PipelineInstance instance(renderPass->LayoutHash(), vertexInput, topology, cull, blendMode, poly);
+
+	lock_guard lock(mPipelineMutex);
 	if (mPipelines.count(instance))
 		return mPipelines.at(instance);
-	else {
-		VkPipelineColorBlendAttachmentState bs = {};
-		bs.colorWriteMask = mShader->mColorMask;
-		switch (blend) {
-		case BLEND_MODE_OPAQUE:
-			bs.blendEnable = VK_FALSE;
-			bs.colorBlendOp = VK_BLEND_OP_ADD;
-			bs.alphaBlendOp = VK_BLEND_OP_ADD;
-			bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-			bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-			break;
-		case BLEND_MODE_ALPHA:
-			bs.blendEnable = VK_TRUE;
-			bs.colorBlendOp = VK_BLEND_OP_ADD;
-			bs.alphaBlendOp = VK_BLEND_OP_ADD;
-			bs.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-			bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-			bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-			bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-			break;
-		case BLEND_MODE_ADDITIVE:
-			bs.blendEnable = VK_TRUE;
-			bs.colorBlendOp = VK_BLEND_OP_ADD;
-			bs.alphaBlendOp = VK_BLEND_OP_ADD;
-			bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-			break;
-		case BLEND_MODE_MULTIPLY:
-			bs.blendEnable = VK_TRUE;
-			bs.colorBlendOp = VK_BLEND_OP_MULTIPLY_EXT;
-			bs.alphaBlendOp = VK_BLEND_OP_MULTIPLY_EXT;
-			bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-			bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+
+	if (!mPendingPipelines.count(instance)) {
+		Profiler::AddCounter("Pipeline Misses");
+
+		// renderPass may be destroyed before the task runs, so the pipeline is created against the device's compatible
+		// render pass, and the key and the task use the shader's copy of the vertex input
+		RenderPass* compatible = mShader->mDevice->CompatibleRenderPass(renderPass->Layout());
+		const VertexInput* input = mShader->StoredVertexInput(vertexInput);
+		PipelineInstance stored = instance;
+		stored.mVertexInput = input;
+		mPendingPipelines.emplace(stored, threadPool->EnqueueBackground([=]() {
+			auto start = chrono::high_resolution_clock::now();
+			VkPipeline p = CreatePipeline(compatible, input, topology, cullMode, blendMode, polyMode);
+			Profiler::AddCounter("Pipeline Compile Time (us)", chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start).count());
+
+			lock_guard lock(mPipelineMutex);
+			mPipelines.emplace(stored, p);
+			mPendingPipelines.erase(stored);
+			mShader->RecordPipeline(this, compatible, input, topology, cullMode, blendMode, polyMode);
+			return p;
+		}).share());
+	}
+
+	// fall back to a pipeline that only differs in cull mode. It has the same layout and is compatible with the render pass,
+	// and the draw only gains or loses back faces. A different blend or polygon mode would draw visibly wrong, so those draws are skipped
+	VkPipeline fallback = VK_NULL_HANDLE;
+	for (const auto& p : mPipelines)
+		if (p.first.mRenderPass == instance.mRenderPass && p.first.mTopology == topology &&
+			p.first.mBlendMode == instance.mBlendMode && p.first.mPolygonMode == instance.mPolygonMode &&
+			((!p.first.mVertexInput && !vertexInput) || (p.first.mVertexInput && vertexInput && *p.first.mVertexInput == *vertexInput))) {
+			fallback = p.second;
 			break;
 		}
-		vector<VkPipelineColorBlendAttachmentState> blendAttachmentStates(renderPass->ColorAttachmentCount());
-		for (uint32_t i = 0; i < blendAttachmentStates.size(); i++) blendAttachmentStates[i] = bs;
-
-		VkPipelineRasterizationStateCreateInfo rasterState = mShader->mRasterizationState;
-		if (cullMode != VK_CULL_MODE_FLAG_BITS_MAX_ENUM) rasterState.cullMode = cullMode;
-		if (polyMode != VK_POLYGON_MODE_MAX_ENUM) rasterState.polygonMode = polyMode;
-
-		VkPipelineColorBlendStateCreateInfo blendState = {};
-		blendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-		blendState.attachmentCount = (uint32_t)blendAttachmentStates.size();
-		blendState.pAttachments = blendAttachmentStates.data();
-
-		VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
-		inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-		inputAssemblyState.topology = topology;
-		inputAssemblyState.primitiveRestartEnable = VK_FALSE;
-
-		VkPipelineVertexInputStateCreateInfo vinput = {};
-		vinput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		if (vertexInput) {
-			vinput.vertexBindingDescriptionCount = 1;
-			vinput.pVertexBindingDescriptions = &vertexInput->mBinding;
-			vinput.vertexAttributeDescriptionCount = (uint32_t)vertexInput->mAttributes.size();
-			vinput.pVertexAttributeDescriptions = vertexInput->mAttributes.data();
-		} else {
-			vinput.vertexBindingDescriptionCount = 0;
-			vinput.pVertexBindingDescriptions = nullptr;
-			vinput.vertexAttributeDescriptionCount = 0;
-			vinput.pVertexAttributeDescriptions = nullptr;
-		}
 
-		VkPipelineMultisampleStateCreateInfo multisampleState = {};
-		multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-		multisampleState.sampleShadingEnable = VK_FALSE;
-		multisampleState.rasterizationSamples = renderPass->RasterizationSamples();
-
-		VkGraphicsPipelineCreateInfo info = {};
-		info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		info.stageCount = 2;
-		info.pStages = mStages;
-		info.pInputAssemblyState = &inputAssemblyState;
-		info.pVertexInputState = &vinput;
-		info.pTessellationState = nullptr;
-		info.pViewportState = &mShader->mViewportState;
-		info.pRasterizationState = &rasterState;
-		info.pMultisampleState = &multisampleState;
-		info.pDepthStencilState = &mShader->mDepthStencilState;
-		info.pColorBlendState = &blendState;
-		info.pDynamicState = &mShader->mDynamicState;
-		info.layout = mPipelineLayout;
-		info.basePipelineIndex = -1;
-		info.basePipelineHandle = VK_NULL_HANDLE;
-		info.renderPass = *renderPass;
-
-		#pragma region print
-		const char* cullstr = "";
-		if (cullMode == VK_CULL_MODE_NONE) cullstr = "VK_CULL_MODE_NONE";
-		if (cullMode & VK_CULL_MODE_BACK_BIT) cullstr = "VK_CULL_MODE_BACK";
-		if (cullMode & VK_CULL_MODE_FRONT_BIT) cullstr = "VK_CULL_MODE_FRONT";
-		if (cullMode == VK_CULL_MODE_FRONT_AND_BACK) cullstr = "VK_CULL_MODE_FRONT_AND_BACK";
-
-		const char* blendstr = "";
-		switch (blend) {
-		case BLEND_MODE_OPAQUE: blendstr = "Opaque"; break;
-		case BLEND_MODE_ALPHA:  blendstr = "Alpha"; break;
-		case BLEND_MODE_ADDITIVE: blendstr = "Additive"; break;
-		case BLEND_MODE_MULTIPLY: blendstr = "Multiply"; break;
-		}
+	Profiler::AddCounter(fallback ? "Pipeline Fallback Draws" : "Pipeline Skipped Draws");
+	// frames that drew anything without its pipeline are only counted once
+	uint64_t frame = mShader->mDevice->Instance()->FrameCount();
+	if (gLastFallbackFrame.exchange(frame) != frame) Profiler::AddCounter("Pipeline Fallback Frames");
+	return fallback;
+}
 
-		string kw = "";
-		for (const auto& p : mShader->mGraphicsVariants)
-			for (const auto& k : p.second)
-				if (k.second == this) {
-					kw = k.first;
-					break;
-				}
-		printf_color(COLOR_CYAN, "%s [%s]: Generating graphics pipeline %s %s %s\n", mShader->mName.c_str(), kw.c_str(), blendstr, cullstr, TopologyToString(topology));
-		#pragma endregion
-
-		VkPipeline p;
-		vkCreateGraphicsPipelines(*mShader->mDevice, mShader->mDevice->PipelineCache(), 1, &info, nullptr, &p);
-		mShader->mDevice->SetObjectName(p, mShader->mName + " Variant", VK_OBJECT_TYPE_PIPELINE);
-		mPipelines.emplace(instance, p);
+VkPipeline GraphicsShader::CreatePipeline(RenderPass* renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode) {
+	BlendMode blend = blendMode == BLEND_MODE_MAX_ENUM ? mShader->mBlendMode : blendMode;
 
-		return p;
+	VkPipelineColorBlendAttachmentState bs = {};
+	bs.colorWriteMask = mShader->mColorMask;
+	switch (blend) {
+	case BLEND_MODE_OPAQUE:
+		bs.blendEnable = VK_FALSE;
+		bs.colorBlendOp = VK_BLEND_OP_ADD;
+		bs.alphaBlendOp = VK_BLEND_OP_ADD;
+		bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+		bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		break;
+	case BLEND_MODE_ALPHA:
+		bs.blendEnable = VK_TRUE;
+		bs.colorBlendOp = VK_BLEND_OP_ADD;
+		bs.alphaBlendOp = VK_BLEND_OP_ADD;
+		bs.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+		bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+		bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+		bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+		break;
+	case BLEND_MODE_ADDITIVE:
+		bs.blendEnable = VK_TRUE;
+		bs.colorBlendOp = VK_BLEND_OP_ADD;
+		bs.alphaBlendOp = VK_BLEND_OP_ADD;
+		bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		break;
+	case BLEND_MODE_MULTIPLY:
+		bs.blendEnable = VK_TRUE;
+		bs.colorBlendOp = VK_BLEND_OP_MULTIPLY_EXT;
+		bs.alphaBlendOp = VK_BLEND_OP_MULTIPLY_EXT;
+		bs.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		bs.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		break;
+	}
+	vector<VkPipelineColorBlendAttachmentState> blendAttachmentStates(renderPass->ColorAttachmentCount());
+	for (uint32_t i = 0; i < blendAttachmentStates.size(); i++) blendAttachmentStates[i] = bs;
+
+	VkPipelineRasterizationStateCreateInfo rasterState = mShader->mRasterizationState;
+	if (cullMode != VK_CULL_MODE_FLAG_BITS_MAX_ENUM) rasterState.cullMode = cullMode;
+	if (polyMode != VK_POLYGON_MODE_MAX_ENUM) rasterState.polygonMode = polyMode;
+
+	VkPipelineColorBlendStateCreateInfo blendState = {};
+	blendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	blendState.attachmentCount = (uint32_t)blendAttachmentStates.size();
+	blendState.pAttachments = blendAttachmentStates.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = {};
+	inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssemblyState.topology = topology;
+	inputAssemblyState.primitiveRestartEnable = VK_FALSE;
+
+	VkPipelineVertexInputStateCreateInfo vinput = {};
+	vinput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	if (vertexInput) {
+		vinput.vertexBindingDescriptionCount = 1;
+		vinput.pVertexBindingDescriptions = &vertexInput->mBinding;
+		vinput.vertexAttributeDescriptionCount = (uint32_t)vertexInput->mAttributes.size();
+		vinput.pVertexAttributeDescriptions = vertexInput->mAttributes.data();
+	} else {
+		vinput.vertexBindingDescriptionCount = 0;
+		vinput.pVertexBindingDescriptions = nullptr;
+		vinput.vertexAttributeDescriptionCount = 0;
+		vinput.pVertexAttributeDescriptions = nullptr;
 	}
-}
 
-GraphicsShader* Shader::GetGraphics(PassType pass, const set<string>& keywords) const {
-	if (!mGraphicsVariants.count(pass)) return nullptr;
-	const auto& v = mGraphicsVariants.at(pass);
+	VkPipelineMultisampleStateCreateInfo multisampleState = {};
+	multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampleState.sampleShadingEnable = VK_FALSE;
+	multisampleState.rasterizationSamples = renderPass->RasterizationSamples();
+
+	VkGraphicsPipelineCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	info.stageCount = 2;
+	info.pStages = mStages;
+	info.pInputAssemblyState = &inputAssemblyState;
+	info.pVertexInputState = &vinput;
+	info.pTessellationState = nullptr;
+	info.pViewportState = &mShader->mViewportState;
+	info.pRasterizationState = &rasterState;
+	info.pMultisampleState = &multisampleState;
+	info.pDepthStencilState = &mShader->mDepthStencilState;
+	info.pColorBlendState = &blendState;
+	info.pDynamicState = &mShader->mDynamicState;
+	info.layout = mPipelineLayout;
+	info.basePipelineIndex = -1;
+	info.basePipelineHandle = VK_NULL_HANDLE;
+	info.renderPass = *renderPass;
+
+	#pragma region print
+	const char* cullstr = "";
+	if (cullMode == VK_CULL_MODE_NONE) cullstr = "VK_CULL_MODE_NONE";
+	if (cullMode & VK_CULL_MODE_BACK_BIT) cullstr = "VK_CULL_MODE_BACK";
+	if (cullMode & VK_CULL_MODE_FRONT_BIT) cullstr = "VK_CULL_MODE_FRONT";
+	if (cullMode == VK_CULL_MODE_FRONT_AND_BACK) cullstr = "VK_CULL_MODE_FRONT_AND_BACK";
+
+	const char* blendstr = "";
+	switch (blend) {
+	case BLEND_MODE_OPAQUE: blendstr = "Opaque"; break;
+	case BLEND_MODE_ALPHA:  blendstr = "Alpha"; break;
+	case BLEND_MODE_ADDITIVE: blendstr = "Additive"; break;
+	case BLEND_MODE_MULTIPLY: blendstr = "Multiply"; break;
+	}
 
-	string kw = "";
-	for (const auto& k : keywords)
-		if (mKeywords.count(k))
-			kw += k + " ";
+	printf_color(COLOR_CYAN, "%s [%s]: Generating graphics pipeline %s %s %s\n", mShader->mName.c_str(), mKeywords.c_str(), blendstr, cullstr, TopologyToString(topology));
+	#pragma endregion
 
-	if (!v.count(kw)) return nullptr;
-	return v.at(kw);
+	VkPipeline p;
+	vkCreateGraphicsPipelines(*mShader->mDevice, mShader->mDevice->PipelineCache(), 1, &info, nullptr, &p);
+	mShader->mDevice->SetObjectName(p, mShader->mName + " Variant", VK_OBJECT_TYPE_PIPELINE);
+	return p;
 }
-ComputeShader* Shader::GetCompute(const string& kernel, const set<string>& keywords) const {
-	if (!mComputeVariants.count(kernel)) return nullptr;
-	auto& k = mComputeVariants.at(kernel);
 
+string Shader::VariantKeywords(const set<string>& keywords) const {
 	string kw = "";
 	for (const auto& k : keywords)
 		if (mKeywords.count(k))
 			kw += k + " ";
+	return kw;
+}
 
-	if (!k.count(kw)) return nullptr;
-	return k.at(kw);
+VkShaderModule Shader::GetModule(uint32_t index) {
+	if (mModules[index] == VK_NULL_HANDLE) {
+		const SpirvModule& spirv = mCompiled->mModules[index];
+		VkShaderModuleCreateInfo module = {};
+		module.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		module.codeSize = spirv.Size() * sizeof(uint32_t);
+		module.pCode = spirv.Data();
+		vkCreateShaderModule(*mDevice, &module, nullptr, &mModules[index]);
+		mDevice->SetObjectName(mModules[index], mName + " Module", VK_OBJECT_TYPE_SHADER_MODULE);
+	}
+	return mModules[index];
+}
+
+void Shader::CreateVariant(uint32_t index, ShaderVariant* variant) {
+	const CompiledVariant& compiled = mCompiled->mVariants[index];
+
+	variant->mDescriptorBindings = compiled.mDescriptorBindings;
+	variant->mPushConstants = compiled.mPushConstants;
+
+	// create DescriptorSetLayout bindings
+	// bindings[descriptorset][binding] = VkDescriptorSetLayoutBinding
+	vector<vector<VkDescriptorSetLayoutBinding>> bindings;
+	vector<vector<VkDescriptorBindingFlagsEXT>> bindingFlags;
+	for (auto& b : variant->mDescriptorBindings) {
+		if (bindings.size() <= b.second.first) bindings.resize((size_t)b.second.first + 1);
+		if (bindingFlags.size() <= b.second.first) bindingFlags.resize((size_t)b.second.first + 1);
+
+		// instance batches' slot indices are written to the frame's temp ring and bound with a dynamic offset
+		if (b.first == "InstanceIndices" && b.second.first == PER_OBJECT && b.second.second.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+			b.second.second.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+
+		bindings[b.second.first].push_back(b.second.second);
+		bindingFlags[b.second.first].push_back(b.second.second.descriptorCount > 1 ? VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT : 0);
+
+		// read static samplers
+		for (const auto& s : compiled.mStaticSamplers) {
+			if (b.first == s.first) {
+				Sampler* sampler = new Sampler(mName + " " + b.first, mDevice, s.second);
+				b.second.second.pImmutableSamplers = &sampler->VkSampler();
+				bindings[b.second.first].back().pImmutableSamplers = &sampler->VkSampler();
+				mStaticSamplers.push_back(sampler);
+			}
+		}
+	}
+
+	// create DescriptorSetLayouts
+	variant->mDescriptorSetLayouts.resize(bindings.size());
+	for (uint32_t b = 0; b < bindings.size(); b++) {			
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT extendedInfo = {};
+		extendedInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+		extendedInfo.bindingCount = (uint32_t)bindingFlags[b].size();
+		extendedInfo.pBindingFlags = bindingFlags[b].data();
+
+		VkDescriptorSetLayoutCreateInfo descriptorSetLayout = {};
+		descriptorSetLayout.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		descriptorSetLayout.pNext = &extendedInfo;
+		descriptorSetLayout.bindingCount = (uint32_t)bindings[b].size();
+		descriptorSetLayout.pBindings = bindings[b].data();
+		vkCreateDescriptorSetLayout(*mDevice, &descriptorSetLayout, nullptr, &variant->mDescriptorSetLayouts[b]);
+		mDevice->SetObjectName(variant->mDescriptorSetLayouts[b], mName + " DescriptorSetLayout", VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT);
+	}
+
+	// Create PipelineLayout
+	vector<VkPushConstantRange> constants;
+	unordered_map<VkShaderStageFlags, uint2> ranges;
+	for (const auto& b : variant->mPushConstants) {
+		if (ranges.count(b.second.stageFlags) == 0)
+			ranges[b.second.stageFlags] = uint2(b.second.offset, b.second.offset + b.second.size);
+		else {
+			ranges[b.second.stageFlags].x = min(ranges[b.second.stageFlags].x, b.second.offset);
+			ranges[b.second.stageFlags].y = max(ranges[b.second.stageFlags].y, b.second.offset + b.second.size);
+		}
+	}
+	for (auto r : ranges) {
+		constants.push_back({});
+		constants.back().stageFlags = r.first;
+		constants.back().offset = r.second.x;
+		constants.back().size = r.second.y - r.second.x;
+	}
+
+	VkPipelineLayoutCreateInfo layout = {};
+	layout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layout.setLayoutCount = (uint32_t)variant->mDescriptorSetLayouts.size();
+	layout.pSetLayouts = variant->mDescriptorSetLayouts.data();
+	layout.pushConstantRangeCount = (uint32_t)constants.size();
+	layout.pPushConstantRanges = constants.data();
+	vkCreatePipelineLayout(*mDevice, &layout, nullptr, &variant->mPipelineLayout);
+	mDevice->SetObjectName(variant->mPipelineLayout, mName + " PipelineLayout", VK_OBJECT_TYPE_PIPELINE_LAYOUT);
+}
+
+string Shader::SplitSpecializationKeywords(const string& keywords, vector<uint32_t>& constants) const {
+	const vector<string>& specialization = mCompiled->mSpecializationKeywords;
+	if (specialization.empty()) return keywords;
+
+	string compiled = "";
+	istringstream stream(keywords);
+	string kw;
+	while (stream >> kw) {
+		auto it = find(specialization.begin(), specialization.end(), kw);
+		if (it == specialization.end()) compiled += kw + " ";
+		else constants.push_back((uint32_t)(it - specialization.begin()));
+	}
+	return compiled;
+}
+
+void Shader::Specialize(ShaderVariant* variant, ShaderVariant* base, const vector<uint32_t>& constants) {
+	variant->mBaseVariant = base;
+	variant->mPipelineLayout = base->mPipelineLayout;
+	variant->mDescriptorSetLayouts = base->mDescriptorSetLayouts;
+	variant->mDescriptorBindings = base->mDescriptorBindings;
+	variant->mPushConstants = base->mPushConstants;
+
+	// the constants default to false, so only the enabled keywords need an entry
+	for (uint32_t i = 0; i < constants.size(); i++) {
+		VkSpecializationMapEntry entry = {};
+		entry.constantID = constants[i];
+		entry.offset = i * sizeof(VkBool32);
+		entry.size = sizeof(VkBool32);
+		variant->mSpecializationEntries.push_back(entry);
+		variant->mSpecializationData.push_back(VK_TRUE);
+	}
+	variant->mSpecializationInfo.mapEntryCount = (uint32_t)variant->mSpecializationEntries.size();
+	variant->mSpecializationInfo.pMapEntries = variant->mSpecializationEntries.data();
+	variant->mSpecializationInfo.dataSize = variant->mSpecializationData.size() * sizeof(VkBool32);
+	variant->mSpecializationInfo.pData = variant->mSpecializationData.data();
+}
+
+GraphicsShader* Shader::FindGraphics(PassType pass, const string& keywords) {
+	auto variants = mGraphicsVariants.find(pass);
+	if (variants != mGraphicsVariants.end() && variants->second.count(keywords))
+		return variants->second.at(keywords);
+
+	GraphicsShader* gv;
+
+	vector<uint32_t> constants;
+	string compiledKeywords = SplitSpecializationKeywords(keywords, constants);
+	if (constants.size()) {
+		// same modules and layouts as the compiled variant, the pipelines are created with different constants
+		GraphicsShader* base = FindGraphics(pass, compiledKeywords);
+		if (!base) return nullptr;
+
+		gv = new GraphicsShader();
+		gv->mShader = this;
+		gv->mPass = pass;
+		gv->mKeywords = keywords;
+		for (uint32_t i = 0; i < 2; i++) {
+			gv->mEntryPoints[i] = base->mEntryPoints[i];
+			gv->mStages[i] = base->mStages[i];
+			gv->mStages[i].pName = gv->mEntryPoints[i].c_str();
+			gv->mStages[i].pSpecializationInfo = &gv->mSpecializationInfo;
+		}
+		Specialize(gv, base, constants);
+
+	} else {
+		auto indices = mGraphicsVariantIndices.find(pass);
+		if (indices == mGraphicsVariantIndices.end() || !indices->second.count(keywords)) return nullptr;
+		uint32_t index = indices->second.at(keywords);
+		const CompiledVariant& compiled = mCompiled->mVariants[index];
+
+		gv = new GraphicsShader();
+		gv->mShader = this;
+		gv->mPass = compiled.mPass;
+		gv->mKeywords = keywords;
+		gv->mEntryPoints[0] = compiled.mEntryPoints[0];
+		gv->mEntryPoints[1] = compiled.mEntryPoints[1];
+
+		gv->mStages[0] = {};
+		gv->mStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		gv->mStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		gv->mStages[0].pName = gv->mEntryPoints[0].c_str();
+		gv->mStages[0].module = GetModule(compiled.mModules[0]);
+
+		gv->mStages[1] = {};
+		gv->mStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		gv->mStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		gv->mStages[1].pName = gv->mEntryPoints[1].c_str();
+		gv->mStages[1].module = GetModule(compiled.mModules[1]);
+
+		CreateVariant(index, gv);
+	}
+
+	mGraphicsVariants[pass][keywords] = gv;
+	return gv;
+}
+ComputeShader* Shader::FindCompute(const string& kernel, const string& keywords) {
+	auto variants = mComputeVariants.find(kernel);
+	if (variants != mComputeVariants.end() && variants->second.count(keywords))
+		return variants->second.at(keywords);
+
+	ComputeShader* cv;
+
+	vector<uint32_t> constants;
+	string compiledKeywords = SplitSpecializationKeywords(keywords, constants);
+	if (constants.size()) {
+		ComputeShader* base = FindCompute(kernel, compiledKeywords);
+		if (!base) return nullptr;
+
+		cv = new ComputeShader();
+		cv->mEntryPoint = base->mEntryPoint;
+		cv->mStage = base->mStage;
+		cv->mStage.pName = cv->mEntryPoint.c_str();
+		cv->mStage.pSpecializationInfo = &cv->mSpecializationInfo;
+		cv->mWorkgroupSize = base->mWorkgroupSize;
+		Specialize(cv, base, constants);
+
+	} else {
+		auto indices = mComputeVariantIndices.find(kernel);
+		if (indices == mComputeVariantIndices.end() || !indices->second.count(keywords)) return nullptr;
+		uint32_t index = indices->second.at(keywords);
+		const CompiledVariant& compiled = mCompiled->mVariants[index];
+
+		cv = new ComputeShader();
+		cv->mEntryPoint = compiled.mEntryPoints[0];
+
+		cv->mStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		cv->mStage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		cv->mStage.pName = cv->mEntryPoint.c_str();
+		cv->mStage.module = GetModule(compiled.mModules[0]);
+
+		cv->mWorkgroupSize = compiled.mWorkgroupSize;
+
+		CreateVariant(index, cv);
+	}
+
+	VkComputePipelineCreateInfo pipeline = {};
+	pipeline.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline.stage = cv->mStage;
+	pipeline.layout = cv->mPipelineLayout;
+	pipeline.basePipelineIndex = -1;
+	pipeline.basePipelineHandle = VK_NULL_HANDLE;
+	vkCreateComputePipelines(*mDevice, mDevice->PipelineCache(), 1, &pipeline, nullptr, &cv->mPipeline);
+	mDevice->SetObjectName(cv->mPipeline, mName, VK_OBJECT_TYPE_PIPELINE);
+
+	mComputeVariants[kernel][keywords] = cv;
+	return cv;
+}
+
+GraphicsShader* Shader::GetGraphics(PassType pass, const set<string>& keywords) {
+	string kw = VariantKeywords(keywords);
+	lock_guard lock(mVariantMutex);
+	return FindGraphics(pass, kw);
+}
+ComputeShader* Shader::GetCompute(const string& kernel, const set<string>& keywords) {
+	string kw = VariantKeywords(keywords);
+	lock_guard lock(mVariantMutex);
+	return FindCompute(kernel, kw);
 }
\ No newline at end of file
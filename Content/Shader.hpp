@@ -1,21 +1,26 @@
 #pragma once
 
+#include <future>
+
 #include <Content/Asset.hpp>
 #include <Core/Instance.hpp>
 #include <Core/Sampler.hpp>
 #include <Core/RenderPass.hpp>
 
+class MappedFile;
 class Shader;
+struct CompiledShader;
 
 struct PipelineInstance {
-	VkRenderPass mRenderPass;
+	// RenderPass::LayoutHash(), pipelines are shared between compatible render passes
+	uint64_t mRenderPass;
 	const VertexInput* mVertexInput;
 	VkPrimitiveTopology mTopology;
 	VkCullModeFlags mCullMode;
 	BlendMode mBlendMode;
 	VkPolygonMode mPolygonMode;
 
-	inline PipelineInstance(VkRenderPass renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode)
+	inline PipelineInstance(uint64_t renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode)
 		: mRenderPass(renderPass), mVertexInput(vertexInput), mTopology(topology), mCullMode(cullMode), mBlendMode(blendMode), mPolygonMode(polyMode) {};
 
 	ENGINE_EXPORT bool operator==(const PipelineInstance& rhs) const;
@@ -44,7 +49,14 @@ public:
 	std::unordered_map<std::string, std::pair<uint32_t, VkDescriptorSetLayoutBinding>> mDescriptorBindings; // descriptorset, binding
 	std::unordered_map<std::string, VkPushConstantRange> mPushConstants;
 
-	inline ShaderVariant() : mPipelineLayout(VK_NULL_HANDLE) {}
+	// the variant this one specializes, it owns the layouts. nullptr for compiled variants
+	ShaderVariant* mBaseVariant;
+	// the specialization keywords enabled in this variant, mSpecializationInfo is passed to every stage
+	std::vector<VkSpecializationMapEntry> mSpecializationEntries;
+	std::vector<VkBool32> mSpecializationData;
+	VkSpecializationInfo mSpecializationInfo;
+
+	inline ShaderVariant() : mPipelineLayout(VK_NULL_HANDLE), mBaseVariant(nullptr), mSpecializationInfo({}) {}
 	inline virtual ~ShaderVariant() {}
 };
 class ComputeShader : public ShaderVariant {
@@ -61,14 +73,36 @@ public:
 	std::string mEntryPoints[2];
 	VkPipelineShaderStageCreateInfo mStages[2];
 	std::unordered_map<PipelineInstance, VkPipeline> mPipelines;
+	// pipelines being created, by GetPipelineAsync on the thread pool or by GetPipeline on the thread that requested them
+	std::unordered_map<PipelineInstance, std::shared_future<VkPipeline>> mPendingPipelines;
+	// guards mPipelines and mPendingPipelines, pipelines can be requested while recording on multiple threads
+	std::mutex mPipelineMutex;
 	Shader* mShader;
+	PassType mPass;
+	// keywords of the variant in alphabetical order, separated by spaces
+	std::string mKeywords;
 
-	inline GraphicsShader() : ShaderVariant() { mShader = nullptr; mStages[0] = {}; mStages[1] = {}; }
+	inline GraphicsShader() : ShaderVariant() { mShader = nullptr; mPass = (PassType)0; mStages[0] = {}; mStages[1] = {}; }
+	/// Returns the pipeline, creating it on this thread first if it doesn't exist yet. GetPipelineAsync requests for it don't wait meanwhile
 	ENGINE_EXPORT VkPipeline GetPipeline(RenderPass* renderPass, const VertexInput* vertexInput,
 		VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
 		VkCullModeFlags cullMode = VK_CULL_MODE_FLAG_BITS_MAX_ENUM,
 		BlendMode blendMode = BLEND_MODE_MAX_ENUM,
 		VkPolygonMode polyMode = VK_POLYGON_MODE_MAX_ENUM);
+	/// Returns the pipeline if it exists, otherwise queues its creation on the thread pool's background threads and returns an
+	/// existing pipeline of this variant that only differs in cull mode, or VK_NULL_HANDLE if there is none, in which case the
+	/// draw should be skipped. Never waits on pipeline creation
+	ENGINE_EXPORT VkPipeline GetPipelineAsync(RenderPass* renderPass, const VertexInput* vertexInput,
+		VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+		VkCullModeFlags cullMode = VK_CULL_MODE_FLAG_BITS_MAX_ENUM,
+		BlendMode blendMode = BLEND_MODE_MAX_ENUM,
+		VkPolygonMode polyMode = VK_POLYGON_MODE_MAX_ENUM);
+
+private:
+	friend class Shader;
+	/// GetPipeline, replay = true for pipelines created from the manifest, which aren't counted as misses
+	ENGINE_EXPORT VkPipeline GetPipeline(RenderPass* renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode, bool replay);
+	ENGINE_EXPORT VkPipeline CreatePipeline(RenderPass* renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, BlendMode blendMode, VkPolygonMode polyMode);
 };
 
 class Shader : public Asset {
@@ -77,20 +111,58 @@ public:
 
 	ENGINE_EXPORT ~Shader() override;
 
-	/// Returns a shader variant for a specific pass and set of keywords, or nullptr if none exists
-	ENGINE_EXPORT GraphicsShader* GetGraphics(PassType pass, const std::set<std::string>& keywords) const;
-	/// Returns a shader variant for a specific kernel and set of keywords, or nullptr if none exists
-	ENGINE_EXPORT ComputeShader* GetCompute(const std::string& kernel, const std::set<std::string>& keywords) const;
+	/// Returns a shader variant for a specific pass and set of keywords, or nullptr if none exists.
+	/// Variants are created the first time they're requested
+	ENGINE_EXPORT GraphicsShader* GetGraphics(PassType pass, const std::set<std::string>& keywords);
+	/// Returns a shader variant for a specific kernel and set of keywords, or nullptr if none exists.
+	/// Variants are created the first time they're requested
+	ENGINE_EXPORT ComputeShader* GetCompute(const std::string& kernel, const std::set<std::string>& keywords);
 
 	inline ::Device* Device() const { return mDevice; }
 	inline PassType PassMask() const { return mPassMask; }
 	inline uint32_t RenderQueue() const { return mRenderQueue; }
+	inline ::BlendMode BlendMode() const { return mBlendMode; }
 
 private:
+	/// The arguments of a GraphicsShader::GetPipeline call, recorded so the pipeline can be created ahead of time on the next run
+	struct PipelineRecord {
+		PassType mPass;
+		std::string mKeywords;
+		RenderPassLayout mRenderPass;
+		bool mHasVertexInput;
+		VkVertexInputBindingDescription mBinding;
+		std::vector<VkVertexInputAttributeDescription> mAttributes;
+		VkPrimitiveTopology mTopology;
+		VkCullModeFlags mCullMode;
+		::BlendMode mBlendMode;
+		VkPolygonMode mPolygonMode;
+	};
+
 	friend class GraphicsShader;
 	friend class AssetManager;
 	ENGINE_EXPORT Shader(const std::string& name, ::Device* device, const std::string& filename);
 
+	/// Returns the keyword string of a variant, the keywords of the shader that are in keywords in alphabetical order
+	ENGINE_EXPORT std::string VariantKeywords(const std::set<std::string>& keywords) const;
+	/// mVariantMutex must be held for these
+	ENGINE_EXPORT GraphicsShader* FindGraphics(PassType pass, const std::string& keywords);
+	ENGINE_EXPORT ComputeShader* FindCompute(const std::string& kernel, const std::string& keywords);
+	/// Fills in the bindings, push constants, descriptor set layouts and pipeline layout of a variant from mCompiled
+	ENGINE_EXPORT void CreateVariant(uint32_t index, ShaderVariant* variant);
+	/// Removes the specialization keywords from a keyword string, and returns the constant ids of the ones it contained
+	ENGINE_EXPORT std::string SplitSpecializationKeywords(const std::string& keywords, std::vector<uint32_t>& constants) const;
+	/// Shares the layouts of base with variant, and enables the specialization constants in variant
+	ENGINE_EXPORT void Specialize(ShaderVariant* variant, ShaderVariant* base, const std::vector<uint32_t>& constants);
+	ENGINE_EXPORT VkShaderModule GetModule(uint32_t index);
+
+	ENGINE_EXPORT std::string PipelineManifestPath() const;
+	/// Creates every pipeline in the manifest written by the last run, so they aren't created mid-frame
+	ENGINE_EXPORT void CreateManifestPipelines();
+	ENGINE_EXPORT void WritePipelineManifest();
+	ENGINE_EXPORT void RecordPipeline(GraphicsShader* variant, RenderPass* renderPass, const VertexInput* vertexInput, VkPrimitiveTopology topology, VkCullModeFlags cullMode, ::BlendMode blendMode, VkPolygonMode polyMode);
+	/// Returns the shader's copy of a vertex input, pipeline keys reference it since the caller's may not outlive the shader
+	ENGINE_EXPORT const VertexInput* StoredVertexInput(const VertexInput* vertexInput);
+
 	::Device* mDevice;
 
 	friend class GraphicsShader;
@@ -99,14 +171,33 @@ private:
 	PassType mPassMask;
 	VkColorComponentFlags mColorMask;
 	uint32_t mRenderQueue;
-	BlendMode mBlendMode;
+	::BlendMode mBlendMode;
 	VkPipelineViewportStateCreateInfo mViewportState;
 	VkPipelineRasterizationStateCreateInfo mRasterizationState;
 	VkPipelineDepthStencilStateCreateInfo mDepthStencilState;
 	VkPipelineDynamicStateCreateInfo mDynamicState;
 	std::vector<VkDynamicState> mDynamicStates;
 
+	// the .stm file stays mapped, the SPIR-V in mCompiled points into it
+	MappedFile* mFile;
+	CompiledShader* mCompiled;
+	// indices into mCompiled->mVariants, by kernel or pass then keywords
+	std::unordered_map<std::string, std::unordered_map<std::string, uint32_t>> mComputeVariantIndices;
+	std::unordered_map<PassType, std::unordered_map<std::string, uint32_t>> mGraphicsVariantIndices;
+
+	// guards the variants and modules, which are created on first use
+	std::mutex mVariantMutex;
 	std::unordered_map<std::string, std::unordered_map<std::string, ComputeShader*>> mComputeVariants;
 	std::unordered_map<PassType, std::unordered_map<std::string, GraphicsShader*>> mGraphicsVariants;
+	// one per module in mCompiled, VK_NULL_HANDLE until a variant uses it
+	std::vector<VkShaderModule> mModules;
 	std::vector<Sampler*> mStaticSamplers;
+
+	std::mutex mManifestMutex;
+	std::vector<PipelineRecord> mManifest;
+	// set when a pipeline that isn't in the manifest on disk is created
+	bool mManifestDirty;
+	// copies of the vertex inputs pipelines were created with, referenced by the keys in the variants' mPipelines
+	std::mutex mVertexInputMutex;
+	std::vector<VertexInput*> mVertexInputs;
 };
\ No newline at end of file
@@ -1,38 +1,30 @@
 #include <cmath>
 
 #include <Content/Texture.hpp>
+#include <Content/Ktx2.hpp>
 
 #include <Core/Buffer.hpp>
 #include <Core/CommandBuffer.hpp>
+#include <Util/MappedFile.hpp>
 #include <Util/Util.hpp>
 #include <ThirdParty/stb_image.h>
 
 using namespace std;
 
-uint8_t* load(const string& filename, bool srgb, uint32_t& pixelSize, int32_t& x, int32_t& y, int32_t& channels, VkFormat& format) {
-	uint8_t* pixels = nullptr;
-	pixelSize = 0;
-	x, y, channels;
-	stbi_info(filename.c_str(), &x, &y, &channels);
+// reads the dimensions and format of an image from its header, without decoding it
+bool probe(const string& filename, bool srgb, uint32_t& pixelSize, int32_t& x, int32_t& y, int32_t& channels, VkFormat& format) {
+	if (!stbi_info(filename.c_str(), &x, &y, &channels)) return false;
 
-	int desiredChannels = 4;
 	if (stbi_is_16_bit(filename.c_str())) {
-		pixels = (uint8_t*)stbi_load_16(filename.c_str(), &x, &y, &channels, desiredChannels);
 		pixelSize = sizeof(uint16_t);
 		srgb = false;
 	} else if (stbi_is_hdr(filename.c_str())) {
-		pixels = (uint8_t*)stbi_loadf(filename.c_str(), &x, &y, &channels, desiredChannels);
 		pixelSize = sizeof(float);
 		srgb = false;
-	} else {
-		pixels = (uint8_t*)stbi_load(filename.c_str(), &x, &y, &channels, desiredChannels);
+	} else
 		pixelSize = sizeof(uint8_t);
-	}
-	if (!pixels) {
-		fprintf_color(COLOR_RED_BOLD, stderr, "Failed to load image: %s\n", filename.c_str());
-		throw;
-	}
-	if (desiredChannels > 0) channels = desiredChannels;
+	// images are always expanded to 4 channels
+	channels = 4;
 
 	if (srgb) {
 		const VkFormat formatMap[4] {
@@ -48,11 +40,94 @@ uint8_t* load(const string& filename, bool srgb, uint32_t& pixelSize, int32_t& x
 		};
 		format = formatMap[pixelSize - 1][channels - 1];
 	}
-
+	return true;
+}
+// decodes an image into 4 channels of pixelSize bytes each, as probed. Returns nullptr on failure
+uint8_t* decode(const string& filename, uint32_t pixelSize) {
+	int32_t x, y, channels;
+	switch (pixelSize) {
+	case sizeof(uint16_t):
+		return (uint8_t*)stbi_load_16(filename.c_str(), &x, &y, &channels, 4);
+	case sizeof(float):
+		return (uint8_t*)stbi_loadf(filename.c_str(), &x, &y, &channels, 4);
+	default:
+		return (uint8_t*)stbi_load(filename.c_str(), &x, &y, &channels, 4);
+	}
+}
+uint8_t* load(const string& filename, bool srgb, uint32_t& pixelSize, int32_t& x, int32_t& y, int32_t& channels, VkFormat& format) {
+	uint8_t* pixels = probe(filename, srgb, pixelSize, x, y, channels, format) ? decode(filename, pixelSize) : nullptr;
+	if (!pixels) {
+		fprintf_color(COLOR_RED_BOLD, stderr, "Failed to load image: %s\n", filename.c_str());
+		throw;
+	}
 	return pixels;
 }
 
-Texture::Texture(const string& name, Device* device, const string& filename, bool srgb) : mName(name), mDevice(device) {
+inline bool IsKtx2(const string& filename) {
+	return fs::path(filename).extension() == ".ktx2";
+}
+// one copy per mip level of a KTX2 file that was copied to offset in a buffer. The faces of a cube map are consecutive within each level
+vector<VkBufferImageCopy> Ktx2CopyRegions(const Ktx2Header* header, VkDeviceSize offset) {
+	const Ktx2Level* levels = (const Ktx2Level*)(header + 1);
+	vector<VkBufferImageCopy> regions(max(header->mLevelCount, 1u));
+	for (uint32_t i = 0; i < regions.size(); i++) {
+		regions[i] = {};
+		regions[i].bufferOffset = offset + levels[i].mByteOffset;
+		regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		regions[i].imageSubresource.mipLevel = i;
+		regions[i].imageSubresource.baseArrayLayer = 0;
+		regions[i].imageSubresource.layerCount = header->mFaceCount;
+		regions[i].imageOffset = { 0, 0, 0 };
+		regions[i].imageExtent = { max(header->mPixelWidth >> i, 1u), max(header->mPixelHeight >> i, 1u), 1 };
+	}
+	return regions;
+}
+
+// barrier that hands ownership of every subresource of a texture between queue families, recorded once on each queue
+VkImageMemoryBarrier OwnershipBarrier(VkImage image, uint32_t mipLevels, uint32_t arrayLayers, uint32_t srcQueueFamily, uint32_t dstQueueFamily, VkAccessFlags srcAccess, VkAccessFlags dstAccess) {
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = srcQueueFamily;
+	barrier.dstQueueFamilyIndex = dstQueueFamily;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = dstAccess;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = arrayLayers;
+	return barrier;
+}
+
+Texture::Texture(const string& name, Device* device, const string& filename, bool srgb) : mName(name), mDevice(device), mPlaceholder(nullptr), mMipsLoaded(false), mViewGeneration(0) {
+	if (IsKtx2(filename)) {
+		MappedFile file(filename);
+		const Ktx2Header* header = file.IsOpen() ? ReadKtx2Header(file.Data(), file.Size()) : nullptr;
+		if (!header) {
+			fprintf_color(COLOR_RED_BOLD, stderr, "Failed to load image: %s\n", filename.c_str());
+			throw;
+		}
+		ReadKtx2(header, srgb);
+		CreateImage();
+		CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
+
+		// the levels are copied straight out of the file's data
+		Buffer uploadBuffer(name + " Copy", mDevice, file.Data(), file.Size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		vector<VkBufferImageCopy> regions = Ktx2CopyRegions(header, 0);
+
+		auto commandBuffer = mDevice->GetCommandBuffer();
+		TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer.get());
+		vkCmdCopyBufferToImage(*commandBuffer, uploadBuffer, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+		TransitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, commandBuffer.get());
+		mDevice->Execute(commandBuffer, false)->Wait();
+
+		printf("Loaded %s: %dx%d %s, %d mips\n", filename.c_str(), mWidth, mHeight, FormatToString(mFormat), mMipLevels);
+		return;
+	}
+
 	int32_t x, y, channels;
 	uint32_t size;
 	uint8_t* pixels = load(filename, srgb, size, x, y, channels, mFormat);
@@ -95,8 +170,43 @@ Texture::Texture(const string& name, Device* device, const string& filename, boo
 
 	printf("Loaded %s: %dx%d %s\n", filename.c_str(), mWidth, mHeight, FormatToString(mFormat));
 }
+Texture::Texture(const string& name, Device* device, const string& filename, bool srgb, Texture* placeholder)
+	: mName(name), mDevice(device), mPlaceholder(placeholder), mMipsLoaded(false), mViewGeneration(0) {
+	if (IsKtx2(filename)) {
+		MappedFile file(filename);
+		const Ktx2Header* header = file.IsOpen() ? ReadKtx2Header(file.Data(), file.Size()) : nullptr;
+		if (!header) {
+			fprintf_color(COLOR_RED_BOLD, stderr, "Failed to load image: %s\n", filename.c_str());
+			throw;
+		}
+		ReadKtx2(header, srgb);
+		CreateImage();
+		CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
+		return;
+	}
+
+	int32_t x, y, channels;
+	uint32_t size;
+	if (!probe(filename, srgb, size, x, y, channels, mFormat)) {
+		fprintf_color(COLOR_RED_BOLD, stderr, "Failed to load image: %s\n", filename.c_str());
+		throw;
+	}
+
+	mWidth = x;
+	mHeight = y;
+	mDepth = 1;
+	mArrayLayers = 1;
+	mMipLevels = (uint32_t)std::floor(std::log2(std::max(mWidth, mHeight))) + 1;
+	mSampleCount = VK_SAMPLE_COUNT_1_BIT;
+	mTiling = VK_IMAGE_TILING_OPTIMAL;
+	mUsage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	mMemoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+	CreateImage();
+	CreateImageView(VK_IMAGE_ASPECT_COLOR_BIT);
+}
 Texture::Texture(const string& name, Device* device, const string& px, const string& nx, const string& py, const string& ny, const string& pz, const string& nz, bool srgb)
-	: mName(name), mDevice(device) {
+	: mName(name), mDevice(device), mPlaceholder(nullptr), mMipsLoaded(false), mViewGeneration(0) {
 	int32_t x, y, channels;
 	uint32_t size;
 	
@@ -155,7 +265,7 @@ Texture::Texture(const string& name, Device* device, const string& px, const str
 }
 
 Texture::Texture(const string& name, Device* device, void* pixels, VkDeviceSize imageSize, uint32_t width, uint32_t height, uint32_t depth, VkFormat format, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties)
-	: mName(name), mDevice(device), mWidth(width), mHeight(height), mDepth(depth), mArrayLayers(1), mMipLevels(mipLevels), mFormat(format), mSampleCount(numSamples), mTiling(tiling), mUsage(usage), mMemoryProperties(properties) {
+	: mName(name), mDevice(device), mPlaceholder(nullptr), mMipsLoaded(false), mViewGeneration(0), mWidth(width), mHeight(height), mDepth(depth), mArrayLayers(1), mMipLevels(mipLevels), mFormat(format), mSampleCount(numSamples), mTiling(tiling), mUsage(usage), mMemoryProperties(properties) {
 	
 	if (mipLevels == 0) mMipLevels = (uint32_t)std::floor(std::log2(std::max(mWidth, mHeight))) + 1;
 	if (mMipLevels > 1) mUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
@@ -193,8 +303,8 @@ Texture::Texture(const string& name, Device* device, void* pixels, VkDeviceSize
 	}
 }
 
-Texture::Texture(const string& name, Device* device, uint32_t width, uint32_t height, uint32_t depth, VkFormat format, VkSampleCountFlagBits numSamples, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties)
-	: mName(name), mDevice(device), mWidth(width), mHeight(height), mDepth(depth), mArrayLayers(1), mMipLevels(1), mFormat(format), mSampleCount(numSamples), mTiling(tiling), mUsage(usage), mMemoryProperties(properties) {
+Texture::Texture(const string& name, Device* device, uint32_t width, uint32_t height, uint32_t depth, VkFormat format, VkSampleCountFlagBits numSamples, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, uint32_t arrayLayers)
+	: mName(name), mDevice(device), mPlaceholder(nullptr), mMipsLoaded(false), mViewGeneration(0), mWidth(width), mHeight(height), mDepth(depth), mArrayLayers(arrayLayers), mMipLevels(1), mFormat(format), mSampleCount(numSamples), mTiling(tiling), mUsage(usage), mMemoryProperties(properties) {
 
 	CreateImage();
 
@@ -219,12 +329,98 @@ Texture::Texture(const string& name, Device* device, uint32_t width, uint32_t he
 Texture::~Texture() {
 	vkDestroyImage(*mDevice, mImage, nullptr);
 	vkDestroyImageView(*mDevice, mView, nullptr);
-	vkFreeMemory(*mDevice, mImageMemory, nullptr);
+	mDevice->MemoryAllocator()->Free(mImageMemory);
 	#ifdef PRINT_VK_ALLOCATIONS
-	fprintf_color(COLOR_BLUE, stdout, "Freed %.1fkb for %s\n", mAllocationInfo.allocationSize / 1024.f, mName.c_str());
+	fprintf_color(COLOR_BLUE, stdout, "Freed %.1fkb for %s\n", mImageMemory.mSize / 1024.f, mName.c_str());
 	#endif
 }
 
+void Texture::ReadKtx2(const Ktx2Header* header, bool srgb) {
+	mWidth = header->mPixelWidth;
+	mHeight = header->mPixelHeight;
+	mDepth = 1;
+	mArrayLayers = header->mFaceCount;
+	mMipLevels = max(header->mLevelCount, 1u);
+	mMipsLoaded = true;
+	// the blocks were encoded for one transfer function, so the file's format is used as-is
+	mFormat = header->mFormat;
+	if (!Ktx2MatchesEncoding(mFormat, srgb))
+		fprintf_color(COLOR_YELLOW, stderr, "%s: Texture was converted %s, but was loaded %s\n", mName.c_str(), srgb ? "linear" : "as sRGB", srgb ? "as sRGB" : "linear");
+	mSampleCount = VK_SAMPLE_COUNT_1_BIT;
+	mTiling = VK_IMAGE_TILING_OPTIMAL;
+	mUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	mMemoryProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+}
+
+uint64_t Texture::UploadAsync(const string& filename) {
+	uint32_t transferFamily = mDevice->TransferQueueFamily();
+	uint32_t graphicsFamily = mDevice->GraphicsQueueFamily();
+
+	if (IsKtx2(filename)) {
+		MappedFile file(filename);
+		const Ktx2Header* header = file.IsOpen() ? ReadKtx2Header(file.Data(), file.Size()) : nullptr;
+		if (!header) {
+			fprintf_color(COLOR_RED_BOLD, stderr, "Failed to load image: %s\n", filename.c_str());
+			return 0;
+		}
+		return mDevice->UploadQueue()->Upload(file.Data(), file.Size(), [&](CommandBuffer* commandBuffer, Buffer* staging, VkDeviceSize offset) {
+			vector<VkBufferImageCopy> regions = Ktx2CopyRegions(header, offset);
+			TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer);
+			vkCmdCopyBufferToImage(*commandBuffer, *staging, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+			if (transferFamily != graphicsFamily) {
+				VkImageMemoryBarrier barrier = OwnershipBarrier(mImage, mMipLevels, mArrayLayers, transferFamily, graphicsFamily, VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+				vkCmdPipelineBarrier(*commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			}
+		}, mName + " Upload");
+	}
+
+	// bytes per channel, from the formats probe() picks
+	uint32_t pixelSize = mFormat == VK_FORMAT_R32G32B32A32_SFLOAT ? sizeof(float) : (mFormat == VK_FORMAT_R16G16B16A16_UNORM ? sizeof(uint16_t) : sizeof(uint8_t));
+	uint8_t* pixels = decode(filename, pixelSize);
+	if (!pixels) {
+		fprintf_color(COLOR_RED_BOLD, stderr, "Failed to load image: %s\n", filename.c_str());
+		return 0;
+	}
+
+	uint64_t ticket = mDevice->UploadQueue()->Upload(pixels, mWidth * mHeight * pixelSize * 4, [&](CommandBuffer* commandBuffer, Buffer* staging, VkDeviceSize offset) {
+		VkBufferImageCopy copyRegion = {};
+		copyRegion.bufferOffset = offset;
+		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		copyRegion.imageSubresource.mipLevel = 0;
+		copyRegion.imageSubresource.baseArrayLayer = 0;
+		copyRegion.imageSubresource.layerCount = 1;
+		copyRegion.imageOffset = { 0, 0, 0 };
+		copyRegion.imageExtent = { mWidth, mHeight, 1 };
+
+		TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer);
+		vkCmdCopyBufferToImage(*commandBuffer, *staging, mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+		if (transferFamily != graphicsFamily) {
+			// release the image to the graphics queue, which generates the mip chain
+			VkImageMemoryBarrier barrier = OwnershipBarrier(mImage, mMipLevels, mArrayLayers, transferFamily, graphicsFamily, VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+			vkCmdPipelineBarrier(*commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+	}, mName + " Upload");
+
+	stbi_image_free(pixels);
+	return ticket;
+}
+void Texture::FinishUpload(CommandBuffer* commandBuffer) {
+	uint32_t transferFamily = mDevice->TransferQueueFamily();
+	uint32_t graphicsFamily = mDevice->GraphicsQueueFamily();
+	if (transferFamily != graphicsFamily) {
+		VkImageMemoryBarrier barrier = OwnershipBarrier(mImage, mMipLevels, mArrayLayers, transferFamily, graphicsFamily, 0, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+		vkCmdPipelineBarrier(*commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+	if (mMipsLoaded)
+		TransitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, commandBuffer);
+	else
+		GenerateMipMaps(commandBuffer);
+
+	mPlaceholder = nullptr;
+	mViewGeneration++;
+}
+
 void Texture::GenerateMipMaps(CommandBuffer* commandBuffer) {
 	VkImageMemoryBarrier barrier = {};
 	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -324,22 +520,17 @@ void Texture::CreateImage() {
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(*mDevice, mImage, &memRequirements);
 
-	mAllocationInfo = {};
-	mAllocationInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	mAllocationInfo.allocationSize = memRequirements.size;
-	mAllocationInfo.memoryTypeIndex = mDevice->FindMemoryType(memRequirements.memoryTypeBits, mMemoryProperties);
-	ThrowIfFailed(vkAllocateMemory(*mDevice, &mAllocationInfo, nullptr, &mImageMemory), "vkAllocateMemory failed for " + mName);
+	mImageMemory = mDevice->MemoryAllocator()->Allocate(memRequirements, mMemoryProperties, mTiling == VK_IMAGE_TILING_LINEAR, mName);
 	#ifdef PRINT_VK_ALLOCATIONS
-	fprintf_color(COLOR_YELLOW, stdout, "Allocated %.1fkb for %s\n", mAllocationInfo.allocationSize / 1024.f, mName.c_str());
+	fprintf_color(COLOR_YELLOW, stdout, "Allocated %.1fkb for %s\n", mImageMemory.mSize / 1024.f, mName.c_str());
 	#endif
-	
-	mDevice->SetObjectName(mImageMemory, mName + " Memory", VK_OBJECT_TYPE_DEVICE_MEMORY);
-	vkBindImageMemory(*mDevice, mImage, mImageMemory, 0);
+
+	vkBindImageMemory(*mDevice, mImage, mImageMemory.mDeviceMemory, mImageMemory.mOffset);
 }
 void Texture::CreateImageView(VkImageAspectFlags aspectFlags) {
 	VkImageViewCreateInfo viewInfo = {};
 	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	viewInfo.viewType = mArrayLayers == 6 ? VK_IMAGE_VIEW_TYPE_CUBE : (mDepth > 1 ? VK_IMAGE_VIEW_TYPE_3D :VK_IMAGE_VIEW_TYPE_2D);
+	viewInfo.viewType = mArrayLayers == 6 ? VK_IMAGE_VIEW_TYPE_CUBE : mArrayLayers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : (mDepth > 1 ? VK_IMAGE_VIEW_TYPE_3D :VK_IMAGE_VIEW_TYPE_2D);
 	viewInfo.format = mFormat;
 	viewInfo.subresourceRange.aspectMask = aspectFlags;
 	viewInfo.subresourceRange.baseMipLevel = 0;
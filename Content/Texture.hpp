@@ -5,14 +5,17 @@
 #include <Core/Sampler.hpp>
 #include <Util/Util.hpp>
 
+struct Ktx2Header;
+
 class Texture : public Asset {
 public:
 	const std::string mName;
 
+	/// arrayLayers > 1 creates a 2D array image, with a view of every layer
 	ENGINE_EXPORT Texture(const std::string& name, Device* device,
 		uint32_t width, uint32_t height, uint32_t depth, VkFormat format,
 		VkSampleCountFlagBits numSamples = VK_SAMPLE_COUNT_1_BIT, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL,
-		VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT, VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT, VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, uint32_t arrayLayers = 1);
 		
 	ENGINE_EXPORT Texture(const std::string& name, Device* device,
 		void* pixels, VkDeviceSize imageSize, uint32_t width, uint32_t height, uint32_t depth, VkFormat format, uint32_t mipLevels,
@@ -24,12 +27,21 @@ public:
 	inline uint32_t Height() const { return mHeight; }
 	inline uint32_t Depth() const { return mDepth; }
 	inline uint32_t MipLevels() const { return mMipLevels; }
+	inline uint32_t ArrayLayers() const { return mArrayLayers; }
 	inline VkFormat Format() const { return mFormat; }
 	inline VkSampleCountFlagBits SampleCount() const { return mSampleCount; }
 	inline VkImageUsageFlags Usage() const { return mUsage; }
+	inline uint64_t DeviceMemorySize() const override { return mImageMemory.mSize; }
 
 	inline VkImage Image() const { return mImage; }
-	inline VkImageView View() const { return mView; }
+	/// While an asynchronously loaded texture is still uploading, this is the view of its placeholder
+	inline VkImageView View() const { return mPlaceholder ? mPlaceholder->View() : mView; }
+	/// False until an asynchronously loaded texture's image has been uploaded
+	inline bool Ready() const { return mPlaceholder == nullptr; }
+
+	/// Incremented when this texture's asynchronous load finishes, and so changes what View() returns.
+	/// Anything that caches descriptors of the texture can compare this to know when to rewrite them
+	inline uint32_t ViewGeneration() const { return mViewGeneration; }
 
 	ENGINE_EXPORT static void TransitionImageLayout(VkImage image, VkFormat format, uint32_t mipLevels, VkImageLayout oldLayout, VkImageLayout newLayout, CommandBuffer* commandBuffer);
 	ENGINE_EXPORT void TransitionImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout, CommandBuffer* commandBuffer);
@@ -41,10 +53,27 @@ public:
 
 private:
 	friend class AssetManager;
+	/// Loads an image with stb_image and generates its mip chain, or a .ktx2 file of BCn blocks with its mip chain as-is
 	ENGINE_EXPORT Texture(const std::string& name, Device* device, const std::string& filename, bool srgb = true);
+	/// Only reads the image's header and creates the image, which samples placeholder until UploadAsync and FinishUpload are done
+	ENGINE_EXPORT Texture(const std::string& name, Device* device, const std::string& filename, bool srgb, Texture* placeholder);
 	ENGINE_EXPORT Texture(const std::string& name, Device* device, const std::string& px, const std::string& nx, const std::string& py, const std::string& ny, const std::string& pz, const std::string& nz, bool srgb = true);
 
+	/// Decodes the image and uploads it on the device's UploadQueue. Returns the upload's ticket, or 0 if the image failed to decode
+	ENGINE_EXPORT uint64_t UploadAsync(const std::string& filename);
+	/// Records the mip chain generation, if the file didn't have one, once the upload has finished, after which the texture is ready.
+	/// commandBuffer must be a graphics command buffer, submitted before anything samples the texture
+	ENGINE_EXPORT void FinishUpload(CommandBuffer* commandBuffer);
+
+	/// Sets the size, format and mip levels of the image from a KTX2 header
+	ENGINE_EXPORT void ReadKtx2(const Ktx2Header* header, bool srgb);
+
 	Device* mDevice;
+	// sampled in place of this texture until it's uploaded, or nullptr
+	Texture* mPlaceholder;
+	// every mip level was loaded from the file, so they aren't generated
+	bool mMipsLoaded;
+	uint32_t mViewGeneration;
 	
 	uint32_t mWidth;
 	uint32_t mHeight;
@@ -58,11 +87,9 @@ private:
 	VkImageUsageFlags mUsage;
 	VkMemoryPropertyFlags mMemoryProperties;
 
-	VkMemoryAllocateInfo mAllocationInfo;
-
 	VkImage mImage;
 	VkImageView mView;
-	VkDeviceMemory mImageMemory;
+	MemoryAllocation mImageMemory;
 
 
 	ENGINE_EXPORT void CreateImage();
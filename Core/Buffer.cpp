@@ -6,38 +6,31 @@
 using namespace std;
 
 Buffer::Buffer(const std::string& name, Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryFlags)
-	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryFlags(memoryFlags), mMappedData(nullptr), mBuffer(VK_NULL_HANDLE), mMemory(VK_NULL_HANDLE) {
+	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryFlags(memoryFlags), mMappedData(nullptr), mBuffer(VK_NULL_HANDLE) {
 	Allocate();
 }
 Buffer::Buffer(const std::string& name, Device* device, const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryFlags)
-	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryFlags(memoryFlags), mMappedData(nullptr), mBuffer(VK_NULL_HANDLE), mMemory(VK_NULL_HANDLE) {
+	: mName(name), mDevice(device), mSize(size), mUsageFlags(usage), mMemoryFlags(memoryFlags), mMappedData(nullptr), mBuffer(VK_NULL_HANDLE) {
 	if ((memoryFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0)
 		mUsageFlags |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 	Allocate();
 	Upload(data, size);
 }
 Buffer::Buffer(const Buffer& src)
-	: mName(src.mName), mDevice(src.mDevice), mSize(0), mUsageFlags(src.mUsageFlags | VK_BUFFER_USAGE_TRANSFER_DST_BIT), mMemoryFlags(src.mMemoryFlags), mMappedData(nullptr), mBuffer(VK_NULL_HANDLE), mMemory(VK_NULL_HANDLE) {
+	: mName(src.mName), mDevice(src.mDevice), mSize(0), mUsageFlags(src.mUsageFlags | VK_BUFFER_USAGE_TRANSFER_DST_BIT), mMemoryFlags(src.mMemoryFlags), mMappedData(nullptr), mBuffer(VK_NULL_HANDLE) {
 	CopyFrom(src);
 }
 Buffer::~Buffer() {
 	if (mMappedData) Unmap();
-	if (mBuffer != VK_NULL_HANDLE) vkDestroyBuffer(*mDevice, mBuffer, nullptr);
-	if (mMemory != VK_NULL_HANDLE) {
-		vkFreeMemory(*mDevice, mMemory, nullptr);
-		#ifdef PRINT_VK_ALLOCATIONS
-		fprintf_color(COLOR_BLUE, stdout, "Freed %.1fkb for %s\n", mAllocationInfo.allocationSize / 1024.f, mName.c_str());
-		#endif
-	}
+	Free();
 }
 
 void* Buffer::Map() {
-	if (mMappedData) return mMappedData;
-	vkMapMemory(*mDevice, mMemory, 0, mSize, 0, &mMappedData);
+	// host visible blocks stay mapped for their whole lifetime
+	mMappedData = mMemory.mMapped;
 	return mMappedData;
 }
 void Buffer::Unmap() {
-	vkUnmapMemory(*mDevice, mMemory);
 	mMappedData = nullptr;
 }
 void Buffer::Upload(const void* data, VkDeviceSize size) {
@@ -54,13 +47,7 @@ void Buffer::Upload(const void* data, VkDeviceSize size) {
 		if ((mUsageFlags & VK_BUFFER_USAGE_TRANSFER_DST_BIT) == 0) {
 			mUsageFlags |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 			
-			if (mBuffer) vkDestroyBuffer(*mDevice, mBuffer, nullptr);
-			if (mMemory) {
-				vkFreeMemory(*mDevice, mMemory, nullptr);
-				#ifdef PRINT_VK_ALLOCATIONS
-				fprintf_color(COLOR_BLUE, stdout, "Freed %.1fkb for %s\n", mAllocationInfo.allocationSize / 1024.f, mName.c_str());
-				#endif
-			}
+			Free();
 			mSize = size;
 			Allocate();
 		}
@@ -74,13 +61,7 @@ void Buffer::Upload(const void* data, VkDeviceSize size) {
 void Buffer::CopyFrom(const Buffer& other) {
 	if (mMappedData) Unmap();
 	if (mSize != other.mSize) {
-		if (mBuffer) vkDestroyBuffer(*mDevice, mBuffer, nullptr);
-		if (mMemory) {
-			vkFreeMemory(*mDevice, mMemory, nullptr);
-			#ifdef PRINT_VK_ALLOCATIONS
-			fprintf_color(COLOR_BLUE, stdout, "Freed %.1fkb for %s\n", mAllocationInfo.allocationSize / 1024.f, mName.c_str());
-			#endif
-		}
+		Free();
 		mSize = other.mSize;
 		Allocate();
 	}
@@ -119,15 +100,21 @@ void Buffer::Allocate(){
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(*mDevice, mBuffer, &memRequirements);
 
-	mAllocationInfo = {};
-	mAllocationInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	mAllocationInfo.allocationSize = memRequirements.size;
-	mAllocationInfo.memoryTypeIndex = mDevice->FindMemoryType(memRequirements.memoryTypeBits, mMemoryFlags);
-	ThrowIfFailed(vkAllocateMemory(*mDevice, &mAllocationInfo, nullptr, &mMemory), "vkAllocateMemory failed for " + mName);
+	mMemory = mDevice->MemoryAllocator()->Allocate(memRequirements, mMemoryFlags, true, mName);
 	#ifdef PRINT_VK_ALLOCATIONS
-	fprintf_color(COLOR_YELLOW, stdout, "Allocated %.1fkb for %s\n", mAllocationInfo.allocationSize / 1024.f, mName.c_str());
+	fprintf_color(COLOR_YELLOW, stdout, "Allocated %.1fkb for %s\n", mMemory.mSize / 1024.f, mName.c_str());
 	#endif
 
-	vkBindBufferMemory(*mDevice, mBuffer, mMemory, 0);
-	mDevice->SetObjectName(mMemory, mName + " Memory", VK_OBJECT_TYPE_DEVICE_MEMORY);
+	vkBindBufferMemory(*mDevice, mBuffer, mMemory.mDeviceMemory, mMemory.mOffset);
+}
+void Buffer::Free() {
+	if (mBuffer != VK_NULL_HANDLE) vkDestroyBuffer(*mDevice, mBuffer, nullptr);
+	mBuffer = VK_NULL_HANDLE;
+	if (mMemory.mDeviceMemory != VK_NULL_HANDLE) {
+		mDevice->MemoryAllocator()->Free(mMemory);
+		#ifdef PRINT_VK_ALLOCATIONS
+		fprintf_color(COLOR_BLUE, stdout, "Freed %.1fkb for %s\n", mMemory.mSize / 1024.f, mName.c_str());
+		#endif
+	}
+	mMemory = MemoryAllocation();
 }
\ No newline at end of file
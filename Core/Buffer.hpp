@@ -19,7 +19,8 @@ public:
 
 	inline void* MappedData() const { return mMappedData; }
 
-	inline VkDeviceMemory Memory() const { return mMemory; }
+	inline VkDeviceMemory Memory() const { return mMemory.mDeviceMemory; }
+	inline VkDeviceSize MemoryOffset() const { return mMemory.mOffset; }
 	inline VkDeviceSize Size() const { return mSize; }
 	inline VkBufferUsageFlags Usage() const { return mUsageFlags; }
 	inline VkMemoryPropertyFlags MemoryProperties() const { return mMemoryFlags; }
@@ -32,7 +33,7 @@ public:
 private:
 	Device* mDevice;
 	VkBuffer mBuffer;
-	VkDeviceMemory mMemory;
+	MemoryAllocation mMemory;
 
 	void* mMappedData;
 	VkDeviceSize mSize;
@@ -40,7 +41,6 @@ private:
 	VkBufferUsageFlags mUsageFlags;
 	VkMemoryPropertyFlags mMemoryFlags;
 
-	VkMemoryAllocateInfo mAllocationInfo;
-
 	ENGINE_EXPORT void Allocate();
+	ENGINE_EXPORT void Free();
 };
\ No newline at end of file
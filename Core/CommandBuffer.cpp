@@ -45,53 +45,109 @@ Semaphore::~Semaphore() {
 	vkDestroySemaphore(*mDevice, mSemaphore, nullptr);
 }
 
-CommandBuffer::CommandBuffer(::Device* device, VkCommandPool commandPool, const string& name)
-	: mDevice(device), mCommandPool(commandPool), mCurrentRenderPass(nullptr), mCurrentMaterial(nullptr), mCurrentPipeline(VK_NULL_HANDLE), mTriangleCount(0), mCurrentIndexBuffer(nullptr) {
+CommandBuffer::CommandBuffer(::Device* device, VkCommandPool commandPool, mutex* commandPoolMutex, const string& name, VkCommandBufferLevel level)
+	: mDevice(device), mCommandPool(commandPool), mCommandPoolMutex(commandPoolMutex), mLevel(level), mCurrentRenderPass(nullptr), mCurrentFramebuffer(VK_NULL_HANDLE), mCurrentMaterial(nullptr), mCurrentPipeline(VK_NULL_HANDLE), mTriangleCount(0), mCurrentIndexBuffer(nullptr) {
 	VkCommandBufferAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool = mCommandPool;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.level = mLevel;
 	allocInfo.commandBufferCount = 1;
-	ThrowIfFailed(vkAllocateCommandBuffers(*mDevice, &allocInfo, &mCommandBuffer), "vkAllocateCommandBuffers failed");
+	{
+		lock_guard lock(*mCommandPoolMutex);
+		ThrowIfFailed(vkAllocateCommandBuffers(*mDevice, &allocInfo, &mCommandBuffer), "vkAllocateCommandBuffers failed");
+	}
 	mDevice->SetObjectName(mCommandBuffer, name, VK_OBJECT_TYPE_COMMAND_BUFFER);
 
-	mSignalFence = make_shared<Fence>(device);
-	mDevice->SetObjectName(mSignalFence->operator VkFence(), name, VK_OBJECT_TYPE_FENCE);
+	if (mLevel == VK_COMMAND_BUFFER_LEVEL_PRIMARY) {
+		mSignalFence = make_shared<Fence>(device);
+		mDevice->SetObjectName(mSignalFence->operator VkFence(), name, VK_OBJECT_TYPE_FENCE);
+	}
 }
 CommandBuffer::~CommandBuffer() {
+	// the last reference may be released on any thread, e.g. by FlushFrames()
+	lock_guard lock(*mCommandPoolMutex);
 	vkFreeCommandBuffers(*mDevice, mCommandPool, 1, &mCommandBuffer);
 }
 
-#ifdef ENABLE_DEBUG_LAYERS
+#if defined(ENABLE_DEBUG_LAYERS) || defined(PROFILER_ENABLE)
 void CommandBuffer::BeginLabel(const string& text, const float4& color) {
+	#ifdef ENABLE_DEBUG_LAYERS
 	VkDebugUtilsLabelEXT label = {};
 	label.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT;
 	memcpy(label.color, &color, sizeof(color));
 	label.pLabelName = text.c_str();
 	mDevice->CmdBeginDebugUtilsLabelEXT(mCommandBuffer, &label);
+	#endif
+	#ifdef PROFILER_ENABLE
+	mTimestampRegions.push_back(mDevice->BeginTimestampRegion(this));
+	#endif
 }
 void CommandBuffer::EndLabel() {
+	#ifdef PROFILER_ENABLE
+	if (mTimestampRegions.size()) {
+		mDevice->EndTimestampRegion(this, mTimestampRegions.back());
+		mTimestampRegions.pop_back();
+	}
+	#endif
+	#ifdef ENABLE_DEBUG_LAYERS
 	mDevice->CmdEndDebugUtilsLabelEXT(mCommandBuffer);
+	#endif
 }
 #endif
 
 void CommandBuffer::Reset(const string& name) {
-	vkResetCommandBuffer(mCommandBuffer, 0);
+	{
+		lock_guard lock(*mCommandPoolMutex);
+		vkResetCommandBuffer(mCommandBuffer, 0);
+	}
 	mDevice->SetObjectName(mCommandBuffer, name, VK_OBJECT_TYPE_COMMAND_BUFFER);
 	
-	mSignalFence->Reset();
-	mDevice->SetObjectName(*mSignalFence, name + " Fence", VK_OBJECT_TYPE_FENCE);
+	if (mLevel == VK_COMMAND_BUFFER_LEVEL_PRIMARY) {
+		mSignalFence->Reset();
+		mDevice->SetObjectName(*mSignalFence, name + " Fence", VK_OBJECT_TYPE_FENCE);
+	}
+
+	// called by the device with mCommandPoolMutex held once this command buffer's fence has signaled. The secondaries may come from
+	// other threads' pools, they're handed back to their own pool's queue and reset by the thread that owns it
+	for (auto& secondary : mSecondaryCommandBuffers)
+		mDevice->mSecondaryCommandBuffers[secondary->mCommandPool].push(secondary);
+	mSecondaryCommandBuffers.clear();
 
 	mCurrentRenderPass = nullptr;
+	mCurrentFramebuffer = VK_NULL_HANDLE;
 	mCurrentCamera = nullptr;
 	mCurrentMaterial = nullptr;
 	mCurrentPipeline = VK_NULL_HANDLE;
 	mTriangleCount = 0;
 	mCurrentIndexBuffer = nullptr;
 	mCurrentVertexBuffers.clear();
+	#ifdef PROFILER_ENABLE
+	mTimestampRegions.clear();
+	#endif
+}
+
+void CommandBuffer::End() {
+	ThrowIfFailed(vkEndCommandBuffer(mCommandBuffer), "vkEndCommandBuffer failed");
 }
+void CommandBuffer::Execute(const vector<shared_ptr<CommandBuffer>>& commandBuffers) {
+	if (commandBuffers.empty()) return;
+	vector<VkCommandBuffer> buffers(commandBuffers.size());
+	for (uint32_t i = 0; i < commandBuffers.size(); i++) {
+		buffers[i] = commandBuffers[i]->mCommandBuffer;
+		mTriangleCount += commandBuffers[i]->mTriangleCount;
+		mSecondaryCommandBuffers.push_back(commandBuffers[i]);
+	}
+	vkCmdExecuteCommands(mCommandBuffer, (uint32_t)buffers.size(), buffers.data());
 
-void CommandBuffer::BeginRenderPass(RenderPass* renderPass, const VkExtent2D& bufferSize, VkFramebuffer frameBuffer, VkClearValue* clearValues, uint32_t clearValueCount) {
+	// the secondary command buffers may have bound anything
+	mCurrentCamera = nullptr;
+	mCurrentMaterial = nullptr;
+	mCurrentIndexBuffer = nullptr;
+	mCurrentVertexBuffers.clear();
+	mCurrentPipeline = VK_NULL_HANDLE;
+}
+
+void CommandBuffer::BeginRenderPass(RenderPass* renderPass, const VkExtent2D& bufferSize, VkFramebuffer frameBuffer, VkClearValue* clearValues, uint32_t clearValueCount, VkSubpassContents contents) {
 	VkRenderPassBeginInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 	info.renderPass = *renderPass;
@@ -99,15 +155,17 @@ void CommandBuffer::BeginRenderPass(RenderPass* renderPass, const VkExtent2D& bu
 	info.pClearValues = clearValues;
 	info.renderArea = { { 0, 0 }, bufferSize };
 	info.framebuffer = frameBuffer;
-	vkCmdBeginRenderPass(*this, &info, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBeginRenderPass(*this, &info, contents);
 
 	mCurrentRenderPass = renderPass;
+	mCurrentFramebuffer = frameBuffer;
 
 	mTriangleCount = 0;
 }
 void CommandBuffer::EndRenderPass() {
 	vkCmdEndRenderPass(*this);
 	mCurrentRenderPass = nullptr;
+	mCurrentFramebuffer = VK_NULL_HANDLE;
 	mCurrentCamera = nullptr;
 	mCurrentMaterial = nullptr;
 	mCurrentIndexBuffer = nullptr;
@@ -153,7 +211,9 @@ VkPipelineLayout CommandBuffer::BindMaterial(Material* material, PassType pass,
 	if (blendMode == BLEND_MODE_MAX_ENUM) blendMode = material->BlendMode();
 	if (cullMode == VK_CULL_MODE_FLAG_BITS_MAX_ENUM) cullMode = material->CullMode();
 
-	VkPipeline pipeline = shader->GetPipeline(mCurrentRenderPass, input, topology, cullMode, blendMode, polyMode);
+	// don't stall recording on pipeline creation, the draw is skipped (or drawn with a fallback) until the pipeline is ready
+	VkPipeline pipeline = shader->GetPipelineAsync(mCurrentRenderPass, input, topology, cullMode, blendMode, polyMode);
+	if (pipeline == VK_NULL_HANDLE) return VK_NULL_HANDLE;
 
 	if (pipeline != mCurrentPipeline && mCurrentCamera == camera && mCurrentMaterial == material) return shader->mPipelineLayout;
 
@@ -1,13 +1,16 @@
 #pragma once
 
+#include <Util/Profiler.hpp>
 #include <Util/Util.hpp>
 
-#ifdef ENABLE_DEBUG_LAYERS
+// command regions are debug labels, and are timed on the GPU when the profiler is enabled
+#if defined(ENABLE_DEBUG_LAYERS) || defined(PROFILER_ENABLE)
 #define BEGIN_CMD_REGION(cmd, label) cmd->BeginLabel(label)
 #define BEGIN_CMD_REGION_COLOR(cmd, label, color) cmd->BeginLabel(label, color)
 #define END_CMD_REGION(cmd) cmd->EndLabel()
 #else
 #define BEGIN_CMD_REGION(cmd, label)
+#define BEGIN_CMD_REGION_COLOR(cmd, label, color)
 #define END_CMD_REGION(cmd)
 #endif
 
@@ -47,12 +50,17 @@ public:
 	ENGINE_EXPORT ~CommandBuffer();
 	inline operator VkCommandBuffer() const { return mCommandBuffer; }
 
-	#ifdef ENABLE_DEBUG_LAYERS
+	#if defined(ENABLE_DEBUG_LAYERS) || defined(PROFILER_ENABLE)
 	ENGINE_EXPORT void BeginLabel(const std::string& label, const float4& color = float4(1,1,1,0));
 	ENGINE_EXPORT void EndLabel();
 	#endif
 
 	ENGINE_EXPORT void Reset(const std::string& name = "Command Buffer");
+	/// Ends recording of a secondary command buffer. Must be called from the thread that recorded it
+	ENGINE_EXPORT void End();
+	/// Executes secondary command buffers inside the current render pass. The secondary command buffers are kept alive
+	/// until this command buffer is submitted, and are then recycled once it completes
+	ENGINE_EXPORT void Execute(const std::vector<std::shared_ptr<CommandBuffer>>& commandBuffers);
 
 	inline RenderPass* CurrentRenderPass() const { return mCurrentRenderPass; }
 
@@ -66,7 +74,8 @@ public:
 		BlendMode blendMode = BLEND_MODE_MAX_ENUM,
 		VkPolygonMode polyMode = VK_POLYGON_MODE_MAX_ENUM);
 
-	/// Binds a material and sets its parameters
+	/// Binds a material and sets its parameters. Returns VK_NULL_HANDLE if the material has no shader for the pass, or its pipeline
+	/// is still being created and there is no fallback (see GraphicsShader::GetPipelineAsync), the draw should be skipped then
 	ENGINE_EXPORT VkPipelineLayout BindMaterial(Material* material, PassType pass, const VertexInput* input, Camera* camera = nullptr,
 		VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
 		VkCullModeFlags cullMode = VK_CULL_MODE_FLAG_BITS_MAX_ENUM,
@@ -76,7 +85,7 @@ public:
 	ENGINE_EXPORT void BindVertexBuffer(Buffer* buffer, uint32_t index, VkDeviceSize offset);
 	ENGINE_EXPORT void BindIndexBuffer(Buffer* buffer, VkDeviceSize offset, VkIndexType indexType);
 
-	ENGINE_EXPORT void BeginRenderPass(RenderPass* renderPass, const VkExtent2D& bufferSize, VkFramebuffer frameBuffer, VkClearValue* clearValues, uint32_t clearValueCount);
+	ENGINE_EXPORT void BeginRenderPass(RenderPass* renderPass, const VkExtent2D& bufferSize, VkFramebuffer frameBuffer, VkClearValue* clearValues, uint32_t clearValueCount, VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
 	ENGINE_EXPORT void EndRenderPass();
 
 	inline ::Device* Device() const { return mDevice; }
@@ -85,17 +94,30 @@ public:
 
 private:
 	friend class Device;
-	ENGINE_EXPORT CommandBuffer(::Device* device, VkCommandPool commandPool, const std::string& name = "Command Buffer");
+	friend class UploadQueue;
+	/// commandPoolMutex guards commandPool, it's held while the command buffer is allocated, reset and freed
+	ENGINE_EXPORT CommandBuffer(::Device* device, VkCommandPool commandPool, std::mutex* commandPoolMutex, const std::string& name = "Command Buffer", VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
 	::Device* mDevice;
 	VkCommandBuffer mCommandBuffer;
 	VkCommandPool mCommandPool;
+	std::mutex* mCommandPoolMutex;
+	VkCommandBufferLevel mLevel;
 	std::shared_ptr<Fence> mSignalFence;
 	std::shared_ptr<Semaphore> mSignalSemaphore;
 
 	std::unordered_map<uint32_t, Buffer*> mCurrentVertexBuffers;
 	Buffer* mCurrentIndexBuffer;
 
+	// secondary command buffers executed by this command buffer, handed back to the device once it has finished executing
+	std::vector<std::shared_ptr<CommandBuffer>> mSecondaryCommandBuffers;
+
+	#ifdef PROFILER_ENABLE
+	// timestamp regions of the open command regions, see Device::BeginTimestampRegion
+	std::vector<uint32_t> mTimestampRegions;
+	#endif
+
 	RenderPass* mCurrentRenderPass;
+	VkFramebuffer mCurrentFramebuffer;
 	Camera* mCurrentCamera;
 	VkPipeline mCurrentPipeline;
 	Material* mCurrentMaterial;
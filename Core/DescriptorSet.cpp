@@ -101,6 +101,37 @@ void DescriptorSet::CreateStorageBufferDescriptor(Buffer* buffer, VkDeviceSize o
 	mPending.push_back(write);
 	mPendingBuffers.push_back(info);
 }
+void DescriptorSet::CreateDynamicStorageBufferDescriptor(Buffer* buffer, VkDeviceSize range, uint32_t binding) {
+	uint64_t idx = (uint64_t)binding;
+	if (mCurrent.count(idx)) {
+		const VkWriteDescriptorSet& c = mCurrent.at(idx);
+		if (c.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC &&
+			c.pBufferInfo->buffer == *buffer &&
+			c.pBufferInfo->range == range) return;
+	}
+
+	VkDescriptorBufferInfo* info;
+	if (mBufferInfoPool.empty())
+		info = new VkDescriptorBufferInfo();
+	else {
+		info = mBufferInfoPool.front();
+		mBufferInfoPool.pop();
+	}
+	info->buffer = *buffer;
+	info->offset = 0;
+	info->range = range;
+
+	VkWriteDescriptorSet write = {};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = mDescriptorSet;
+	write.dstBinding = binding;
+	write.dstArrayElement = 0;
+	write.pBufferInfo = info;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	write.descriptorCount = 1;
+	mPending.push_back(write);
+	mPendingBuffers.push_back(info);
+}
 
 void DescriptorSet::CreateUniformBufferDescriptor(Buffer* buffer, VkDeviceSize offset, VkDeviceSize range, uint32_t binding) {
 	uint64_t idx = (uint64_t)binding;
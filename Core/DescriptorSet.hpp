@@ -14,6 +14,8 @@ public:
 
 	ENGINE_EXPORT void CreateStorageBufferDescriptor(Buffer* buffer, uint32_t index, VkDeviceSize offset, VkDeviceSize range, uint32_t binding);
 	ENGINE_EXPORT void CreateStorageBufferDescriptor(Buffer* buffer, VkDeviceSize offset, VkDeviceSize range, uint32_t binding);
+	/// The offset into the buffer is supplied when the set is bound, through pDynamicOffsets
+	ENGINE_EXPORT void CreateDynamicStorageBufferDescriptor(Buffer* buffer, VkDeviceSize range, uint32_t binding);
 	ENGINE_EXPORT void CreateUniformBufferDescriptor(Buffer* buffer, VkDeviceSize offset, VkDeviceSize range, uint32_t binding);
 	
 	ENGINE_EXPORT void CreateStorageTextureDescriptor(Texture* texture, uint32_t binding, VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL);
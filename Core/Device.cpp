@@ -2,13 +2,42 @@
 #include <Core/Device.hpp>
 #include <Core/Instance.hpp>
 #include <Core/CommandBuffer.hpp>
+#include <Core/RenderPass.hpp>
 #include <Core/Window.hpp>
 #include <Util/Profiler.hpp>
 #include <Util/Util.hpp>
 
 using namespace std;
 
-void Device::FrameContext::Reset() {
+// initial size of each frame context's temp ring, it doubles whenever a frame overflows it
+#define TEMP_RING_SIZE (4 * 1024 * 1024)
+#define TEMP_RING_USAGE (VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+
+// timestamp queries per frame context, two per command region
+#define TIMESTAMP_QUERY_COUNT 1024
+#define INVALID_TIMESTAMP_REGION 0xFFFFFFFFu
+
+#define CACHE_DIRECTORY "Cache/"
+#define PIPELINE_CACHE_MAGIC 0x43505453 // STPC
+
+// written in front of the pipeline cache data. drivers are supposed to reject caches from other devices, but not all do,
+// so the cache is only used if every field matches the current device
+struct PipelineCacheHeader {
+	uint32_t mMagic;
+	uint32_t mVendorID;
+	uint32_t mDeviceID;
+	uint32_t mDriverVersion;
+	uint8_t mPipelineCacheUUID[VK_UUID_SIZE];
+	uint64_t mDataSize;
+};
+
+inline string PipelineCachePath(const string& directory, const VkPhysicalDeviceProperties& properties) {
+	char name[64];
+	snprintf(name, 64, "pipelines_%04x_%04x.bin", properties.vendorID, properties.deviceID);
+	return directory + name;
+}
+
+void Device::FrameContext::Wait() {
 	if (mFences.size()) {
 		PROFILER_BEGIN("Wait for GPU");
 		vector<VkFence> fences(mFences.size());
@@ -20,6 +49,38 @@ void Device::FrameContext::Reset() {
 
 	mFences.clear();
 	mSemaphores.clear();
+}
+
+void Device::FrameContext::Reset() {
+	Wait();
+
+	if (mTimestampRegions.size()) {
+		// queries of command buffers that were never submitted stay unavailable, their regions are dropped
+		PROFILER_BEGIN("Read timestamps");
+		vector<uint64_t> results(mTimestampCount * 2);
+		vkGetQueryPoolResults(*mDevice, mTimestampPool, 0, mTimestampCount, results.size() * sizeof(uint64_t), results.data(), 2 * sizeof(uint64_t),
+			VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+		double period = mDevice->Limits().timestampPeriod;
+		for (const TimestampRegion& r : mTimestampRegions) {
+			const uint64_t* begin = results.data() + 2 * r.mQuery;
+			const uint64_t* end = results.data() + 2 * r.mEndQuery;
+			if (!begin[1] || !end[1]) continue;
+			uint64_t ticks = (end[0] - begin[0]) & mDevice->mTimestampMask;
+			Profiler::AddGpuTime(r.mProfilerFrame, r.mSamplePath, chrono::nanoseconds((int64_t)(ticks * period)));
+		}
+		PROFILER_END;
+	}
+	mTimestampRegions.clear();
+	mTimestampCount = 0;
+	mTimestampPoolReset = false;
+	if (!mTimestampPool && mDevice->mTimestampMask) {
+		VkQueryPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		poolInfo.queryCount = TIMESTAMP_QUERY_COUNT;
+		ThrowIfFailed(vkCreateQueryPool(*mDevice, &poolInfo, nullptr, &mTimestampPool), "vkCreateQueryPool failed");
+		mDevice->SetObjectName(mTimestampPool, "Timestamp Pool", VK_OBJECT_TYPE_QUERY_POOL);
+	}
 
 	PROFILER_BEGIN("Clear old buffers");
 	for (auto it = mTempBuffers.begin(); it != mTempBuffers.end();) {
@@ -40,9 +101,28 @@ void Device::FrameContext::Reset() {
 
 	mTempBuffersInUse.clear();
 	mTempDescriptorSetsInUse.clear();
+
+	// the GPU is done with this frame context, so the ring can be rewound (or replaced with a larger one)
+	VkDeviceSize ringSize = mTempRing ? mTempRing->Size() : TEMP_RING_SIZE;
+	while (ringSize < mTempRingOffset + mTempRingOverflow) ringSize *= 2;
+	if (!mTempRing || mTempRing->Size() != ringSize) {
+		safe_delete(mTempRing);
+		mTempRing = new Buffer("Temp Ring", mDevice, ringSize, TEMP_RING_USAGE, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		mTempRing->Map();
+	}
+	mTempRingOffset = 0;
+	mTempRingOverflow = 0;
 }
 Device::FrameContext::~FrameContext() {
-	Reset();
+	// only wait for the GPU and release, Reset would read timestamps back and reallocate the temp ring
+	Wait();
+	mTimestampRegions.clear();
+	for (Buffer* b : mTempBuffersInUse)
+		safe_delete(b);
+	for (DescriptorSet* ds : mTempDescriptorSetsInUse)
+		safe_delete(ds);
+	if (mTimestampPool) vkDestroyQueryPool(*mDevice, mTimestampPool, nullptr);
+	safe_delete(mTempRing);
 	for (auto b : mTempBuffers)
 		safe_delete(b.first);
 	for (auto kp : mTempDescriptorSets)
@@ -84,7 +164,7 @@ bool Device::FindQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface, ui
 }
 
 Device::Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t physicalDeviceIndex, uint32_t graphicsQueueFamily, uint32_t presentQueueFamily, const set<string>& deviceExtensions, vector<const char*> validationLayers)
-	: mInstance(instance), mFrameContexts(nullptr), mGraphicsQueueFamily(graphicsQueueFamily), mPresentQueueFamily(presentQueueFamily), mFrameContextIndex(0) {
+	: mInstance(instance), mFrameContexts(nullptr), mGraphicsQueueFamily(graphicsQueueFamily), mPresentQueueFamily(presentQueueFamily), mFrameContextIndex(0), mCacheDirectory(CACHE_DIRECTORY) {
 
 	#ifdef ENABLE_DEBUG_LAYERS
 	SetDebugUtilsObjectNameEXT = (PFN_vkSetDebugUtilsObjectNameEXT)vkGetInstanceProcAddr(*instance, "vkSetDebugUtilsObjectNameEXT");
@@ -100,8 +180,39 @@ Device::Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t p
 	for (const string& s : deviceExtensions)
 		deviceExts.push_back(s.c_str());
 
+	// optional extensions
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(mPhysicalDevice, nullptr, &extensionCount, nullptr);
+	vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(mPhysicalDevice, nullptr, &extensionCount, extensions.data());
+	bool drawIndirectCount = false;
+	for (const VkExtensionProperties& e : extensions)
+		if (strcmp(e.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0) drawIndirectCount = true;
+	if (drawIndirectCount && !deviceExtensions.count(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME))
+		deviceExts.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	mMemoryBudgetSupported = false;
+	for (const VkExtensionProperties& e : extensions)
+		if (strcmp(e.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) mMemoryBudgetSupported = true;
+	if (mMemoryBudgetSupported && !deviceExtensions.count(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+		deviceExts.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
 	#pragma region get queue info
-	set<uint32_t> uniqueQueueFamilies{ mGraphicsQueueFamily, mPresentQueueFamily };
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(mPhysicalDevice, &queueFamilyCount, nullptr);
+	vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(mPhysicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	// prefer a transfer-only family (the DMA engine), then any family without graphics, so uploads run alongside rendering.
+	// the present queue is skipped since presenting isn't synchronized with uploads
+	mTransferQueueFamily = mGraphicsQueueFamily;
+	for (uint32_t i = 0; i < queueFamilyCount; i++) {
+		VkQueueFlags flags = queueFamilies[i].queueFlags;
+		if (queueFamilies[i].queueCount == 0 || i == mPresentQueueFamily || (flags & VK_QUEUE_GRAPHICS_BIT) || !(flags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT))) continue;
+		if (mTransferQueueFamily == mGraphicsQueueFamily || !(flags & VK_QUEUE_COMPUTE_BIT))
+			mTransferQueueFamily = i;
+	}
+
+	set<uint32_t> uniqueQueueFamilies{ mGraphicsQueueFamily, mPresentQueueFamily, mTransferQueueFamily };
 	vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	float queuePriority = 1.0f;
 	for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -128,6 +239,24 @@ Device::Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t p
 	indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
 	indexingFeatures.runtimeDescriptorArray = VK_TRUE;
 
+	// multiview is required by Vulkan 1.1, but check anyway so stereo cameras can fall back to drawing each eye
+	VkPhysicalDeviceMultiviewFeatures multiviewFeatures = {};
+	multiviewFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES;
+	VkPhysicalDeviceFeatures2 supportedFeatures = {};
+	supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supportedFeatures.pNext = &multiviewFeatures;
+	vkGetPhysicalDeviceFeatures2(mPhysicalDevice, &supportedFeatures);
+	mMultiviewSupported = multiviewFeatures.multiview == VK_TRUE;
+	mTextureCompressionBCSupported = supportedFeatures.features.textureCompressionBC == VK_TRUE;
+	deviceFeatures.textureCompressionBC = supportedFeatures.features.textureCompressionBC;
+	mMultiDrawIndirectSupported = supportedFeatures.features.multiDrawIndirect == VK_TRUE;
+	mDrawIndirectFirstInstanceSupported = supportedFeatures.features.drawIndirectFirstInstance == VK_TRUE;
+	deviceFeatures.multiDrawIndirect = supportedFeatures.features.multiDrawIndirect;
+	deviceFeatures.drawIndirectFirstInstance = supportedFeatures.features.drawIndirectFirstInstance;
+	multiviewFeatures.multiviewGeometryShader = VK_FALSE;
+	multiviewFeatures.multiviewTessellationShader = VK_FALSE;
+	if (mMultiviewSupported) indexingFeatures.pNext = &multiviewFeatures;
+
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	createInfo.queueCreateInfoCount = (uint32_t)queueCreateInfos.size();
@@ -140,35 +269,67 @@ Device::Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t p
 	createInfo.pNext = &indexingFeatures;
 	ThrowIfFailed(vkCreateDevice(mPhysicalDevice, &createInfo, nullptr, &mDevice), "vkCreateDevice failed");
 
-	VkPhysicalDeviceProperties properties = {};
-	vkGetPhysicalDeviceProperties(mPhysicalDevice, &properties);
-	string name = "Device " + to_string(properties.deviceID) + ": " + properties.deviceName;
+	vkGetPhysicalDeviceProperties(mPhysicalDevice, &mProperties);
+	string name = "Device " + to_string(mProperties.deviceID) + ": " + mProperties.deviceName;
 	SetObjectName(mDevice, name, VK_OBJECT_TYPE_DEVICE);
-	mLimits = properties.limits;
+	mLimits = mProperties.limits;
+
+	uint32_t timestampBits = queueFamilies[mGraphicsQueueFamily].timestampValidBits;
+	mTimestampMask = timestampBits >= 64 ? ~0ull : (1ull << timestampBits) - 1;
+
+	mCmdDrawIndexedIndirectCount = drawIndirectCount ? (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(mDevice, "vkCmdDrawIndexedIndirectCountKHR") : nullptr;
+
+	vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &mMemoryProperties);
+	mMemoryAllocator = new ::MemoryAllocator(this);
 
 	vkGetDeviceQueue(mDevice, mGraphicsQueueFamily, 0, &mGraphicsQueue);
 	vkGetDeviceQueue(mDevice, mPresentQueueFamily, 0, &mPresentQueue);
+	vkGetDeviceQueue(mDevice, mTransferQueueFamily, 0, &mTransferQueue);
 	SetObjectName(mGraphicsQueue, name + " Graphics Queue", VK_OBJECT_TYPE_QUEUE);
 	SetObjectName(mPresentQueue, name + " Present Queue", VK_OBJECT_TYPE_QUEUE);
+	if (mTransferQueue != mGraphicsQueue) SetObjectName(mTransferQueue, name + " Transfer Queue", VK_OBJECT_TYPE_QUEUE);
+
+	mUploadQueue = new ::UploadQueue(this, mTransferQueueFamily, mTransferQueue);
 	#pragma endregion
 
 	#pragma region PipelineCache and DesriptorPool
 	VkPipelineCacheCreateInfo cache = {};
 	cache.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-	vkCreatePipelineCache(mDevice, &cache, nullptr, &mPipelineCache);
+
+	vector<uint8_t> cacheData;
+	string cachePath = PipelineCachePath(mCacheDirectory, mProperties);
+	if (fs::exists(cachePath) && ReadFile(cachePath, cacheData) && cacheData.size() >= sizeof(PipelineCacheHeader)) {
+		const PipelineCacheHeader* header = (const PipelineCacheHeader*)cacheData.data();
+		if (header->mMagic == PIPELINE_CACHE_MAGIC &&
+			header->mVendorID == mProperties.vendorID &&
+			header->mDeviceID == mProperties.deviceID &&
+			header->mDriverVersion == mProperties.driverVersion &&
+			memcmp(header->mPipelineCacheUUID, mProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0 &&
+			header->mDataSize == cacheData.size() - sizeof(PipelineCacheHeader)) {
+			cache.initialDataSize = (size_t)header->mDataSize;
+			cache.pInitialData = cacheData.data() + sizeof(PipelineCacheHeader);
+		} else
+			fprintf_color(COLOR_YELLOW, stderr, "Discarding pipeline cache from a different device or driver version\n");
+	}
+	if (vkCreatePipelineCache(mDevice, &cache, nullptr, &mPipelineCache) != VK_SUCCESS) {
+		cache.initialDataSize = 0;
+		cache.pInitialData = nullptr;
+		ThrowIfFailed(vkCreatePipelineCache(mDevice, &cache, nullptr, &mPipelineCache), "vkCreatePipelineCache failed");
+	}
 	
-	VkDescriptorPoolSize type_count[5] {
+	VkDescriptorPoolSize type_count[6] {
 		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,			mLimits.maxDescriptorSetUniformBuffers },
 		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,	mLimits.maxDescriptorSetSampledImages },
 		{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,				mLimits.maxDescriptorSetSampledImages },
 		{ VK_DESCRIPTOR_TYPE_SAMPLER,					mLimits.maxDescriptorSetSamplers },
 		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,			mLimits.maxDescriptorSetStorageBuffers },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,	mLimits.maxDescriptorSetStorageBuffersDynamic },
 	};
 
 	VkDescriptorPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-	poolInfo.poolSizeCount = 5;
+	poolInfo.poolSizeCount = 6;
 	poolInfo.pPoolSizes = type_count;
 	poolInfo.maxSets = 65535;
 
@@ -178,14 +339,59 @@ Device::Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t p
 }
 Device::~Device() {
 	FlushFrames();
+	safe_delete(mUploadQueue);
 	safe_delete_array(mFrameContexts);
+	#ifdef PRINT_VK_ALLOCATIONS
+	mMemoryAllocator->PrintStats();
+	#endif
+	safe_delete(mMemoryAllocator);
+	for (auto& p : mCompatibleRenderPasses)
+		safe_delete(p.second);
 	vkDestroyDescriptorPool(mDevice, mDescriptorPool, nullptr);
+	SavePipelineCache();
 	vkDestroyPipelineCache(mDevice, mPipelineCache, nullptr);
-	for (auto& p : mCommandBuffers)
-		vkDestroyCommandPool(mDevice, p.first, nullptr);
+	for (auto& p : mCommandPools)
+		vkDestroyCommandPool(mDevice, p.second, nullptr);
 	vkDestroyDevice(mDevice, nullptr);
 }
 
+void Device::SavePipelineCache() {
+	size_t size = 0;
+	if (vkGetPipelineCacheData(mDevice, mPipelineCache, &size, nullptr) != VK_SUCCESS || size == 0) return;
+	vector<uint8_t> data(sizeof(PipelineCacheHeader) + size);
+	if (vkGetPipelineCacheData(mDevice, mPipelineCache, &size, data.data() + sizeof(PipelineCacheHeader)) != VK_SUCCESS) return;
+
+	PipelineCacheHeader* header = (PipelineCacheHeader*)data.data();
+	header->mMagic = PIPELINE_CACHE_MAGIC;
+	header->mVendorID = mProperties.vendorID;
+	header->mDeviceID = mProperties.deviceID;
+	header->mDriverVersion = mProperties.driverVersion;
+	memcpy(header->mPipelineCacheUUID, mProperties.pipelineCacheUUID, VK_UUID_SIZE);
+	header->mDataSize = size;
+
+	error_code ec;
+	fs::create_directories(mCacheDirectory, ec);
+	// write to a temporary file first, so a crash while writing can't leave a truncated cache behind
+	string path = PipelineCachePath(mCacheDirectory, mProperties);
+	string tmp = path + ".tmp";
+	ofstream file(tmp, ios::binary);
+	if (!file.is_open()) {
+		fprintf_color(COLOR_YELLOW, stderr, "Could not write pipeline cache: %s\n", tmp.c_str());
+		return;
+	}
+	file.write((const char*)data.data(), sizeof(PipelineCacheHeader) + size);
+	file.close();
+	fs::rename(tmp, path, ec);
+	if (ec) fprintf_color(COLOR_YELLOW, stderr, "Could not write pipeline cache: %s\n", path.c_str());
+}
+
+RenderPass* Device::CompatibleRenderPass(const RenderPassLayout& layout) {
+	lock_guard lock(mCompatibleRenderPassMutex);
+	::RenderPass*& renderPass = mCompatibleRenderPasses[layout.Hash()];
+	if (!renderPass) renderPass = new ::RenderPass("Compatible", this, layout);
+	return renderPass;
+}
+
 VkSampleCountFlagBits Device::GetMaxUsableSampleCount() {
 	VkPhysicalDeviceProperties physicalDeviceProperties;
 	vkGetPhysicalDeviceProperties(mPhysicalDevice, &physicalDeviceProperties);
@@ -203,6 +409,7 @@ VkSampleCountFlagBits Device::GetMaxUsableSampleCount() {
 
 void Device::FlushFrames() {
 	vkDeviceWaitIdle(mDevice);
+	// the command buffers released here lock their own pool's mutex as they're freed, since their pools belong to other threads
 	lock_guard lock(mCommandPoolMutex);
 	for (auto& p : mCommandBuffers) {
 		while (p.second.size()) {
@@ -210,6 +417,8 @@ void Device::FlushFrames() {
 			p.second.pop();
 		}
 	}
+	for (auto& p : mSecondaryCommandBuffers)
+		while (p.second.size()) p.second.pop();
 	for (uint32_t i = 0; i < MaxFramesInFlight(); i++)
 		mFrameContexts[i].Reset();
 }
@@ -226,20 +435,34 @@ void Device::SetObjectName(void* object, const string& name, VkObjectType type)
 }
 
 uint32_t Device::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
-	VkPhysicalDeviceMemoryProperties memProperties;
-	vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &memProperties);
-
-	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
-		if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+	for (uint32_t i = 0; i < mMemoryProperties.memoryTypeCount; i++)
+		if ((typeFilter & (1 << i)) && (mMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
 			return i;
 
 	fprintf_color(COLOR_RED, stderr, "Failed to find suitable memory type!");
 	throw;
 }
+bool Device::DeviceMemoryBudget(VkDeviceSize& usage, VkDeviceSize& budget) const {
+	if (!mMemoryBudgetSupported) return false;
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+	budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+	VkPhysicalDeviceMemoryProperties2 properties = {};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+	properties.pNext = &budgetProperties;
+	vkGetPhysicalDeviceMemoryProperties2(mPhysicalDevice, &properties);
+
+	usage = 0;
+	budget = 0;
+	for (uint32_t i = 0; i < properties.memoryProperties.memoryHeapCount; i++) {
+		if (!(properties.memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)) continue;
+		usage += budgetProperties.heapUsage[i];
+		budget += budgetProperties.heapBudget[i];
+	}
+	return true;
+}
 
-shared_ptr<CommandBuffer> Device::GetCommandBuffer(const std::string& name) {
+VkCommandPool Device::GetCommandPool(const string& name, mutex*& poolMutex) {
 	// get a commandpool for the current thread
-	lock_guard lock(mCommandPoolMutex);
 	VkCommandPool& commandPool = mCommandPools[this_thread::get_id()];
 	if (!commandPool) {
 		VkCommandPoolCreateInfo poolInfo = {};
@@ -249,6 +472,14 @@ shared_ptr<CommandBuffer> Device::GetCommandBuffer(const std::string& name) {
 		ThrowIfFailed(vkCreateCommandPool(mDevice, &poolInfo, nullptr, &commandPool), "vkCreateCommandPool failed");
 		SetObjectName(commandPool, name + " Graphics Command Pool", VK_OBJECT_TYPE_COMMAND_POOL);
 	}
+	poolMutex = &mCommandPoolMutexes[commandPool];
+	return commandPool;
+}
+
+shared_ptr<CommandBuffer> Device::GetCommandBuffer(const std::string& name) {
+	lock_guard lock(mCommandPoolMutex);
+	mutex* poolMutex;
+	VkCommandPool commandPool = GetCommandPool(name, poolMutex);
 
 	auto& commandBufferQueue = mCommandBuffers[commandPool];
 
@@ -264,7 +495,7 @@ shared_ptr<CommandBuffer> Device::GetCommandBuffer(const std::string& name) {
 			commandBuffer.reset();
 	}
 	
-	if (!commandBuffer) commandBuffer = shared_ptr<CommandBuffer>(new CommandBuffer(this, commandPool, name));
+	if (!commandBuffer) commandBuffer = shared_ptr<CommandBuffer>(new CommandBuffer(this, commandPool, poolMutex, name));
 
 	// begin recording commands
 	VkCommandBufferBeginInfo beginInfo = {};
@@ -274,6 +505,73 @@ shared_ptr<CommandBuffer> Device::GetCommandBuffer(const std::string& name) {
 
 	return commandBuffer;
 }
+uint32_t Device::BeginTimestampRegion(CommandBuffer* commandBuffer) {
+	FrameContext* frame = CurrentFrameContext();
+	uint32_t viewCount = commandBuffer->mCurrentRenderPass ? commandBuffer->mCurrentRenderPass->ViewCount() : 1;
+	if (commandBuffer->mLevel != VK_COMMAND_BUFFER_LEVEL_PRIMARY || !frame->mTimestampPool || frame->mTimestampCount + 2 * viewCount > TIMESTAMP_QUERY_COUNT)
+		return INVALID_TIMESTAMP_REGION;
+	if (!frame->mTimestampPoolReset && commandBuffer->mCurrentRenderPass) return INVALID_TIMESTAMP_REGION;
+
+	TimestampRegion region = {};
+	if (!Profiler::CurrentSamplePath(region.mProfilerFrame, region.mSamplePath)) return INVALID_TIMESTAMP_REGION;
+
+	if (!frame->mTimestampPoolReset) {
+		vkCmdResetQueryPool(*commandBuffer, frame->mTimestampPool, 0, TIMESTAMP_QUERY_COUNT);
+		frame->mTimestampPoolReset = true;
+	}
+	region.mQuery = frame->mTimestampCount;
+	region.mEndQuery = region.mQuery + viewCount;
+	region.mViewCount = viewCount;
+	frame->mTimestampCount += 2 * viewCount;
+	vkCmdWriteTimestamp(*commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame->mTimestampPool, region.mQuery);
+	frame->mTimestampRegions.push_back(region);
+	return (uint32_t)frame->mTimestampRegions.size() - 1;
+}
+void Device::EndTimestampRegion(CommandBuffer* commandBuffer, uint32_t region) {
+	if (region == INVALID_TIMESTAMP_REGION) return;
+	FrameContext* frame = CurrentFrameContext();
+	const TimestampRegion& r = frame->mTimestampRegions[region];
+	// a region that ends in a render pass with more views than it began with would overrun its queries, its end query is left
+	// unavailable and the region is dropped
+	uint32_t viewCount = commandBuffer->mCurrentRenderPass ? commandBuffer->mCurrentRenderPass->ViewCount() : 1;
+	if (viewCount > r.mViewCount) return;
+	vkCmdWriteTimestamp(*commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame->mTimestampPool, r.mEndQuery);
+}
+
+shared_ptr<CommandBuffer> Device::GetSecondaryCommandBuffer(CommandBuffer* primary, const string& name) {
+	shared_ptr<CommandBuffer> commandBuffer;
+	{
+		lock_guard lock(mCommandPoolMutex);
+		mutex* poolMutex;
+		VkCommandPool commandPool = GetCommandPool(name, poolMutex);
+
+		auto& commandBufferQueue = mSecondaryCommandBuffers[commandPool];
+		// command buffers in this queue were released by a primary command buffer that finished executing
+		if (commandBufferQueue.size()) {
+			commandBuffer = commandBufferQueue.front();
+			commandBufferQueue.pop();
+			commandBuffer->Reset(name);
+		} else
+			commandBuffer = shared_ptr<CommandBuffer>(new CommandBuffer(this, commandPool, poolMutex, name, VK_COMMAND_BUFFER_LEVEL_SECONDARY));
+	}
+
+	commandBuffer->mCurrentRenderPass = primary->mCurrentRenderPass;
+	commandBuffer->mCurrentFramebuffer = primary->mCurrentFramebuffer;
+
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = *primary->mCurrentRenderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = primary->mCurrentFramebuffer;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+	ThrowIfFailed(vkBeginCommandBuffer(commandBuffer->mCommandBuffer, &beginInfo), "vkBeginCommandBuffer failed");
+
+	return commandBuffer;
+}
 
 shared_ptr<Fence> Device::Execute(shared_ptr<CommandBuffer> commandBuffer, bool frameContext) {
 	lock_guard lock(mCommandPoolMutex);
@@ -309,6 +607,13 @@ shared_ptr<Fence> Device::Execute(shared_ptr<CommandBuffer> commandBuffer, bool
 	return commandBuffer->mSignalFence;
 }
 
+void Device::CmdDrawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount, uint32_t stride) {
+	if (mCmdDrawIndexedIndirectCount)
+		mCmdDrawIndexedIndirectCount(commandBuffer, buffer, offset, countBuffer, countOffset, maxDrawCount, stride);
+	else
+		vkCmdDrawIndexedIndirect(commandBuffer, buffer, offset, maxDrawCount, stride);
+}
+
 Buffer* Device::GetTempBuffer(const std::string& name, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties) {
 	lock_guard lock(mTmpBufferMutex);
 	FrameContext* frame = CurrentFrameContext();
@@ -333,6 +638,34 @@ Buffer* Device::GetTempBuffer(const std::string& name, VkDeviceSize size, VkBuff
 	frame->mTempBuffersInUse.push_back(b);
 	return b;
 }
+Device::TempRange Device::AllocateTemp(VkDeviceSize size, VkDeviceSize alignment) {
+	FrameContext* frame = CurrentFrameContext();
+	if (alignment == 0) alignment = max(mLimits.minStorageBufferOffsetAlignment, mLimits.minUniformBufferOffsetAlignment);
+
+	// bump the ring's offset, the loop only repeats if another thread allocated in between
+	VkDeviceSize capacity = frame->mTempRing->Size();
+	VkDeviceSize offset = frame->mTempRingOffset.load(memory_order_relaxed);
+	VkDeviceSize start;
+	do {
+		start = (offset + alignment - 1) / alignment * alignment;
+		if (start + size > capacity) break;
+	} while (!frame->mTempRingOffset.compare_exchange_weak(offset, start + size, memory_order_relaxed));
+
+	TempRange range = {};
+	range.mSize = size;
+	if (start + size <= capacity) {
+		range.mBuffer = frame->mTempRing;
+		range.mOffset = start;
+	} else {
+		// the ring is full, fall back to a temp buffer until the ring grows
+		frame->mTempRingOverflow += size + alignment;
+		range.mBuffer = GetTempBuffer("Temp Ring Overflow", size, TEMP_RING_USAGE, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		range.mOffset = 0;
+	}
+	range.mData = (uint8_t*)range.mBuffer->MappedData() + range.mOffset;
+	return range;
+}
+
 DescriptorSet* Device::GetTempDescriptorSet(const std::string& name, VkDescriptorSetLayout layout) {
 	lock_guard lock(mTmpDescriptorSetMutex);
 	FrameContext* frame = CurrentFrameContext();
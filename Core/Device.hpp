@@ -6,14 +6,28 @@
 #include <Core/DescriptorSet.hpp>
 #include <Core/CommandBuffer.hpp>
 #include <Core/Instance.hpp>
+#include <Core/MemoryAllocator.hpp>
+#include <Core/UploadQueue.hpp>
 #include <Util/Util.hpp>
 
 class CommandBuffer;
 class Fence;
+class RenderPass;
 class Window;
+struct RenderPassLayout;
 
 class Device {
 public:
+	/// A command region timed with a pair of timestamp queries, attached to the profiler sample that was open when it began
+	struct TimestampRegion {
+		// timestamps written inside a multiview render pass take a query per view, so each timestamp gets mViewCount queries
+		uint32_t mQuery;
+		uint32_t mEndQuery;
+		uint32_t mViewCount;
+		uint64_t mProfilerFrame;
+		std::vector<uint32_t> mSamplePath;
+	};
+
 	struct FrameContext {
 		std::vector<std::shared_ptr<Semaphore>> mSemaphores; // semaphores that signal when this frame is 'done'
 		std::vector<std::shared_ptr<Fence>> mFences; // fences that signal when this frame is 'done'
@@ -24,13 +38,38 @@ public:
 		std::vector<Buffer*> mTempBuffersInUse;
 		std::vector<DescriptorSet*> mTempDescriptorSetsInUse;
 
+		// persistently mapped buffer that AllocateTemp hands out ranges of, from a bump pointer
+		Buffer* mTempRing;
+		std::atomic<VkDeviceSize> mTempRingOffset;
+		// bytes that didn't fit into mTempRing, the ring grows to fit them the next time the frame context is reset
+		std::atomic<VkDeviceSize> mTempRingOverflow;
+
+		// timestamps of the command regions recorded this frame, read back into the profiler when the frame context is reset.
+		// the pool is reset by the first command buffer that writes a timestamp
+		VkQueryPool mTimestampPool;
+		uint32_t mTimestampCount;
+		bool mTimestampPoolReset;
+		std::vector<TimestampRegion> mTimestampRegions;
+
 		Device* mDevice;
 
-		inline FrameContext() : mFences({}), mSemaphores({}), mTempBuffers({}), mTempDescriptorSets({}), mTempBuffersInUse({}), mTempDescriptorSetsInUse({}) {};
+		inline FrameContext() : mFences({}), mSemaphores({}), mTempBuffers({}), mTempDescriptorSets({}), mTempBuffersInUse({}), mTempDescriptorSetsInUse({}), mTempRing(nullptr), mTempRingOffset(0), mTempRingOverflow(0),
+			mTimestampPool(VK_NULL_HANDLE), mTimestampCount(0), mTimestampPoolReset(false), mDevice(nullptr) {};
 		ENGINE_EXPORT ~FrameContext();
+		/// Waits for the frame's fences, then releases its semaphores and fences
+		ENGINE_EXPORT void Wait();
 		ENGINE_EXPORT void Reset();
 	};
 
+	/// A range of a frame context's temp ring buffer, valid until the frame context is reused
+	struct TempRange {
+		Buffer* mBuffer;
+		VkDeviceSize mOffset;
+		VkDeviceSize mSize;
+		// host pointer to mOffset
+		void* mData;
+	};
+
 	ENGINE_EXPORT static bool FindQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface, uint32_t& graphicsFamily, uint32_t& presentFamily);
 
 	ENGINE_EXPORT ~Device();
@@ -41,15 +80,44 @@ public:
 	inline VkQueue PresentQueue() const { return mPresentQueue; };
 	inline uint32_t GraphicsQueueFamily() const { return mGraphicsQueueFamily; };
 	inline uint32_t PresentQueueFamily() const { return mPresentQueueFamily; };
+	/// Queue family of UploadQueue(), which is GraphicsQueueFamily() if the device has no separate transfer family
+	inline uint32_t TransferQueueFamily() const { return mTransferQueueFamily; };
 
 	ENGINE_EXPORT void SetObjectName(void* object, const std::string& name, VkObjectType type) const;
 
 	ENGINE_EXPORT uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+	inline const VkPhysicalDeviceMemoryProperties& MemoryProperties() const { return mMemoryProperties; }
+	/// Buffer and Texture memory is sub-allocated from here
+	inline ::MemoryAllocator* MemoryAllocator() const { return mMemoryAllocator; }
+	/// Asynchronous uploads through a staging ring on the transfer queue
+	inline ::UploadQueue* UploadQueue() const { return mUploadQueue; }
 	
 	ENGINE_EXPORT Buffer* GetTempBuffer(const std::string& name, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);
 	ENGINE_EXPORT DescriptorSet* GetTempDescriptorSet(const std::string& name, VkDescriptorSetLayout layout);
+	/// Allocates a range of host visible, coherent memory that lives until this frame context is reused.
+	/// Lock-free unless the ring is full. alignment = 0 aligns to the minimum storage/uniform buffer offset alignment
+	ENGINE_EXPORT TempRange AllocateTemp(VkDeviceSize size, VkDeviceSize alignment = 0);
 
 	ENGINE_EXPORT std::shared_ptr<CommandBuffer> GetCommandBuffer(const std::string& name = "Command Buffer");
+	/// Gets a secondary command buffer from the calling thread's command pool that continues primary's current render pass.
+	/// Call End() on the thread that recorded it, then pass it to primary->Execute()
+	ENGINE_EXPORT std::shared_ptr<CommandBuffer> GetSecondaryCommandBuffer(CommandBuffer* primary, const std::string& name = "Secondary Command Buffer");
+	/// Records vkCmdDrawIndexedIndirectCountKHR. Without VK_KHR_draw_indirect_count, all maxDrawCount draws are recorded
+	/// with vkCmdDrawIndexedIndirect instead, so draws past the count must have an instance count of 0
+	ENGINE_EXPORT void CmdDrawIndexedIndirectCount(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countOffset, uint32_t maxDrawCount, uint32_t stride);
+	inline bool DrawIndirectCountSupported() const { return mCmdDrawIndexedIndirectCount != nullptr; }
+	/// True if an indirect draw can record more than one draw command
+	inline bool MultiDrawIndirectSupported() const { return mMultiDrawIndirectSupported; }
+	/// True if indirect draw commands can have a first instance other than 0
+	inline bool DrawIndirectFirstInstanceSupported() const { return mDrawIndirectFirstInstanceSupported; }
+	/// True if render passes can render to several array layers at once with VK_KHR_multiview (core in Vulkan 1.1)
+	inline bool MultiviewSupported() const { return mMultiviewSupported; }
+	/// True if BC1-BC7 block compressed images can be sampled. Desktop GPUs support them, most mobile GPUs don't
+	inline bool TextureCompressionBCSupported() const { return mTextureCompressionBCSupported; }
+	inline bool MemoryBudgetSupported() const { return mMemoryBudgetSupported; }
+	/// Gets the bytes the process uses and the bytes it can use without degrading performance, summed over the device local heaps.
+	/// Returns false without VK_EXT_memory_budget
+	ENGINE_EXPORT bool DeviceMemoryBudget(VkDeviceSize& usage, VkDeviceSize& budget) const;
 	ENGINE_EXPORT std::shared_ptr<Fence> Execute(std::shared_ptr<CommandBuffer> commandBuffer, bool frameContext = true);
 	ENGINE_EXPORT void FlushFrames();
 
@@ -62,6 +130,13 @@ public:
 	inline const VkPhysicalDeviceLimits& Limits() const { return mLimits; }
 	inline ::Instance* Instance() const { return mInstance; }
 	inline VkPipelineCache PipelineCache() const { return mPipelineCache; }
+	/// Pipeline caches and pipeline manifests are kept here between runs
+	inline const std::string& CacheDirectory() const { return mCacheDirectory; }
+	/// Writes the pipeline cache to CacheDirectory(). It's loaded when a Device is created for the same GPU and driver version.
+	/// Called when the device is destroyed
+	ENGINE_EXPORT void SavePipelineCache();
+	/// Returns a render pass with the given layout to create pipelines against, owned by the device
+	ENGINE_EXPORT ::RenderPass* CompatibleRenderPass(const RenderPassLayout& layout);
 
 	inline operator VkDevice() const { return mDevice; }
 
@@ -69,34 +144,66 @@ private:
 	friend class DescriptorSet;
 	friend class CommandBuffer;
 	friend class ::Instance;
+	friend class ::UploadQueue;
+	// returns the command pool of the calling thread and the mutex that guards it, mCommandPoolMutex must be held
+	ENGINE_EXPORT VkCommandPool GetCommandPool(const std::string& name, std::mutex*& poolMutex);
+	// writes the first timestamp of a region into the current frame context, and returns the region's index.
+	// returns INVALID_TIMESTAMP_REGION if the region can't be timed: timestamps are only written into primary command buffers
+	// recorded on the profiler's thread, and the pool can only be reset outside of a render pass
+	ENGINE_EXPORT uint32_t BeginTimestampRegion(CommandBuffer* commandBuffer);
+	ENGINE_EXPORT void EndTimestampRegion(CommandBuffer* commandBuffer, uint32_t region);
+
 	ENGINE_EXPORT Device(::Instance* instance, VkPhysicalDevice physicalDevice, uint32_t physicalDeviceIndex, uint32_t graphicsQueue, uint32_t presentQueue, const std::set<std::string>& deviceExtensions, std::vector<const char*> validationLayers);
 
 	::Instance* mInstance;
 	uint32_t mFrameContextIndex; // assigned by mInstance
 	FrameContext* mFrameContexts;
 
+	VkPhysicalDeviceProperties mProperties;
 	VkPhysicalDeviceLimits mLimits;
+	VkPhysicalDeviceMemoryProperties mMemoryProperties;
+	::MemoryAllocator* mMemoryAllocator;
+	::UploadQueue* mUploadQueue;
 
 	uint32_t mMaxMSAASamples;
 	uint32_t mPhysicalDeviceIndex;
 	VkPhysicalDevice mPhysicalDevice;
 	VkDevice mDevice;
 	VkPipelineCache mPipelineCache;
+	std::string mCacheDirectory;
+	std::mutex mCompatibleRenderPassMutex;
+	std::unordered_map<uint64_t, ::RenderPass*> mCompatibleRenderPasses;
 
 	uint32_t mGraphicsQueueFamily;
 	uint32_t mPresentQueueFamily;
+	uint32_t mTransferQueueFamily;
 
 	VkQueue mGraphicsQueue;
 	VkQueue mPresentQueue;
+	VkQueue mTransferQueue;
 
 	VkDescriptorPool mDescriptorPool;
 
+	PFN_vkCmdDrawIndexedIndirectCountKHR mCmdDrawIndexedIndirectCount;
+	bool mMultiviewSupported;
+	bool mTextureCompressionBCSupported;
+	bool mMultiDrawIndirectSupported;
+	bool mDrawIndirectFirstInstanceSupported;
+	bool mMemoryBudgetSupported;
+	// valid bits of the graphics queue's timestamps, 0 if it doesn't support them
+	uint64_t mTimestampMask;
+
 	std::mutex mTmpDescriptorSetMutex;
 	std::mutex mTmpBufferMutex;
 	std::mutex mDescriptorPoolMutex;
+	// guards the maps below. Lock it before a pool's mutex when both are needed
 	std::mutex mCommandPoolMutex;
 	std::unordered_map<std::thread::id, VkCommandPool> mCommandPools;
+	// guards each pool while command buffers are allocated from it, reset or freed, which may happen on threads other than its own
+	std::unordered_map<VkCommandPool, std::mutex> mCommandPoolMutexes;
 	std::unordered_map<VkCommandPool, std::queue<std::shared_ptr<CommandBuffer>>> mCommandBuffers;
+	// secondary command buffers that are ready to be reused
+	std::unordered_map<VkCommandPool, std::queue<std::shared_ptr<CommandBuffer>>> mSecondaryCommandBuffers;
 
 	#ifdef ENABLE_DEBUG_LAYERS
 	PFN_vkSetDebugUtilsObjectNameEXT SetDebugUtilsObjectNameEXT;
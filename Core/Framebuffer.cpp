@@ -8,7 +8,7 @@ Framebuffer::Framebuffer(const string& name, ::Device* device, uint32_t width, u
 	const vector<VkFormat>& colorFormats, VkFormat depthFormat, VkSampleCountFlagBits sampleCount,
 	const vector<VkSubpassDependency>& dependencies, VkAttachmentLoadOp loadOp)
 	: mName(name), mDevice(device), mRenderPass(nullptr),
-	mWidth(width), mHeight(height), mSampleCount(sampleCount), mColorFormats(colorFormats), mDepthFormat(depthFormat), mSubpassDependencies(dependencies), mLoadOp(loadOp) {
+	mWidth(width), mHeight(height), mSampleCount(sampleCount), mViewCount(1), mColorFormats(colorFormats), mDepthFormat(depthFormat), mSubpassDependencies(dependencies), mLoadOp(loadOp) {
 
 	mFramebuffers = new VkFramebuffer[mDevice->MaxFramesInFlight()];
 	mColorBuffers = colorFormats.size() ? new vector<Texture*>[mDevice->MaxFramesInFlight()] : nullptr;
@@ -81,17 +81,18 @@ void Framebuffer::CreateRenderPass() {
 	subpasses[0].pDepthStencilAttachment = &depthAttachmentRef;
 
 	safe_delete(mRenderPass);
-	mRenderPass = new ::RenderPass(mName + "RenderPass", this, attachments, subpasses, mSubpassDependencies);
+	mRenderPass = new ::RenderPass(mName + "RenderPass", this, attachments, subpasses, mSubpassDependencies, mViewCount);
 	PROFILER_END;
 }
 
 bool Framebuffer::UpdateBuffers() {
 	uint32_t frameContextIndex = mDevice->FrameContextIndex();
 
-	if (!mRenderPass || mRenderPass->RasterizationSamples() != mSampleCount) CreateRenderPass();
+	if (!mRenderPass || mRenderPass->RasterizationSamples() != mSampleCount || mRenderPass->ViewCount() != mViewCount) CreateRenderPass();
 
 	if (mFramebuffers[frameContextIndex] == VK_NULL_HANDLE
-		|| mDepthBuffers[frameContextIndex]->Width() != mWidth || mDepthBuffers[frameContextIndex]->Height() != mHeight || mDepthBuffers[frameContextIndex]->SampleCount() != mSampleCount) {
+		|| mDepthBuffers[frameContextIndex]->Width() != mWidth || mDepthBuffers[frameContextIndex]->Height() != mHeight || mDepthBuffers[frameContextIndex]->SampleCount() != mSampleCount
+		|| mDepthBuffers[frameContextIndex]->ArrayLayers() != mViewCount) {
 		
 		PROFILER_BEGIN("Create Framebuffers");
 		if (mFramebuffers[frameContextIndex] != VK_NULL_HANDLE)
@@ -105,12 +106,12 @@ bool Framebuffer::UpdateBuffers() {
 		for (uint32_t i = 0; i < mColorFormats.size(); i++) {
 			safe_delete(mColorBuffers[frameContextIndex][i]);
 			mColorBuffers[frameContextIndex][i] = new Texture(mName + "ColorBuffer", mDevice, mWidth, mHeight, 1, mColorFormats[i],
-				mSampleCount, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+				mSampleCount, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mViewCount);
 			views[i] = mColorBuffers[frameContextIndex][i]->View();
 		}
 
 		safe_delete(mDepthBuffers[frameContextIndex]);
-		mDepthBuffers[frameContextIndex] = new Texture(mName + "DepthBuffer", mDevice, mWidth, mHeight, 1, mDepthFormat, mSampleCount, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		mDepthBuffers[frameContextIndex] = new Texture(mName + "DepthBuffer", mDevice, mWidth, mHeight, 1, mDepthFormat, mSampleCount, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mViewCount);
 		views[views.size() - 1] = mDepthBuffers[frameContextIndex]->View();
 
 		VkFramebufferCreateInfo fb = {};
@@ -120,7 +121,7 @@ bool Framebuffer::UpdateBuffers() {
 		fb.renderPass = *mRenderPass;
 		fb.width = mWidth;
 		fb.height = mHeight;
-		fb.layers = 1;
+		fb.layers = 1; // multiview render passes write the views' layers themselves
 		vkCreateFramebuffer(*mDevice, &fb, nullptr, &mFramebuffers[frameContextIndex]);
 		mDevice->SetObjectName(mFramebuffers[frameContextIndex], mName + " Framebuffer " + to_string(frameContextIndex), VK_OBJECT_TYPE_FRAMEBUFFER);
 		PROFILER_END;
@@ -129,7 +130,7 @@ bool Framebuffer::UpdateBuffers() {
 	return false;
 }
 
-void Framebuffer::BeginRenderPass(CommandBuffer* commandBuffer) {
+void Framebuffer::BeginRenderPass(CommandBuffer* commandBuffer, VkSubpassContents contents) {
 	uint32_t frameContextIndex = mDevice->FrameContextIndex();
 	if (UpdateBuffers()) {
 		if (mColorFormats.size()) {
@@ -146,10 +147,13 @@ void Framebuffer::BeginRenderPass(CommandBuffer* commandBuffer) {
 		}
 		mDepthBuffers[frameContextIndex]->TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, commandBuffer);
 	}
-	commandBuffer->BeginRenderPass(mRenderPass, { mWidth, mHeight }, mFramebuffers[frameContextIndex], mClearValues.data(), (uint32_t)mClearValues.size());
+	commandBuffer->BeginRenderPass(mRenderPass, { mWidth, mHeight }, mFramebuffers[frameContextIndex], mClearValues.data(), (uint32_t)mClearValues.size(), contents);
 }
 
 void Framebuffer::Clear(CommandBuffer* commandBuffer) {
+	Clear(commandBuffer, { { 0, 0 }, { mWidth, mHeight } });
+}
+void Framebuffer::Clear(CommandBuffer* commandBuffer, const VkRect2D& rect) {
 	vector<VkClearAttachment> clears(mClearValues.size());
 	for (uint32_t i = 0; i < mClearValues.size(); i++) {
 		clears[i] = {};
@@ -158,13 +162,17 @@ void Framebuffer::Clear(CommandBuffer* commandBuffer) {
 		clears[i].aspectMask = i == mColorFormats.size() ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
 	}
 
-	VkClearRect rect = {};
-	rect.layerCount = 1;
-	rect.rect.extent = { mWidth, mHeight };
-	vkCmdClearAttachments(*commandBuffer, clears.size(), clears.data(), 1, &rect);
+	VkClearRect clearRect = {};
+	clearRect.layerCount = 1;
+	clearRect.rect.offset.x = clamp(rect.offset.x, 0, (int32_t)mWidth);
+	clearRect.rect.offset.y = clamp(rect.offset.y, 0, (int32_t)mHeight);
+	clearRect.rect.extent.width = min(rect.extent.width, mWidth - clearRect.rect.offset.x);
+	clearRect.rect.extent.height = min(rect.extent.height, mHeight - clearRect.rect.offset.y);
+	if (clearRect.rect.extent.width == 0 || clearRect.rect.extent.height == 0) return;
+	vkCmdClearAttachments(*commandBuffer, (uint32_t)clears.size(), clears.data(), 1, &clearRect);
 }
 
-void Framebuffer::ResolveColor(CommandBuffer* commandBuffer, uint32_t index, VkImage destination) {
+void Framebuffer::ResolveColor(CommandBuffer* commandBuffer, uint32_t index, VkImage destination, const VkOffset2D& viewOffset) {
 	if (!mColorBuffers) return;
 
 	uint32_t frameContextIndex = mDevice->FrameContextIndex();
@@ -172,25 +180,35 @@ void Framebuffer::ResolveColor(CommandBuffer* commandBuffer, uint32_t index, VkI
 	mColorBuffers[frameContextIndex][index]->TransitionImageLayout(VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, commandBuffer);
 
 	if (mSampleCount == VK_SAMPLE_COUNT_1_BIT) {
-		VkImageCopy region = {};
-		region.extent = { mWidth, mHeight, 1 };
-		region.dstSubresource.layerCount = 1;
-		region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		region.srcSubresource.layerCount = 1;
-		region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		vector<VkImageCopy> regions(mViewCount);
+		for (uint32_t i = 0; i < mViewCount; i++) {
+			regions[i] = {};
+			regions[i].extent = { mWidth, mHeight, 1 };
+			regions[i].dstOffset = { viewOffset.x * (int32_t)i, viewOffset.y * (int32_t)i, 0 };
+			regions[i].dstSubresource.layerCount = 1;
+			regions[i].dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			regions[i].srcSubresource.baseArrayLayer = i;
+			regions[i].srcSubresource.layerCount = 1;
+			regions[i].srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		}
 		vkCmdCopyImage(*commandBuffer,
 			mColorBuffers[frameContextIndex][index]->Image(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+			destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
 	} else {
-		VkImageResolve region = {};
-		region.extent = { mWidth, mHeight, 1 };
-		region.dstSubresource.layerCount = 1;
-		region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		region.srcSubresource.layerCount = 1;
-		region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		vector<VkImageResolve> regions(mViewCount);
+		for (uint32_t i = 0; i < mViewCount; i++) {
+			regions[i] = {};
+			regions[i].extent = { mWidth, mHeight, 1 };
+			regions[i].dstOffset = { viewOffset.x * (int32_t)i, viewOffset.y * (int32_t)i, 0 };
+			regions[i].dstSubresource.layerCount = 1;
+			regions[i].dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			regions[i].srcSubresource.baseArrayLayer = i;
+			regions[i].srcSubresource.layerCount = 1;
+			regions[i].srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		}
 		vkCmdResolveImage(*commandBuffer,
 			mColorBuffers[frameContextIndex][index]->Image(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+			destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
 	}
 
 	mColorBuffers[frameContextIndex][index]->TransitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, commandBuffer);
@@ -18,23 +18,30 @@ public:
 	inline void Width(uint32_t w) { mWidth = w; }
 	inline void Height(uint32_t h) { mHeight = h; }
 	inline void SampleCount(VkSampleCountFlagBits s) { mSampleCount = s; }
+	/// Renders to viewCount array layers of every attachment at once with multiview, see Device::MultiviewSupported.
+	/// Width and Height are the size of a single view
+	inline void ViewCount(uint32_t v) { mViewCount = v; }
 
 	inline uint32_t Width() const { return mWidth; }
 	inline uint32_t Height() const { return mHeight; }
 	inline VkSampleCountFlagBits SampleCount() const { return mSampleCount; }
+	inline uint32_t ViewCount() const { return mViewCount; }
 
 	inline void ClearValue(uint32_t i, const VkClearValue& value) { mClearValues[i] = value; }
 
 	inline Texture* ColorBuffer(uint32_t i) { return mColorBuffers[mDevice->FrameContextIndex()][i]; }
 	inline Texture* DepthBuffer() { return mDepthBuffers[mDevice->FrameContextIndex()]; }
 
-	ENGINE_EXPORT void ResolveColor(CommandBuffer* commandBuffer, uint32_t index, VkImage destination);
+	/// Resolves or copies a color buffer to destination. With multiple views, view i is written at viewOffset * i
+	ENGINE_EXPORT void ResolveColor(CommandBuffer* commandBuffer, uint32_t index, VkImage destination, const VkOffset2D& viewOffset = { 0, 0 });
 	ENGINE_EXPORT void ResolveDepth(CommandBuffer* commandBuffer, VkImage destination);
 
 	inline uint32_t ColorBufferCount() const { return mColorBuffers ? (uint32_t)mColorBuffers[mDevice->FrameContextIndex()].size() : 0; }
 
 	ENGINE_EXPORT void Clear(CommandBuffer* commandBuffer);
-	ENGINE_EXPORT void BeginRenderPass(CommandBuffer* commandBuffer);
+	/// Clears the attachments inside rect, which is clamped to the framebuffer
+	ENGINE_EXPORT void Clear(CommandBuffer* commandBuffer, const VkRect2D& rect);
+	ENGINE_EXPORT void BeginRenderPass(CommandBuffer* commandBuffer, VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
 	inline ::RenderPass* RenderPass() const { return mRenderPass; }
 	inline ::Device* Device() const { return mDevice; }
 
@@ -51,6 +58,7 @@ private:
 	uint32_t mWidth;
 	uint32_t mHeight;
 	VkSampleCountFlagBits mSampleCount;
+	uint32_t mViewCount;
 	std::vector<VkFormat> mColorFormats;
 	std::vector<VkClearValue> mClearValues;
 	VkFormat mDepthFormat;
@@ -3,6 +3,7 @@
 #include <Core/Window.hpp>
 #include <Scene/Camera.hpp>
 #include <Util/Profiler.hpp>
+#include <Util/ThreadPool.hpp>
 #include <Core/PluginManager.hpp>
 
 using namespace std;
@@ -61,7 +62,7 @@ LRESULT CALLBACK Instance::WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARA
 #endif
 
 Instance::Instance(int argc, char** argv, PluginManager* pluginManager)
-	: mInstance(VK_NULL_HANDLE), mFrameCount(0), mMaxFramesInFlight(0), mTotalTime(0), mDeltaTime(0), mWindow(nullptr), mWindowInput(nullptr), mDestroyPending(false)
+	: mInstance(VK_NULL_HANDLE), mFrameCount(0), mMaxFramesInFlight(0), mTotalTime(0), mDeltaTime(0), mWindow(nullptr), mThreadPool(nullptr), mWindowInput(nullptr), mDestroyPending(false)
 	#ifdef ENABLE_DEBUG_LAYERS
 	, mDebugMessenger(VK_NULL_HANDLE)
 	#endif
@@ -74,10 +75,14 @@ Instance::Instance(int argc, char** argv, PluginManager* pluginManager)
 	uint32_t deviceIndex = 0;
 	VkRect2D windowPosition = { { 160, 90 }, { 1600, 900 } };
 	bool fullscreen = false;
+	uint32_t threadCount = 0;
 	for (int i = 0; i < argc; i++) {
 		if (mCmdArguments[i] == "--device") {
 			i++;
 			if (i < argc) deviceIndex = atoi(argv[i]);
+		} else if (mCmdArguments[i] == "--threads") {
+			i++;
+			if (i < argc) threadCount = atoi(argv[i]);
 		} else if (mCmdArguments[i] == "--fullscreen")
 			fullscreen = true;
 		else if (mCmdArguments[i] == "--nodebug")
@@ -87,6 +92,8 @@ Instance::Instance(int argc, char** argv, PluginManager* pluginManager)
 
 	memset(const_cast<ProfilerSample*>(Profiler::Frames()), 0, sizeof(ProfilerSample)* PROFILER_FRAME_COUNT);
 
+	mThreadPool = new ::ThreadPool(threadCount);
+
 	mInstanceExtensions  = { VK_KHR_SURFACE_EXTENSION_NAME };
 	mDeviceExtensions = {
 		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
@@ -281,13 +288,16 @@ Instance::Instance(int argc, char** argv, PluginManager* pluginManager)
 	mMaxFramesInFlight = mWindow->mImageCount;
 
 	mDevice->mFrameContexts = new Device::FrameContext[mMaxFramesInFlight];
-	for (uint32_t i = 0; i < mMaxFramesInFlight; i++)
+	for (uint32_t i = 0; i < mMaxFramesInFlight; i++) {
 		mDevice->mFrameContexts[i].mDevice = mDevice;
+		mDevice->mFrameContexts[i].Reset();
+	}
 
 	mStartTime = mClock.now();
 	mLastFrame = mClock.now();
 }
 Instance::~Instance() {
+	safe_delete(mThreadPool);
 	safe_delete(mWindow);
 
 	#ifdef __linux
@@ -17,6 +17,7 @@ namespace x11{
 
 class Window;
 class Device;
+class ThreadPool;
 class PluginManager;
 
 class Instance {
@@ -25,6 +26,8 @@ public:
 
 	inline ::Device* Device() const { return mDevice; }
 	inline ::Window* Window() const { return mWindow; }
+	/// Worker threads shared by the engine. Sized with --threads (defaults to one per hardware thread)
+	inline ::ThreadPool* ThreadPool() const { return mThreadPool; }
 
 	inline float TotalTime() const { return mTotalTime; }
 	inline float DeltaTime() const { return mDeltaTime; }
@@ -53,6 +56,7 @@ private:
 
 	::Device* mDevice;
 	::Window* mWindow;
+	::ThreadPool* mThreadPool;
 	uint32_t mMaxFramesInFlight;
 	uint64_t mFrameCount;
 
@@ -0,0 +1,289 @@
+#include <Core/MemoryAllocator.hpp>
+#include <Core/Device.hpp>
+
+using namespace std;
+
+// size of the blocks that allocations are taken from, shrunk for small heaps
+#define MEMORY_BLOCK_SIZE (64 * 1024 * 1024)
+#define MEMORY_MIN_BLOCK_SIZE (1024 * 1024)
+// smallest range the buddy allocator hands out, free list allocations are rounded up to a multiple of it
+#define MEMORY_MIN_ALLOCATION 256
+// largest request the buddy allocator takes, larger ones are allocated from the free list blocks
+#define MEMORY_MAX_BUDDY_ALLOCATION (256 * 1024)
+
+inline uint32_t Log2(VkDeviceSize x) {
+	uint32_t r = 0;
+	while (x >>= 1) r++;
+	return r;
+}
+inline VkDeviceSize NextPowerOfTwo(VkDeviceSize x) {
+	VkDeviceSize r = 1;
+	while (r < x) r <<= 1;
+	return r;
+}
+
+MemoryAllocator::MemoryAllocator(Device* device)
+	: mDevice(device), mDedicatedAllocationCount(0), mDedicatedBytes(0), mAllocationCount(0), mBytesInUse(0), mBytesReserved(0) {
+	const VkPhysicalDeviceMemoryProperties& properties = mDevice->MemoryProperties();
+	mPools.resize(2 * properties.memoryTypeCount);
+	for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+		// keep a single block below an eighth of its heap so small heaps aren't exhausted by partially used blocks
+		VkDeviceSize heapSize = properties.memoryHeaps[properties.memoryTypes[i].heapIndex].size;
+		VkDeviceSize blockSize = MEMORY_BLOCK_SIZE;
+		while (blockSize > MEMORY_MIN_BLOCK_SIZE && blockSize > heapSize / 8) blockSize >>= 1;
+		mPools[2 * i].mBlockSize = blockSize;
+		mPools[2 * i + 1].mBlockSize = blockSize;
+	}
+}
+MemoryAllocator::~MemoryAllocator() {
+	if (mAllocationCount)
+		fprintf_color(COLOR_YELLOW, stderr, "Destroying MemoryAllocator with %u live allocations (%.1fkb)\n", mAllocationCount, mBytesInUse / 1024.f);
+	for (Pool& pool : mPools)
+		for (Block* block : pool.mBlocks)
+			if (block) {
+				vkFreeMemory(*mDevice, block->mMemory, nullptr);
+				delete block;
+			}
+}
+
+VkDeviceMemory MemoryAllocator::AllocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped, const string& name) {
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	if (vkAllocateMemory(*mDevice, &allocInfo, nullptr, &memory) != VK_SUCCESS) return VK_NULL_HANDLE;
+	mDevice->SetObjectName(memory, name, VK_OBJECT_TYPE_DEVICE_MEMORY);
+	#ifdef PRINT_VK_ALLOCATIONS
+	fprintf_color(COLOR_YELLOW, stdout, "Allocated %.1fkb of device memory for %s\n", size / 1024.f, name.c_str());
+	#endif
+
+	*mapped = nullptr;
+	if (mDevice->MemoryProperties().memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		ThrowIfFailed(vkMapMemory(*mDevice, memory, 0, VK_WHOLE_SIZE, 0, mapped), "vkMapMemory failed for " + name);
+	return memory;
+}
+
+bool MemoryAllocator::AllocateFromBlock(Block* block, VkDeviceSize blockSize, uint32_t level, VkDeviceSize& offset) {
+	// find the smallest free range that fits, then split it down to the requested level
+	int32_t l = (int32_t)level;
+	while (l >= 0 && block->mFreeLists[l].empty()) l--;
+	if (l < 0) return false;
+
+	// taking the lowest offset keeps allocations packed towards the start of the block
+	offset = *block->mFreeLists[l].begin();
+	block->mFreeLists[l].erase(block->mFreeLists[l].begin());
+	while ((uint32_t)l < level) {
+		l++;
+		block->mFreeLists[l].insert(offset + (blockSize >> l));
+	}
+	return true;
+}
+void MemoryAllocator::FreeToBlock(Block* block, VkDeviceSize blockSize, uint32_t level, VkDeviceSize offset) {
+	// merge with the buddy range for as long as it is free
+	while (level > 0) {
+		VkDeviceSize buddy = offset ^ (blockSize >> level);
+		auto it = block->mFreeLists[level].find(buddy);
+		if (it == block->mFreeLists[level].end()) break;
+		block->mFreeLists[level].erase(it);
+		offset = min(offset, buddy);
+		level--;
+	}
+	block->mFreeLists[level].insert(offset);
+}
+
+bool MemoryAllocator::AllocateFromRanges(Block* block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) {
+	// best fit: the smallest free range that holds size bytes once its start is aligned
+	auto best = block->mFreeRanges.end();
+	VkDeviceSize bestOffset = 0;
+	for (auto it = block->mFreeRanges.begin(); it != block->mFreeRanges.end(); it++) {
+		VkDeviceSize aligned = AlignUp(it->first, alignment);
+		if (aligned + size > it->first + it->second) continue;
+		if (best == block->mFreeRanges.end() || it->second < best->second) {
+			best = it;
+			bestOffset = aligned;
+		}
+	}
+	if (best == block->mFreeRanges.end()) return false;
+
+	VkDeviceSize rangeStart = best->first;
+	VkDeviceSize rangeEnd = best->first + best->second;
+	block->mFreeRanges.erase(best);
+	// the padding in front of the aligned offset and the rest of the range stay free
+	if (bestOffset > rangeStart) block->mFreeRanges.emplace(rangeStart, bestOffset - rangeStart);
+	if (bestOffset + size < rangeEnd) block->mFreeRanges.emplace(bestOffset + size, rangeEnd - (bestOffset + size));
+	offset = bestOffset;
+	return true;
+}
+void MemoryAllocator::FreeToRanges(Block* block, VkDeviceSize offset, VkDeviceSize size) {
+	auto next = block->mFreeRanges.lower_bound(offset);
+	// merge with the free range that ends where this one starts, and the one that starts where it ends
+	if (next != block->mFreeRanges.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset) {
+			offset = prev->first;
+			size += prev->second;
+			block->mFreeRanges.erase(prev);
+		}
+	}
+	if (next != block->mFreeRanges.end() && offset + size == next->first) {
+		size += next->second;
+		block->mFreeRanges.erase(next);
+	}
+	block->mFreeRanges.emplace(offset, size);
+}
+
+MemoryAllocation MemoryAllocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear, const string& name) {
+	MemoryAllocation allocation;
+	allocation.mMemoryType = mDevice->FindMemoryType(requirements.memoryTypeBits, properties);
+	allocation.mRequestedSize = requirements.size;
+	allocation.mPool = 2 * allocation.mMemoryType + (linear ? 0 : 1);
+
+	lock_guard lock(mMutex);
+	Pool& pool = mPools[allocation.mPool];
+
+	// buddy ranges are aligned to their size, so rounding up to the alignment satisfies it too
+	bool buddy = max(requirements.size, requirements.alignment) <= MEMORY_MAX_BUDDY_ALLOCATION;
+	VkDeviceSize size = buddy ?
+		NextPowerOfTwo(max(max(requirements.size, requirements.alignment), (VkDeviceSize)MEMORY_MIN_ALLOCATION)) :
+		AlignUp(requirements.size, MEMORY_MIN_ALLOCATION);
+	if (size <= pool.mBlockSize / 2) {
+		uint32_t level = Log2(pool.mBlockSize) - Log2(size);
+		auto AllocateFrom = [&](Block* block, VkDeviceSize& offset) {
+			if (buddy) return AllocateFromBlock(block, pool.mBlockSize, level, offset);
+			return AllocateFromRanges(block, size, requirements.alignment, offset);
+		};
+
+		VkDeviceSize offset;
+		uint32_t blockIndex = ~0u;
+		for (uint32_t i = 0; i < pool.mBlocks.size(); i++)
+			if (pool.mBlocks[i] && pool.mBlocks[i]->mBuddy == buddy && AllocateFrom(pool.mBlocks[i], offset)) {
+				blockIndex = i;
+				break;
+			}
+
+		if (blockIndex == ~0u) {
+			void* mapped;
+			VkDeviceMemory memory = AllocateDeviceMemory(pool.mBlockSize, allocation.mMemoryType, &mapped, "Memory Block (type " + to_string(allocation.mMemoryType) + (linear ? ", linear)" : ", optimal)"));
+			if (memory != VK_NULL_HANDLE) {
+				Block* block = new Block();
+				block->mMemory = memory;
+				block->mMapped = mapped;
+				block->mBuddy = buddy;
+				block->mAllocationCount = 0;
+				if (buddy) {
+					block->mFreeLists.resize(Log2(pool.mBlockSize) - Log2(MEMORY_MIN_ALLOCATION) + 1);
+					block->mFreeLists[0].insert(0);
+				} else
+					block->mFreeRanges.emplace(0, pool.mBlockSize);
+
+				for (blockIndex = 0; blockIndex < pool.mBlocks.size(); blockIndex++)
+					if (!pool.mBlocks[blockIndex]) break;
+				if (blockIndex == pool.mBlocks.size()) pool.mBlocks.push_back(block);
+				else pool.mBlocks[blockIndex] = block;
+
+				AllocateFrom(block, offset);
+			}
+			// otherwise the heap can't fit another block, fall through to a dedicated allocation
+		}
+
+		if (blockIndex != ~0u) {
+			Block* block = pool.mBlocks[blockIndex];
+			block->mAllocationCount++;
+			allocation.mDeviceMemory = block->mMemory;
+			allocation.mOffset = offset;
+			allocation.mSize = size;
+			allocation.mMapped = block->mMapped ? (uint8_t*)block->mMapped + offset : nullptr;
+			allocation.mBlock = blockIndex;
+
+			mAllocationCount++;
+			mBytesInUse += requirements.size;
+			mBytesReserved += size;
+			return allocation;
+		}
+	}
+
+	allocation.mDeviceMemory = AllocateDeviceMemory(requirements.size, allocation.mMemoryType, &allocation.mMapped, name + " Memory");
+	if (allocation.mDeviceMemory == VK_NULL_HANDLE) throw runtime_error("vkAllocateMemory failed for " + name);
+	allocation.mOffset = 0;
+	allocation.mSize = requirements.size;
+	allocation.mBlock = ~0u;
+
+	mDedicatedAllocationCount++;
+	mDedicatedBytes += requirements.size;
+	mAllocationCount++;
+	mBytesInUse += requirements.size;
+	mBytesReserved += requirements.size;
+	return allocation;
+}
+
+void MemoryAllocator::Free(const MemoryAllocation& allocation) {
+	if (allocation.mDeviceMemory == VK_NULL_HANDLE) return;
+
+	lock_guard lock(mMutex);
+	mAllocationCount--;
+	mBytesInUse -= allocation.mRequestedSize;
+	mBytesReserved -= allocation.mSize;
+
+	if (allocation.mBlock == ~0u) {
+		vkFreeMemory(*mDevice, allocation.mDeviceMemory, nullptr);
+		mDedicatedAllocationCount--;
+		mDedicatedBytes -= allocation.mSize;
+		return;
+	}
+
+	Pool& pool = mPools[allocation.mPool];
+	Block* block = pool.mBlocks[allocation.mBlock];
+	if (block->mBuddy)
+		FreeToBlock(block, pool.mBlockSize, Log2(pool.mBlockSize) - Log2(allocation.mSize), allocation.mOffset);
+	else
+		FreeToRanges(block, allocation.mOffset, allocation.mSize);
+
+	if (--block->mAllocationCount == 0) {
+		// release empty blocks, but keep the last one of each kind around so a pool doesn't reallocate every time it empties
+		uint32_t liveBlocks = 0;
+		for (Block* b : pool.mBlocks)
+			if (b && b->mBuddy == block->mBuddy) liveBlocks++;
+		if (liveBlocks > 1) {
+			vkFreeMemory(*mDevice, block->mMemory, nullptr);
+			#ifdef PRINT_VK_ALLOCATIONS
+			fprintf_color(COLOR_BLUE, stdout, "Freed %.1fkb memory block\n", pool.mBlockSize / 1024.f);
+			#endif
+			delete block;
+			pool.mBlocks[allocation.mBlock] = nullptr;
+		}
+	}
+}
+
+MemoryAllocator::Stats MemoryAllocator::GetStats() {
+	lock_guard lock(mMutex);
+	Stats stats = {};
+	stats.mDeviceAllocationCount = mDedicatedAllocationCount;
+	stats.mAllocationCount = mAllocationCount;
+	stats.mBytesAllocated = mDedicatedBytes;
+	stats.mBytesInUse = mBytesInUse;
+	stats.mBytesReserved = mBytesReserved;
+	for (const Pool& pool : mPools)
+		for (const Block* block : pool.mBlocks) {
+			if (!block) continue;
+			stats.mDeviceAllocationCount++;
+			stats.mBytesAllocated += pool.mBlockSize;
+			for (uint32_t level = 0; level < block->mFreeLists.size(); level++) {
+				if (block->mFreeLists[level].empty()) continue;
+				stats.mBytesFree += block->mFreeLists[level].size() * (pool.mBlockSize >> level);
+				stats.mLargestFreeRange = max(stats.mLargestFreeRange, pool.mBlockSize >> level);
+			}
+			for (const auto& range : block->mFreeRanges) {
+				stats.mBytesFree += range.second;
+				stats.mLargestFreeRange = max(stats.mLargestFreeRange, range.second);
+			}
+		}
+	return stats;
+}
+void MemoryAllocator::PrintStats() {
+	Stats stats = GetStats();
+	printf("Device memory: %u allocations in %u device allocations\n", stats.mAllocationCount, stats.mDeviceAllocationCount);
+	printf("\t%.2fmb allocated, %.2fmb in use, %.2fmb reserved, %.2fmb free\n",
+		stats.mBytesAllocated / (1024.f * 1024.f), stats.mBytesInUse / (1024.f * 1024.f), stats.mBytesReserved / (1024.f * 1024.f), stats.mBytesFree / (1024.f * 1024.f));
+	printf("\tlargest free range %.2fmb, fragmentation %.1f%%\n", stats.mLargestFreeRange / (1024.f * 1024.f), stats.Fragmentation() * 100.f);
+}
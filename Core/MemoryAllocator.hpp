@@ -0,0 +1,99 @@
+#pragma once
+
+#include <map>
+#include <set>
+
+#include <Util/Util.hpp>
+
+class Device;
+
+/// A range of device memory handed out by MemoryAllocator
+struct MemoryAllocation {
+	VkDeviceMemory mDeviceMemory;
+	VkDeviceSize mOffset;
+	// size of the range, rounded up from the requested size
+	VkDeviceSize mSize;
+	// size that was requested
+	VkDeviceSize mRequestedSize;
+	uint32_t mMemoryType;
+	// pointer to mOffset inside the persistently mapped block, or nullptr if the memory isn't host visible
+	void* mMapped;
+
+	// pool and block the range was taken from, mBlock is ~0u for dedicated allocations
+	uint32_t mPool;
+	uint32_t mBlock;
+
+	inline MemoryAllocation() : mDeviceMemory(VK_NULL_HANDLE), mOffset(0), mSize(0), mRequestedSize(0), mMemoryType(0), mMapped(nullptr), mPool(0), mBlock(~0u) {}
+};
+
+/// Sub-allocates Buffer and Texture memory from large VkDeviceMemory blocks. Small requests use a buddy allocator inside their
+/// blocks, larger ones would lose up to half their size to power of two rounding so they're taken from blocks with a best-fit
+/// free list instead. Linear (buffer) and optimal (image) resources are kept in separate pools for every memory type, so
+/// bufferImageGranularity never has to be considered. Requests larger than half a block get a dedicated VkDeviceMemory.
+/// Host visible blocks are mapped once when they are created. Thread safe.
+class MemoryAllocator {
+public:
+	struct Stats {
+		// number of VkDeviceMemory objects, including dedicated allocations
+		uint32_t mDeviceAllocationCount;
+		uint32_t mAllocationCount;
+		// bytes allocated from the device
+		VkDeviceSize mBytesAllocated;
+		// bytes requested by live allocations
+		VkDeviceSize mBytesInUse;
+		// bytes taken by live allocations after rounding, mBytesReserved - mBytesInUse is lost to internal fragmentation
+		VkDeviceSize mBytesReserved;
+		// free bytes inside blocks, and the largest free range among them
+		VkDeviceSize mBytesFree;
+		VkDeviceSize mLargestFreeRange;
+
+		/// 1 - largest free range / free bytes: 0 when all free memory is in one range, approaches 1 as it splinters
+		inline float Fragmentation() const { return mBytesFree ? 1.f - (float)((double)mLargestFreeRange / (double)mBytesFree) : 0.f; }
+	};
+
+	ENGINE_EXPORT MemoryAllocator(Device* device);
+	ENGINE_EXPORT ~MemoryAllocator();
+
+	/// linear should be true for buffers and linear-tiled images, false for optimal-tiled images
+	ENGINE_EXPORT MemoryAllocation Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear, const std::string& name);
+	ENGINE_EXPORT void Free(const MemoryAllocation& allocation);
+
+	ENGINE_EXPORT Stats GetStats();
+	ENGINE_EXPORT void PrintStats();
+
+private:
+	struct Block {
+		VkDeviceMemory mMemory;
+		void* mMapped;
+		// true if the block is split by the buddy allocator, false if it's managed by mFreeRanges
+		bool mBuddy;
+		// offsets of the free ranges of each level, level 0 is the whole block and each level halves the range size
+		std::vector<std::set<VkDeviceSize>> mFreeLists;
+		// offset and size of each free range, neighbouring ranges are always merged
+		std::map<VkDeviceSize, VkDeviceSize> mFreeRanges;
+		uint32_t mAllocationCount;
+	};
+	struct Pool {
+		VkDeviceSize mBlockSize;
+		// blocks are never moved, so MemoryAllocation::mBlock stays valid. Released blocks leave a nullptr behind
+		std::vector<Block*> mBlocks;
+	};
+
+	ENGINE_EXPORT VkDeviceMemory AllocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped, const std::string& name);
+	ENGINE_EXPORT bool AllocateFromBlock(Block* block, VkDeviceSize blockSize, uint32_t level, VkDeviceSize& offset);
+	ENGINE_EXPORT void FreeToBlock(Block* block, VkDeviceSize blockSize, uint32_t level, VkDeviceSize offset);
+	ENGINE_EXPORT bool AllocateFromRanges(Block* block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+	ENGINE_EXPORT void FreeToRanges(Block* block, VkDeviceSize offset, VkDeviceSize size);
+
+	Device* mDevice;
+	std::mutex mMutex;
+
+	// two pools for each memory type: mPools[2 * type] for linear resources, mPools[2 * type + 1] for optimal images
+	std::vector<Pool> mPools;
+
+	uint32_t mDedicatedAllocationCount;
+	VkDeviceSize mDedicatedBytes;
+	uint32_t mAllocationCount;
+	VkDeviceSize mBytesInUse;
+	VkDeviceSize mBytesReserved;
+};
@@ -6,11 +6,71 @@ using namespace std;
 RenderPass::RenderPass(const string& name, ::Device* device,
 	const vector<VkAttachmentDescription>& attachments,
 	const vector<VkSubpassDescription>& subpasses,
-	const vector<VkSubpassDependency>& dependencies)
+	const vector<VkSubpassDependency>& dependencies, uint32_t viewCount)
 	: mName(name), mDevice(device), mFramebuffer(nullptr) {
+	Create(attachments, subpasses, dependencies, viewCount);
+}
+RenderPass::RenderPass(const string& name, ::Device* device, const RenderPassLayout& layout)
+	: mName(name), mDevice(device), mFramebuffer(nullptr) {
+	// load ops and layouts don't affect compatibility, so these match what Framebuffer uses
+	vector<VkAttachmentReference> colorAttachments(layout.mColorFormats.size());
+	vector<VkAttachmentDescription> attachments(layout.mColorFormats.size() + 1);
+	for (uint32_t i = 0; i < attachments.size(); i++) {
+		bool depth = i == layout.mColorFormats.size();
+		attachments[i].format = depth ? layout.mDepthFormat : layout.mColorFormats[i];
+		attachments[i].samples = layout.mSampleCount;
+		attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachments[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[i].initialLayout = depth ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		attachments[i].finalLayout = attachments[i].initialLayout;
+		if (!depth) {
+			colorAttachments[i].attachment = i;
+			colorAttachments[i].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		}
+	}
+
+	VkAttachmentReference depthAttachmentRef = {};
+	depthAttachmentRef.attachment = (uint32_t)layout.mColorFormats.size();
+	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	vector<VkSubpassDescription> subpasses(1);
+	subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpasses[0].colorAttachmentCount = (uint32_t)colorAttachments.size();
+	subpasses[0].pColorAttachments = colorAttachments.data();
+	subpasses[0].pDepthStencilAttachment = &depthAttachmentRef;
+	Create(attachments, subpasses, {}, layout.mViewCount);
+}
+RenderPass::RenderPass(const string& name, ::Framebuffer* frameBuffer,
+	const vector<VkAttachmentDescription>& attachments,
+	const vector<VkSubpassDescription>& subpasses,
+	const vector<VkSubpassDependency>& dependencies, uint32_t viewCount)
+	: RenderPass(name, frameBuffer->Device(), attachments, subpasses, dependencies, viewCount) {
+	mFramebuffer = frameBuffer;
+}
+void RenderPass::Create(const vector<VkAttachmentDescription>& attachments, const vector<VkSubpassDescription>& subpasses, const vector<VkSubpassDependency>& dependencies, uint32_t viewCount) {
 	mRasterizationSamples = attachments[subpasses[0].pDepthStencilAttachment->attachment].samples;
 	mColorAttachmentCount = subpasses[0].colorAttachmentCount;
 
+	mLayout.mColorFormats.resize(mColorAttachmentCount);
+	for (uint32_t i = 0; i < mColorAttachmentCount; i++)
+		mLayout.mColorFormats[i] = attachments[subpasses[0].pColorAttachments[i].attachment].format;
+	mLayout.mDepthFormat = attachments[subpasses[0].pDepthStencilAttachment->attachment].format;
+	mLayout.mSampleCount = mRasterizationSamples;
+	mLayout.mViewCount = viewCount;
+	mLayoutHash = mLayout.Hash();
+
+	// every subpass renders all views, and the views are correlated so the implementation can render them concurrently
+	uint32_t viewMask = (1u << viewCount) - 1;
+	vector<uint32_t> viewMasks(subpasses.size(), viewMask);
+	VkRenderPassMultiviewCreateInfo multiviewInfo = {};
+	multiviewInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO;
+	multiviewInfo.subpassCount = (uint32_t)viewMasks.size();
+	multiviewInfo.pViewMasks = viewMasks.data();
+	multiviewInfo.correlationMaskCount = 1;
+	multiviewInfo.pCorrelationMasks = &viewMask;
+
 	VkRenderPassCreateInfo renderPassInfo = {};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
 	renderPassInfo.attachmentCount = (uint32_t)attachments.size();
@@ -19,16 +79,11 @@ RenderPass::RenderPass(const string& name, ::Device* device,
 	renderPassInfo.pSubpasses = subpasses.data();
 	renderPassInfo.dependencyCount = (uint32_t)dependencies.size();
 	renderPassInfo.pDependencies = dependencies.data();
+	if (viewCount > 1) renderPassInfo.pNext = &multiviewInfo;
 	ThrowIfFailed(vkCreateRenderPass(*mDevice, &renderPassInfo, nullptr, &mRenderPass), "vkCreateRenderPass failed");
 	mDevice->SetObjectName(mRenderPass, mName + " RenderPass", VK_OBJECT_TYPE_RENDER_PASS);
 }
-RenderPass::RenderPass(const string& name, ::Framebuffer* frameBuffer,
-	const vector<VkAttachmentDescription>& attachments,
-	const vector<VkSubpassDescription>& subpasses,
-	const vector<VkSubpassDependency>& dependencies)
-	: RenderPass(name, frameBuffer->Device(), attachments, subpasses, dependencies) {
-	mFramebuffer = frameBuffer;
-}
+
 RenderPass::~RenderPass() {
 	vkDestroyRenderPass(*mDevice, mRenderPass, nullptr);
 }
\ No newline at end of file
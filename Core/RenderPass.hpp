@@ -6,31 +6,61 @@
 class Camera;
 class Framebuffer;
 
+/// The attachment formats, sample count and view count of a render pass, which decide the pipelines it's compatible with.
+/// A pipeline created against one render pass can be used in any render pass with the same layout
+struct RenderPassLayout {
+	std::vector<VkFormat> mColorFormats;
+	VkFormat mDepthFormat;
+	VkSampleCountFlagBits mSampleCount;
+	// number of array layers rendered at once with multiview, 1 without multiview
+	uint32_t mViewCount;
+
+	inline uint64_t Hash() const {
+		std::size_t h = 0;
+		for (VkFormat f : mColorFormats) hash_combine(h, f);
+		hash_combine(h, mDepthFormat);
+		hash_combine(h, mSampleCount);
+		hash_combine(h, mViewCount);
+		return h;
+	}
+};
+
 class RenderPass {
 public:
 	const std::string mName;
 
+	/// viewCount > 1 renders every subpass to the first viewCount array layers of the attachments at once, with VK_KHR_multiview
 	ENGINE_EXPORT RenderPass(const std::string& name, ::Device* device,
 		const std::vector<VkAttachmentDescription>& attachments,
 		const std::vector<VkSubpassDescription>& subpasses,
-		const std::vector<VkSubpassDependency>& dependencies);
+		const std::vector<VkSubpassDependency>& dependencies, uint32_t viewCount = 1);
 	ENGINE_EXPORT RenderPass(const std::string& name, ::Framebuffer* frameBuffer,
 		const std::vector<VkAttachmentDescription>& attachments,
 		const std::vector<VkSubpassDescription>& subpasses,
-		const std::vector<VkSubpassDependency>& dependencies);
+		const std::vector<VkSubpassDependency>& dependencies, uint32_t viewCount = 1);
+	/// Creates a render pass that is only used to create pipelines for render passes with the same layout
+	ENGINE_EXPORT RenderPass(const std::string& name, ::Device* device, const RenderPassLayout& layout);
 	ENGINE_EXPORT ~RenderPass();
 
 	inline uint32_t ColorAttachmentCount() const { return mColorAttachmentCount; }
 	inline VkSampleCountFlagBits RasterizationSamples() const { return mRasterizationSamples; }
+	inline uint32_t ViewCount() const { return mLayout.mViewCount; }
 	inline ::Device* Device() const { return mDevice; }
 	inline ::Framebuffer* Framebuffer() const { return mFramebuffer; }
+	inline const RenderPassLayout& Layout() const { return mLayout; }
+	/// Identifies compatible render passes, see RenderPassLayout
+	inline uint64_t LayoutHash() const { return mLayoutHash; }
 
 	inline operator VkRenderPass() const { return mRenderPass; }
 
 private:
+	ENGINE_EXPORT void Create(const std::vector<VkAttachmentDescription>& attachments, const std::vector<VkSubpassDescription>& subpasses, const std::vector<VkSubpassDependency>& dependencies, uint32_t viewCount);
+
 	::Device* mDevice;
 	::Framebuffer* mFramebuffer;
 	VkRenderPass mRenderPass;
 	VkSampleCountFlagBits mRasterizationSamples;
 	uint32_t mColorAttachmentCount;
+	RenderPassLayout mLayout;
+	uint64_t mLayoutHash;
 };
\ No newline at end of file
@@ -0,0 +1,150 @@
+#include <Core/UploadQueue.hpp>
+#include <Core/Buffer.hpp>
+#include <Core/CommandBuffer.hpp>
+#include <Core/Device.hpp>
+#include <Util/Profiler.hpp>
+
+using namespace std;
+
+#define STAGING_RING_SIZE (32 * 1024 * 1024)
+// staging offsets must be a multiple of 4 and of the texel size, 16 covers every uncompressed format
+#define STAGING_ALIGNMENT 16
+
+UploadQueue::UploadQueue(Device* device, uint32_t queueFamily, VkQueue queue)
+	: mDevice(device), mQueueFamily(queueFamily), mQueue(queue), mStagingHead(0), mNextTicket(1), mFinishedTicket(0) {
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = mQueueFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	ThrowIfFailed(vkCreateCommandPool(*mDevice, &poolInfo, nullptr, &mCommandPool), "vkCreateCommandPool failed");
+	mDevice->SetObjectName(mCommandPool, "Upload Command Pool", VK_OBJECT_TYPE_COMMAND_POOL);
+
+	mStagingRing = new Buffer("Staging Ring", mDevice, STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	mStagingRing->Map();
+}
+UploadQueue::~UploadQueue() {
+	Flush();
+	mCommandBuffers.clear();
+	safe_delete(mStagingRing);
+	vkDestroyCommandPool(*mDevice, mCommandPool, nullptr);
+}
+
+void UploadQueue::Reclaim() {
+	// retire uploads in submission order, so mFinishedTicket covers every ticket before it
+	while (mInFlight.size() && mInFlight.front().mCommandBuffer->mSignalFence->Signaled()) {
+		InFlight& upload = mInFlight.front();
+		mFinishedTicket = upload.mTicket;
+		safe_delete(upload.mDedicatedStaging);
+		mCommandBuffers.push_back(upload.mCommandBuffer);
+		mInFlight.pop_front();
+	}
+}
+
+VkDeviceSize UploadQueue::AllocateStaging(VkDeviceSize size) {
+	VkDeviceSize alignment = max((VkDeviceSize)STAGING_ALIGNMENT, mDevice->Limits().optimalBufferCopyOffsetAlignment);
+	VkDeviceSize capacity = mStagingRing->Size();
+
+	while (true) {
+		Reclaim();
+
+		// the oldest range still in use by the GPU
+		const InFlight* oldest = nullptr;
+		for (const InFlight& upload : mInFlight)
+			if (!upload.mDedicatedStaging) {
+				oldest = &upload;
+				break;
+			}
+
+		if (!oldest) {
+			mStagingHead = size;
+			return 0;
+		}
+
+		VkDeviceSize tail = oldest->mBegin;
+		VkDeviceSize head = (mStagingHead + alignment - 1) / alignment * alignment;
+		if (mStagingHead > tail) {
+			// free space is [head, capacity) followed by [0, tail)
+			if (head + size <= capacity) {
+				mStagingHead = head + size;
+				return head;
+			}
+			if (size <= tail) {
+				mStagingHead = size;
+				return 0;
+			}
+		} else if (head + size <= tail) {
+			// the ring has wrapped, free space is [head, tail)
+			mStagingHead = head + size;
+			return head;
+		}
+
+		PROFILER_BEGIN("Wait for staging");
+		mInFlight.front().mCommandBuffer->mSignalFence->Wait();
+		PROFILER_END;
+	}
+}
+
+shared_ptr<CommandBuffer> UploadQueue::GetCommandBuffer(const string& name) {
+	shared_ptr<CommandBuffer> commandBuffer;
+	if (mCommandBuffers.size()) {
+		commandBuffer = mCommandBuffers.back();
+		mCommandBuffers.pop_back();
+		commandBuffer->Reset(name);
+	} else
+		commandBuffer = shared_ptr<CommandBuffer>(new CommandBuffer(mDevice, mCommandPool, &mCommandPoolMutex, name));
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	ThrowIfFailed(vkBeginCommandBuffer(commandBuffer->mCommandBuffer, &beginInfo), "vkBeginCommandBuffer failed");
+	return commandBuffer;
+}
+
+uint64_t UploadQueue::Upload(const void* data, VkDeviceSize size, const RecordFunc& record, const string& name) {
+	lock_guard lock(mMutex);
+
+	InFlight upload = {};
+	Buffer* staging;
+	if (size > mStagingRing->Size()) {
+		upload.mDedicatedStaging = new Buffer(name + " Staging", mDevice, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		upload.mDedicatedStaging->Map();
+		staging = upload.mDedicatedStaging;
+	} else {
+		upload.mBegin = AllocateStaging(size);
+		upload.mEnd = upload.mBegin + size;
+		staging = mStagingRing;
+	}
+	memcpy((uint8_t*)staging->MappedData() + upload.mBegin, data, size);
+
+	upload.mCommandBuffer = GetCommandBuffer(name);
+	record(upload.mCommandBuffer.get(), staging, upload.mBegin);
+	ThrowIfFailed(vkEndCommandBuffer(upload.mCommandBuffer->mCommandBuffer), "vkEndCommandBuffer failed");
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &upload.mCommandBuffer->mCommandBuffer;
+	if (mQueue == mDevice->GraphicsQueue()) {
+		// the graphics queue is shared with Device::Execute
+		lock_guard queueLock(mDevice->mCommandPoolMutex);
+		ThrowIfFailed(vkQueueSubmit(mQueue, 1, &submitInfo, *upload.mCommandBuffer->mSignalFence), "vkQueueSubmit failed");
+	} else
+		ThrowIfFailed(vkQueueSubmit(mQueue, 1, &submitInfo, *upload.mCommandBuffer->mSignalFence), "vkQueueSubmit failed");
+
+	upload.mTicket = mNextTicket++;
+	mInFlight.push_back(upload);
+	return upload.mTicket;
+}
+
+bool UploadQueue::Finished(uint64_t ticket) {
+	lock_guard lock(mMutex);
+	if (ticket > mFinishedTicket) Reclaim();
+	return ticket <= mFinishedTicket;
+}
+
+void UploadQueue::Flush() {
+	lock_guard lock(mMutex);
+	for (InFlight& upload : mInFlight)
+		upload.mCommandBuffer->mSignalFence->Wait();
+	Reclaim();
+}
\ No newline at end of file
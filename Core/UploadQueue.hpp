@@ -0,0 +1,64 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+
+#include <Util/Util.hpp>
+
+class Buffer;
+class CommandBuffer;
+class Device;
+
+/// Copies data through a persistently mapped staging ring and submits the copies to the device's transfer queue, so
+/// uploads never wait on (or stall) the graphics queue. The transfer queue is a dedicated transfer family when the device
+/// has one, otherwise it's the graphics queue. Uploads are identified by increasing tickets. Thread safe.
+class UploadQueue {
+public:
+	/// Records the copies out of the staging range that holds the uploaded data
+	typedef std::function<void(CommandBuffer* commandBuffer, Buffer* staging, VkDeviceSize offset)> RecordFunc;
+
+	ENGINE_EXPORT UploadQueue(Device* device, uint32_t queueFamily, VkQueue queue);
+	ENGINE_EXPORT ~UploadQueue();
+
+	inline uint32_t QueueFamily() const { return mQueueFamily; }
+
+	/// Copies data into the staging ring, then records and submits the copies. Blocks while the ring is full of in-flight
+	/// uploads, uploads larger than the ring get their own staging buffer. Returns the upload's ticket
+	ENGINE_EXPORT uint64_t Upload(const void* data, VkDeviceSize size, const RecordFunc& record, const std::string& name = "Upload");
+	/// Returns true once the upload has finished executing on the GPU
+	ENGINE_EXPORT bool Finished(uint64_t ticket);
+	/// Waits for every submitted upload to finish
+	ENGINE_EXPORT void Flush();
+
+private:
+	struct InFlight {
+		uint64_t mTicket;
+		std::shared_ptr<CommandBuffer> mCommandBuffer;
+		// range of the staging ring used by the upload, or the staging buffer it got if it didn't fit in the ring
+		VkDeviceSize mBegin;
+		VkDeviceSize mEnd;
+		Buffer* mDedicatedStaging;
+	};
+
+	// mMutex must be held for these
+	ENGINE_EXPORT void Reclaim();
+	ENGINE_EXPORT VkDeviceSize AllocateStaging(VkDeviceSize size);
+	ENGINE_EXPORT std::shared_ptr<CommandBuffer> GetCommandBuffer(const std::string& name);
+
+	Device* mDevice;
+	uint32_t mQueueFamily;
+	VkQueue mQueue;
+	VkCommandPool mCommandPool;
+	std::mutex mCommandPoolMutex;
+
+	std::mutex mMutex;
+	Buffer* mStagingRing;
+	// end of the most recent range allocated from mStagingRing
+	VkDeviceSize mStagingHead;
+	// in submission order
+	std::deque<InFlight> mInFlight;
+	std::vector<std::shared_ptr<CommandBuffer>> mCommandBuffers;
+	uint64_t mNextTicket;
+	// every upload up to and including this ticket has finished
+	uint64_t mFinishedTicket;
+};
\ No newline at end of file
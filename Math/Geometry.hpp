@@ -22,6 +22,10 @@ struct AABB {
 
 	inline float3 Center() const { return (mMax + mMin) * .5f; }
 	inline float3 Extents() const { return (mMax - mMin) * .5f; }
+	inline float SurfaceArea() const {
+		float3 s = mMax - mMin;
+		return 2.f * (s.x * s.y + s.y * s.z + s.z * s.x);
+	}
 
 	inline bool Intersects(const float3& point) const {
 		float3 e = (mMax - mMin) * .5f;
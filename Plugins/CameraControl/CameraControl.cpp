@@ -46,6 +46,10 @@ void CameraControl::Update() {
 	if (mInput->KeyDownFirst(KEY_TILDE))
 		mShowPerformance = !mShowPerformance;
 
+	// Write the profiled frames for chrome://tracing or Perfetto
+	if (mInput->KeyDownFirst(KEY_F4))
+		Profiler::RequestTrace("profile.json");
+
 	// Snapshot profiler frames
 	if (mInput->KeyDownFirst(KEY_F3)) {
 		mSnapshotPerformance = !mSnapshotPerformance;
@@ -61,6 +65,7 @@ void CameraControl::Update() {
 
 					p.first->mStartTime = p.second->mStartTime;
 					p.first->mDuration = p.second->mDuration;
+					p.first->mGpuDuration = p.second->mGpuDuration;
 					strncpy(p.first->mLabel, p.second->mLabel, PROFILER_LABEL_SIZE);
 					p.first->mChildren.resize(p.second->mChildren.size());
 
@@ -209,7 +214,10 @@ void CameraControl::PreRenderScene(CommandBuffer* commandBuffer, Camera* camera,
 				}
 
 				if (selected) {
-					snprintf(tmpText, 64, "%s: %.2fms\n", selected->mLabel, selected->mDuration.count() * 1e-6f);
+					if (selected->mGpuDuration.count())
+						snprintf(tmpText, 64, "%s: %.2fms (gpu %.2fms)\n", selected->mLabel, selected->mDuration.count() * 1e-6f, selected->mGpuDuration.count() * 1e-6f);
+					else
+						snprintf(tmpText, 64, "%s: %.2fms\n", selected->mLabel, selected->mDuration.count() * 1e-6f);
 					GUI::Rect(fRect2D(0, graphHeight, s.x, 20), float4(0,0,0,.8f));
 					GUI::DrawString(reg14, tmpText, 1, float2(s.x * .5f, graphHeight + 8), 14.f, TEXT_ANCHOR_MID, TEXT_ANCHOR_MID);
 				}
@@ -220,5 +228,9 @@ void CameraControl::PreRenderScene(CommandBuffer* commandBuffer, Camera* camera,
 
 		snprintf(tmpText, 64, "%.2f fps | %llu tris\n", mFps, commandBuffer->mTriangleCount);
 		GUI::DrawString(sem16, tmpText, 1.f, float2(5, camera->FramebufferHeight() - 18), 18.f);
+
+		snprintf(tmpText, 64, "%llu pipelines (%.1fms) | %llu fallback frames\n",
+			Profiler::Counter("Pipeline Misses"), Profiler::Counter("Pipeline Compile Time (us)") * 1e-3f, Profiler::Counter("Pipeline Fallback Frames"));
+		GUI::DrawString(reg14, tmpText, float4(.6f, .6f, .6f, 1.f), float2(5, camera->FramebufferHeight() - 36), 14.f);
 	}
 }
\ No newline at end of file
@@ -27,7 +27,7 @@ Slice ReadDicomSlice(const string& file) {
 	return { new DicomImage(file.c_str()), s, x };
 }
 
-Texture* Dicom::LoadDicomStack(const string& folder, Device* device, float3* size) {
+DicomVolume* Dicom::LoadDicomStack(const string& folder, Device* device) {
 	double3 maxSpacing = 0;
 	vector<Slice> images = {};
 	for (const auto& p : fs::directory_iterator(folder))
@@ -49,17 +49,15 @@ Texture* Dicom::LoadDicomStack(const string& folder, Device* device, float3* siz
 	if (w == 0 || h == 0) return nullptr;
 
 	// volume size in meters
-	if (size) {
-		float2 b = images[0].location;
-		for (auto i : images) {
-			b.x = (float)fmin(i.location - i.spacing.z * .5, b.x);
-			b.y = (float)fmax(i.location + i.spacing.z * .5, b.y);
-		}
-
-		*size = float3(.001 * double3(maxSpacing.xy * double2(w, h), b.y - b.x));
-		printf("%fm x %fm x %fm\n", size->x, size->y, size->z);
+	float2 b = images[0].location;
+	for (auto i : images) {
+		b.x = (float)fmin(i.location - i.spacing.z * .5, b.x);
+		b.y = (float)fmax(i.location + i.spacing.z * .5, b.y);
 	}
 
+	float3 size = float3(.001 * double3(maxSpacing.xy * double2(w, h), b.y - b.x));
+	printf("%fm x %fm x %fm\n", size.x, size.y, size.z);
+
 	uint16_t* data = new uint16_t[w * h * d];
 	memset(data, 0, w * h * d * sizeof(uint16_t));
 	for (uint32_t i = 0; i < images.size(); i++) {
@@ -71,5 +69,5 @@ Texture* Dicom::LoadDicomStack(const string& folder, Device* device, float3* siz
 	Texture* tex = new Texture(folder, device, data, w*h*d*sizeof(uint16_t), w, h, d, VK_FORMAT_R16_UNORM, 1, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
 	delete[] data;
 	for (auto& i : images) delete i.image;
-	return tex;
+	return new DicomVolume(tex, size);
 }
\ No newline at end of file
@@ -2,7 +2,20 @@
 
 #include <Content/Texture.hpp>
 
+/// A volume assembled from a folder of slices, kept by the AssetManager like the other assets
+class DicomVolume : public Asset {
+public:
+	Texture* const mTexture;
+	// size of the volume in meters
+	const float3 mSize;
+
+	inline DicomVolume(Texture* texture, const float3& size) : mTexture(texture), mSize(size) {}
+	inline ~DicomVolume() { delete mTexture; }
+
+	inline uint64_t DeviceMemorySize() const override { return mTexture->DeviceMemorySize(); }
+};
+
 class Dicom {
 public:
-	PLUGIN_EXPORT static Texture* LoadDicomStack(const std::string& folder, Device* device, float3* size);
+	PLUGIN_EXPORT static DicomVolume* LoadDicomStack(const std::string& folder, Device* device);
 };
\ No newline at end of file
@@ -39,6 +39,11 @@ private:
 	float mVolumeExtinction;
 	float mVolumePhaseHG;
 
+	// volumes, masks and baked volumes are acquired from the AssetManager, so switching data sets releases them
+	// and switching back reuses them while they're within budget
+	shared_ptr<DicomVolume> mVolume;
+	shared_ptr<Texture> mMask;
+	// mVolume's texture
 	Texture* mRawVolume;
 	Texture* mRawMask;
 	bool mRawVolumeNew;
@@ -47,12 +52,17 @@ private:
 	
 	struct FrameData {
 		// Volume color and density, post-transfer and post-threshold
-		Texture* mBakedVolume;
+		shared_ptr<Texture> mBakedVolume;
 		bool mImagesNew;
 		bool mDirty;
 	};
 	FrameData* mFrameData;
 
+	shared_ptr<Shader> mPrecomputeShader;
+	shared_ptr<Shader> mVolumeShader;
+	shared_ptr<Texture> mNoiseTexture;
+	shared_ptr<Texture> mEnvironmentTexture;
+
 	Camera* mMainCamera;
 
 	MouseKeyboardInput* mInput;
@@ -85,10 +95,9 @@ public:
 		mEnabled = true;
 	}
 	PLUGIN_EXPORT ~DicomVis() {
-		safe_delete(mRawVolume);
-		for (uint32_t i = 0; i < mScene->Instance()->Device()->MaxFramesInFlight(); i++) {
-			safe_delete(mFrameData[i].mBakedVolume);
-		}
+		// the assets are released when the plugin is destroyed, before the AssetManager
+		mScene->Environment()->EnvironmentTexture(nullptr);
+		safe_delete_array(mFrameData);
 		for (Object* obj : mObjects)
 			mScene->RemoveObject(obj);
 	}
@@ -110,7 +119,11 @@ public:
 
 		mScene->Environment()->EnableCelestials(false);
 		mScene->Environment()->EnableScattering(false);
-		mScene->Environment()->EnvironmentTexture(mScene->AssetManager()->LoadTexture("Assets/Textures/paul_lobe_haus_8k.hdr"));
+		mEnvironmentTexture = mScene->AssetManager()->AcquireTexture("Assets/Textures/paul_lobe_haus_8k.hdr");
+		mScene->Environment()->EnvironmentTexture(mEnvironmentTexture.get());
+		mPrecomputeShader = mScene->AssetManager()->AcquireShader("Shaders/precompute.stm");
+		mVolumeShader = mScene->AssetManager()->AcquireShader("Shaders/volume.stm");
+		mNoiseTexture = mScene->AssetManager()->AcquireTexture("Assets/Textures/rgbanoise.png", false);
 		mScene->Environment()->AmbientLight(.1f);
 
 		string path = "/Data";
@@ -141,8 +154,7 @@ public:
 			else if (p.path().extension().string() == ".raw")
 				mDataFolders[p.path().parent_path().string()] = true;
 
-		mFrameData = new FrameData[mScene->Instance()->Device()->MaxFramesInFlight()];
-		memset(mFrameData, 0, sizeof(FrameData) * mScene->Instance()->Device()->MaxFramesInFlight());
+		mFrameData = new FrameData[mScene->Instance()->Device()->MaxFramesInFlight()]();
 
 		return true;
 	}
@@ -152,6 +164,10 @@ public:
 		if (mInput->KeyDownFirst(KEY_TILDE))
 			mShowPerformance = !mShowPerformance;
 
+		// Write the profiled frames for chrome://tracing or Perfetto
+		if (mInput->KeyDownFirst(KEY_F4))
+			Profiler::RequestTrace("profile.json");
+
 		// Snapshot profiler frames
 		if (mInput->KeyDownFirst(KEY_F3)) {
 			mSnapshotPerformance = !mSnapshotPerformance;
@@ -167,6 +183,7 @@ public:
 
 						p.first->mStartTime = p.second->mStartTime;
 						p.first->mDuration = p.second->mDuration;
+						p.first->mGpuDuration = p.second->mGpuDuration;
 						strncpy(p.first->mLabel, p.second->mLabel, PROFILER_LABEL_SIZE);
 						p.first->mChildren.resize(p.second->mChildren.size());
 
@@ -294,7 +311,10 @@ public:
 					}
 
 					if (selected) {
-						snprintf(tmpText, 64, "%s: %.2fms\n", selected->mLabel, selected->mDuration.count() * 1e-6f);
+						if (selected->mGpuDuration.count())
+							snprintf(tmpText, 64, "%s: %.2fms (gpu %.2fms)\n", selected->mLabel, selected->mDuration.count() * 1e-6f, selected->mGpuDuration.count() * 1e-6f);
+						else
+							snprintf(tmpText, 64, "%s: %.2fms\n", selected->mLabel, selected->mDuration.count() * 1e-6f);
 						GUI::Rect(fRect2D(0, graphHeight, s.x, 20), float4(0,0,0,.8f));
 						GUI::DrawString(reg14, tmpText, 1, float2(s.x * .5f, graphHeight + 8), 14.f, TEXT_ANCHOR_MID, TEXT_ANCHOR_MID);
 					}
@@ -411,13 +431,13 @@ public:
 			if (mInvert) kw.emplace("INVERT");
 			if (mVolumeColored) kw.emplace("COLORED");
 			else if (mColorize) kw.emplace("COLORIZE");
-			ComputeShader* copy = mScene->AssetManager()->LoadShader("Shaders/precompute.stm")->GetCompute("CopyRaw", kw);
+			ComputeShader* copy = mPrecomputeShader->GetCompute("CopyRaw", kw);
 			vkCmdBindPipeline(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, copy->mPipeline);
 			
 			DescriptorSet* ds = commandBuffer->Device()->GetTempDescriptorSet("CopyRaw", copy->mDescriptorSetLayouts[0]);
 			ds->CreateStorageTextureDescriptor(mRawVolume, copy->mDescriptorBindings.at("RawVolume").second.binding, VK_IMAGE_LAYOUT_GENERAL);
 			if (mRawMask) ds->CreateStorageTextureDescriptor(mRawMask, copy->mDescriptorBindings.at("RawMask").second.binding, VK_IMAGE_LAYOUT_GENERAL);
-			ds->CreateStorageTextureDescriptor(fd.mBakedVolume, copy->mDescriptorBindings.at("BakedVolume").second.binding, VK_IMAGE_LAYOUT_GENERAL);
+			ds->CreateStorageTextureDescriptor(fd.mBakedVolume.get(), copy->mDescriptorBindings.at("BakedVolume").second.binding, VK_IMAGE_LAYOUT_GENERAL);
 			ds->FlushWrites();
 			vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, copy->mPipelineLayout, 0, 1, *ds, 0, nullptr);
 
@@ -443,18 +463,18 @@ public:
 			set<string> kw;
 			if (mPhysicalShading) kw.emplace("PHYSICAL_SHADING");
 			if (mColorize) kw.emplace("COLORIZE");
-			ComputeShader* draw = mScene->AssetManager()->LoadShader("Shaders/volume.stm")->GetCompute("Draw", kw);
+			ComputeShader* draw = mVolumeShader->GetCompute("Draw", kw);
 			vkCmdBindPipeline(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, draw->mPipeline);
 			
 			DescriptorSet* ds = commandBuffer->Device()->GetTempDescriptorSet("Draw Volume", draw->mDescriptorSetLayouts[0]);
-			ds->CreateSampledTextureDescriptor(fd.mBakedVolume, draw->mDescriptorBindings.at("BakedVolume").second.binding, VK_IMAGE_LAYOUT_GENERAL);
+			ds->CreateSampledTextureDescriptor(fd.mBakedVolume.get(), draw->mDescriptorBindings.at("BakedVolume").second.binding, VK_IMAGE_LAYOUT_GENERAL);
 			if (mPhysicalShading){
 				//ds->CreateSampledTextureDescriptor(fd.mBakedInscatter, draw->mDescriptorBindings.at("BakedInscatter").second.binding, VK_IMAGE_LAYOUT_GENERAL);
 				ds->CreateSampledTextureDescriptor(mScene->Environment()->EnvironmentTexture(), draw->mDescriptorBindings.at("EnvironmentTexture").second.binding);
 			}
 			ds->CreateStorageTextureDescriptor(camera->ResolveBuffer(0), draw->mDescriptorBindings.at("RenderTarget").second.binding, VK_IMAGE_LAYOUT_GENERAL);
 			ds->CreateStorageTextureDescriptor(camera->ResolveBuffer(1), draw->mDescriptorBindings.at("DepthNormal").second.binding, VK_IMAGE_LAYOUT_GENERAL);
-			ds->CreateSampledTextureDescriptor(mScene->AssetManager()->LoadTexture("Assets/Textures/rgbanoise.png", false), draw->mDescriptorBindings.at("NoiseTex").second.binding);
+			ds->CreateSampledTextureDescriptor(mNoiseTexture.get(), draw->mDescriptorBindings.at("NoiseTex").second.binding);
 			ds->FlushWrites();
 			vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, draw->mPipelineLayout, 0, 1, *ds, 0, nullptr);
 
@@ -521,7 +541,7 @@ public:
 		mFrameIndex++;
 	}
 	
-	Texture* LoadRawStack(const fs::path& folder, Device* device, float3* scale) {
+	DicomVolume* LoadRawStack(const fs::path& folder, Device* device) {
 		vector<pair<int, string>> images;
 		for (const auto& p : fs::directory_iterator(folder))
 			if (p.path().extension().string() == ".png")
@@ -563,48 +583,48 @@ public:
 	}
 
 	void LoadVolume(CommandBuffer* commandBuffer, const fs::path& folder, bool color) {
-		safe_delete(mRawVolume);
-		safe_delete(mRawMask);
-		for (uint32_t i = 0; i < commandBuffer->Device()->MaxFramesInFlight(); i++) {
-			safe_delete(mFrameData[i].mBakedVolume);
+		Device* device = mScene->Instance()->Device();
+		AssetManager* assets = mScene->AssetManager();
+
+		// only textures that were just created need their initial layout transition, reacquired ones are already in use
+		bool created = false;
+		shared_ptr<DicomVolume> vol = assets->AcquireAsset<DicomVolume>(folder.string(), [&]() {
+			created = true;
+			return color ? LoadRawStack(folder, device) : Dicom::LoadDicomStack(folder.string(), device);
+		});
+		if (!vol) {
+			fprintf_color(COLOR_RED, stderr, "Failed to load volume!\n");
+			return;
 		}
 
-		Texture* vol;
-		if (color) {
-			vol = LoadRawStack(folder.string(), mScene->Instance()->Device(), &mVolumeScale);
-			if (!vol) {
-				fprintf_color(COLOR_RED, stderr, "Failed to load volume!\n");
-				return;
-			}
-		} else {
-			vol = Dicom::LoadDicomStack(folder.string(), mScene->Instance()->Device(), &mVolumeScale);
-			if (!vol) {
-				fprintf_color(COLOR_RED, stderr, "Failed to load volume!\n");
-				return;
-			}
-
-			string maskPath = folder.string() + "/_mask";
-
-			if (fs::exists(maskPath)) {
-				mRawMask = LoadMask(maskPath, mScene->Instance()->Device());
-				if (!mRawMask)
-					fprintf_color(COLOR_RED, stderr, "Failed to load mask!\n");
-				else
-					mRawMaskNew = true;
-			}
+		shared_ptr<Texture> mask;
+		bool maskCreated = false;
+		string maskPath = folder.string() + "/_mask";
+		if (!color && fs::exists(maskPath)) {
+			mask = assets->AcquireAsset<Texture>(maskPath, [&]() { maskCreated = true; return LoadMask(maskPath, device); });
+			if (!mask) fprintf_color(COLOR_RED, stderr, "Failed to load mask!\n");
 		}
 
 		mVolumeColored = color;
 		
 		mVolumeRotation = quaternion(0,0,0,1);
 		mVolumePosition = float3(0, 1.6f, 0);
-		mRawVolume = vol;
-		mRawVolumeNew = true;
-
-		for (uint32_t i = 0; i < commandBuffer->Device()->MaxFramesInFlight(); i++) {
+		mVolume = vol;
+		mMask = mask;
+		mRawVolume = mVolume->mTexture;
+		mRawMask = mMask.get();
+		mVolumeScale = mVolume->mSize;
+		mRawVolumeNew = created;
+		mRawMaskNew = maskCreated;
+
+		for (uint32_t i = 0; i < device->MaxFramesInFlight(); i++) {
 			FrameData& fd = mFrameData[i];
-			fd.mBakedVolume = new Texture("Baked Volume", mScene->Instance()->Device(), nullptr, 0, mRawVolume->Width(), mRawVolume->Height(), mRawVolume->Depth(), VK_FORMAT_R16G16B16A16_UNORM, 3, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
-			fd.mImagesNew = true;
+			bool bakedCreated = false;
+			fd.mBakedVolume = assets->AcquireAsset<Texture>(folder.string() + "/Baked Volume " + to_string(i), [&]() {
+				bakedCreated = true;
+				return new Texture("Baked Volume", device, nullptr, 0, mRawVolume->Width(), mRawVolume->Height(), mRawVolume->Depth(), VK_FORMAT_R16G16B16A16_UNORM, 3, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+			});
+			fd.mImagesNew = bakedCreated;
 			fd.mDirty = true;
 		}
 
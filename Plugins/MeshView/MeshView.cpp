@@ -38,6 +38,9 @@ private:
 	SkinnedMeshRenderer* mWasp;
 	SkinnedMeshRenderer* mHead;
 
+	shared_ptr<Shader> mPbr;
+	shared_ptr<Texture> mIcons;
+
 	SkelJoint* ReadJoint(Tokenizer& t, AnimationRig& destRig, const string& name, float scale) {
 		shared_ptr<SkelJoint> j = make_shared<SkelJoint>(name, destRig.size());
 		mScene->AddObject(j);
@@ -400,6 +403,14 @@ public:
 		mScene = scene;
 		mInput = mScene->InputManager()->GetFirst<MouseKeyboardInput>();
 
+		// loaded on the thread pool while the scene is set up
+		AssetManager* assets = mScene->AssetManager();
+		auto pbr = assets->AcquireShaderAsync("Shaders/pbr.stm");
+		auto grid = assets->AcquireTextureAsync("Assets/Textures/grid.png");
+		auto bump = assets->AcquireTextureAsync("Assets/Textures/bump.png");
+		auto mask = assets->AcquireTextureAsync("Assets/Textures/mask.png");
+		auto icons = assets->AcquireTextureAsync("Assets/Textures/icons.png");
+
 		mScene->Environment()->EnableCelestials(false);
 		mScene->Environment()->EnableScattering(false);
 		mScene->Environment()->AmbientLight(.3f);
@@ -430,11 +441,14 @@ public:
 		mScene->AddObject(light2);
 		mObjects.push_back(light2.get());
 
-		auto planeMat = make_shared<Material>("Plane", mScene->AssetManager()->LoadShader("Shaders/pbr.stm"));
+		mPbr = pbr.get();
+		mIcons = icons.get();
+
+		auto planeMat = make_shared<Material>("Plane", mPbr);
 		planeMat->EnableKeyword("TEXTURED");
-		planeMat->SetParameter("MainTextures", 0, mScene->AssetManager()->LoadTexture("Assets/Textures/grid.png"));
-		planeMat->SetParameter("NormalTextures", 0, mScene->AssetManager()->LoadTexture("Assets/Textures/bump.png"));
-		planeMat->SetParameter("MaskTextures", 0, mScene->AssetManager()->LoadTexture("Assets/Textures/mask.png"));
+		planeMat->SetParameter("MainTextures", 0, grid.get());
+		planeMat->SetParameter("NormalTextures", 0, bump.get());
+		planeMat->SetParameter("MaskTextures", 0, mask.get());
 		planeMat->SetParameter("TextureST", float4(256, 256, 1, 1));
 		planeMat->SetParameter("Color", float4(1));
 		planeMat->SetParameter("Metallic", 0.f);
@@ -483,7 +497,7 @@ public:
 			if (mHead) mHead->mVisible = false;
 			if (mWasp) { mWasp->mVisible = true; return; }
 
-			auto waspMat = make_shared<Material>("Wasp", mScene->AssetManager()->LoadShader("Shaders/pbr.stm"));
+			auto waspMat = make_shared<Material>("Wasp", mPbr);
 			waspMat->SetParameter("Color", float4(1));
 			waspMat->SetParameter("Metallic", 0.f);
 			waspMat->SetParameter("Roughness", .5f);
@@ -510,11 +524,12 @@ public:
 			if (mWasp) mWasp->mVisible = false;
 			if (mHead) { mHead->mVisible = true; return; }
 
-			auto headMat = make_shared<Material>("Head", mScene->AssetManager()->LoadShader("Shaders/pbr.stm"));
+			auto headMat = make_shared<Material>("Head", mPbr);
 			headMat->EnableKeyword("TEXTURED");
-			headMat->SetParameter("MainTextures", 0, mScene->AssetManager()->LoadTexture("Assets/Models/head/head.png"));
-			headMat->SetParameter("NormalTextures", 0, mScene->AssetManager()->LoadTexture("Assets/Textures/bump.png"));
-			headMat->SetParameter("MaskTextures", 0, mScene->AssetManager()->LoadTexture("Assets/Textures/mask.png"));
+			// only kept loaded while the material uses them
+			headMat->SetParameter("MainTextures", 0, mScene->AssetManager()->AcquireTexture("Assets/Models/head/head.png"));
+			headMat->SetParameter("NormalTextures", 0, mScene->AssetManager()->AcquireTexture("Assets/Textures/bump.png"));
+			headMat->SetParameter("MaskTextures", 0, mScene->AssetManager()->AcquireTexture("Assets/Textures/mask.png"));
 			headMat->SetParameter("TextureST", float4(1, 1, 0, 0));
 			headMat->SetParameter("Color", float4(1));
 			headMat->SetParameter("Metallic", 0.f);
@@ -733,7 +748,7 @@ public:
 
 			float3 col = light->mEnabled ? light->Color() : light->Color() * .2f;
 			Gizmos::DrawBillboard(light->WorldPosition(), hover && light != selectedLight ? .09f : .075f, camera->WorldRotation(), float4(col, 1),
-				mScene->AssetManager()->LoadTexture("Assets/Textures/icons.png"), float4(.5f, .5f, 0, 0));
+				mIcons.get(), float4(.5f, .5f, 0, 0));
 
 			if (hover && change)
 				mSelected = light;
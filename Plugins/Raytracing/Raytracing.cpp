@@ -56,6 +56,11 @@ private:
 	Scene* mScene;
 	uint32_t mFrameIndex;
 
+	shared_ptr<Shader> mRaytraceShader;
+	shared_ptr<Shader> mResolveShader;
+	shared_ptr<Shader> mBlitShader;
+	shared_ptr<Texture> mNoiseTexture;
+
 	struct FrameData {
 		float4x4 mViewProjection;
 		float4x4 mInvViewProjection;
@@ -293,11 +298,12 @@ public:
 		string folder = "Assets/Models/";
 		string file = "cornellbox.gltf";
 
-		shared_ptr<Material> opaque = make_shared<Material>("PBR", mScene->AssetManager()->LoadShader("Shaders/pbr.stm"));
+		shared_ptr<Shader> pbr = mScene->AssetManager()->AcquireShader("Shaders/pbr.stm");
+		shared_ptr<Material> opaque = make_shared<Material>("PBR", pbr);
 		opaque->EnableKeyword("TEXTURED");
 		opaque->SetParameter("TextureST", float4(1, 1, 0, 0));
 
-		shared_ptr<Material> alphaClip = make_shared<Material>("Cutout PBR", mScene->AssetManager()->LoadShader("Shaders/pbr.stm"));
+		shared_ptr<Material> alphaClip = make_shared<Material>("Cutout PBR", pbr);
 		alphaClip->RenderQueue(5000);
 		alphaClip->BlendMode(BLEND_MODE_ALPHA);
 		alphaClip->CullMode(VK_CULL_MODE_NONE);
@@ -306,7 +312,7 @@ public:
 		alphaClip->EnableKeyword("TWO_SIDED");
 		alphaClip->SetParameter("TextureST", float4(1, 1, 0, 0));
 
-		shared_ptr<Material> alphaBlend = make_shared<Material>("Transparent PBR", mScene->AssetManager()->LoadShader("Shaders/pbr.stm"));
+		shared_ptr<Material> alphaBlend = make_shared<Material>("Transparent PBR", pbr);
 		alphaBlend->RenderQueue(5000);
 		alphaBlend->BlendMode(BLEND_MODE_ALPHA);
 		alphaBlend->CullMode(VK_CULL_MODE_NONE);
@@ -319,7 +325,7 @@ public:
 		shared_ptr<Material> curBlend = nullptr;
 
 		uint32_t arraySize =
-			mScene->AssetManager()->LoadShader("Shaders/pbr.stm")->GetGraphics(PASS_MAIN, { "TEXTURED" })->mDescriptorBindings.at("MainTextures").second.descriptorCount;
+			pbr->GetGraphics(PASS_MAIN, { "TEXTURED" })->mDescriptorBindings.at("MainTextures").second.descriptorCount;
 
 		uint32_t opaque_i = 0;
 		uint32_t clip_i = 0;
@@ -346,7 +352,7 @@ public:
 				if (opaque_i >= arraySize) curOpaque.reset();
 				if (!curOpaque) {
 					opaque_i = opaque_i % arraySize;
-					curOpaque = make_shared<Material>("PBR", mScene->AssetManager()->LoadShader("Shaders/pbr.stm"));
+					curOpaque = make_shared<Material>("PBR", pbr);
 					curOpaque->EnableKeyword("TEXTURED");
 					curOpaque->SetParameter("TextureST", float4(1, 1, 0, 0));
 				}
@@ -359,7 +365,7 @@ public:
 				if (clip_i >= arraySize) curClip.reset();
 				if (!curClip) {
 					clip_i = clip_i % arraySize;
-					curClip = make_shared<Material>("Cutout PBR", mScene->AssetManager()->LoadShader("Shaders/pbr.stm"));
+					curClip = make_shared<Material>("Cutout PBR", pbr);
 					curClip->RenderQueue(5000);
 					curClip->BlendMode(BLEND_MODE_ALPHA);
 					curClip->CullMode(VK_CULL_MODE_NONE);
@@ -377,7 +383,7 @@ public:
 				if (blend_i >= 64) curBlend.reset();
 				if (!curBlend) {
 					blend_i = blend_i % arraySize;
-					curBlend = make_shared<Material>("Transparent PBR", mScene->AssetManager()->LoadShader("Shaders/pbr.stm"));
+					curBlend = make_shared<Material>("Transparent PBR", pbr);
 					curBlend->RenderQueue(5000);
 					curBlend->BlendMode(BLEND_MODE_ALPHA);
 					curBlend->CullMode(VK_CULL_MODE_NONE);
@@ -399,20 +405,20 @@ public:
 			aiString baseColorTexture, metalRoughTexture, normalTexture, emissiveTexture;
 
 			if (aimaterial->GetTexture(AI_MATKEY_GLTF_PBRMETALLICROUGHNESS_BASE_COLOR_TEXTURE, &baseColorTexture) == AI_SUCCESS && baseColorTexture.length) {
-				mat->SetParameter("MainTextures", i, scene->AssetManager()->LoadTexture(folder + baseColorTexture.C_Str()));
+				mat->SetParameter("MainTextures", i, scene->AssetManager()->AcquireTexture(folder + baseColorTexture.C_Str()));
 				baseColor = aiColor4D(1);
 			} else
-				mat->SetParameter("MainTextures", i, scene->AssetManager()->LoadTexture("Assets/Textures/white.png"));
+				mat->SetParameter("MainTextures", i, scene->AssetManager()->AcquireTexture("Assets/Textures/white.png"));
 
 			if (aimaterial->GetTexture(AI_MATKEY_GLTF_PBRMETALLICROUGHNESS_METALLICROUGHNESS_TEXTURE, &metalRoughTexture) == AI_SUCCESS && metalRoughTexture.length)
-				mat->SetParameter("MaskTextures", i, scene->AssetManager()->LoadTexture(folder + metalRoughTexture.C_Str(), false));
+				mat->SetParameter("MaskTextures", i, scene->AssetManager()->AcquireTexture(folder + metalRoughTexture.C_Str(), false));
 			else
-				mat->SetParameter("MaskTextures", i, scene->AssetManager()->LoadTexture("Assets/Textures/mask.png", false));
+				mat->SetParameter("MaskTextures", i, scene->AssetManager()->AcquireTexture("Assets/Textures/mask.png", false));
 
 			if (aimaterial->GetTexture(aiTextureType_NORMALS, 0, &normalTexture) == AI_SUCCESS && normalTexture.length)
-				mat->SetParameter("NormalTextures", i, scene->AssetManager()->LoadTexture(folder + normalTexture.C_Str(), false));
+				mat->SetParameter("NormalTextures", i, scene->AssetManager()->AcquireTexture(folder + normalTexture.C_Str(), false));
 			else
-				mat->SetParameter("NormalTextures", i, scene->AssetManager()->LoadTexture("Assets/Textures/bump.png", false));
+				mat->SetParameter("NormalTextures", i, scene->AssetManager()->AcquireTexture("Assets/Textures/bump.png", false));
 
 			aimaterial->Get(AI_MATKEY_GLTF_PBRMETALLICROUGHNESS_BASE_COLOR_FACTOR, baseColor);
 			aimaterial->Get(AI_MATKEY_GLTF_PBRMETALLICROUGHNESS_METALLIC_FACTOR, metallic);
@@ -446,6 +452,11 @@ public:
 		}
 		#pragma endregion
 
+		mRaytraceShader = mScene->AssetManager()->AcquireShader("Shaders/raytrace.stm");
+		mResolveShader = mScene->AssetManager()->AcquireShader("Shaders/resolve.stm");
+		mBlitShader = mScene->AssetManager()->AcquireShader("Shaders/rtblit.stm");
+		mNoiseTexture = mScene->AssetManager()->AcquireTexture("Assets/Textures/rgbanoise.png", false);
+
 		mFrameData = new FrameData[mScene->Instance()->Device()->MaxFramesInFlight()];
 		for (uint32_t i = 0; i < mScene->Instance()->Device()->MaxFramesInFlight(); i++) {
 			mFrameData[i].mPrimary = nullptr;
@@ -519,8 +530,7 @@ public:
 		FrameData& pfd = mFrameData[(commandBuffer->Device()->FrameContextIndex() + (commandBuffer->Device()->MaxFramesInFlight()-1)) % commandBuffer->Device()->MaxFramesInFlight()];
 		bool accum = pfd.mPrimary && pfd.mPrimary->Width() == fd.mPrimary->Width() && pfd.mPrimary->Height() == fd.mPrimary->Height();
 
-		Shader* rt = mScene->AssetManager()->LoadShader("Shaders/raytrace.stm");
-		ComputeShader* trace = accum ? rt->GetCompute("Raytrace", { "ACCUMULATE" }) : rt->GetCompute("Raytrace", {});
+		ComputeShader* trace = accum ? mRaytraceShader->GetCompute("Raytrace", { "ACCUMULATE" }) : mRaytraceShader->GetCompute("Raytrace", {});
 		vkCmdBindPipeline(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, trace->mPipeline);
 
 		fd.mViewProjection = camera->ViewProjection();
@@ -561,7 +571,7 @@ public:
 		ds->CreateStorageBufferDescriptor(fd.mTriangles, 0, fd.mTriangles->Size(), trace->mDescriptorBindings.at("Triangles").second.binding);
 		ds->CreateStorageBufferDescriptor(fd.mMaterials, 0, fd.mMaterials->Size(), trace->mDescriptorBindings.at("Materials").second.binding);
 		ds->CreateStorageBufferDescriptor(fd.mLights, 0, fd.mLights->Size(), trace->mDescriptorBindings.at("Lights").second.binding);
-		ds->CreateSampledTextureDescriptor(mScene->AssetManager()->LoadTexture("Assets/Textures/rgbanoise.png", false), trace->mDescriptorBindings.at("NoiseTex").second.binding, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		ds->CreateSampledTextureDescriptor(mNoiseTexture.get(), trace->mDescriptorBindings.at("NoiseTex").second.binding, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 		ds->FlushWrites();
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, trace->mPipelineLayout, 0, 1, *ds, 0, nullptr);
 
@@ -581,7 +591,7 @@ public:
 		uint2 ires(camera->FramebufferWidth(), camera->FramebufferHeight());
 
 		#pragma region combine x
-		ComputeShader* combine = mScene->AssetManager()->LoadShader("Shaders/resolve.stm")->GetCompute("Combine", {"MULTI_COMBINE"});
+		ComputeShader* combine = mResolveShader->GetCompute("Combine", {"MULTI_COMBINE"});
 		vkCmdBindPipeline(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, combine->mPipeline);
 
 		ds = commandBuffer->Device()->GetTempDescriptorSet("Resolve", combine->mDescriptorSetLayouts[0]);
@@ -610,7 +620,7 @@ public:
 			1, barriers);
 		
 		#pragma region combine y
-		combine = mScene->AssetManager()->LoadShader("Shaders/resolve.stm")->GetCompute("Combine", {});
+		combine = mResolveShader->GetCompute("Combine", {});
 		vkCmdBindPipeline(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, combine->mPipeline);
 
 		ds = commandBuffer->Device()->GetTempDescriptorSet("Resolve2", combine->mDescriptorSetLayouts[0]);
@@ -642,7 +652,7 @@ public:
 	PLUGIN_EXPORT void PostRenderScene(CommandBuffer* commandBuffer, Camera* camera, PassType pass) override {
 		if (pass != PASS_MAIN) return;
 
-		GraphicsShader* shader = mScene->AssetManager()->LoadShader("Shaders/rtblit.stm")->GetGraphics(PASS_MAIN, {});
+		GraphicsShader* shader = mBlitShader->GetGraphics(PASS_MAIN, {});
 		if (!shader) return;
 
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, pass, nullptr);
@@ -82,7 +82,9 @@ void triplanar(uint index, uint topIndex, float3 p, float3 blend, inout float4 c
 
 v2f vsmain(
 	uint v : SV_VertexID,
-	uint instance : SV_InstanceID ) {
+	uint instance : SV_InstanceID,
+	uint viewIndex : SV_ViewID ) {
+	StratumSetViewIndex(viewIndex);
 
 	float3 vertex = float3(v % 17, 0, v / 17) / 16.0;
 	vertex.xz -= .5;
@@ -108,8 +110,10 @@ float fsdepth(in float4 worldPos : TEXCOORD0) : SV_Target0 {
 }
 
 void fsmain(v2f i,
+	uint viewIndex : SV_ViewID,
 	out float4 color : SV_Target0,
 	out float4 depthNormal : SV_Target1) {
+	StratumSetViewIndex(viewIndex);
 	depthNormal = float4(cross(ddx(i.worldPos.xyz), ddy(i.worldPos.xyz)), i.worldPos.w);
 	
 	float3 view = ComputeView(i.worldPos.xyz, i.screenPos);
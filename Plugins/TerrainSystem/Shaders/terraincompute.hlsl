@@ -98,19 +98,15 @@ void DrawDetails(uint3 id : SV_DispatchThreadID) {
 
 	DetailTransform d = DetailTransforms[id.x];
 
-	float4x4 transform    = qtom(d.rotation);
-	float4x4 invTransform = qtom(qinv(d.rotation));
-
+	float4x4 transform = qtom(d.rotation);
 	transform *= d.scale;
 	transform[3].xyz = d.position;
 
-	invTransform /= d.scale;
-	invTransform[3].xyz = -d.position;
-
 	if (length(CameraPosition - d.position) < ImposterRange) {
 		uint index;
 		InterlockedAdd(IndirectCommands[0].instanceCount, 1, index);
-		DetailInstances[index].ObjectToWorld = transform;
-		DetailInstances[index].WorldToObject = invTransform;
+		// transform has the translation in its last row, so the rows of ObjectToWorld are its columns
+		for (uint i = 0; i < 3; i++)
+			DetailInstances[index].ObjectToWorld[i] = float4(transform[0][i], transform[1][i], transform[2][i], transform[3][i]);
 	}
 }
\ No newline at end of file
@@ -19,6 +19,8 @@ public:
 	PLUGIN_EXPORT float Height(const float3& lp);
 
 	inline PassType PassMask() override { return (PassType)(Main | Depth); }
+	// the LOD follows the camera
+	inline bool Deforming() override { return true; }
 
 	inline ::Material* Material() const { return mMaterial.get(); }
 	inline void Material(std::shared_ptr<::Material> m) { mMaterial = m; }
@@ -107,7 +109,7 @@ private:
 
 	std::vector<Detail> mDetails;
 
-	Shader* mTerrainCompute;
+	std::shared_ptr<Shader> mTerrainCompute;
 
 	Texture* mHeightmap;
 	uint16_t* mHeights;
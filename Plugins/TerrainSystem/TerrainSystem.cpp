@@ -23,13 +23,14 @@ TerrainSystem::~TerrainSystem() {
 bool TerrainSystem::Init(Scene* scene) {
 	mScene = scene;
 	mInput = mScene->InputManager()->GetFirst<MouseKeyboardInput>();
+	mIcons = mScene->AssetManager()->AcquireTexture("Assets/Textures/icons.png");
 
 	#pragma region Terrain object
-	shared_ptr<Material> terrainMat = make_shared<Material>("Terrain", mScene->AssetManager()->LoadShader("Shaders/terrain.stm"));
+	shared_ptr<Material> terrainMat = make_shared<Material>("Terrain", mScene->AssetManager()->AcquireShader("Shaders/terrain.stm"));
 
-	terrainMat->SetParameter("MainTextures", 0, mScene->AssetManager()->LoadTexture("Assets/Textures/rock13/rock13_col.jpg"));
-	terrainMat->SetParameter("NormalTextures", 0, mScene->AssetManager()->LoadTexture("Assets/Textures/rock13/rock13_nrm.jpg", false));
-	terrainMat->SetParameter("MaskTextures", 0, mScene->AssetManager()->LoadTexture("Assets/Textures/rock13/rock13_msk.png", false));
+	terrainMat->SetParameter("MainTextures", 0, mScene->AssetManager()->AcquireTexture("Assets/Textures/rock13/rock13_col.jpg"));
+	terrainMat->SetParameter("NormalTextures", 0, mScene->AssetManager()->AcquireTexture("Assets/Textures/rock13/rock13_nrm.jpg", false));
+	terrainMat->SetParameter("MaskTextures", 0, mScene->AssetManager()->AcquireTexture("Assets/Textures/rock13/rock13_msk.png", false));
 
 	//terrainMat->SetParameter("MainTextures", 1, mScene->AssetManager()->LoadTexture("Assets/Textures/grass/grass1_col.png"));
 	//terrainMat->SetParameter("NormalTextures", 1, mScene->AssetManager()->LoadTexture("Assets/Textures/grass/grass1_nrm.png", false));
@@ -39,9 +40,9 @@ bool TerrainSystem::Init(Scene* scene) {
 	//terrainMat->SetParameter("NormalTextures", 2, mScene->AssetManager()->LoadTexture("Assets/Textures/dirt/ground3_nrm.jpg", false));
 	//terrainMat->SetParameter("MaskTextures", 2, mScene->AssetManager()->LoadTexture("Assets/Textures/dirt/ground3_msk.jpg", false));
 
-	terrainMat->SetParameter("MainTextures", 1, mScene->AssetManager()->LoadTexture("Assets/Textures/snow06/Snow06_col.jpg", false));
-	terrainMat->SetParameter("NormalTextures", 1, mScene->AssetManager()->LoadTexture("Assets/Textures/snow06/Snow06_nrm.jpg", false));
-	terrainMat->SetParameter("MaskTextures", 1, mScene->AssetManager()->LoadTexture("Assets/Textures/snow06/Snow06_msk.png", false));
+	terrainMat->SetParameter("MainTextures", 1, mScene->AssetManager()->AcquireTexture("Assets/Textures/snow06/Snow06_col.jpg", false));
+	terrainMat->SetParameter("NormalTextures", 1, mScene->AssetManager()->AcquireTexture("Assets/Textures/snow06/Snow06_nrm.jpg", false));
+	terrainMat->SetParameter("MaskTextures", 1, mScene->AssetManager()->AcquireTexture("Assets/Textures/snow06/Snow06_msk.png", false));
 
 	shared_ptr<TerrainRenderer> terrain = make_shared<TerrainRenderer>("Terrain", 2048.f, 100.f);
 	mScene->AddObject(terrain);
@@ -178,7 +179,7 @@ void TerrainSystem::DrawGizmos(CommandBuffer* commandBuffer, Camera* camera) {
 
 		float3 col = light->mEnabled ? light->Color() : light->Color() * .2f;
 		Gizmos::DrawBillboard(light->WorldPosition(), hover && light != selectedLight ? .09f : .075f, camera->WorldRotation(), float4(col, 1),
-			mScene->AssetManager()->LoadTexture("Assets/Textures/icons.png"), float4(.5f, .5f, 0, 0));
+			mIcons.get(), float4(.5f, .5f, 0, 0));
 
 		if (hover) {
 			hitT = lt;
@@ -23,4 +23,5 @@ private:
 	std::vector<Object*> mObjects;
 	Object* mSelected;
 	MouseKeyboardInput* mInput;
+	std::shared_ptr<Texture> mIcons;
 };
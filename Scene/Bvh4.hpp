@@ -0,0 +1,174 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SIMD
+#include <emmintrin.h>
+#endif
+
+#define BVH4_LEAF_BIT 0x80000000u
+// entries of a traversal stack kept on the C++ stack, deeper trees traverse with a stack on the heap
+#define BVH_LOCAL_STACK_SIZE 256
+
+/// 4-wide BVH node, collapsed from a binary BVH so one ray can be tested against four boxes at once.
+/// Bounds are stored as structure-of-arrays: mMin[axis][child]
+struct Bvh4Node {
+	float mMin[3][4];
+	float mMax[3][4];
+	// index of a child Bvh4Node, or the index of a leaf node in the binary BVH with BVH4_LEAF_BIT set
+	uint32_t mChildren[4];
+	uint32_t mChildCount;
+	// index of the binary BVH node each child was collapsed from, which its bounds are copied from by RefitBvh4
+	uint32_t mSources[4];
+};
+
+/// Traversal stack of size entries, on the C++ stack unless the tree is too deep for BVH_LOCAL_STACK_SIZE
+struct BvhStack {
+	uint32_t mLocal[BVH_LOCAL_STACK_SIZE];
+	std::vector<uint32_t> mHeap;
+	uint32_t* mData;
+
+	inline BvhStack(uint32_t size) : mData(mLocal) {
+		if (size > BVH_LOCAL_STACK_SIZE) {
+			mHeap.resize(size);
+			mData = mHeap.data();
+		}
+	}
+};
+
+/// Returns the number of entries a depth-first traversal of a binary BVH needs on its stack, which is one more than its depth
+/// since each level leaves at most one sibling behind
+template<class Bvh2Node>
+inline uint32_t Bvh2StackSize(const std::vector<Bvh2Node>& nodes) {
+	// children are always stored after their parent, so a forward sweep visits parents first
+	std::vector<uint32_t> depth(nodes.size());
+	uint32_t maxDepth = 0;
+	for (uint32_t i = 0; i < nodes.size(); i++) {
+		maxDepth = std::max(maxDepth, depth[i]);
+		if (nodes[i].mRightOffset == 0) continue;
+		depth[i + 1] = depth[i] + 1;
+		depth[i + nodes[i].mRightOffset] = depth[i] + 1;
+	}
+	return maxDepth + 1;
+}
+/// Returns the number of entries a traversal of a 4-wide BVH with PushChildren needs on its stack: each level leaves at most three
+/// siblings behind
+inline uint32_t Bvh4StackSize(const std::vector<Bvh4Node>& nodes) {
+	// CollapseBvh2 adds each node before its children
+	std::vector<uint32_t> depth(nodes.size());
+	uint32_t maxDepth = 0;
+	for (uint32_t i = 0; i < nodes.size(); i++) {
+		maxDepth = std::max(maxDepth, depth[i]);
+		for (uint32_t c = 0; c < nodes[i].mChildCount; c++)
+			if (!(nodes[i].mChildren[c] & BVH4_LEAF_BIT)) depth[nodes[i].mChildren[c]] = depth[i] + 1;
+	}
+	return 3 * (maxDepth + 1) + 1;
+}
+
+/// Collapses the binary BVH rooted at nodes[index] into result, returns the index of the new Bvh4Node.
+/// Bvh2Node must have the mBounds/mRightOffset layout used by ObjectBvh2 and TriangleBvh2
+template<class Bvh2Node>
+inline uint32_t CollapseBvh2(const std::vector<Bvh2Node>& nodes, uint32_t index, std::vector<Bvh4Node>& result) {
+	uint32_t children[4];
+	uint32_t childCount = 0;
+	if (nodes[index].mRightOffset == 0)
+		children[childCount++] = index;
+	else {
+		children[childCount++] = index + 1;
+		children[childCount++] = index + nodes[index].mRightOffset;
+	}
+
+	// open the largest interior child until the node is full
+	while (childCount < 4) {
+		int32_t largest = -1;
+		float area = -1;
+		for (uint32_t i = 0; i < childCount; i++)
+			if (nodes[children[i]].mRightOffset != 0 && nodes[children[i]].mBounds.SurfaceArea() > area) {
+				largest = (int32_t)i;
+				area = nodes[children[i]].mBounds.SurfaceArea();
+			}
+		if (largest < 0) break;
+		uint32_t c = children[largest];
+		children[largest] = c + 1;
+		children[childCount++] = c + nodes[c].mRightOffset;
+	}
+
+	uint32_t ni = (uint32_t)result.size();
+	result.push_back({});
+	for (uint32_t i = 0; i < 4; i++)
+		for (uint32_t axis = 0; axis < 3; axis++) {
+			result[ni].mMin[axis][i] = i < childCount ? nodes[children[i]].mBounds.mMin[axis] : 0;
+			result[ni].mMax[axis][i] = i < childCount ? nodes[children[i]].mBounds.mMax[axis] : 0;
+		}
+	result[ni].mChildCount = childCount;
+
+	for (uint32_t i = 0; i < childCount; i++) {
+		uint32_t child = nodes[children[i]].mRightOffset == 0 ? (children[i] | BVH4_LEAF_BIT) : CollapseBvh2(nodes, children[i], result);
+		result[ni].mChildren[i] = child;
+		result[ni].mSources[i] = children[i];
+	}
+	for (uint32_t i = childCount; i < 4; i++) {
+		result[ni].mChildren[i] = 0;
+		result[ni].mSources[i] = 0;
+	}
+	return ni;
+}
+
+/// Copies the bounds of a refitted binary BVH into the 4-wide BVH collapsed from it, whose topology is unchanged
+template<class Bvh2Node>
+inline void RefitBvh4(const std::vector<Bvh2Node>& nodes, std::vector<Bvh4Node>& result) {
+	for (Bvh4Node& node : result)
+		for (uint32_t i = 0; i < node.mChildCount; i++)
+			for (uint32_t axis = 0; axis < 3; axis++) {
+				node.mMin[axis][i] = nodes[node.mSources[i]].mBounds.mMin[axis];
+				node.mMax[axis][i] = nodes[node.mSources[i]].mBounds.mMax[axis];
+			}
+}
+
+#ifdef BVH_SIMD
+/// Ray splatted across SSE lanes for Bvh4Node tests
+struct Bvh4Ray {
+	__m128 mOrigin[3];
+	__m128 mInvDirection[3];
+
+	inline Bvh4Ray() {}
+	inline Bvh4Ray(const Ray& ray) {
+		for (uint32_t axis = 0; axis < 3; axis++) {
+			mOrigin[axis] = _mm_set1_ps(ray.mOrigin[axis]);
+			mInvDirection[axis] = _mm_set1_ps(1.f / ray.mDirection[axis]);
+		}
+	}
+};
+
+/// Tests a ray against the children of a node, returns a bitmask of the children that were hit in [0, tmax]
+/// and writes the entry distance of each child into tnear
+inline uint32_t IntersectBvh4Node(const Bvh4Node& node, const Bvh4Ray& ray, float tmax, float tnear[4]) {
+	__m128 t0 = _mm_setzero_ps();
+	__m128 t1 = _mm_set1_ps(tmax);
+	for (uint32_t axis = 0; axis < 3; axis++) {
+		__m128 a = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.mMin[axis]), ray.mOrigin[axis]), ray.mInvDirection[axis]);
+		__m128 b = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.mMax[axis]), ray.mOrigin[axis]), ray.mInvDirection[axis]);
+		// NaNs (0 * inf) fall through to the running t0/t1 since min/max return the second operand
+		t0 = _mm_max_ps(_mm_min_ps(a, b), t0);
+		t1 = _mm_min_ps(_mm_max_ps(a, b), t1);
+	}
+	_mm_storeu_ps(tnear, t0);
+	return (uint32_t)_mm_movemask_ps(_mm_cmple_ps(t0, t1)) & ((1u << node.mChildCount) - 1);
+}
+
+/// Pushes the children in mask onto a traversal stack far to near, so the nearest child is popped first
+inline void PushChildren(const Bvh4Node& node, uint32_t mask, const float tnear[4], uint32_t* todo, int& stackptr) {
+	uint32_t order[4];
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < 4; i++)
+		if (mask & (1 << i)) {
+			uint32_t j = n++;
+			for (; j > 0 && tnear[order[j - 1]] < tnear[i]; j--)
+				order[j] = order[j - 1];
+			order[j] = i;
+		}
+	for (uint32_t i = 0; i < n; i++)
+		todo[++stackptr] = node.mChildren[order[i]];
+}
+#endif
@@ -61,7 +61,7 @@ Camera::Camera(const string& name, ::Device* device, VkFormat renderFormat, VkFo
 	mOrthographic(false), mOrthographicSize(3),
 	mFieldOfView(PI/4),
 	mNear(.03f), mFar(500.f),
-	mRenderPriority(100), mStereoMode(STEREO_NONE) {
+	mRenderPriority(100), mStereoMode(STEREO_NONE), mAllowMultiview(true), mMultiview(false), mStereoExtent({ 0, 0 }) {
 
 	vector<VkFormat> colorFormats{ renderFormat, VK_FORMAT_R16G16B16A16_SFLOAT };
 	mFramebuffer = new ::Framebuffer(name, mDevice, 1600, 900, colorFormats, depthFormat, sampleCount, {}, VK_ATTACHMENT_LOAD_OP_CLEAR);
@@ -79,7 +79,7 @@ Camera::Camera(const string& name, Window* targetWindow, VkFormat depthFormat, V
 	mOrthographic(false), mOrthographicSize(3),
 	mFieldOfView(PI/4),
 	mNear(.03f), mFar(500.f),
-	mRenderPriority(100), mStereoMode(STEREO_NONE) {
+	mRenderPriority(100), mStereoMode(STEREO_NONE), mAllowMultiview(true), mMultiview(false), mStereoExtent({ 0, 0 }) {
 
 	mTargetWindow->mTargetCamera = this;
 
@@ -100,7 +100,7 @@ Camera::Camera(const string& name, ::Framebuffer* framebuffer)
 	mOrthographic(false), mOrthographicSize(3),
 	mFieldOfView(PI/4),
 	mNear(.03f), mFar(500.f),
-	mRenderPriority(100), mStereoMode(STEREO_NONE) {
+	mRenderPriority(100), mStereoMode(STEREO_NONE), mAllowMultiview(true), mMultiview(false), mStereoExtent({ 0, 0 }) {
 
 	mResolveBuffers = new vector<Texture*>[mDevice->MaxFramesInFlight()];
 	memset(mResolveBuffers, 0, sizeof(Texture*) * mDevice->MaxFramesInFlight());
@@ -155,36 +155,49 @@ Ray Camera::ScreenToWorldRay(const float2& uv, StereoEye eye) {
 
 void Camera::PreRender() {
 	if (mTargetWindow && (FramebufferWidth() != mTargetWindow->BackBufferSize().width || FramebufferHeight() != mTargetWindow->BackBufferSize().height)) {
-		mFramebuffer->Width(mTargetWindow->BackBufferSize().width);
-		mFramebuffer->Height(mTargetWindow->BackBufferSize().height);
-		mMatricesDirty = true;
+		UpdateMultiview(mTargetWindow->BackBufferSize().width, mTargetWindow->BackBufferSize().height);
 
 		mViewport.x = 0;
 		mViewport.y = 0;
-		mViewport.width = (float)mFramebuffer->Width();
-		mViewport.height = (float)mFramebuffer->Height();
+		mViewport.width = (float)FramebufferWidth();
+		mViewport.height = (float)FramebufferHeight();
 	}
 }
+void Camera::UpdateMultiview(uint32_t width, uint32_t height) {
+	// only framebuffers the camera owns are switched to multiview, a supplied framebuffer keeps its views
+	mMultiview = mAllowMultiview && mDeleteFramebuffer && mStereoMode != STEREO_NONE && mDevice->MultiviewSupported();
+	mStereoExtent = { width, height };
+	if (mDeleteFramebuffer) mFramebuffer->ViewCount(mMultiview ? 2 : 1);
+	mFramebuffer->Width(mMultiview && mStereoMode == STEREO_SBS_HORIZONTAL ? width / 2 : width);
+	mFramebuffer->Height(mMultiview && mStereoMode == STEREO_SBS_VERTICAL ? height / 2 : height);
+	mMatricesDirty = true;
+}
 void Camera::Resolve(CommandBuffer* commandBuffer) {
 	if (!mFramebuffer->Width() || !mFramebuffer->Height()) return;
 
 	vector<Texture*>& buffers = mResolveBuffers[mDevice->FrameContextIndex()];
 	if (buffers.size() < mFramebuffer->ColorBufferCount()) buffers.resize(mFramebuffer->ColorBufferCount());
-	if (mFramebuffer->SampleCount() == VK_SAMPLE_COUNT_1_BIT)
+	if (mFramebuffer->SampleCount() == VK_SAMPLE_COUNT_1_BIT && !mMultiview)
 		for (uint32_t i = 0; i < buffers.size(); i++)
 			mFramebuffer->ColorBuffer(i)->TransitionImageLayout(VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, commandBuffer);
 	else {
 		PROFILER_BEGIN("Resolve/Copy Camera");
 		BEGIN_CMD_REGION(commandBuffer, "Resolve/Copy Camera");
+		// with multiview, each eye's layer goes to its half of the side by side image
+		VkOffset2D viewOffset = { 0, 0 };
+		if (mMultiview) {
+			if (mStereoMode == STEREO_SBS_HORIZONTAL) viewOffset.x = (int32_t)mFramebuffer->Width();
+			else viewOffset.y = (int32_t)mFramebuffer->Height();
+		}
 		for (uint32_t i = 0; i < buffers.size(); i++) {
-			if (buffers[i] && (buffers[i]->Width() != mFramebuffer->Width() || buffers[i]->Height() != mFramebuffer->Height()))
+			if (buffers[i] && (buffers[i]->Width() != FramebufferWidth() || buffers[i]->Height() != FramebufferHeight()))
 				safe_delete(buffers[i]);
 			if (!buffers[i]) {
-				buffers[i] = new Texture("Camera Resolve", mDevice, mFramebuffer->Width(), mFramebuffer->Height(), 1, mFramebuffer->ColorBuffer(i)->Format(), VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
+				buffers[i] = new Texture("Camera Resolve", mDevice, FramebufferWidth(), FramebufferHeight(), 1, mFramebuffer->ColorBuffer(i)->Format(), VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
 				buffers[i]->TransitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer);
 			} else
 				buffers[i]->TransitionImageLayout(VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer);
-			mFramebuffer->ResolveColor(commandBuffer, i, buffers[i]->Image());
+			mFramebuffer->ResolveColor(commandBuffer, i, buffers[i]->Image(), viewOffset);
 			buffers[i]->TransitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL, commandBuffer);
 		}
 		END_CMD_REGION(commandBuffer);
@@ -193,7 +206,7 @@ void Camera::Resolve(CommandBuffer* commandBuffer) {
 }
 void Camera::PostRender(CommandBuffer* commandBuffer) {
 	vector<Texture*>& buffers = mResolveBuffers[mDevice->FrameContextIndex()];
-	if (mFramebuffer->SampleCount() == VK_SAMPLE_COUNT_1_BIT)
+	if (mFramebuffer->SampleCount() == VK_SAMPLE_COUNT_1_BIT && !mMultiview)
 		for (uint32_t i = 0; i < buffers.size(); i++)
 			mFramebuffer->ColorBuffer(i)->TransitionImageLayout(VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, commandBuffer);
 }
@@ -215,23 +228,40 @@ void Camera::Set(CommandBuffer* commandBuffer) {
 	buf.Right = WorldRotation() * float3(1, 0, 0);
 	buf.Up = WorldRotation() * float3(0, 1, 0);
 	
+	SetViewport(commandBuffer);
+}
+void Camera::SetViewport(CommandBuffer* commandBuffer) {
 	VkRect2D scissor{ { 0, 0 }, { mFramebuffer->Width(), mFramebuffer->Height() } };
+	VkViewport viewport = EyeViewport();
 	vkCmdSetScissor(*commandBuffer, 0, 1, &scissor);
-	vkCmdSetViewport(*commandBuffer, 0, 1, &mViewport);
+	vkCmdSetViewport(*commandBuffer, 0, 1, &viewport);
+}
+VkViewport Camera::EyeViewport() const {
+	VkViewport viewport = mViewport;
+	if (mMultiview && mStereoMode == STEREO_SBS_HORIZONTAL) {
+		viewport.x /= 2;
+		viewport.width /= 2;
+	} else if (mMultiview && mStereoMode == STEREO_SBS_VERTICAL) {
+		viewport.y /= 2;
+		viewport.height /= 2;
+	}
+	return viewport;
 }
 
 void Camera::SetStereo(CommandBuffer* commandBuffer, ShaderVariant* shader, StereoEye eye) {
 	if (!shader) return;
-	uint32_t eyec = eye;
+	// the view index selects the eye in multiview render passes, see STRATUM_EYE
+	uint32_t eyec = mMultiview ? 0 : eye;
 	commandBuffer->PushConstant(shader, "StereoEye", &eyec);
 
 	float4 clipst(1, 1, 0, 0);
 	VkRect2D scissor{ { 0, 0 }, { mFramebuffer->Width(), mFramebuffer->Height() } };
-	if (mStereoMode == STEREO_SBS_HORIZONTAL) {
+	// with multiview each eye has its own layer, so there is nothing to offset
+	if (mStereoMode == STEREO_SBS_HORIZONTAL && !mMultiview) {
 		clipst = float4(.5f, 1, eye == EYE_LEFT ? -.25f : .25f, 0);
 		scissor.extent.width /= 2;
 		scissor.offset.x = eye == EYE_LEFT ? 0 : scissor.extent.width;
-	} else if (mStereoMode == STEREO_SBS_VERTICAL) {
+	} else if (mStereoMode == STEREO_SBS_VERTICAL && !mMultiview) {
 		clipst = float4(1, .5f, 0, eye == EYE_LEFT ? -.25f : .25f);
 		scissor.extent.height /= 2;
 		scissor.offset.y = eye == EYE_LEFT ? 0 : scissor.extent.height;
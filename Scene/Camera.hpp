@@ -35,7 +35,9 @@ public:
 
 	// Updates the uniform buffer and sets the non-stereo viewport
 	ENGINE_EXPORT virtual void Set(CommandBuffer* commandBuffer);
-	// Sets the viewport and StereoEye push constant
+	// Sets the non-stereo viewport without touching the uniform buffer, safe to call from multiple threads once Set() has been called this frame
+	ENGINE_EXPORT virtual void SetViewport(CommandBuffer* commandBuffer);
+	// Sets the viewport and StereoEye push constant. With multiview, both eyes are drawn at once and only EYE_LEFT needs to be set
 	ENGINE_EXPORT virtual void SetStereo(CommandBuffer* commandBuffer, ShaderVariant* shader, StereoEye eye);
 
 	ENGINE_EXPORT virtual float4 WorldToClip(const float3& worldPos, StereoEye eye = EYE_NONE);
@@ -50,6 +52,7 @@ public:
 	// If TargetWindow is nullptr and SampleCount is not VK_SAMPLE_COUNT_1, resolves the framebuffer to ResolveBuffer and transitions ResolveBuffer to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
 	// If TargetWindow is nullptr and SampleCount is VK_SAMPLE_COUNT_1, transitions the framebuffer to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
 	// If TargetWindow is not nullptr, resolves or copies the framebuffer to the window
+	// With multiview, the eyes are always resolved or copied side by side into ResolveBuffer
 	ENGINE_EXPORT virtual void Resolve(CommandBuffer* commandBuffer);
 
 	ENGINE_EXPORT virtual void DrawGizmos(CommandBuffer* commandBuffer, Camera* camera);
@@ -57,7 +60,9 @@ public:
 
 	// Setters
 
-	inline virtual void StereoMode(::StereoMode s) { mStereoMode = s; mMatricesDirty = true; }
+	inline virtual void StereoMode(::StereoMode s) { uint32_t w = FramebufferWidth(), h = FramebufferHeight(); mStereoMode = s; UpdateMultiview(w, h); }
+	// Stereo cameras render both eyes in a single pass with multiview when the device supports it, instead of drawing everything once per eye
+	inline virtual void AllowMultiview(bool m) { uint32_t w = FramebufferWidth(), h = FramebufferHeight(); mAllowMultiview = m; UpdateMultiview(w, h); }
 
 	inline virtual void Orthographic(bool o) { mOrthographic = o; mMatricesDirty = true; }
 	inline virtual void OrthographicSize(float s) { mOrthographicSize = s; mMatricesDirty = true; }
@@ -71,8 +76,8 @@ public:
 	inline virtual void ViewportWidth(float f) { mViewport.width = f; mMatricesDirty = true; }
 	inline virtual void ViewportHeight(float f) { mViewport.height = f; mMatricesDirty = true; }
 
-	inline virtual void FramebufferWidth(uint32_t w) { mFramebuffer->Width(w);  mMatricesDirty = true; }
-	inline virtual void FramebufferHeight(uint32_t h) { mFramebuffer->Height(h); mMatricesDirty = true; }
+	inline virtual void FramebufferWidth(uint32_t w) { UpdateMultiview(w, FramebufferHeight()); }
+	inline virtual void FramebufferHeight(uint32_t h) { UpdateMultiview(FramebufferWidth(), h); }
 	inline virtual void SampleCount(VkSampleCountFlagBits s) { mFramebuffer->SampleCount(s); }
 
 	inline virtual void HeadToEye(const float4x4& transform, StereoEye eye = EYE_NONE) { mHeadToEye[eye] = transform; mMatricesDirty = true; }
@@ -82,6 +87,9 @@ public:
 	// Getters
 
 	inline virtual ::StereoMode StereoMode() { return mStereoMode; }
+	inline virtual bool AllowMultiview() const { return mAllowMultiview; }
+	// True if both eyes are rendered in a single pass, to the two array layers of the framebuffer
+	inline virtual bool Multiview() const { return mMultiview; }
 
 	inline virtual float Near() const { return mNear; }
 	inline virtual float Far() const { return mFar; }
@@ -95,15 +103,18 @@ public:
 	inline virtual float ViewportWidth() const { return mViewport.width; }
 	inline virtual float ViewportHeight() const { return mViewport.height; }
 	inline virtual float Aspect() const { return mViewport.width / mViewport.height; }
+	// The viewport in the framebuffer, which only covers one eye's half of the viewport when rendering with multiview
+	ENGINE_EXPORT virtual VkViewport EyeViewport() const;
 
-	inline virtual uint32_t FramebufferWidth()  const { return mFramebuffer->Width();  }
-	inline virtual uint32_t FramebufferHeight() const { return mFramebuffer->Height(); }
+	// The size of the image the camera renders, with multiview the framebuffer is the size of a single eye
+	inline virtual uint32_t FramebufferWidth()  const { return mMultiview ? mStereoExtent.width : mFramebuffer->Width();  }
+	inline virtual uint32_t FramebufferHeight() const { return mMultiview ? mStereoExtent.height : mFramebuffer->Height(); }
 	inline virtual VkSampleCountFlagBits SampleCount() const { return mFramebuffer->SampleCount(); }
 
 
 	inline virtual ::Framebuffer* Framebuffer() const { return mFramebuffer; }
 	inline virtual Texture* ColorBuffer(uint32_t index = 0) const { return mFramebuffer->ColorBuffer(index); }
-	inline virtual Texture* ResolveBuffer(uint32_t index = 0) const { return mFramebuffer->SampleCount() == VK_SAMPLE_COUNT_1_BIT ? mFramebuffer->ColorBuffer(index) : mResolveBuffers[mDevice->FrameContextIndex()][index]; }
+	inline virtual Texture* ResolveBuffer(uint32_t index = 0) const { return mFramebuffer->SampleCount() == VK_SAMPLE_COUNT_1_BIT && !mMultiview ? mFramebuffer->ColorBuffer(index) : mResolveBuffers[mDevice->FrameContextIndex()][index]; }
 
 	inline virtual Buffer* UniformBuffer() const { return mUniformBuffer; }
 	ENGINE_EXPORT virtual ::DescriptorSet* DescriptorSet(VkShaderStageFlags stage);
@@ -125,6 +136,10 @@ private:
 	uint32_t mRenderPriority;
 
 	::StereoMode mStereoMode;
+	bool mAllowMultiview;
+	bool mMultiview;
+	// the size of the side by side image while rendering with multiview
+	VkExtent2D mStereoExtent;
 
 	bool mOrthographic;
 	float mOrthographicSize;
@@ -158,6 +173,8 @@ private:
 	std::vector<std::unordered_map<VkShaderStageFlags, ::DescriptorSet*>> mDescriptorSets;
 
 	void CreateDescriptorSet();
+	// Resizes the framebuffer to width x height, or to one eye of it when rendering with multiview
+	ENGINE_EXPORT void UpdateMultiview(uint32_t width, uint32_t height);
 
 protected:
 	ENGINE_EXPORT virtual void Dirty();
@@ -93,11 +93,11 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, pass, nullptr);
 		if (!layout) return;
 
-		Buffer* screenRects = commandBuffer->Device()->GetTempBuffer("WorldRects", mWorldRects.size() * sizeof(GuiRect), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
-		memcpy(screenRects->MappedData(), mWorldRects.data(), mWorldRects.size() * sizeof(GuiRect));
+		Device::TempRange screenRects = commandBuffer->Device()->AllocateTemp(mWorldRects.size() * sizeof(GuiRect));
+		memcpy(screenRects.mData, mWorldRects.data(), mWorldRects.size() * sizeof(GuiRect));
 
 		DescriptorSet* ds = commandBuffer->Device()->GetTempDescriptorSet("WorldRects", shader->mDescriptorSetLayouts[PER_OBJECT]);
-		ds->CreateStorageBufferDescriptor(screenRects, 0, mWorldRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
+		ds->CreateStorageBufferDescriptor(screenRects.mBuffer, screenRects.mOffset, mWorldRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
 		ds->FlushWrites();
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, *ds, 0, nullptr);
 
@@ -109,11 +109,11 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, pass, nullptr);
 		if (!layout) return;
 
-		Buffer* screenRects = commandBuffer->Device()->GetTempBuffer("WorldRects", mWorldTextureRects.size() * sizeof(GuiRect), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
-		memcpy(screenRects->MappedData(), mWorldTextureRects.data(), mWorldTextureRects.size() * sizeof(GuiRect));
+		Device::TempRange screenRects = commandBuffer->Device()->AllocateTemp(mWorldTextureRects.size() * sizeof(GuiRect));
+		memcpy(screenRects.mData, mWorldTextureRects.data(), mWorldTextureRects.size() * sizeof(GuiRect));
 
 		DescriptorSet* ds = commandBuffer->Device()->GetTempDescriptorSet("WorldRects", shader->mDescriptorSetLayouts[PER_OBJECT]);
-		ds->CreateStorageBufferDescriptor(screenRects, 0, mWorldTextureRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
+		ds->CreateStorageBufferDescriptor(screenRects.mBuffer, screenRects.mOffset, mWorldTextureRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
 		for (uint32_t i = 0; i < mTextureArray.size(); i++)
 			ds->CreateSampledTextureDescriptor(mTextureArray[i], i, shader->mDescriptorBindings.at("Textures").second.binding);
 		ds->FlushWrites();
@@ -184,11 +184,11 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, pass, nullptr);
 		if (!layout) return;
 
-		Buffer* screenRects = commandBuffer->Device()->GetTempBuffer("ScreenRects", mScreenRects.size() * sizeof(GuiRect), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
-		memcpy(screenRects->MappedData(), mScreenRects.data(), mScreenRects.size() * sizeof(GuiRect));
+		Device::TempRange screenRects = commandBuffer->Device()->AllocateTemp(mScreenRects.size() * sizeof(GuiRect));
+		memcpy(screenRects.mData, mScreenRects.data(), mScreenRects.size() * sizeof(GuiRect));
 
 		DescriptorSet* ds = commandBuffer->Device()->GetTempDescriptorSet("ScreenRects", shader->mDescriptorSetLayouts[PER_OBJECT]);
-		ds->CreateStorageBufferDescriptor(screenRects, 0, mScreenRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
+		ds->CreateStorageBufferDescriptor(screenRects.mBuffer, screenRects.mOffset, mScreenRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
 		ds->FlushWrites();
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, *ds, 0, nullptr);
 
@@ -203,11 +203,11 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, pass, nullptr);
 		if (!layout) return;
 
-		Buffer* screenRects = commandBuffer->Device()->GetTempBuffer("WorldRects", mScreenTextureRects.size() * sizeof(GuiRect), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
-		memcpy(screenRects->MappedData(), mScreenTextureRects.data(), mScreenTextureRects.size() * sizeof(GuiRect));
+		Device::TempRange screenRects = commandBuffer->Device()->AllocateTemp(mScreenTextureRects.size() * sizeof(GuiRect));
+		memcpy(screenRects.mData, mScreenTextureRects.data(), mScreenTextureRects.size() * sizeof(GuiRect));
 
 		DescriptorSet* ds = commandBuffer->Device()->GetTempDescriptorSet("WorldRects", shader->mDescriptorSetLayouts[PER_OBJECT]);
-		ds->CreateStorageBufferDescriptor(screenRects, 0, mScreenTextureRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
+		ds->CreateStorageBufferDescriptor(screenRects.mBuffer, screenRects.mOffset, mScreenTextureRects.size() * sizeof(GuiRect), shader->mDescriptorBindings.at("Rects").second.binding);
 		for (uint32_t i = 0; i < mTextureArray.size(); i++)
 			ds->CreateSampledTextureDescriptor(mTextureArray[i], i, shader->mDescriptorBindings.at("Textures").second.binding);
 		ds->FlushWrites();
@@ -274,11 +274,11 @@ void GUI::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 		VkPipelineLayout layout = commandBuffer->BindShader(shader, pass, nullptr, nullptr, VK_PRIMITIVE_TOPOLOGY_LINE_STRIP);
 		if (!layout) return;
 
-		Buffer* b = commandBuffer->Device()->GetTempBuffer("Perf Graph Pts", sizeof(float2) * mLinePoints.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
-		memcpy(b->MappedData(), mLinePoints.data(), sizeof(float2) * mLinePoints.size());
+		Device::TempRange b = commandBuffer->Device()->AllocateTemp(sizeof(float2) * mLinePoints.size());
+		memcpy(b.mData, mLinePoints.data(), sizeof(float2) * mLinePoints.size());
 		
 		DescriptorSet* ds = commandBuffer->Device()->GetTempDescriptorSet("Perf Graph DS", shader->mDescriptorSetLayouts[PER_OBJECT]);
-		ds->CreateStorageBufferDescriptor(b, 0, sizeof(float2) * mLinePoints.size(), INSTANCE_BUFFER_BINDING);
+		ds->CreateStorageBufferDescriptor(b.mBuffer, b.mOffset, sizeof(float2) * mLinePoints.size(), INSTANCE_BUFFER_BINDING);
 		ds->FlushWrites();
 
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, *ds, 0, nullptr);
@@ -326,7 +326,7 @@ void Gizmos::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 			// wire cube
 			camera->SetStereo(commandBuffer, shader, EYE_LEFT);
 			vkCmdDrawIndexed(*commandBuffer, 24, wireCubeCount, 36, 0, instanceOffset);
-			if (camera->StereoMode() != STEREO_NONE) {
+			if (camera->StereoMode() != STEREO_NONE && !camera->Multiview()) {
 				camera->SetStereo(commandBuffer, shader, EYE_RIGHT);
 				vkCmdDrawIndexed(*commandBuffer, 24, wireCubeCount, 36, 0, instanceOffset);
 			}
@@ -336,7 +336,7 @@ void Gizmos::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 			// wire circle
 			camera->SetStereo(commandBuffer, shader, EYE_LEFT);
 			vkCmdDrawIndexed(*commandBuffer, CircleResolution * 2, wireCircleCount, 60, 0, instanceOffset);
-			if (camera->StereoMode() != STEREO_NONE) {
+			if (camera->StereoMode() != STEREO_NONE && !camera->Multiview()) {
 				camera->SetStereo(commandBuffer, shader, EYE_RIGHT);
 				vkCmdDrawIndexed(*commandBuffer, CircleResolution * 2, wireCircleCount, 60, 0, instanceOffset);
 			}
@@ -356,7 +356,7 @@ void Gizmos::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 			// billboard
 			camera->SetStereo(commandBuffer, shader, EYE_LEFT);
 			vkCmdDrawIndexed(*commandBuffer, 6, billboardCount, 0, 0, instanceOffset);
-			if (camera->StereoMode() != STEREO_NONE) {
+			if (camera->StereoMode() != STEREO_NONE && !camera->Multiview()) {
 				camera->SetStereo(commandBuffer, shader, EYE_RIGHT);
 				vkCmdDrawIndexed(*commandBuffer, 6, billboardCount, 0, 0, instanceOffset);
 			}
@@ -366,7 +366,7 @@ void Gizmos::Draw(CommandBuffer* commandBuffer, PassType pass, Camera* camera) {
 			// cube	
 			camera->SetStereo(commandBuffer, shader, EYE_LEFT);
 			vkCmdDrawIndexed(*commandBuffer, 36, cubeCount, 0, 0, instanceOffset);
-			if (camera->StereoMode() != STEREO_NONE) {
+			if (camera->StereoMode() != STEREO_NONE && !camera->Multiview()) {
 				camera->SetStereo(commandBuffer, shader, EYE_RIGHT);
 				vkCmdDrawIndexed(*commandBuffer, 36, cubeCount, 0, 0, instanceOffset);
 			}
@@ -10,12 +10,13 @@
 using namespace std;
 
 MeshRenderer::MeshRenderer(const string& name)
-	: Object(name), mVisible(true), mMesh(nullptr), mRayMask(0) {}
+	: Object(name), mVisible(true), mMesh(nullptr), mRayMask(0), mInstanceSlot(INVALID_INSTANCE_SLOT), mInstanceDirty(true), mGpuInstance(INVALID_INSTANCE_SLOT) {}
 MeshRenderer::~MeshRenderer() {}
 
 bool MeshRenderer::UpdateTransform() {
 	if (!Object::UpdateTransform()) return false;
 	mAABB = Mesh()->Bounds() * ObjectToWorld();
+	mInstanceDirty = true;
 	return true;
 }
 
@@ -27,12 +28,12 @@ void MeshRenderer::PreRender(CommandBuffer* commandBuffer, Camera* camera, PassT
 	if (pass == PASS_MAIN) Scene()->Environment()->SetEnvironment(camera, mMaterial.get());
 }
 
-void MeshRenderer::DrawInstanced(CommandBuffer* commandBuffer, Camera* camera, uint32_t instanceCount, VkDescriptorSet instanceDS, PassType pass) {
+GraphicsShader* MeshRenderer::BindDraw(CommandBuffer* commandBuffer, Camera* camera, VkDescriptorSet instanceDS, uint32_t instanceOffset, PassType pass) {
 	::Mesh* mesh = Mesh();
 
 	VkCullModeFlags cull = (pass == PASS_DEPTH) ? VK_CULL_MODE_NONE : VK_CULL_MODE_FLAG_BITS_MAX_ENUM;
 	VkPipelineLayout layout = commandBuffer->BindMaterial(mMaterial.get(), pass, mesh->VertexInput(), camera, mesh->Topology(), cull);
-	if (!layout) return;
+	if (!layout) return nullptr;
 	auto shader = mMaterial->GetShader(pass);
 
 	uint32_t lc = (uint32_t)Scene()->ActiveLights().size();
@@ -45,23 +46,54 @@ void MeshRenderer::DrawInstanced(CommandBuffer* commandBuffer, Camera* camera, u
 		commandBuffer->PushConstant(shader, kp.first, &kp.second);
 	
 	if (instanceDS != VK_NULL_HANDLE)
-		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, &instanceDS, 0, nullptr);
+		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, &instanceDS, 1, &instanceOffset);
 
 	commandBuffer->BindVertexBuffer(mesh->VertexBuffer().get(), 0, 0);
 	commandBuffer->BindIndexBuffer(mesh->IndexBuffer().get(), 0, mesh->IndexType());
+	return shader;
+}
+
+void MeshRenderer::DrawInstanced(CommandBuffer* commandBuffer, Camera* camera, uint32_t instanceCount, VkDescriptorSet instanceDS, uint32_t instanceOffset, PassType pass) {
+	GraphicsShader* shader = BindDraw(commandBuffer, camera, instanceDS, instanceOffset, pass);
+	if (!shader) return;
+	::Mesh* mesh = Mesh();
+
 	camera->SetStereo(commandBuffer, shader, EYE_LEFT);
 	vkCmdDrawIndexed(*commandBuffer, mesh->IndexCount(), instanceCount, mesh->BaseIndex(), mesh->BaseVertex(), 0);
 	commandBuffer->mTriangleCount += instanceCount * (mesh->IndexCount() / 3);
 	
-	if (camera->StereoMode() != STEREO_NONE) {
+	if (camera->StereoMode() != STEREO_NONE && !camera->Multiview()) {
 		camera->SetStereo(commandBuffer, shader, EYE_RIGHT);
 		vkCmdDrawIndexed(*commandBuffer, mesh->IndexCount(), instanceCount, mesh->BaseIndex(), mesh->BaseVertex(), 0);
 		commandBuffer->mTriangleCount += instanceCount * (mesh->IndexCount() / 3);
 	}
 }
 
+void MeshRenderer::DrawIndirect(CommandBuffer* commandBuffer, Camera* camera, VkDescriptorSet instanceDS, uint32_t instanceOffset, Buffer* drawBuffer, VkDeviceSize drawOffset, uint32_t drawCount, Buffer* countBuffer, VkDeviceSize countOffset, PassType pass) {
+	GraphicsShader* shader = BindDraw(commandBuffer, camera, instanceDS, instanceOffset, pass);
+	if (!shader) return;
+	Device* device = commandBuffer->Device();
+
+	auto draw = [&]() {
+		if (device->MultiDrawIndirectSupported())
+			device->CmdDrawIndexedIndirectCount(*commandBuffer, *drawBuffer, drawOffset, *countBuffer, countOffset, drawCount, sizeof(GPUDrawCommand));
+		else
+			// draws past the count have an instance count of 0
+			for (uint32_t i = 0; i < drawCount; i++)
+				vkCmdDrawIndexedIndirect(*commandBuffer, *drawBuffer, drawOffset + i * sizeof(GPUDrawCommand), 1, sizeof(GPUDrawCommand));
+	};
+
+	// the instance count is only known on the GPU, so nothing is added to mTriangleCount
+	camera->SetStereo(commandBuffer, shader, EYE_LEFT);
+	draw();
+	if (camera->StereoMode() != STEREO_NONE && !camera->Multiview()) {
+		camera->SetStereo(commandBuffer, shader, EYE_RIGHT);
+		draw();
+	}
+}
+
 void MeshRenderer::Draw(CommandBuffer* commandBuffer, Camera* camera, PassType pass) {
-	DrawInstanced(commandBuffer, camera, 1, VK_NULL_HANDLE, pass);
+	DrawInstanced(commandBuffer, camera, 1, VK_NULL_HANDLE, 0, pass);
 }
 
 bool MeshRenderer::Intersect(const Ray& ray, float* t, bool any) {
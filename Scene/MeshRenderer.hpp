@@ -6,6 +6,8 @@
 #include <Scene/Renderer.hpp>
 #include <Util/Util.hpp>
 
+#define INVALID_INSTANCE_SLOT 0xFFFFFFFFu
+
 class MeshRenderer : public Renderer {
 public:
 	union PushConstantValue {
@@ -58,7 +60,13 @@ public:
 	ENGINE_EXPORT virtual void Draw(CommandBuffer* commandBuffer, Camera* camera, PassType pass) override;
 
 	ENGINE_EXPORT virtual void PreRender(CommandBuffer* commandBuffer, Camera* camera, PassType pass);
-	ENGINE_EXPORT virtual void DrawInstanced(CommandBuffer* commandBuffer, Camera* camera, uint32_t instanceCount, VkDescriptorSet instanceDS, PassType pass);
+	/// instanceDS is a PER_OBJECT descriptor set whose InstanceIndices buffer is bound at the dynamic offset instanceOffset
+	ENGINE_EXPORT virtual void DrawInstanced(CommandBuffer* commandBuffer, Camera* camera, uint32_t instanceCount, VkDescriptorSet instanceDS, uint32_t instanceOffset, PassType pass);
+	/// Draws the first n of the drawCount GPUDrawCommands at drawOffset in one call, where n is the uint at countOffset. Every command
+	/// must share this renderer's material and mesh buffers. Used by GPU-driven scenes
+	ENGINE_EXPORT virtual void DrawIndirect(CommandBuffer* commandBuffer, Camera* camera, VkDescriptorSet instanceDS, uint32_t instanceOffset, Buffer* drawBuffer, VkDeviceSize drawOffset, uint32_t drawCount, Buffer* countBuffer, VkDeviceSize countOffset, PassType pass);
+	/// True if the renderer can be drawn from a GPU-driven scene, which culls and draws it with DrawIndirect
+	inline virtual bool GpuDrivable() { return true; }
 
 	ENGINE_EXPORT virtual void DrawGizmos(CommandBuffer* commandBuffer, Camera* camera);
 
@@ -66,7 +74,13 @@ public:
 	inline virtual AABB Bounds() override { UpdateTransform(); return mAABB; }
 
 private:
+	friend class Scene;
 	uint32_t mRayMask;
+	// slot in the scene's persistent instance buffer, and whether the transform changed since the slot was last uploaded
+	uint32_t mInstanceSlot;
+	bool mInstanceDirty;
+	// index of the renderer's bounds in the scene's GPU scene, INVALID_INSTANCE_SLOT if it isn't GPU-driven
+	uint32_t mGpuInstance;
 
 protected:
 	std::shared_ptr<::Material> mMaterial;
@@ -75,4 +89,6 @@ protected:
 	AABB mAABB;
 	std::variant<::Mesh*, std::shared_ptr<::Mesh>> mMesh;
 	ENGINE_EXPORT virtual bool UpdateTransform() override;
+	/// Binds the material, push constants, instance descriptor set and mesh buffers. Returns nullptr if the material can't be bound
+	ENGINE_EXPORT virtual GraphicsShader* BindDraw(CommandBuffer* commandBuffer, Camera* camera, VkDescriptorSet instanceDS, uint32_t instanceOffset, PassType pass);
 };
\ No newline at end of file
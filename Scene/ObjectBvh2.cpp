@@ -1,18 +1,37 @@
 #include <Scene/ObjectBvh2.hpp>
 
 #include <Scene/Scene.hpp>
+#include <Util/ThreadPool.hpp>
 
 using namespace std;
 
+#define BVH_SAH_BIN_COUNT 16u
+// relative cost of traversing a node vs. intersecting a primitive
+#define BVH_SAH_TRAVERSAL_COST .5f
+// number of rays per IntersectBatch task
+#define BVH_BATCH_SIZE 64
+
 void ObjectBvh2::Build(Object** objects, uint32_t objectCount) {
 	mPrimitives.clear();
 	mNodes.clear();
+	mNodes4.clear();
+	mStackSize = 0;
+	mStackSize4 = 0;
+	mBuildCost = 0;
+
+	if (objectCount == 0) return;
+
+	mPrimitives.reserve(objectCount);
+	mNodes.reserve(2 * objectCount - 1);
 
+	// centroids are kept alongside mPrimitives and swapped with them during partitioning
+	vector<float3> centroids(objectCount);
 	for (uint32_t i = 0; i < objectCount; i++) {
 		AABB aabb(objects[i]->Bounds());
 		aabb.mMin -= 1e-3f;
 		aabb.mMax += 1e-3f;
 		mPrimitives.push_back({ aabb, objects[i] });
+		centroids[i] = aabb.Center();
 	}
 
 	struct BuildTask {
@@ -20,8 +39,13 @@ void ObjectBvh2::Build(Object** objects, uint32_t objectCount) {
 		uint32_t mStart;
 		uint32_t mEnd;
 	};
+	struct Bin {
+		AABB mBounds;
+		uint32_t mCount;
+	};
 
-	BuildTask todo[1024];
+	// grows with the depth of the tree, which a run of lopsided splits can take past any fixed size
+	vector<BuildTask> todo(64);
 	uint32_t stackptr = 0;
 	const uint32_t untouched = 0xffffffff;
 	const uint32_t touchedTwice = 0xfffffffd;
@@ -30,15 +54,18 @@ void ObjectBvh2::Build(Object** objects, uint32_t objectCount) {
 	uint32_t nLeafs = 0;
 
 	Node node;
+	Bin bins[BVH_SAH_BIN_COUNT];
+	float rightCost[BVH_SAH_BIN_COUNT];
+	const AABB empty(float3(1e30f), float3(-1e30f));
 
 	todo[stackptr].mStart = 0;
-	todo[stackptr].mEnd = mPrimitives.size();
+	todo[stackptr].mEnd = (uint32_t)mPrimitives.size();
 	todo[stackptr].mParentOffset = 0xfffffffc;
 	stackptr++;
 
 	while (stackptr > 0) {
 		// Pop the next item off of the stack
-		BuildTask& bnode(todo[--stackptr]);
+		BuildTask bnode = todo[--stackptr];
 		uint32_t start = bnode.mStart;
 		uint32_t end = bnode.mEnd;
 		uint32_t nPrims = end - start;
@@ -50,16 +77,16 @@ void ObjectBvh2::Build(Object** objects, uint32_t objectCount) {
 
 		// Calculate the bounding box for this node
 		AABB bb(mPrimitives[start].mBounds);
-		AABB bc(mPrimitives[start].mBounds.Center(), mPrimitives[start].mBounds.Center());
+		AABB bc(centroids[start], centroids[start]);
 		for (uint32_t p = start + 1; p < end; ++p) {
 			bb.Encapsulate(mPrimitives[p].mBounds);
-			bc.Encapsulate(mPrimitives[p].mBounds.Center());
+			bc.Encapsulate(centroids[p]);
 		}
 		node.mBounds = bb;
 
 		// If the number of primitives at this point is less than the leaf
 		// size, then this will become a leaf. (Signified by rightOffset == 0)
-		if (nPrims <= 1) {
+		if (nPrims <= mLeafSize) {
 			node.mRightOffset = 0;
 			nLeafs++;
 		}
@@ -81,30 +108,65 @@ void ObjectBvh2::Build(Object** objects, uint32_t objectCount) {
 		// If this is a leaf, no need to subdivide.
 		if (node.mRightOffset == 0) continue;
 
-		// Set the split dimensions
-		uint32_t split_dim = 0;
-		float3 ext = bc.Extents();
-		if (ext.y > ext.x) {
-			split_dim = 1;
-			if (ext.z > ext.y) split_dim = 2;
-		} else
-			if (ext.z > ext.x) split_dim = 2;
+		// Bin the centroids along each axis and pick the split with the lowest SAH cost
+		uint32_t splitDim = 0;
+		uint32_t splitBin = 0;
+		float splitCost = 1e30f;
+		float3 ext = bc.mMax - bc.mMin;
+		for (uint32_t axis = 0; axis < 3; axis++) {
+			if (ext[axis] <= 0) continue;
+			float scale = BVH_SAH_BIN_COUNT / ext[axis];
+
+			for (uint32_t b = 0; b < BVH_SAH_BIN_COUNT; b++) {
+				bins[b].mBounds = empty;
+				bins[b].mCount = 0;
+			}
+			for (uint32_t i = start; i < end; ++i) {
+				uint32_t b = min(BVH_SAH_BIN_COUNT - 1, (uint32_t)((centroids[i][axis] - bc.mMin[axis]) * scale));
+				bins[b].mBounds.Encapsulate(mPrimitives[i].mBounds);
+				bins[b].mCount++;
+			}
 
-		// Split on the center of the longest axis
-		float split_coord = .5f * (bc.mMin[split_dim] + bc.mMax[split_dim]);
+			// sweep right to left, then left to right to evaluate every bin boundary
+			AABB acc = empty;
+			uint32_t count = 0;
+			for (uint32_t b = BVH_SAH_BIN_COUNT - 1; b > 0; b--) {
+				acc.Encapsulate(bins[b].mBounds);
+				count += bins[b].mCount;
+				rightCost[b] = count ? acc.SurfaceArea() * count : 0;
+			}
+			acc = empty;
+			count = 0;
+			for (uint32_t b = 1; b < BVH_SAH_BIN_COUNT; b++) {
+				acc.Encapsulate(bins[b - 1].mBounds);
+				count += bins[b - 1].mCount;
+				if (count == 0 || count == nPrims) continue;
+				float cost = acc.SurfaceArea() * count + rightCost[b];
+				if (cost < splitCost) {
+					splitCost = cost;
+					splitDim = axis;
+					splitBin = b;
+				}
+			}
+		}
 
 		// Partition the list of objects on this split
 		uint32_t mid = start;
-		for (uint32_t i = start; i < end; ++i)
-			if (mPrimitives[i].mBounds.Center()[split_dim] < split_coord) {
-				swap(mPrimitives[i], mPrimitives[mid]);
-				mid++;
-			}
+		if (splitBin) {
+			float scale = BVH_SAH_BIN_COUNT / ext[splitDim];
+			for (uint32_t i = start; i < end; ++i)
+				if (min(BVH_SAH_BIN_COUNT - 1, (uint32_t)((centroids[i][splitDim] - bc.mMin[splitDim]) * scale)) < splitBin) {
+					swap(mPrimitives[i], mPrimitives[mid]);
+					swap(centroids[i], centroids[mid]);
+					mid++;
+				}
+		}
 
 		// If we get a bad split, just choose the center...
 		if (mid == start || mid == end)
 			mid = start + (end - start) / 2;
 
+		if (stackptr + 2 > todo.size()) todo.resize(2 * todo.size());
 		todo[stackptr].mStart = mid;
 		todo[stackptr].mEnd = end;
 		todo[stackptr].mParentOffset = nNodes - 1;
@@ -114,12 +176,62 @@ void ObjectBvh2::Build(Object** objects, uint32_t objectCount) {
 		todo[stackptr].mParentOffset = nNodes - 1;
 		stackptr++;
 	}
+
+	#ifdef BVH_SIMD
+	CollapseBvh2(mNodes, 0, mNodes4);
+	mStackSize4 = Bvh4StackSize(mNodes4);
+	#endif
+	mStackSize = Bvh2StackSize(mNodes);
+
+	mBuildCost = SAHCost();
+}
+
+float ObjectBvh2::Refit() {
+	if (mNodes.size() == 0) return 0;
+
+	for (Primitive& p : mPrimitives) {
+		p.mBounds = p.mObject->Bounds();
+		p.mBounds.mMin -= 1e-3f;
+		p.mBounds.mMax += 1e-3f;
+	}
+
+	// children are always stored after their parent, so a reverse sweep visits them first
+	for (uint32_t i = (uint32_t)mNodes.size(); i-- > 0;) {
+		Node& node = mNodes[i];
+		if (node.mRightOffset == 0) {
+			node.mBounds = mPrimitives[node.mStartIndex].mBounds;
+			for (uint32_t o = 1; o < node.mCount; ++o)
+				node.mBounds.Encapsulate(mPrimitives[node.mStartIndex + o].mBounds);
+		} else {
+			node.mBounds = mNodes[i + 1].mBounds;
+			node.mBounds.Encapsulate(mNodes[i + node.mRightOffset].mBounds);
+		}
+	}
+
+	#ifdef BVH_SIMD
+	RefitBvh4(mNodes, mNodes4);
+	#endif
+
+	return SAHCost();
+}
+
+float ObjectBvh2::SAHCost() const {
+	if (mNodes.size() == 0) return 0;
+
+	float rootArea = mNodes[0].mBounds.SurfaceArea();
+	if (rootArea <= 0) return 0;
+
+	float cost = 0;
+	for (const Node& node : mNodes)
+		cost += node.mBounds.SurfaceArea() * (node.mRightOffset == 0 ? node.mCount : BVH_SAH_TRAVERSAL_COST);
+	return cost / rootArea;
 }
 
 void ObjectBvh2::FrustumCheck(const float4 frustum[6], vector<Object*>& objects, uint32_t mask) {
 	if (mNodes.size() == 0) return;
 
-	uint32_t todo[1024];
+	BvhStack stack(mStackSize);
+	uint32_t* todo = stack.mData;
 	int32_t stackptr = 0;
 
 	todo[stackptr] = 0;
@@ -141,13 +253,28 @@ void ObjectBvh2::FrustumCheck(const float4 frustum[6], vector<Object*>& objects,
 		}
 	}
 }
-Object* ObjectBvh2::Intersect(const Ray& ray, float* t, bool any, uint32_t mask) {
-	if (mNodes.size() == 0) return nullptr;
-
-	float ht = 1e20f;
-	Object* hitObject = nullptr;
+bool ObjectBvh2::IntersectLeaf(const Node& leaf, const Ray& ray, Hit& hit, bool any, uint32_t mask) {
+	bool h = false;
+	for (uint32_t o = 0; o < leaf.mCount; ++o) {
+		Object* object = mPrimitives[leaf.mStartIndex + o].mObject;
+		if ((object->LayerMask() & mask) == 0) continue;
+
+		float ct;
+		if (!object->Intersect(ray, &ct, any)) continue;
+
+		if (ct < hit.mT) {
+			hit.mT = ct;
+			hit.mObject = object;
+			h = true;
+			if (any) return true;
+		}
+	}
+	return h;
+}
 
-	uint32_t todo[64];
+bool ObjectBvh2::IntersectScalar(const Ray& ray, Hit& hit, bool any, uint32_t mask) {
+	BvhStack stack(mStackSize);
+	uint32_t* todo = stack.mData;
 	int stackptr = 0;
 
 	todo[stackptr] = 0;
@@ -159,21 +286,7 @@ Object* ObjectBvh2::Intersect(const Ray& ray, float* t, bool any, uint32_t mask)
 		const Node& node = mNodes[ni];
 
 		if (node.mRightOffset == 0) {
-			for (uint32_t o = 0; o < node.mCount; ++o) {
-				if ((mPrimitives[node.mStartIndex + o].mObject->LayerMask() & mask) == 0) continue;
-
-				float ct;
-				if (!mPrimitives[node.mStartIndex + o].mObject->Intersect(ray, &ct, any)) continue;
-
-				if (ct < ht) {
-					ht = ct;
-					hitObject = mPrimitives[node.mStartIndex + o].mObject;
-					if (any) {
-						if (t) *t = ct;
-						return mPrimitives[node.mStartIndex + o].mObject;
-					}
-				}
-			}
+			if (IntersectLeaf(node, ray, hit, any, mask) && any) return true;
 		} else {
 			uint32_t n0 = ni + 1;
 			uint32_t n1 = ni + node.mRightOffset;
@@ -194,8 +307,85 @@ Object* ObjectBvh2::Intersect(const Ray& ray, float* t, bool any, uint32_t mask)
 		}
 	}
 
-	if (t) *t = ht;
-	return hitObject;
+	return hit.mObject != nullptr;
+}
+
+#ifdef BVH_SIMD
+bool ObjectBvh2::IntersectWide(const Ray& ray, Hit& hit, bool any, uint32_t mask) {
+	Bvh4Ray ray4(ray);
+
+	BvhStack stack(mStackSize4);
+	uint32_t* todo = stack.mData;
+	int stackptr = 0;
+
+	todo[stackptr] = 0;
+
+	while (stackptr >= 0) {
+		uint32_t ni = todo[stackptr];
+		stackptr--;
+
+		if (ni & BVH4_LEAF_BIT) {
+			if (IntersectLeaf(mNodes[ni & ~BVH4_LEAF_BIT], ray, hit, any, mask) && any) return true;
+			continue;
+		}
+
+		const Bvh4Node& node = mNodes4[ni];
+		float tnear[4];
+		uint32_t hitMask = IntersectBvh4Node(node, ray4, hit.mT, tnear);
+		PushChildren(node, hitMask, tnear, todo, stackptr);
+	}
+
+	return hit.mObject != nullptr;
+}
+#endif
+
+Object* ObjectBvh2::Intersect(const Ray& ray, float* t, bool any, uint32_t mask) {
+	if (mNodes.size() == 0) return nullptr;
+
+	Hit hit;
+	hit.mT = 1e20f;
+	hit.mObject = nullptr;
+
+	#ifdef BVH_SIMD
+	if (mNodes4.size()) IntersectWide(ray, hit, any, mask);
+	else IntersectScalar(ray, hit, any, mask);
+	#else
+	IntersectScalar(ray, hit, any, mask);
+	#endif
+
+	if (t) *t = hit.mT;
+	return hit.mObject;
+}
+
+uint32_t ObjectBvh2::IntersectBatch(const Ray* rays, size_t count, Hit* hits, bool any, uint32_t mask, ThreadPool* threadPool) {
+	for (size_t i = 0; i < count; i++) {
+		hits[i].mT = 1e20f;
+		hits[i].mObject = nullptr;
+	}
+	if (mNodes.size() == 0) return 0;
+
+	atomic<uint32_t> hitCount(0);
+	auto intersectRange = [&](size_t first, size_t last) {
+		uint32_t h = 0;
+		for (size_t i = first; i < last; i++) {
+			#ifdef BVH_SIMD
+			bool hit = mNodes4.size() ? IntersectWide(rays[i], hits[i], any, mask) : IntersectScalar(rays[i], hits[i], any, mask);
+			#else
+			bool hit = IntersectScalar(rays[i], hits[i], any, mask);
+			#endif
+			if (hit) h++;
+		}
+		hitCount += h;
+	};
+
+	if (threadPool && count > BVH_BATCH_SIZE)
+		threadPool->ParallelFor((uint32_t)((count + BVH_BATCH_SIZE - 1) / BVH_BATCH_SIZE), [&](uint32_t b) {
+			intersectRange(b * BVH_BATCH_SIZE, min<size_t>((b + 1) * (size_t)BVH_BATCH_SIZE, count));
+		});
+	else
+		intersectRange(0, count);
+
+	return hitCount;
 }
 
 void ObjectBvh2::DrawGizmos(CommandBuffer* commandBuffer, Camera* camera, Scene* scene) {}
\ No newline at end of file
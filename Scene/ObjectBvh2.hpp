@@ -1,11 +1,14 @@
 #pragma once
 
+#include <Scene/Bvh4.hpp>
 #include <Scene/Object.hpp>
 
 #ifdef GetObject
 #undef GetObject
 #endif
 
+class ThreadPool;
+
 class ObjectBvh2 {
 public:
 	struct Primitive {
@@ -20,24 +23,51 @@ public:
 		uint32_t mCount;
 		uint32_t mRightOffset; // 1st child is at node[index + 1], 2nd child is at node[index + mRightOffset]
 	};
+	struct Hit {
+		float mT;
+		Object* mObject;
+	};
 
-	inline ObjectBvh2() {};
+	inline ObjectBvh2(uint32_t leafSize = 1) : mStackSize(0), mStackSize4(0), mLeafSize(leafSize), mBuildCost(0) {};
 	inline ~ObjectBvh2() {}
 
 	const std::vector<Node>& Nodes() const { return mNodes; }
 	Object* GetObject(uint32_t index) const { return mPrimitives[index].mObject; }
 
 	inline AABB Bounds() { return mNodes.size() ? mNodes[0].mBounds : AABB(); }
+	inline uint32_t PrimitiveCount() const { return (uint32_t)mPrimitives.size(); }
+	// SAH cost of the tree right after the last Build()
+	inline float BuildCost() const { return mBuildCost; }
 
+	// Builds the tree using a binned SAH split
 	ENGINE_EXPORT void Build(Object** objects, uint32_t objectCount);
+	// Re-fetches the bounds of every object and updates the node bounds bottom-up, keeping the topology intact.
+	// The 4-wide tree's bounds are updated in place. Returns the SAH cost of the refitted tree
+	ENGINE_EXPORT float Refit();
+	ENGINE_EXPORT float SAHCost() const;
 	ENGINE_EXPORT void FrustumCheck(const float4 frustum[6], std::vector<Object*>& objects, uint32_t mask);
 	ENGINE_EXPORT Object* Intersect(const Ray& ray, float* t, bool any, uint32_t mask);
+	/// Intersects many rays at once, split into groups across the thread pool if one is supplied. Returns the number of rays that hit.
+	/// Object::Intersect must be safe to call concurrently when a thread pool is used
+	ENGINE_EXPORT uint32_t IntersectBatch(const Ray* rays, size_t count, Hit* hits, bool any, uint32_t mask, ThreadPool* threadPool = nullptr);
 
 	ENGINE_EXPORT void DrawGizmos(CommandBuffer* commandBuffer, Camera* camera, Scene* scene);
 
 private:
+	ENGINE_EXPORT bool IntersectLeaf(const Node& leaf, const Ray& ray, Hit& hit, bool any, uint32_t mask);
+	ENGINE_EXPORT bool IntersectScalar(const Ray& ray, Hit& hit, bool any, uint32_t mask);
+	#ifdef BVH_SIMD
+	ENGINE_EXPORT bool IntersectWide(const Ray& ray, Hit& hit, bool any, uint32_t mask);
+	#endif
+
 	std::vector<Node> mNodes;
+	// mNodes collapsed into a 4-wide tree for SIMD traversal
+	std::vector<Bvh4Node> mNodes4;
+	// traversal stack entries needed by mNodes and mNodes4, from Bvh2StackSize and Bvh4StackSize
+	uint32_t mStackSize;
+	uint32_t mStackSize4;
 	std::vector<Primitive> mPrimitives;
 
 	uint32_t mLeafSize;
+	float mBuildCost;
 };
\ No newline at end of file
@@ -13,6 +13,8 @@ public:
 	inline virtual void PreFrame(CommandBuffer* commandBuffer) {};
 	inline virtual void PreRender(CommandBuffer* commandBuffer, Camera* camera, PassType pass) {};
 	virtual void Draw(CommandBuffer* commandBuffer, Camera* camera, PassType pass) = 0;
+	/// Renderers whose shape changes without their transform changing return true, so shadows they cast aren't cached
+	inline virtual bool Deforming() { return false; }
 
 	inline virtual uint32_t LayerMask() override { return Visible() ? Object::LayerMask() | PassMask() : Object::LayerMask(); };
 };
\ No newline at end of file
@@ -1,9 +1,13 @@
 #include <Scene/Scene.hpp>
+#include <Content/MeshCache.hpp>
 #include <Scene/Renderer.hpp>
 #include <Scene/MeshRenderer.hpp>
 #include <Scene/GUI.hpp>
 #include <Core/Instance.hpp>
 #include <Util/Profiler.hpp>
+#include <Util/ThreadPool.hpp>
+
+#include <cassert>
 
 #include <assimp/scene.h>
 #include <assimp/cimport.h>
@@ -12,32 +16,73 @@
 
 using namespace std;
 
+#define SCENE_IMPORT_FLAGS (aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_FlipUVs | aiProcess_MakeLeftHanded | aiProcess_SortByPType)
+
 #define INSTANCE_BATCH_SIZE 1024
-#define MAX_GPU_LIGHTS 64
+// initial capacity of the persistent instance buffer, it doubles whenever it runs out of slots
+#define INSTANCE_SLOT_MIN_CAPACITY 1024
+#define PARALLEL_RECORD_THRESHOLD 512
+#define PARALLEL_RECORD_MIN_CHUNK 128
+#define MAX_GPU_LIGHTS 4096
+// renderers in later queues are blended and need to be sorted back to front, so they aren't GPU-driven
+#define GPU_DRIVEN_MAX_RENDER_QUEUE 2000
 
 #define SHADOW_ATLAS_RESOLUTION 4096
+// resolution of each sun cascade
 #define SHADOW_RESOLUTION 1024
+// spot light shadows are sized by how much of the main camera's view their range covers
+#define SHADOW_MIN_RESOLUTION 128
+#define SHADOW_MAX_RESOLUTION 2048
+#define MAX_GPU_SHADOWS 64
+// the scene BVH is rebuilt once refitting has degraded its SAH cost by this factor
+#define BVH_REBUILD_THRESHOLD 1.5f
+
+// render queue in the top 16 bits, then material id, mesh id, and a depth bucket in the bottom 16 bits.
+// blended renderers have to be drawn back to front, so their key holds the inverted depth above the material and mesh ids instead
+inline uint64_t ComputeRenderKey(Object* o, const float3& cameraPosition, float cameraFar) {
+	Renderer* r = dynamic_cast<Renderer*>(o);
+	if (!r->Visible()) return 0xFFFFFFFFFFFFFFFFull;
+
+	uint64_t key = (uint64_t)min(r->RenderQueue(), 0xFFFEu) << 48;
+	uint64_t depth = (uint64_t)(clamp(length(r->Bounds().Center() - cameraPosition) / cameraFar, 0.f, 1.f) * 0xFFFF);
+	MeshRenderer* m = dynamic_cast<MeshRenderer*>(r);
+	if (!m) return key | depth;
+
+	// sort ids are reused once their material or mesh is destroyed, so they only outgrow 16 bits with 65536 live materials or meshes
+	assert(m->Material()->SortId() <= 0xFFFF && m->Mesh()->SortId() <= 0xFFFF);
+	uint64_t ids = ((uint64_t)(m->Material()->SortId() & 0xFFFF) << 16) | (uint64_t)(m->Mesh()->SortId() & 0xFFFF);
+
+	::BlendMode blend = m->Material()->BlendMode() == BLEND_MODE_MAX_ENUM ? m->Material()->Shader()->BlendMode() : m->Material()->BlendMode();
+	if (blend != BLEND_MODE_OPAQUE)
+		return key | ((0xFFFF - depth) << 32) | ids;
+	return key | (ids << 16) | depth;
+}
 
-bool RendererCompare(Object* oa, Object* ob) {
-	Renderer* a = dynamic_cast<Renderer*>(oa);
-	Renderer* b = dynamic_cast<Renderer*>(ob);
-	uint32_t qa = a->Visible() ? a->RenderQueue() : 0xFFFFFFFF;
-	uint32_t qb = b->Visible() ? b->RenderQueue() : 0xFFFFFFFF;
-	if (qa == qb && qa != 0xFFFFFFFF) {
-		MeshRenderer* ma = dynamic_cast<MeshRenderer*>(a);
-		MeshRenderer* mb = dynamic_cast<MeshRenderer*>(b);
-		if (ma && mb)
-			if (ma->Material() == mb->Material())
-				return ma->Mesh() < mb->Mesh();
-			else
-				return ma->Material() < mb->Material();
+// view space bounds of the froxel at tile (x, y) between view depths z0 and z1, the same as lightcluster.hlsl
+inline void LightClusterBounds(const GPULightClusterCamera& camera, uint32_t eye, uint32_t x, uint32_t y, float z0, float z1, float3& mn, float3& mx) {
+	float2 ndc0 = float2((float)x / LIGHT_CLUSTER_X, (float)y / LIGHT_CLUSTER_Y) * 2 - 1;
+	float2 ndc1 = float2((float)(x + 1) / LIGHT_CLUSTER_X, (float)(y + 1) / LIGHT_CLUSTER_Y) * 2 - 1;
+	mn = 1e20f;
+	mx = -1e20f;
+	for (uint32_t i = 0; i < 4; i++) {
+		float2 ndc((i & 1) ? ndc1.x : ndc0.x, (i & 2) ? ndc1.y : ndc0.y);
+		float4 n = camera.InvProjection[eye] * float4(ndc, 0, 1);
+		float4 f = camera.InvProjection[eye] * float4(ndc, 1, 1);
+		float3 pn = n.xyz / n.w;
+		float3 pf = f.xyz / f.w;
+		float3 p0 = lerp(pn, pf, (z0 - pn.z) / (pf.z - pn.z));
+		float3 p1 = lerp(pn, pf, (z1 - pn.z) / (pf.z - pn.z));
+		mn = min(mn, min(p0, p1));
+		mx = max(mx, max(p0, p1));
 	}
-	return qa < qb;
-};
+}
 
 Scene::Scene(::Instance* instance, ::AssetManager* assetManager, ::InputManager* inputManager, ::PluginManager* pluginManager)
-	: mInstance(instance), mAssetManager(assetManager), mInputManager(inputManager), mPluginManager(pluginManager), mLastBvhBuild(0), mDrawGizmos(false), mBvhDirty(true) {
+	: mInstance(instance), mAssetManager(assetManager), mInputManager(inputManager), mPluginManager(pluginManager), mLastBvhBuild(0), mDrawGizmos(false), mBvhDirty(true), mBvhRebuild(true),
+	mGpuDriven(false), mCullShader(nullptr), mGpuSceneFrame(0), mGpuSceneDirty(true), mGpuInstances(nullptr), mGpuBounds(nullptr), mGpuDrawCommands(nullptr), mGpuInstanceCount(0),
+	mInstanceSlots(nullptr), mInstanceSlotCount(0), mGpuLightCount(0), mGpuLightClusters(true), mLightClusterShader(nullptr), mLightOverflowReported(false), mSceneVersion(0) {
 	mBvh = new ObjectBvh2();
+	mShadowAtlas = new ShadowAtlas(SHADOW_ATLAS_RESOLUTION, SHADOW_MIN_RESOLUTION);
 	mShadowTexelSize = float2(1.f / SHADOW_ATLAS_RESOLUTION, 1.f / SHADOW_ATLAS_RESOLUTION) * .75f;
 	mEnvironment = new ::Environment(this);
 
@@ -49,12 +94,17 @@ Scene::Scene(::Instance* instance, ::AssetManager* assetManager, ::InputManager*
 	uint32_t c = mInstance->Device()->MaxFramesInFlight();
 	mLightBuffers = new Buffer*[c];
 	mShadowBuffers = new Buffer*[c];
+	mLightOverflowBuffers = new Buffer*[c];
 	for (uint32_t i = 0; i < c; i++) {
 		mLightBuffers[i] = new Buffer("Light Buffer", mInstance->Device(), MAX_GPU_LIGHTS * sizeof(GPULight), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		mShadowBuffers[i] = new Buffer("Shadow Buffer", mInstance->Device(), MAX_GPU_LIGHTS * sizeof(ShadowData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		mShadowBuffers[i] = new Buffer("Shadow Buffer", mInstance->Device(), MAX_GPU_SHADOWS * sizeof(ShadowData), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		mLightOverflowBuffers[i] = new Buffer("Light Overflow", mInstance->Device(), sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
 		mLightBuffers[i]->Map();
 		mShadowBuffers[i]->Map();
+		mLightOverflowBuffers[i]->Map();
+		*(uint32_t*)mLightOverflowBuffers[i]->MappedData() = 0;
 
 		mShadowAtlases[i] = new Texture("ShadowAtlas", mInstance->Device(), SHADOW_ATLAS_RESOLUTION, SHADOW_ATLAS_RESOLUTION, 1, VK_FORMAT_D32_SFLOAT, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
 		
@@ -73,15 +123,24 @@ Scene::~Scene(){
 
 	safe_delete(mEnvironment);
 
+	safe_delete(mInstanceSlots);
+	safe_delete(mGpuInstances);
+	safe_delete(mGpuBounds);
+	safe_delete(mGpuDrawCommands);
+	for (auto& b : mRetiredInstanceSlots) safe_delete(b.first);
+
 	for (uint32_t i = 0; i < mInstance->Device()->MaxFramesInFlight(); i++) {
 		safe_delete(mShadowAtlases[i]);
 		safe_delete(mLightBuffers[i]);
 		safe_delete(mShadowBuffers[i]);
+		safe_delete(mLightOverflowBuffers[i]);
 	}
 	safe_delete_array(mShadowAtlases);
 	safe_delete_array(mLightBuffers);
 	safe_delete_array(mShadowBuffers);
+	safe_delete_array(mLightOverflowBuffers);
 	safe_delete(mShadowAtlasFramebuffer);
+	safe_delete(mShadowAtlas);
 	for (Camera* c : mShadowCameras) safe_delete(c);
 
 	mCameras.clear();
@@ -94,93 +153,162 @@ Object* Scene::LoadModelScene(const string& filename,
 	function<shared_ptr<Material>(Scene*, aiMaterial*)> materialSetupFunc,
 	function<void(Scene*, Object*, aiMaterial*)> objectSetupFunc,
 	float scale, float directionalLightIntensity, float spotLightIntensity, float pointLightIntensity) {
-	const aiScene* scene = aiImportFile(filename.c_str(), aiProcessPreset_TargetRealtime_MaxQuality | aiProcess_FlipUVs | aiProcess_MakeLeftHanded | aiProcess_SortByPType);
-	if (!scene) {
-		fprintf_color(COLOR_RED, stderr, "Failed to open %s: %s\n", filename.c_str(), aiGetErrorString());
-		throw;
-	}
+	::Device* device = mInstance->Device();
+	::ThreadPool* threadPool = mInstance->ThreadPool();
+
+	// a valid cache replaces the import, and its BVHs are restored instead of rebuilt
+	MeshCache cache(device->CacheDirectory(), filename, scale, SCENE_IMPORT_FLAGS);
+	aiScene* cachedScene = cache.IsValid() && cache.IndexType() == VK_INDEX_TYPE_UINT32 ? cache.CreateScene() : nullptr;
+	const aiScene* scene = cachedScene;
 
 	Object* root = nullptr;
 
 	vector<shared_ptr<Mesh>> meshes;
+	vector<TriangleBvh2*> bvhs;
 	vector<shared_ptr<Material>> materials;
 	unordered_map<aiNode*, Object*> objectMap;
 
 	vector<StdVertex> vertices;
 	vector<uint32_t> indices;
+	vector<MeshCache::SubMesh> subMeshes;
+
+	// point into the mapped cache file, or into the vectors above after an import
+	const StdVertex* vertexData;
+	const uint32_t* indexData;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+
+	if (cachedScene) {
+		subMeshes = cache.SubMeshes();
+		vertexData = cache.Vertices();
+		vertexCount = cache.VertexCount();
+		indexData = (const uint32_t*)cache.Indices();
+		indexCount = cache.IndexCount();
+	} else {
+		scene = aiImportFile(filename.c_str(), SCENE_IMPORT_FLAGS);
+		if (!scene) {
+			fprintf_color(COLOR_RED, stderr, "Failed to open %s: %s\n", filename.c_str(), aiGetErrorString());
+			throw;
+		}
+
+		uint32_t totalVertices = 0;
+		uint32_t totalIndices = 0;
+		for (uint32_t m = 0; m < scene->mNumMeshes; m++) {
+			const aiMesh* mesh = scene->mMeshes[m];
+			totalVertices += mesh->mNumVertices;
+			for (uint32_t i = 0; i < mesh->mNumFaces; i++)
+				totalIndices += min(mesh->mFaces[i].mNumIndices, 3u);
+		}
+		vertices.reserve(totalVertices);
+		indices.reserve(totalIndices);
+
+		for (uint32_t m = 0; m < scene->mNumMeshes; m++) {
+			const aiMesh* mesh = scene->mMeshes[m];
+			VkPrimitiveTopology topo = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+			uint32_t baseVertex = (uint32_t)vertices.size();
+			uint32_t baseIndex  = (uint32_t)indices.size();
+
+			for (uint32_t i = 0; i < mesh->mNumVertices; i++) {
+				StdVertex vertex = {};
+				memset(&vertex, 0, sizeof(StdVertex));
+
+				vertex.position = { (float)mesh->mVertices[i].x, (float)mesh->mVertices[i].y, (float)mesh->mVertices[i].z };
+				if (mesh->HasNormals()) vertex.normal = { (float)mesh->mNormals[i].x, (float)mesh->mNormals[i].y, (float)mesh->mNormals[i].z };
+				if (mesh->HasTangentsAndBitangents()) {
+					vertex.tangent = { (float)mesh->mTangents[i].x, (float)mesh->mTangents[i].y, (float)mesh->mTangents[i].z, 1.f };
+					float3 bt = float3((float)mesh->mBitangents[i].x, (float)mesh->mBitangents[i].y, (float)mesh->mBitangents[i].z);
+					vertex.tangent.w = dot(cross(vertex.tangent.xyz, vertex.normal), bt) > 0.f ? 1.f : -1.f;
+				}
+				if (mesh->HasTextureCoords(0)) vertex.uv = { (float)mesh->mTextureCoords[0][i].x, (float)mesh->mTextureCoords[0][i].y };
+				vertex.position *= scale;
+				vertices.push_back(vertex);
+			}
 
-	uint32_t totalVertices = 0;
-	uint32_t totalIndices = 0;
+			float3 mn = vertices[baseVertex].position, mx = vertices[baseVertex].position;
+			for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
+				const aiFace& f = mesh->mFaces[i];
+				indices.push_back(f.mIndices[0]);
+				mn = min(vertices[baseVertex + f.mIndices[0]].position, mn);
+				mx = max(vertices[baseVertex + f.mIndices[0]].position, mx);
+				if (f.mNumIndices > 1) {
+					indices.push_back(f.mIndices[1]);
+					mn = min(vertices[baseVertex + f.mIndices[1]].position, mn);
+					mx = max(vertices[baseVertex + f.mIndices[1]].position, mx);
+					if (f.mNumIndices > 2) {
+						indices.push_back(f.mIndices[2]);
+						mn = min(vertices[baseVertex + f.mIndices[2]].position, mn);
+						mx = max(vertices[baseVertex + f.mIndices[2]].position, mx);
+					} else
+						topo = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+				} else
+					topo = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+			}
 
-	for (uint32_t m = 0; m < scene->mNumMeshes; m++) {
-		const aiMesh* mesh = scene->mMeshes[m];
-		totalVertices += mesh->mNumVertices;
-		for (uint32_t i = 0; i < mesh->mNumFaces; i++)
-			totalIndices += min(mesh->mFaces[i].mNumIndices, 3u);
+			MeshCache::SubMesh subMesh = {};
+			subMesh.mName = mesh->mName.C_Str();
+			subMesh.mBaseVertex = baseVertex;
+			subMesh.mVertexCount = (uint32_t)vertices.size() - baseVertex;
+			subMesh.mBaseIndex = baseIndex;
+			subMesh.mIndexCount = (uint32_t)indices.size() - baseIndex;
+			subMesh.mMaterialIndex = mesh->mMaterialIndex;
+			subMesh.mTopology = topo;
+			subMesh.mBounds = AABB(mn, mx);
+			subMeshes.push_back(subMesh);
+		}
+
+		vertexData = vertices.data();
+		vertexCount = (uint32_t)vertices.size();
+		indexData = indices.data();
+		indexCount = (uint32_t)indices.size();
 	}
 
-	shared_ptr<Buffer> vertexBuffer = make_shared<Buffer>(scene->mRootNode->mName.C_Str() + string(" Vertices"), mInstance->Device(), sizeof(StdVertex) * totalVertices, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-	shared_ptr<Buffer> indexBuffer  = make_shared<Buffer>(scene->mRootNode->mName.C_Str() + string(" Indices") , mInstance->Device(), sizeof(uint32_t) * totalIndices  , VK_BUFFER_USAGE_INDEX_BUFFER_BIT  | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	shared_ptr<Buffer> vertexBuffer = make_shared<Buffer>(scene->mRootNode->mName.C_Str() + string(" Vertices"), device, sizeof(StdVertex) * vertexCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	shared_ptr<Buffer> indexBuffer  = make_shared<Buffer>(scene->mRootNode->mName.C_Str() + string(" Indices") , device, sizeof(uint32_t) * indexCount  , VK_BUFFER_USAGE_INDEX_BUFFER_BIT  | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	vertexBuffer->Upload(vertexData, sizeof(StdVertex) * vertexCount);
+	indexBuffer->Upload(indexData, sizeof(uint32_t) * indexCount);
 
 	for (uint32_t m = 0; m < scene->mNumMaterials; m++)
 		materials.push_back(materialSetupFunc(this, scene->mMaterials[m]));
 
-	for (uint32_t m = 0; m < scene->mNumMeshes; m++) {
-		const aiMesh* mesh = scene->mMeshes[m];
-		VkPrimitiveTopology topo = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-
-		uint32_t baseVertex = (uint32_t)vertices.size();
-		uint32_t baseIndex  = (uint32_t)indices.size();
-
-		for (uint32_t i = 0; i < mesh->mNumVertices; i++) {
-			StdVertex vertex = {};
-			memset(&vertex, 0, sizeof(StdVertex));
-
-			vertex.position = { (float)mesh->mVertices[i].x, (float)mesh->mVertices[i].y, (float)mesh->mVertices[i].z };
-			if (mesh->HasNormals()) vertex.normal = { (float)mesh->mNormals[i].x, (float)mesh->mNormals[i].y, (float)mesh->mNormals[i].z };
-			if (mesh->HasTangentsAndBitangents()) {
-				vertex.tangent = { (float)mesh->mTangents[i].x, (float)mesh->mTangents[i].y, (float)mesh->mTangents[i].z, 1.f };
-				float3 bt = float3((float)mesh->mBitangents[i].x, (float)mesh->mBitangents[i].y, (float)mesh->mBitangents[i].z);
-				vertex.tangent.w = dot(cross(vertex.tangent.xyz, vertex.normal), bt) > 0.f ? 1.f : -1.f;
-			}
-			if (mesh->HasTextureCoords(0)) vertex.uv = { (float)mesh->mTextureCoords[0][i].x, (float)mesh->mTextureCoords[0][i].y };
-			vertex.position *= scale;
-			vertices.push_back(vertex);
-		}
-
-		float3 mn = vertices[baseVertex].position, mx = vertices[baseVertex].position;
-		for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
-			const aiFace& f = mesh->mFaces[i];
-			indices.push_back(f.mIndices[0]);
-			mn = min(vertices[baseVertex + f.mIndices[0]].position, mn);
-			mx = max(vertices[baseVertex + f.mIndices[0]].position, mx);
-			if (f.mNumIndices > 1) {
-				indices.push_back(f.mIndices[1]);
-				mn = min(vertices[baseVertex + f.mIndices[1]].position, mn);
-				mx = max(vertices[baseVertex + f.mIndices[1]].position, mx);
-				if (f.mNumIndices > 2) {
-					indices.push_back(f.mIndices[2]);
-					mn = min(vertices[baseVertex + f.mIndices[2]].position, mn);
-					mx = max(vertices[baseVertex + f.mIndices[2]].position, mx);
-				} else
-					topo = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
-			} else
-				topo = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
-		}
-
-		uint32_t vertexCount = (uint32_t)vertices.size() - baseVertex;
-		uint32_t indexCount  = (uint32_t)indices.size() - baseIndex;
-
+	vector<Mesh*> created;
+	for (const MeshCache::SubMesh& m : subMeshes) {
 		TriangleBvh2* bvh = new TriangleBvh2();
-		bvh->Build(vertices.data() + baseVertex, vertexCount, sizeof(StdVertex), indices.data() + baseIndex, indexCount, VK_INDEX_TYPE_UINT32);
+		bvhs.push_back(bvh);
+		created.push_back(new Mesh(m.mName, device,
+			m.mBounds, bvh, vertexBuffer, indexBuffer, m.mBaseVertex, m.mVertexCount, m.mBaseIndex, m.mIndexCount,
+			&StdVertex::VertexInput, VK_INDEX_TYPE_UINT32, m.mTopology));
+	}
 
-		meshes.push_back(make_shared<Mesh>(mesh->mName.C_Str(), mInstance->Device(),
-			AABB(mn, mx), bvh, vertexBuffer, indexBuffer, baseVertex, vertexCount, baseIndex, indexCount,
-			&StdVertex::VertexInput, VK_INDEX_TYPE_UINT32, topo));
+	// Build or restore the triangle BVHs concurrently, large meshes also split their own build across the pool
+	auto bvhStart = chrono::high_resolution_clock::now();
+	threadPool->ParallelFor((uint32_t)bvhs.size(), [&](uint32_t m) {
+		const MeshCache::SubMesh& s = subMeshes[m];
+		if (cachedScene)
+			bvhs[m]->Load(s.mBvhNodes, s.mBvhNodeCount, s.mBvhTriangles, s.mBvhTriangleCount, vertexData + s.mBaseVertex, s.mVertexCount, sizeof(StdVertex));
+		else
+			bvhs[m]->Build((void*)(vertexData + s.mBaseVertex), s.mVertexCount, sizeof(StdVertex), (void*)(indexData + s.mBaseIndex), s.mIndexCount, VK_INDEX_TYPE_UINT32, threadPool);
+	});
+	float bvhTime = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - bvhStart).count();
+	float bvhCost = 0;
+	for (TriangleBvh2* bvh : bvhs) bvhCost += bvh->SAHCost();
+
+	if (!cachedScene) {
+		for (uint32_t m = 0; m < subMeshes.size(); m++) {
+			subMeshes[m].mBvhNodes = bvhs[m]->Nodes().data();
+			subMeshes[m].mBvhNodeCount = (uint32_t)bvhs[m]->Nodes().size();
+			subMeshes[m].mBvhTriangles = bvhs[m]->Triangles().data();
+			subMeshes[m].mBvhTriangleCount = bvhs[m]->TriangleCount();
+		}
+		MeshCache::Write(device->CacheDirectory(), filename, scale, SCENE_IMPORT_FLAGS, scene, vertexData, vertexCount, indexData, indexCount, VK_INDEX_TYPE_UINT32, nullptr, subMeshes);
 	}
 
-	vertexBuffer->Upload(vertices.data(), vertices.size() * sizeof(StdVertex));
-	indexBuffer->Upload(indices.data(), indices.size() * sizeof(uint32_t));
+	// the meshes are registered once their BVHs are built, so the AssetManager counts the BVHs' memory too.
+	// Meshes of a model that's already loaded are shared, and the new copies are deleted
+	for (uint32_t m = 0; m < created.size(); m++) {
+		meshes.push_back(mAssetManager->AcquireAsset<Mesh>(filename + "|" + to_string(scale) + "|" + to_string(m), [&]() { return created[m]; }));
+		if (meshes.back().get() != created[m]) safe_delete(created[m]);
+	}
 
 	queue<pair<Object*, aiNode*>> nodes;
 	nodes.push(make_pair((Object*)nullptr, scene->mRootNode));
@@ -316,7 +444,12 @@ Object* Scene::LoadModelScene(const string& filename,
 		}
 	}
 
-	printf("Loaded %s\n", filename.c_str());
+	bool fromCache = cachedScene != nullptr;
+	if (fromCache) delete cachedScene;
+	else aiReleaseImport(scene);
+
+	printf("Loaded %s%s / %d meshes / BVHs %s in %.2fms (%d threads), mean SAH cost %.2f\n", filename.c_str(), fromCache ? " from cache" : "", (int)bvhs.size(),
+		fromCache ? "loaded" : "built", bvhTime, threadPool->ThreadCount() + 1, bvhs.size() ? bvhCost / bvhs.size() : 0.f);
 	return root;
 }
 
@@ -339,6 +472,10 @@ void Scene::Update() {
 void Scene::AddObject(shared_ptr<Object> object) {
 	mObjects.push_back(object);
 	object->mScene = this;
+	mBvhDirty = true;
+	mBvhRebuild = true;
+	mGpuSceneDirty = true;
+	mSceneVersion++;
 
 	if (auto l = dynamic_cast<Light*>(object.get()))
 		mLights.push_back(l);
@@ -346,11 +483,14 @@ void Scene::AddObject(shared_ptr<Object> object) {
 		mCameras.push_back(c);
 	if (auto r = dynamic_cast<Renderer*>(object.get()))
 		mRenderers.push_back(r);
+	// the instance slot is assigned by UpdateInstanceSlots(), a freed slot still holds its old renderer's transform until then
+	if (auto m = dynamic_cast<MeshRenderer*>(object.get()))
+		m->mInstanceDirty = true;
 }
 void Scene::RemoveObject(Object* object) {
 	if (!object) return;
 
-	if (auto l = dynamic_cast<Light*>(object))
+	if (auto l = dynamic_cast<Light*>(object)) {
 		for (auto it = mLights.begin(); it != mLights.end();) {
 			if (*it == l) {
 				it = mLights.erase(it);
@@ -358,8 +498,17 @@ void Scene::RemoveObject(Object* object) {
 			} else
 				it++;
 		}
+		// release the light's shadow tiles
+		for (auto it = mShadowTiles.begin(); it != mShadowTiles.end();) {
+			if (it->first.first == l) {
+				mShadowAtlas->Free(it->second.mTile);
+				it = mShadowTiles.erase(it);
+			} else
+				it++;
+		}
+	}
 
-	if (auto c = dynamic_cast<Camera*>(object))
+	if (auto c = dynamic_cast<Camera*>(object)) {
 		for (auto it = mCameras.begin(); it != mCameras.end();) {
 			if (*it == c) {
 				it = mCameras.erase(it);
@@ -367,6 +516,9 @@ void Scene::RemoveObject(Object* object) {
 			} else
 				it++;
 		}
+		mRenderLists.erase(c);
+		mLightClusters.erase(c);
+	}
 
 	if (auto r = dynamic_cast<Renderer*>(object))
 		for (auto it = mRenderers.begin(); it != mRenderers.end();) {
@@ -376,6 +528,10 @@ void Scene::RemoveObject(Object* object) {
 			} else
 				it++;
 		}
+	if (auto m = dynamic_cast<MeshRenderer*>(object)) {
+		if (m->mInstanceSlot != INVALID_INSTANCE_SLOT) mFreeInstanceSlots.push_back(m->mInstanceSlot);
+		m->mInstanceSlot = INVALID_INSTANCE_SLOT;
+	}
 
 	for (auto it = mObjects.begin(); it != mObjects.end();)
 		if (it->get() == object) {
@@ -385,12 +541,16 @@ void Scene::RemoveObject(Object* object) {
 			object->mParent = nullptr;
 			object->mScene = nullptr;
 			it = mObjects.erase(it);
+			mBvhDirty = true;
+			mBvhRebuild = true;
+			mGpuSceneDirty = true;
+			mSceneVersion++;
 			break;
 		} else
 			it++;
 }
 
-void Scene::AddShadowCamera(uint32_t si, ShadowData* sd, bool ortho, float size, const float3& pos, const quaternion& rot, float near, float far) {
+void Scene::AddShadowCamera(uint32_t si, ShadowData* sd, bool ortho, float size, const float3& pos, const quaternion& rot, float near, float far, const ShadowAtlas::Tile& tile) {
 	if (mShadowCameras.size() <= si)
 		mShadowCameras.push_back(new Camera("ShadowCamera", mShadowAtlasFramebuffer));
 	Camera* sc = mShadowCameras[si];
@@ -403,10 +563,10 @@ void Scene::AddShadowCamera(uint32_t si, ShadowData* sd, bool ortho, float size,
 	sc->LocalPosition(pos);
 	sc->LocalRotation(rot);
 
-	sc->ViewportX((float)((si % (SHADOW_ATLAS_RESOLUTION / SHADOW_RESOLUTION)) * SHADOW_RESOLUTION));
-	sc->ViewportY((float)((si / (SHADOW_ATLAS_RESOLUTION / SHADOW_RESOLUTION)) * SHADOW_RESOLUTION));
-	sc->ViewportWidth(SHADOW_RESOLUTION);
-	sc->ViewportHeight(SHADOW_RESOLUTION);
+	sc->ViewportX((float)tile.mX);
+	sc->ViewportY((float)tile.mY);
+	sc->ViewportWidth((float)tile.mSize);
+	sc->ViewportHeight((float)tile.mSize);
 
 	sd->WorldToShadow = sc->ViewProjection();
 	sd->CameraPosition = pos;
@@ -414,6 +574,73 @@ void Scene::AddShadowCamera(uint32_t si, ShadowData* sd, bool ortho, float size,
 	sd->InvProj22 = 1.f / (sc->Projection()[2][2] * (far - near));
 };
 
+void Scene::AllocateShadowTiles(vector<ShadowRequest>& requests) {
+	for (auto& t : mShadowTiles)
+		t.second.mUsed = false;
+
+	// keep the tiles that were requested with the same resolution, so their contents can be reused
+	vector<ShadowRequest*> unallocated;
+	for (ShadowRequest& r : requests) {
+		auto it = mShadowTiles.find(make_pair(r.mLight, r.mCascade));
+		if (it != mShadowTiles.end() && it->second.mResolution == r.mResolution) {
+			it->second.mUsed = true;
+			r.mTile = &it->second;
+		} else {
+			r.mTile = nullptr;
+			unallocated.push_back(&r);
+		}
+	}
+
+	// free every other tile before allocating, so the new tiles can take their space
+	for (auto it = mShadowTiles.begin(); it != mShadowTiles.end();) {
+		if (!it->second.mUsed) {
+			mShadowAtlas->Free(it->second.mTile);
+			it = mShadowTiles.erase(it);
+		} else
+			it++;
+	}
+
+	// largest first, so small tiles don't fragment the space large ones need
+	sort(unallocated.begin(), unallocated.end(), [](const ShadowRequest* a, const ShadowRequest* b) { return a->mResolution > b->mResolution; });
+	for (ShadowRequest* r : unallocated) {
+		ShadowTile tile = {};
+		if (!mShadowAtlas->Allocate(r->mResolution, tile.mTile)) continue;
+		tile.mResolution = r->mResolution;
+		tile.mUsed = true;
+		r->mTile = &(mShadowTiles[make_pair(r->mLight, r->mCascade)] = tile);
+	}
+}
+
+size_t Scene::ShadowKey(const ShadowRequest& request, Camera* camera) {
+	size_t key = 0;
+	hash_combine(key, request.mOrtho);
+	hash_combine(key, request.mSize);
+	hash_combine(key, request.mNear);
+	hash_combine(key, request.mFar);
+	for (uint32_t i = 0; i < 3; i++) hash_combine(key, request.mPosition[i]);
+	for (uint32_t i = 0; i < 4; i++) hash_combine(key, request.mRotation.v[i]);
+	hash_combine(key, request.mTile->mTile.mX);
+	hash_combine(key, request.mTile->mTile.mY);
+	hash_combine(key, request.mTile->mTile.mSize);
+
+	// GPU-driven renderers aren't in the culled list, so any change to the scene changes the key
+	if (mGpuDriven && mGpuSceneFrame == mInstance->FrameCount())
+		hash_combine(key, mSceneVersion);
+
+	auto list = mRenderLists.find(camera);
+	if (list == mRenderLists.end()) return key;
+	for (Object* o : list->second.mObjects) {
+		hash_combine(key, o);
+		if (dynamic_cast<Renderer*>(o)->Deforming())
+			hash_combine(key, mInstance->FrameCount());
+		float4x4 objectToWorld = o->ObjectToWorld();
+		for (uint32_t i = 0; i < 4; i++)
+			for (uint32_t j = 0; j < 4; j++)
+				hash_combine(key, objectToWorld[i][j]);
+	}
+	return key;
+}
+
 void Scene::PreFrame(CommandBuffer* commandBuffer) {
 	PROFILER_BEGIN("Scene PreFrame");
 
@@ -425,6 +652,26 @@ void Scene::PreFrame(CommandBuffer* commandBuffer) {
 			r->PreFrame(commandBuffer);
 	PROFILER_END;
 
+	PROFILER_BEGIN("Update Instance Slots");
+	UpdateInstanceSlots(commandBuffer);
+	PROFILER_END;
+
+	// the clusters built the last time this frame context was used are done, report the lights they left out
+	uint32_t* lightOverflow = (uint32_t*)mLightOverflowBuffers[commandBuffer->Device()->FrameContextIndex()]->MappedData();
+	if (*lightOverflow) {
+		Profiler::AddCounter("Light Cluster Overflow", *lightOverflow);
+		if (!mLightOverflowReported)
+			fprintf_color(COLOR_YELLOW, stderr, "%u lights were left out of light clusters that already had %u lights\n", *lightOverflow, LIGHT_CLUSTER_MAX_LIGHTS);
+		mLightOverflowReported = true;
+		*lightOverflow = 0;
+	}
+
+	if (mGpuDriven) {
+		PROFILER_BEGIN("Update GPU Scene");
+		UpdateGpuScene(commandBuffer);
+		PROFILER_END;
+	}
+
 	Camera* mainCamera = nullptr;
 	sort(mCameras.begin(), mCameras.end(), [](const auto& a, const auto& b) {
 		return a->RenderPriority() > b->RenderPriority();
@@ -436,16 +683,12 @@ void Scene::PreFrame(CommandBuffer* commandBuffer) {
 		}
 	if (!mainCamera) return;
 
-	if (!mBvh) {
-		PROFILER_BEGIN("Sort Renderers");
-		sort(mRenderers.begin(), mRenderers.end(), RendererCompare);
-		PROFILER_END;
-	}
-
 	Device* device = commandBuffer->Device();
 	PROFILER_BEGIN("Lighting");
+	vector<ShadowRequest> shadowRequests;
 	uint32_t si = 0;
 	mShadowCount = 0;
+	mGpuLightCount = 0;
 	mActiveLights.clear();
 	if (mainCamera && mLights.size()) {
 		AABB sceneBounds;
@@ -465,8 +708,6 @@ void Scene::PreFrame(CommandBuffer* commandBuffer) {
 		GPULight* lights = (GPULight*)mLightBuffers[frameContextIndex]->MappedData();
 		ShadowData* shadows = (ShadowData*)mShadowBuffers[frameContextIndex]->MappedData();
 
-		uint32_t maxShadows = (SHADOW_ATLAS_RESOLUTION / SHADOW_RESOLUTION) * (SHADOW_ATLAS_RESOLUTION / SHADOW_RESOLUTION);
-
 		float ct = tanf(mainCamera->FieldOfView() * .5f) * max(1.f, mainCamera->Aspect());
 		float3 cp = mainCamera->WorldPosition();
 		float3 fwd = mainCamera->WorldRotation().forward();
@@ -496,9 +737,10 @@ void Scene::PreFrame(CommandBuffer* commandBuffer) {
 			lights[li].ShadowIndex = -1;
 			lights[li].CascadeSplits = -1.f;
 
-			if (l->CastShadows() && si+1 < maxShadows) {
+			if (l->CastShadows() && si+1 < MAX_GPU_SHADOWS) {
 				switch (l->Type()) {
 				case LIGHT_TYPE_SUN: {
+					if (si + l->CascadeCount() > MAX_GPU_SHADOWS) break;
 					float4 cascadeSplits = 0;
 					float cf = min(l->ShadowDistance(), mainCamera->Far());
 
@@ -574,7 +816,7 @@ void Scene::PreFrame(CommandBuffer* commandBuffer) {
 							sz = max(sz, abs(dot(corners[j] - pos, right)));
 						}
 
-						AddShadowCamera(si, &shadows[si], true, 2*sz, pos, l->WorldRotation(), near, far);
+						shadowRequests.push_back({ l, ci, li, true, 2*sz, pos, l->WorldRotation(), near, far, SHADOW_RESOLUTION, nullptr });
 						si++;
 						z0 = z1;
 					}
@@ -583,39 +825,89 @@ void Scene::PreFrame(CommandBuffer* commandBuffer) {
 				}
 				case LIGHT_TYPE_POINT:
 					break;
-				case LIGHT_TYPE_SPOT:
+				case LIGHT_TYPE_SPOT: {
+					// size the tile by how much of the main camera's view the light's range covers
+					float coverage = 1.f;
+					float d = length(l->WorldPosition() - cp);
+					if (!mainCamera->Orthographic() && d > l->Range()) coverage = l->Range() / (d * ct);
+					uint32_t resolution = SHADOW_MIN_RESOLUTION;
+					while (resolution < SHADOW_MAX_RESOLUTION && resolution < coverage * SHADOW_MAX_RESOLUTION) resolution <<= 1;
+
 					lights[li].CascadeSplits = 1.f;
 					lights[li].ShadowIndex = (int32_t)si;
-					AddShadowCamera(si, &shadows[si], false, l->OuterSpotAngle() * 2, l->WorldPosition(), l->WorldRotation(), l->Radius() - .001f, l->Range());
+					shadowRequests.push_back({ l, 0, li, false, l->OuterSpotAngle() * 2, l->WorldPosition(), l->WorldRotation(), l->Radius() - .001f, l->Range(), resolution, nullptr });
 					si++;
 					break;
 				}
+				}
 			}
 
 			li++;
 			if (li >= MAX_GPU_LIGHTS) break;
 		}
+		mGpuLightCount = li;
+		PROFILER_END;
+
+		PROFILER_BEGIN("Allocate Shadows");
+		AllocateShadowTiles(shadowRequests);
+		while (mShadowCameras.size() < si)
+			mShadowCameras.push_back(new Camera("ShadowCamera", mShadowAtlasFramebuffer));
+		for (uint32_t i = 0; i < si; i++) {
+			const ShadowRequest& r = shadowRequests[i];
+			if (r.mTile)
+				AddShadowCamera(i, &shadows[i], r.mOrtho, r.mSize, r.mPosition, r.mRotation, r.mNear, r.mFar, r.mTile->mTile);
+			else
+				lights[r.mLightIndex].ShadowIndex = -1; // the atlas is full
+		}
 		PROFILER_END;
 	}
+
+	PROFILER_BEGIN("Cull Cameras");
+	CullCameras(si);
+	PROFILER_END;
+
 	if (si) {
 		PROFILER_BEGIN("Render Shadows");
 		BEGIN_CMD_REGION(commandBuffer, "Render Shadows");
 
+		// tiles whose camera and casters haven't changed since they were rendered into this frame context's atlas are skipped
+		vector<size_t> keys(si);
+		mInstance->ThreadPool()->ParallelFor(si, [&](uint32_t i) {
+			if (shadowRequests[i].mTile) keys[i] = ShadowKey(shadowRequests[i], mShadowCameras[i]);
+		});
+
+		uint32_t fc = commandBuffer->Device()->FrameContextIndex();
+		uint32_t cached = 0;
 		bool g = mDrawGizmos;
 		mDrawGizmos = false;
 		for (uint32_t i = 0; i < si; i++) {
-			mShadowCameras[i]->mEnabled = true;
-			Render(commandBuffer, mShadowCameras[i], mShadowAtlasFramebuffer, PASS_DEPTH, i == 0);
+			ShadowTile* tile = shadowRequests[i].mTile;
+			mShadowCameras[i]->mEnabled = tile != nullptr;
+			if (!tile) continue;
+			if (tile->mKey != keys[i]) {
+				tile->mKey = keys[i];
+				tile->mValidFrameContexts = 0;
+			}
+			if (tile->mValidFrameContexts & (1u << fc)) {
+				cached++;
+				continue;
+			}
+			// only clears the camera's tile
+			Render(commandBuffer, mShadowCameras[i], mShadowAtlasFramebuffer, PASS_DEPTH, true);
+			tile->mValidFrameContexts |= 1u << fc;
 			mShadowCount++;
 		}
 		for (uint32_t i = si; i < mShadowCameras.size(); i++)
 			mShadowCameras[i]->mEnabled = false;
 		mDrawGizmos = g;
+		Profiler::AddCounter("Cached Shadows", cached);
 
-		uint32_t fc = commandBuffer->Device()->FrameContextIndex();
-		mShadowAtlases[fc]->TransitionImageLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer);
-		mShadowAtlasFramebuffer->ResolveDepth(commandBuffer, mShadowAtlases[fc]->Image());
-		mShadowAtlases[fc]->TransitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, commandBuffer);
+		// this frame context's copy of the atlas only changes when a tile was rendered
+		if (mShadowCount) {
+			mShadowAtlases[fc]->TransitionImageLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, commandBuffer);
+			mShadowAtlasFramebuffer->ResolveDepth(commandBuffer, mShadowAtlases[fc]->Image());
+			mShadowAtlases[fc]->TransitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, commandBuffer);
+		}
 
 		END_CMD_REGION(commandBuffer);
 		PROFILER_END;
@@ -629,16 +921,254 @@ void Scene::PreFrame(CommandBuffer* commandBuffer) {
 	PROFILER_END;
 }
 
+void Scene::CullCameras(uint32_t shadowCameraCount) {
+	struct CullJob {
+		float4 mFrustum[6];
+		float3 mPosition;
+		float mFar;
+		RenderList* mList;
+	};
+	vector<CullJob> jobs;
+	auto AddJob = [&](Camera* camera, PassType pass) {
+		// resolve the frustum here, Camera::Frustum() lazily updates the camera's matrices and isn't safe to call from the workers
+		camera->PreRender();
+		RenderList& list = mRenderLists[camera];
+		list.mObjects.clear();
+		list.mPass = pass;
+		list.mFrame = mInstance->FrameCount();
+		CullJob job;
+		memcpy(job.mFrustum, camera->Frustum(), sizeof(job.mFrustum));
+		job.mPosition = camera->WorldPosition();
+		job.mFar = camera->Far();
+		job.mList = &list;
+		jobs.push_back(job);
+	};
+	for (uint32_t i = 0; i < shadowCameraCount; i++)
+		AddJob(mShadowCameras[i], PASS_DEPTH);
+	for (Camera* c : mCameras)
+		if (c->EnabledHierarchy())
+			AddJob(c, PASS_MAIN);
+
+	// build or refit the bvh before any worker reads it
+	bool gpuScene = mGpuDriven && mGpuSceneFrame == mInstance->FrameCount();
+	ObjectBvh2* bvh = gpuScene ? nullptr : BVH();
+	mInstance->ThreadPool()->ParallelFor((uint32_t)jobs.size(), [&](uint32_t i) {
+		RenderList* list = jobs[i].mList;
+		if (gpuScene)
+			CullCpuRenderers(jobs[i].mFrustum, list->mObjects, list->mPass);
+		else
+			bvh->FrustumCheck(jobs[i].mFrustum, list->mObjects, list->mPass);
+		SortRenderList(*list, jobs[i].mPosition, jobs[i].mFar);
+	});
+}
+
 void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* framebuffer, PassType pass, bool clear) {
+	auto it = mRenderLists.find(camera);
+	if (it != mRenderLists.end() && it->second.mPass == pass && it->second.mFrame == mInstance->FrameCount()) {
+		Render(commandBuffer, camera, framebuffer, pass, clear, it->second.mObjects);
+		return;
+	}
+
 	PROFILER_BEGIN("Gather Renderers");
-	mRenderList.clear();
-	BVH()->FrustumCheck(camera->Frustum(), mRenderList, pass);
+	mRenderList.mObjects.clear();
+	if (mGpuDriven && mGpuSceneFrame == mInstance->FrameCount())
+		CullCpuRenderers(camera->Frustum(), mRenderList.mObjects, pass);
+	else
+		BVH()->FrustumCheck(camera->Frustum(), mRenderList.mObjects, pass);
 	PROFILER_END;
 	PROFILER_BEGIN("Sort Renderers");
-	sort(mRenderList.begin(), mRenderList.end(), RendererCompare);
+	SortRenderList(mRenderList, camera->WorldPosition(), camera->Far());
+	PROFILER_END;
+
+	Render(commandBuffer, camera, framebuffer, pass, clear, mRenderList.mObjects);
+}
+
+void Scene::SortRenderList(RenderList& list, const float3& cameraPosition, float cameraFar) {
+	vector<RenderKey>& keys = list.mKeys[0];
+	vector<RenderKey>& tmp = list.mKeys[1];
+	size_t count = list.mObjects.size();
+	keys.resize(count);
+	tmp.resize(count);
+	for (size_t i = 0; i < count; i++)
+		keys[i] = { ComputeRenderKey(list.mObjects[i], cameraPosition, cameraFar), list.mObjects[i] };
+
+	if (count < 64)
+		sort(keys.begin(), keys.end(), [](const RenderKey& a, const RenderKey& b) { return a.mKey < b.mKey; });
+	else {
+		// LSD radix sort on bytes. all histograms are built in one pass, and bytes that are equal across every key
+		// (usually most of the render queue) are skipped
+		uint32_t counts[8][256];
+		memset(counts, 0, sizeof(counts));
+		for (const RenderKey& k : keys)
+			for (uint32_t d = 0; d < 8; d++)
+				counts[d][(k.mKey >> (d * 8)) & 0xFF]++;
+
+		RenderKey* src = keys.data();
+		RenderKey* dst = tmp.data();
+		for (uint32_t d = 0; d < 8; d++) {
+			uint32_t shift = d * 8;
+			uint32_t* c = counts[d];
+			if (c[(src[0].mKey >> shift) & 0xFF] == count) continue;
+			uint32_t offset = 0;
+			for (uint32_t b = 0; b < 256; b++) {
+				uint32_t n = c[b];
+				c[b] = offset;
+				offset += n;
+			}
+			for (size_t i = 0; i < count; i++)
+				dst[c[(src[i].mKey >> shift) & 0xFF]++] = src[i];
+			swap(src, dst);
+		}
+		if (src != keys.data()) keys.swap(tmp);
+	}
+
+	for (size_t i = 0; i < count; i++)
+		list.mObjects[i] = keys[i].mObject;
+}
+
+void Scene::RecordRenderList(CommandBuffer* commandBuffer, Camera* camera, PassType pass, Object* const* objects, size_t count) {
+	struct BatchDescriptorSet {
+		VkDescriptorSetLayout mLayout;
+		VkBuffer mBuffer;
+		uint32_t mSizeClass;
+		DescriptorSet* mDescriptorSet;
+	};
+	// instances are bound with a dynamic offset, so batches with the same layout, buffer and range share a descriptor set
+	vector<BatchDescriptorSet> batchDescriptorSets;
+
+	Device* device = commandBuffer->Device();
+	vector<MeshRenderer*> batch;
+
+	auto DrawLastBatch = [&]() {
+		if (batch.empty()) return;
+		PROFILER_BEGIN("Draw Batch");
+		GraphicsShader* shader = batch[0]->Material()->GetShader(pass);
+
+		// round the range up to a power of two instances so batches of similar size can share a descriptor set
+		uint32_t sizeClass = 0;
+		while ((1u << sizeClass) < batch.size()) sizeClass++;
+		VkDeviceSize rangeSize = sizeof(uint32_t) << sizeClass;
+
+		// the transforms are already in mInstanceSlots, the batch only needs their slot indices
+		Device::TempRange range = device->AllocateTemp(rangeSize);
+		uint32_t* indices = (uint32_t*)range.mData;
+		for (uint32_t i = 0; i < batch.size(); i++)
+			indices[i] = batch[i]->mInstanceSlot;
+
+		VkDescriptorSetLayout layout = shader->mDescriptorSetLayouts[PER_OBJECT];
+		DescriptorSet* batchDS = nullptr;
+		for (const BatchDescriptorSet& b : batchDescriptorSets)
+			if (b.mLayout == layout && b.mBuffer == *range.mBuffer && b.mSizeClass == sizeClass) {
+				batchDS = b.mDescriptorSet;
+				break;
+			}
+		if (!batchDS) {
+			batchDS = CreateInstanceDescriptorSet(device, shader, camera, pass, range.mBuffer, rangeSize);
+			batchDescriptorSets.push_back({ layout, *range.mBuffer, sizeClass, batchDS });
+		}
+
+		batch[0]->DrawInstanced(commandBuffer, camera, (uint32_t)batch.size(), *batchDS, (uint32_t)range.mOffset, pass);
+		batch.clear();
+		PROFILER_END;
+	};
+	for (size_t i = 0; i < count; i++) {
+		Renderer* r = dynamic_cast<Renderer*>(objects[i]);
+		MeshRenderer* cur = dynamic_cast<MeshRenderer*>(r);
+		if (cur && cur->Material()->GetShader(pass)->mDescriptorBindings.count("InstanceIndices")) {
+			// renderers added after PreFrame() don't have a slot yet, and are drawn from the next frame on
+			if (!mInstanceSlots || cur->mInstanceSlot == INVALID_INSTANCE_SLOT || cur->mInstanceSlot * sizeof(InstanceBuffer) >= mInstanceSlots->Size()) continue;
+			if (batch.size() && (batch.size() >= INSTANCE_BATCH_SIZE || batch[0]->Material() != cur->Material() || batch[0]->Mesh() != cur->Mesh()))
+				DrawLastBatch();
+			batch.push_back(cur);
+		} else {
+			DrawLastBatch();
+			PROFILER_BEGIN("Draw Unbatched");
+			r->Draw(commandBuffer, camera, pass);
+			PROFILER_END;
+		}
+	}
+	DrawLastBatch();
+}
+
+DescriptorSet* Scene::CreateInstanceDescriptorSet(Device* device, GraphicsShader* shader, Camera* camera, PassType pass, Buffer* indices, VkDeviceSize rangeSize) {
+	uint32_t frameContextIndex = device->FrameContextIndex();
+	DescriptorSet* ds = device->GetTempDescriptorSet("Instance Batch", shader->mDescriptorSetLayouts[PER_OBJECT]);
+	ds->CreateStorageBufferDescriptor(mInstanceSlots, 0, mInstanceSlots->Size(), INSTANCE_BUFFER_BINDING);
+	ds->CreateDynamicStorageBufferDescriptor(indices, rangeSize, INSTANCE_INDEX_BINDING);
+	if (pass == PASS_MAIN) {
+		if (shader->mDescriptorBindings.count("Lights"))
+			ds->CreateStorageBufferDescriptor(mLightBuffers[frameContextIndex], 0, mLightBuffers[frameContextIndex]->Size(), LIGHT_BUFFER_BINDING);
+		if (shader->mDescriptorBindings.count("Shadows"))
+			ds->CreateStorageBufferDescriptor(mShadowBuffers[frameContextIndex], 0, mShadowBuffers[frameContextIndex]->Size(), SHADOW_BUFFER_BINDING);
+		if (shader->mDescriptorBindings.count("ShadowAtlas"))
+			ds->CreateSampledTextureDescriptor(mShadowAtlases[frameContextIndex], SHADOW_ATLAS_BINDING);
+		const LightClusterData& clusters = mLightClusters.at(camera);
+		if (shader->mDescriptorBindings.count("LightClusters"))
+			ds->CreateStorageBufferDescriptor(clusters.mClusters.mBuffer, clusters.mClusters.mOffset, clusters.mClusters.mSize, LIGHT_CLUSTER_BINDING);
+		if (shader->mDescriptorBindings.count("LightIndices"))
+			ds->CreateStorageBufferDescriptor(clusters.mIndices.mBuffer, clusters.mIndices.mOffset, clusters.mIndices.mSize, LIGHT_INDEX_BINDING);
+	}
+	ds->FlushWrites();
+	return ds;
+}
+
+void Scene::RecordRenderListParallel(CommandBuffer* commandBuffer, Camera* camera, PassType pass, const vector<Object*>& renderList) {
+	struct RecordJob {
+		size_t mStart;
+		size_t mEnd;
+		// renderers other than MeshRenderers make no thread-safety guarantees, so they are recorded on this thread
+		bool mMainThread;
+		shared_ptr<CommandBuffer> mCommandBuffer;
+	};
+
+	PROFILER_BEGIN("Prepare Materials");
+	// materials are bound from the worker threads, so resolve their variants and write their descriptor sets here
+	vector<MeshRenderer*> meshRenderers(renderList.size());
+	Material* lastMaterial = nullptr;
+	for (size_t i = 0; i < renderList.size(); i++) {
+		meshRenderers[i] = dynamic_cast<MeshRenderer*>(renderList[i]);
+		if (meshRenderers[i] && meshRenderers[i]->Material() && meshRenderers[i]->Material() != lastMaterial) {
+			lastMaterial = meshRenderers[i]->Material();
+			lastMaterial->UpdateDescriptorSets(pass);
+		}
+	}
+	PROFILER_END;
+
+	// split the list into a few chunks per thread, ending chunks between instance batches where possible
+	uint32_t threadCount = mInstance->ThreadPool()->ThreadCount() + 1;
+	size_t chunkSize = max<size_t>(PARALLEL_RECORD_MIN_CHUNK, (renderList.size() + threadCount * 4 - 1) / (threadCount * 4));
+	vector<RecordJob> jobs;
+	for (size_t i = 0; i < renderList.size();) {
+		bool mainThread = meshRenderers[i] == nullptr;
+		size_t end = i + 1;
+		for (; end < renderList.size() && (meshRenderers[end] == nullptr) == mainThread; end++) {
+			if (end - i < chunkSize || mainThread) continue;
+			if (end - i >= 2 * chunkSize) break;
+			if (meshRenderers[end]->Material() != meshRenderers[end - 1]->Material() || meshRenderers[end]->Mesh() != meshRenderers[end - 1]->Mesh()) break;
+		}
+		jobs.push_back({ i, end, mainThread, nullptr });
+		i = end;
+	}
+
+	auto Record = [&](RecordJob& job) {
+		job.mCommandBuffer = commandBuffer->Device()->GetSecondaryCommandBuffer(commandBuffer, "Render Renderers");
+		camera->SetViewport(job.mCommandBuffer.get());
+		RecordRenderList(job.mCommandBuffer.get(), camera, pass, renderList.data() + job.mStart, job.mEnd - job.mStart);
+		job.mCommandBuffer->End();
+	};
+
+	PROFILER_BEGIN("Record Renderers");
+	mInstance->ThreadPool()->ParallelFor((uint32_t)jobs.size(), [&](uint32_t i) {
+		if (!jobs[i].mMainThread) Record(jobs[i]);
+	});
+	for (RecordJob& job : jobs)
+		if (job.mMainThread) Record(job);
 	PROFILER_END;
 
-	Render(commandBuffer, camera, framebuffer, pass, clear, mRenderList);
+	vector<shared_ptr<CommandBuffer>> commandBuffers(jobs.size());
+	for (uint32_t i = 0; i < jobs.size(); i++)
+		commandBuffers[i] = jobs[i].mCommandBuffer;
+	commandBuffer->Execute(commandBuffers);
 }
 
 void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* framebuffer, PassType pass, bool clear, vector<Object*>& renderList) {
@@ -668,114 +1198,80 @@ void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* fr
 	END_CMD_REGION(commandBuffer);
 	PROFILER_END;
 
+	GpuDrawList gpuDrawList;
+	bool gpuScene = CullGpuScene(commandBuffer, camera, pass, gpuDrawList);
+
+	if (pass == PASS_MAIN) BuildLightClusters(commandBuffer, camera);
+
 	PROFILER_BEGIN("Render");
 	BEGIN_CMD_REGION(commandBuffer, "Render");
 
+	// record the draws across the thread pool when there are enough to be worth splitting
+	bool parallel = renderList.size() >= PARALLEL_RECORD_THRESHOLD && mInstance->ThreadPool()->ThreadCount() > 0;
+
 	PROFILER_BEGIN("Begin RenderPass");
 	// begin renderpass
 	if (!framebuffer) framebuffer = camera->Framebuffer();
-	framebuffer->BeginRenderPass(commandBuffer);
-	if (clear) framebuffer->Clear(commandBuffer);
-	camera->Set(commandBuffer);
+	// when recording in parallel, everything inside the render pass goes into secondary command buffers
+	CommandBuffer* sceneCommandBuffer = commandBuffer;
+	shared_ptr<CommandBuffer> secondary;
+	if (parallel) {
+		framebuffer->BeginRenderPass(commandBuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		secondary = commandBuffer->Device()->GetSecondaryCommandBuffer(commandBuffer, "PreRenderScene");
+		sceneCommandBuffer = secondary.get();
+	} else
+		framebuffer->BeginRenderPass(commandBuffer);
+	if (clear) {
+		// only the camera's viewport, shadow cameras render to tiles of a shared atlas
+		VkViewport viewport = camera->EyeViewport();
+		VkRect2D rect = { { (int32_t)viewport.x, (int32_t)viewport.y }, { (uint32_t)viewport.width, (uint32_t)viewport.height } };
+		framebuffer->Clear(sceneCommandBuffer, rect);
+	}
+	camera->Set(sceneCommandBuffer);
 	PROFILER_END;
 
 	PROFILER_BEGIN("Plugin PreRenderScene");
 	for (const auto& p : mPluginManager->Plugins())
-		if (p->mEnabled) p->PreRenderScene(commandBuffer, camera, pass);
+		if (p->mEnabled) p->PreRenderScene(sceneCommandBuffer, camera, pass);
 	PROFILER_END;
 
 	// skybox
 	if (mEnvironment->mSkyboxMaterial && pass == PASS_MAIN) {
 		PROFILER_BEGIN("Draw skybox");
 		ShaderVariant* shader = mEnvironment->mSkyboxMaterial->GetShader(PASS_MAIN);
-		VkPipelineLayout layout = commandBuffer->BindMaterial(mEnvironment->mSkyboxMaterial.get(), pass, mSkyboxCube->VertexInput(), camera, mSkyboxCube->Topology());
-		commandBuffer->BindVertexBuffer(mSkyboxCube->VertexBuffer().get(), 0, 0);
-		commandBuffer->BindIndexBuffer(mSkyboxCube->IndexBuffer().get(), 0, mSkyboxCube->IndexType());
-		camera->SetStereo(commandBuffer, shader, EYE_LEFT);
-		vkCmdDrawIndexed(*commandBuffer, mSkyboxCube->IndexCount(), 1, mSkyboxCube->BaseIndex(), mSkyboxCube->BaseVertex(), 0);
-		commandBuffer->mTriangleCount += mSkyboxCube->IndexCount() / 3;
-		if (camera->StereoMode() != STEREO_NONE) {
-			camera->SetStereo(commandBuffer, shader, EYE_RIGHT);
-			vkCmdDrawIndexed(*commandBuffer, mSkyboxCube->IndexCount(), 1, mSkyboxCube->BaseIndex(), mSkyboxCube->BaseVertex(), 0);
-			commandBuffer->mTriangleCount += mSkyboxCube->IndexCount() / 3;
+		VkPipelineLayout layout = sceneCommandBuffer->BindMaterial(mEnvironment->mSkyboxMaterial.get(), pass, mSkyboxCube->VertexInput(), camera, mSkyboxCube->Topology());
+		// no layout while the skybox pipeline is still being created
+		if (layout) {
+			sceneCommandBuffer->BindVertexBuffer(mSkyboxCube->VertexBuffer().get(), 0, 0);
+			sceneCommandBuffer->BindIndexBuffer(mSkyboxCube->IndexBuffer().get(), 0, mSkyboxCube->IndexType());
+			camera->SetStereo(sceneCommandBuffer, shader, EYE_LEFT);
+			vkCmdDrawIndexed(*sceneCommandBuffer, mSkyboxCube->IndexCount(), 1, mSkyboxCube->BaseIndex(), mSkyboxCube->BaseVertex(), 0);
+			sceneCommandBuffer->mTriangleCount += mSkyboxCube->IndexCount() / 3;
+			if (camera->StereoMode() != STEREO_NONE && !camera->Multiview()) {
+				camera->SetStereo(sceneCommandBuffer, shader, EYE_RIGHT);
+				vkCmdDrawIndexed(*sceneCommandBuffer, mSkyboxCube->IndexCount(), 1, mSkyboxCube->BaseIndex(), mSkyboxCube->BaseVertex(), 0);
+				sceneCommandBuffer->mTriangleCount += mSkyboxCube->IndexCount() / 3;
+			}
 		}
 		PROFILER_END;
 	}
 
-	#pragma region Render renderers
-	uint32_t frameContextIndex = commandBuffer->Device()->FrameContextIndex();
-	DescriptorSet* batchDS = nullptr;
-	Buffer* batchBuffer = nullptr;
-	InstanceBuffer* curBatch = nullptr;
-	MeshRenderer* batchStart = nullptr;
-	uint32_t batchSize = 0;
+	if (gpuScene) DrawGpuScene(sceneCommandBuffer, camera, pass, gpuDrawList);
 
-	auto DrawLastBatch = [&]() {
-		if (batchStart) {
-			PROFILER_BEGIN("Draw Batch");
-			batchStart->DrawInstanced(commandBuffer, camera, batchSize, *batchDS, pass);
-			batchStart = nullptr;
-			PROFILER_END;
-		}
-	};
-	for (Object* o : renderList) {
-		Renderer* r = dynamic_cast<Renderer*>(o);
-		bool batched = false;
-		if (MeshRenderer* cur = dynamic_cast<MeshRenderer*>(r)) {
-			GraphicsShader* curShader = cur->Material()->GetShader(pass);
-			if (curShader->mDescriptorBindings.count("Instances")) {
-				if (!batchStart || batchSize + 1 >= INSTANCE_BATCH_SIZE || (batchStart->Material() != cur->Material()) || batchStart->Mesh() != cur->Mesh()) {
-					// render last batch
-					DrawLastBatch();
-
-					// start a new batch
-					PROFILER_BEGIN("Start batch");
-					batchSize = 0;
-					batchStart = cur;
-
-					batchBuffer = commandBuffer->Device()->GetTempBuffer("Instance Batch", sizeof(InstanceBuffer) * INSTANCE_BATCH_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-					curBatch = (InstanceBuffer*)batchBuffer->MappedData();
-
-					batchDS = commandBuffer->Device()->GetTempDescriptorSet("Instance Batch", curShader->mDescriptorSetLayouts[PER_OBJECT]);
-					batchDS->CreateStorageBufferDescriptor(batchBuffer, 0, batchBuffer->Size(), INSTANCE_BUFFER_BINDING);
-					if (pass == PASS_MAIN) {
-						if (curShader->mDescriptorBindings.count("Lights"))
-							batchDS->CreateStorageBufferDescriptor(mLightBuffers[frameContextIndex], 0, mLightBuffers[frameContextIndex]->Size(), LIGHT_BUFFER_BINDING);
-						if (curShader->mDescriptorBindings.count("Shadows"))
-							batchDS->CreateStorageBufferDescriptor(mShadowBuffers[frameContextIndex], 0, mShadowBuffers[frameContextIndex]->Size(), SHADOW_BUFFER_BINDING);
-						if (curShader->mDescriptorBindings.count("ShadowAtlas"))
-							batchDS->CreateSampledTextureDescriptor(mShadowAtlases[frameContextIndex], SHADOW_ATLAS_BINDING);
-					}
-					batchDS->FlushWrites();
+	if (parallel) {
+		secondary->End();
+		commandBuffer->Execute({ secondary });
+		RecordRenderListParallel(commandBuffer, camera, pass, renderList);
 
-					PROFILER_END;
-				}
-
-				// append to batch
-				PROFILER_BEGIN("Append to batch");
-				curBatch[batchSize].ObjectToWorld = cur->ObjectToWorld();
-				curBatch[batchSize].WorldToObject = cur->WorldToObject();
-				batchSize++;
-				batched = true;
-				PROFILER_END;
-			}
-		}
-
-		if (!batched) {
-			// render last batch
-			DrawLastBatch();
-			PROFILER_BEGIN("Draw Unbatched");
-			r->Draw(commandBuffer, camera, pass);
-			PROFILER_END;
-		}
-	}
-	// render last batch
-	DrawLastBatch();
-	#pragma endregion
+		secondary = commandBuffer->Device()->GetSecondaryCommandBuffer(commandBuffer, "PostRenderScene");
+		sceneCommandBuffer = secondary.get();
+		camera->SetViewport(sceneCommandBuffer);
+	} else
+		RecordRenderList(commandBuffer, camera, pass, renderList.data(), renderList.size());
 
 	if (mDrawGizmos && pass == PASS_MAIN) {
 		PROFILER_BEGIN("Draw Gizmos");
-		BEGIN_CMD_REGION(commandBuffer, "Draw Gizmos");
+		BEGIN_CMD_REGION(sceneCommandBuffer, "Draw Gizmos");
 		/*
 		for (Camera* c : mShadowCameras)
 			if (camera != c) {
@@ -802,34 +1298,38 @@ void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* fr
 			}
 		*/
 
-		if (mBvh) mBvh->DrawGizmos(commandBuffer, camera, this);
+		if (mBvh) mBvh->DrawGizmos(sceneCommandBuffer, camera, this);
 
 		for (const auto& r : mObjects)
 			if (r->EnabledHierarchy())
-				r->DrawGizmos(commandBuffer, camera);
+				r->DrawGizmos(sceneCommandBuffer, camera);
 
 		for (const auto& p : mPluginManager->Plugins())
 			if (p->mEnabled)
-				p->DrawGizmos(commandBuffer, camera);
-		Gizmos::Draw(commandBuffer, pass, camera);
-		END_CMD_REGION(commandBuffer);
+				p->DrawGizmos(sceneCommandBuffer, camera);
+		Gizmos::Draw(sceneCommandBuffer, pass, camera);
+		END_CMD_REGION(sceneCommandBuffer);
 		PROFILER_END;
 	}
 
 	if (pass == PASS_MAIN) {
 		PROFILER_BEGIN("Draw GUI");
-		GUI::Draw(commandBuffer, pass, camera);
+		GUI::Draw(sceneCommandBuffer, pass, camera);
 		PROFILER_END;
 	}
 
-	camera->Set(commandBuffer);
+	camera->Set(sceneCommandBuffer);
 	PROFILER_BEGIN("Plugin PostRenderScene");
 	for (const auto& p : mPluginManager->Plugins())
-		if (p->mEnabled) p->PostRenderScene(commandBuffer, camera, pass);
+		if (p->mEnabled) p->PostRenderScene(sceneCommandBuffer, camera, pass);
 	PROFILER_END;
 
 
 	PROFILER_BEGIN("End RenderPass");
+	if (parallel) {
+		secondary->End();
+		commandBuffer->Execute({ secondary });
+	}
 	vkCmdEndRenderPass(*commandBuffer);
 	PROFILER_END;
 
@@ -837,17 +1337,600 @@ void Scene::Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* fr
 	PROFILER_END;
 }
 
+void Scene::UpdateInstanceSlots(CommandBuffer* commandBuffer) {
+	Device* device = commandBuffer->Device();
+	uint64_t frame = mInstance->FrameCount();
+	for (auto it = mRetiredInstanceSlots.begin(); it != mRetiredInstanceSlots.end();)
+		if (frame >= it->second + device->MaxFramesInFlight()) {
+			safe_delete(it->first);
+			it = mRetiredInstanceSlots.erase(it);
+		} else
+			it++;
+
+	// ObjectToWorld() updates the transform if it changed, which marks the slot dirty
+	vector<MeshRenderer*>& dirty = mMovedRenderers;
+	dirty.clear();
+	for (Renderer* r : mRenderers)
+		if (MeshRenderer* m = dynamic_cast<MeshRenderer*>(r)) {
+			if (m->mInstanceSlot == INVALID_INSTANCE_SLOT) {
+				if (mFreeInstanceSlots.size()) {
+					m->mInstanceSlot = mFreeInstanceSlots.back();
+					mFreeInstanceSlots.pop_back();
+				} else
+					m->mInstanceSlot = mInstanceSlotCount++;
+				m->mInstanceDirty = true;
+			}
+			m->ObjectToWorld();
+			if (m->mInstanceDirty) dirty.push_back(m);
+		}
+
+	uint32_t capacity = mInstanceSlots ? (uint32_t)(mInstanceSlots->Size() / sizeof(InstanceBuffer)) : 0;
+	bool grow = mInstanceSlotCount > capacity;
+	if (dirty.empty() && !grow) return;
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.size = VK_WHOLE_SIZE;
+	barrier.srcQueueFamilyIndex = barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	if (mInstanceSlots) {
+		// previous frames' draws read the slots, and the copies below overwrite or read them
+		barrier.buffer = *mInstanceSlots;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(*commandBuffer,
+			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, nullptr, 1, &barrier, 0, nullptr);
+	}
+
+	if (grow) {
+		uint32_t newCapacity = max(capacity, (uint32_t)INSTANCE_SLOT_MIN_CAPACITY);
+		while (newCapacity < mInstanceSlotCount) newCapacity *= 2;
+		Buffer* slots = new Buffer("Instance Slots", device, newCapacity * sizeof(InstanceBuffer),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		if (mInstanceSlots) {
+			VkBufferCopy region = {};
+			region.size = mInstanceSlots->Size();
+			vkCmdCopyBuffer(*commandBuffer, *mInstanceSlots, *slots, 1, &region);
+			mRetiredInstanceSlots.push_back(make_pair(mInstanceSlots, frame));
+
+			barrier.buffer = *slots;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier(*commandBuffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				0, 0, nullptr, 1, &barrier, 0, nullptr);
+		}
+		mInstanceSlots = slots;
+	}
+
+	if (dirty.size()) {
+		// copy in slot order, so runs of consecutive slots become a single region
+		sort(dirty.begin(), dirty.end(), [](const MeshRenderer* a, const MeshRenderer* b) { return a->mInstanceSlot < b->mInstanceSlot; });
+		Device::TempRange range = device->AllocateTemp(dirty.size() * sizeof(InstanceBuffer), sizeof(float4));
+		InstanceBuffer* instances = (InstanceBuffer*)range.mData;
+		vector<VkBufferCopy> regions;
+		for (uint32_t i = 0; i < dirty.size(); i++) {
+			MeshRenderer* m = dirty[i];
+			float4x4 o2w = m->ObjectToWorld();
+			for (uint32_t r = 0; r < 3; r++)
+				instances[i].ObjectToWorld[r] = float4(o2w[0][r], o2w[1][r], o2w[2][r], o2w[3][r]);
+			m->mInstanceDirty = false;
+
+			if (i && m->mInstanceSlot == dirty[i - 1]->mInstanceSlot + 1)
+				regions.back().size += sizeof(InstanceBuffer);
+			else {
+				VkBufferCopy region = {};
+				region.srcOffset = range.mOffset + i * sizeof(InstanceBuffer);
+				region.dstOffset = m->mInstanceSlot * sizeof(InstanceBuffer);
+				region.size = sizeof(InstanceBuffer);
+				regions.push_back(region);
+			}
+		}
+		vkCmdCopyBuffer(*commandBuffer, *range.mBuffer, *mInstanceSlots, (uint32_t)regions.size(), regions.data());
+		Profiler::AddCounter("Instance Slot Uploads", dirty.size());
+	}
+
+	barrier.buffer = *mInstanceSlots;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(*commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+		0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+// draws can share an indirect call if they bind the same pipeline, descriptor sets and mesh buffers
+static bool SameBatch(MeshRenderer* a, MeshRenderer* b) {
+	::Mesh* ma = a->Mesh();
+	::Mesh* mb = b->Mesh();
+	return a->Material() == b->Material() &&
+		ma->VertexBuffer() == mb->VertexBuffer() && ma->IndexBuffer() == mb->IndexBuffer() && ma->IndexType() == mb->IndexType() && ma->Topology() == mb->Topology() &&
+		(ma->VertexInput() == mb->VertexInput() || (ma->VertexInput() && mb->VertexInput() && *ma->VertexInput() == *mb->VertexInput()));
+}
+
+void Scene::UpdateGpuScene(CommandBuffer* commandBuffer) {
+	mGpuSceneFrame = mInstance->FrameCount();
+
+	bool rebuild = mGpuSceneDirty || mGpuRendererStates.size() != mRenderers.size();
+	for (size_t i = 0; i < mRenderers.size() && !rebuild; i++) {
+		const GpuRendererState& s = mGpuRendererStates[i];
+		Renderer* r = mRenderers[i];
+		rebuild = s.mRenderer != r || s.mVisible != r->Visible() || s.mMask != r->LayerMask() ||
+			(s.mMeshRenderer && (s.mMaterial != s.mMeshRenderer->Material() || s.mMesh != s.mMeshRenderer->Mesh()));
+	}
+	if (rebuild) {
+		BuildGpuScene(commandBuffer);
+		return;
+	}
+
+	for (CpuRenderer& r : mCpuRenderers)
+		r.mBounds = r.mRenderer->Bounds();
+
+	// only the renderers that moved upload their bounds, in instance order so runs of consecutive instances become a single region
+	vector<MeshRenderer*> moved;
+	for (MeshRenderer* m : mMovedRenderers)
+		if (m->mGpuInstance != INVALID_INSTANCE_SLOT) moved.push_back(m);
+	if (moved.empty()) return;
+	sort(moved.begin(), moved.end(), [](const MeshRenderer* a, const MeshRenderer* b) { return a->mGpuInstance < b->mGpuInstance; });
+
+	Device* device = commandBuffer->Device();
+	Device::TempRange range = device->AllocateTemp(moved.size() * sizeof(GPUInstanceBounds), sizeof(float4));
+	GPUInstanceBounds* bounds = (GPUInstanceBounds*)range.mData;
+	vector<VkBufferCopy> regions;
+	for (uint32_t i = 0; i < moved.size(); i++) {
+		MeshRenderer* m = moved[i];
+		GPUInstanceBounds& b = mGpuBoundsData[m->mGpuInstance];
+		AABB aabb = m->Bounds();
+		b.Min = aabb.mMin;
+		b.Max = aabb.mMax;
+		bounds[i] = b;
+
+		if (i && m->mGpuInstance == moved[i - 1]->mGpuInstance + 1)
+			regions.back().size += sizeof(GPUInstanceBounds);
+		else {
+			VkBufferCopy region = {};
+			region.srcOffset = range.mOffset + i * sizeof(GPUInstanceBounds);
+			region.dstOffset = m->mGpuInstance * sizeof(GPUInstanceBounds);
+			region.size = sizeof(GPUInstanceBounds);
+			regions.push_back(region);
+		}
+	}
+
+	// previous frames' culling reads the bounds
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(*commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+	vkCmdCopyBuffer(*commandBuffer, *range.mBuffer, *mGpuBounds, (uint32_t)regions.size(), regions.data());
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(*commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+	Profiler::AddCounter("GPU Scene Bounds Uploads", moved.size());
+}
+
+void Scene::BuildGpuScene(CommandBuffer* commandBuffer) {
+	mGpuDraws.clear();
+	mGpuBatches.clear();
+	mCpuRenderers.clear();
+	mGpuRendererStates.clear();
+	mGpuBoundsData.clear();
+	mGpuInstanceCount = 0;
+	mGpuSceneDirty = false;
+	Profiler::AddCounter("GPU Scene Rebuilds");
+
+	Device* device = commandBuffer->Device();
+
+	struct DrawKey {
+		uint64_t mKey;
+		Buffer* mVertexBuffer;
+		MeshRenderer* mRenderer;
+	};
+	// renderers can be drawn from the GPU scene if every pass they draw in has an instanced variant. Each draw finds its culled
+	// instances with its first instance, so the GPU scene needs drawIndirectFirstInstance
+	vector<DrawKey> keys;
+	for (Renderer* r : mRenderers) {
+		MeshRenderer* m = dynamic_cast<MeshRenderer*>(r);
+		bool visible = r->Visible();
+		mGpuRendererStates.push_back({ r, m, m ? m->Material() : nullptr, m ? m->Mesh() : nullptr, r->LayerMask(), visible });
+		if (m) m->mGpuInstance = INVALID_INSTANCE_SLOT;
+		if (!visible) continue;
+
+		bool gpu = device->DrawIndirectFirstInstanceSupported() && m && m->GpuDrivable() && m->RenderQueue() < GPU_DRIVEN_MAX_RENDER_QUEUE;
+		for (PassType pass : { PASS_MAIN, PASS_DEPTH })
+			if (gpu && (m->PassMask() & pass)) {
+				GraphicsShader* shader = m->Material()->GetShader(pass);
+				gpu = shader && shader->mDescriptorBindings.count("InstanceIndices");
+			}
+		gpu = gpu && m->mInstanceSlot != INVALID_INSTANCE_SLOT && m->mInstanceSlot * sizeof(InstanceBuffer) < mInstanceSlots->Size();
+		if (gpu)
+			keys.push_back({ ((uint64_t)m->Material()->SortId() << 32) | m->Mesh()->SortId(), m->Mesh()->VertexBuffer().get(), m });
+		else
+			mCpuRenderers.push_back({ r, r->Bounds(), r->LayerMask() });
+	}
+	if (keys.empty()) return;
+	// by material, then by vertex buffer so meshes that share buffers end up in the same batch
+	sort(keys.begin(), keys.end(), [](const DrawKey& a, const DrawKey& b) {
+		if ((a.mKey >> 32) != (b.mKey >> 32)) return a.mKey < b.mKey;
+		if (a.mVertexBuffer != b.mVertexBuffer) return a.mVertexBuffer < b.mVertexBuffer;
+		return a.mKey < b.mKey;
+	});
+
+	Device::TempRange instanceRange = device->AllocateTemp(keys.size() * sizeof(uint32_t));
+	uint32_t* instances = (uint32_t*)instanceRange.mData;
+	mGpuBoundsData.resize(keys.size());
+	vector<GPUDrawCommand> commands;
+
+	for (size_t i = 0; i < keys.size();) {
+		size_t end = i + 1;
+		while (end < keys.size() && keys[end].mKey == keys[i].mKey) end++;
+
+		GpuDraw draw = {};
+		draw.mRenderer = keys[i].mRenderer;
+		draw.mInstanceBase = mGpuInstanceCount;
+		draw.mInstanceCount = (uint32_t)(end - i);
+		for (uint32_t j = 0; j < draw.mInstanceCount; j++) {
+			MeshRenderer* m = keys[i + j].mRenderer;
+			uint32_t instance = draw.mInstanceBase + j;
+			m->mGpuInstance = instance;
+			instances[instance] = m->mInstanceSlot;
+			AABB aabb = m->Bounds();
+			GPUInstanceBounds& b = mGpuBoundsData[instance];
+			b.Min = aabb.mMin;
+			b.Max = aabb.mMax;
+			b.DrawIndex = (uint32_t)mGpuDraws.size();
+			b.Mask = m->LayerMask();
+			draw.mMask |= b.Mask;
+		}
+
+		if (mGpuBatches.empty() || !SameBatch(mGpuBatches.back().mRenderer, draw.mRenderer))
+			mGpuBatches.push_back({ draw.mRenderer, (uint32_t)mGpuDraws.size(), 0, 0 });
+		GpuBatch& batch = mGpuBatches.back();
+
+		::Mesh* mesh = draw.mRenderer->Mesh();
+		GPUDrawCommand command = {};
+		command.IndexCount = mesh->IndexCount();
+		command.FirstIndex = mesh->BaseIndex();
+		command.VertexOffset = mesh->BaseVertex();
+		command.FirstInstance = draw.mInstanceBase;
+		command.Batch = (uint32_t)mGpuBatches.size() - 1;
+		command.BatchOffset = batch.mDrawCount++;
+		commands.push_back(command);
+		batch.mMask |= draw.mMask;
+
+		mGpuDraws.push_back(draw);
+		mGpuInstanceCount += draw.mInstanceCount;
+		i = end;
+	}
+
+	Device::TempRange boundsRange = device->AllocateTemp(mGpuBoundsData.size() * sizeof(GPUInstanceBounds));
+	memcpy(boundsRange.mData, mGpuBoundsData.data(), boundsRange.mSize);
+	Device::TempRange commandRange = device->AllocateTemp(commands.size() * sizeof(GPUDrawCommand));
+	memcpy(commandRange.mData, commands.data(), commandRange.mSize);
+
+	// grow the resident buffers, the outgrown ones are kept until the frames that use them are done
+	auto reserve = [&](Buffer*& buffer, const string& name, VkDeviceSize size) {
+		if (buffer && buffer->Size() >= size) return;
+		VkDeviceSize capacity = buffer ? buffer->Size() * 2 : 0;
+		if (buffer) mRetiredInstanceSlots.push_back(make_pair(buffer, mInstance->FrameCount()));
+		buffer = new Buffer(name, device, max(capacity, size), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	};
+	reserve(mGpuInstances, "GPU Scene Instances", instanceRange.mSize);
+	reserve(mGpuBounds, "GPU Scene Bounds", boundsRange.mSize);
+	reserve(mGpuDrawCommands, "GPU Scene Draw Commands", commandRange.mSize);
+
+	// previous frames' culling reads the buffers
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(*commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+	VkBufferCopy region = {};
+	region.srcOffset = instanceRange.mOffset;
+	region.size = instanceRange.mSize;
+	vkCmdCopyBuffer(*commandBuffer, *instanceRange.mBuffer, *mGpuInstances, 1, &region);
+	region.srcOffset = boundsRange.mOffset;
+	region.size = boundsRange.mSize;
+	vkCmdCopyBuffer(*commandBuffer, *boundsRange.mBuffer, *mGpuBounds, 1, &region);
+	region.srcOffset = commandRange.mOffset;
+	region.size = commandRange.mSize;
+	vkCmdCopyBuffer(*commandBuffer, *commandRange.mBuffer, *mGpuDrawCommands, 1, &region);
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(*commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void Scene::CullCpuRenderers(const float4 frustum[6], vector<Object*>& objects, uint32_t mask) {
+	for (const CpuRenderer& r : mCpuRenderers)
+		if ((r.mMask & mask) && r.mBounds.Intersects(frustum))
+			objects.push_back(r.mRenderer);
+}
+
+bool Scene::CullGpuScene(CommandBuffer* commandBuffer, Camera* camera, PassType pass, GpuDrawList& drawList) {
+	if (!mGpuDriven || mGpuSceneFrame != mInstance->FrameCount() || mGpuDraws.empty()) return false;
+	if (!mCullShader) mCullShader = mAssetManager->LoadShader("Shaders/cull.stm");
+	ComputeShader* shader = mCullShader->GetCompute("cull", {});
+	if (!shader) return false;
+
+	PROFILER_BEGIN("Cull GPU Scene");
+	BEGIN_CMD_REGION(commandBuffer, "Cull GPU Scene");
+	Device* device = commandBuffer->Device();
+
+	// draw commands, then batch draw counts, then culled instances
+	uint32_t drawCount = (uint32_t)mGpuDraws.size();
+	VkDeviceSize alignment = device->Limits().minStorageBufferOffsetAlignment;
+	VkDeviceSize commandsSize = drawCount * sizeof(GPUDrawCommand);
+	VkDeviceSize countsSize = mGpuBatches.size() * sizeof(uint32_t);
+	drawList.mInstanceSize = mGpuInstanceCount * sizeof(uint32_t);
+	drawList.mCountOffset = (commandsSize + alignment - 1) / alignment * alignment;
+	drawList.mInstanceOffset = (drawList.mCountOffset + countsSize + alignment - 1) / alignment * alignment;
+	drawList.mBuffer = device->GetTempBuffer("Culled Draws", drawList.mInstanceOffset + drawList.mInstanceSize,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	// start from the resident draw commands, which have 0 instances, and batch draw counts of 0
+	VkBufferCopy region = {};
+	region.size = commandsSize;
+	vkCmdCopyBuffer(*commandBuffer, *mGpuDrawCommands, *drawList.mBuffer, 1, &region);
+	vkCmdFillBuffer(*commandBuffer, *drawList.mBuffer, drawList.mCountOffset, countsSize, 0);
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.buffer = *drawList.mBuffer;
+	barrier.size = VK_WHOLE_SIZE;
+	barrier.srcQueueFamilyIndex = barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(*commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	vkCmdBindPipeline(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, shader->mPipeline);
+	DescriptorSet* ds = device->GetTempDescriptorSet("Cull", shader->mDescriptorSetLayouts[0]);
+	ds->CreateStorageBufferDescriptor(mGpuInstances, 0, mGpuInstanceCount * sizeof(uint32_t), shader->mDescriptorBindings.at("InstanceSlots").second.binding);
+	ds->CreateStorageBufferDescriptor(mGpuBounds, 0, mGpuInstanceCount * sizeof(GPUInstanceBounds), shader->mDescriptorBindings.at("Bounds").second.binding);
+	ds->CreateStorageBufferDescriptor(drawList.mBuffer, 0, commandsSize, shader->mDescriptorBindings.at("DrawCommands").second.binding);
+	ds->CreateStorageBufferDescriptor(drawList.mBuffer, drawList.mCountOffset, countsSize, shader->mDescriptorBindings.at("DrawCounts").second.binding);
+	ds->CreateStorageBufferDescriptor(drawList.mBuffer, drawList.mInstanceOffset, drawList.mInstanceSize, shader->mDescriptorBindings.at("CulledInstances").second.binding);
+	ds->FlushWrites();
+	vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, shader->mPipelineLayout, 0, 1, *ds, 0, nullptr);
+
+	uint32_t passMask = pass;
+	commandBuffer->PushConstant(shader, "Frustum", camera->Frustum());
+	commandBuffer->PushConstant(shader, "InstanceCount", &mGpuInstanceCount);
+	commandBuffer->PushConstant(shader, "PassMask", &passMask);
+	vkCmdDispatch(*commandBuffer, (mGpuInstanceCount + 63) / 64, 1, 1);
+
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(*commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	// the batches' renderers still need their PreRender, for the environment textures
+	for (const GpuBatch& batch : mGpuBatches)
+		if (batch.mMask & pass)
+			batch.mRenderer->PreRender(commandBuffer, camera, pass);
+
+	END_CMD_REGION(commandBuffer);
+	PROFILER_END;
+	return true;
+}
+
+void Scene::DrawGpuScene(CommandBuffer* commandBuffer, Camera* camera, PassType pass, const GpuDrawList& drawList) {
+	struct DrawDescriptorSet {
+		VkDescriptorSetLayout mLayout;
+		DescriptorSet* mDescriptorSet;
+	};
+	vector<DrawDescriptorSet> descriptorSets;
+
+	PROFILER_BEGIN("Draw GPU Scene");
+	BEGIN_CMD_REGION(commandBuffer, "Draw GPU Scene");
+	Device* device = commandBuffer->Device();
+	uint32_t calls = 0;
+	for (uint32_t i = 0; i < mGpuBatches.size(); i++) {
+		const GpuBatch& batch = mGpuBatches[i];
+		if ((batch.mMask & pass) == 0) continue;
+		GraphicsShader* shader = batch.mRenderer->Material()->GetShader(pass);
+
+		// every batch binds all of the culled instances, each draw's first instance is the start of its range
+		VkDescriptorSetLayout layout = shader->mDescriptorSetLayouts[PER_OBJECT];
+		DescriptorSet* drawDS = nullptr;
+		for (const DrawDescriptorSet& d : descriptorSets)
+			if (d.mLayout == layout) {
+				drawDS = d.mDescriptorSet;
+				break;
+			}
+		if (!drawDS) {
+			drawDS = CreateInstanceDescriptorSet(device, shader, camera, pass, drawList.mBuffer, drawList.mInstanceSize);
+			descriptorSets.push_back({ layout, drawDS });
+		}
+
+		batch.mRenderer->DrawIndirect(commandBuffer, camera, *drawDS, (uint32_t)drawList.mInstanceOffset,
+			drawList.mBuffer, batch.mFirstDraw * sizeof(GPUDrawCommand), batch.mDrawCount, drawList.mBuffer, drawList.mCountOffset + i * sizeof(uint32_t), pass);
+		calls++;
+	}
+	Profiler::AddCounter("GPU Scene Indirect Calls", calls);
+	END_CMD_REGION(commandBuffer);
+	PROFILER_END;
+}
+
+void Scene::BuildLightClusters(CommandBuffer* commandBuffer, Camera* camera) {
+	PROFILER_BEGIN("Build Light Clusters");
+	BEGIN_CMD_REGION(commandBuffer, "Build Light Clusters");
+	Device* device = commandBuffer->Device();
+	uint32_t frameContextIndex = device->FrameContextIndex();
+
+	GPULightClusterCamera clusterCamera = {};
+	for (uint32_t i = 0; i < 2; i++) {
+		clusterCamera.View[i] = camera->View((StereoEye)i);
+		clusterCamera.InvProjection[i] = camera->InverseProjection((StereoEye)i);
+	}
+	clusterCamera.Position = camera->WorldPosition();
+	clusterCamera.LightCount = mGpuLightCount;
+	clusterCamera.Near = camera->Near();
+	clusterCamera.Far = camera->Far();
+	clusterCamera.EyeCount = camera->StereoMode() == STEREO_NONE ? 1 : 2;
+
+	ComputeShader* shader = nullptr;
+	if (mGpuLightClusters) {
+		if (!mLightClusterShader) mLightClusterShader = mAssetManager->LoadShader("Shaders/lightcluster.stm");
+		shader = mLightClusterShader->GetCompute("cluster", {});
+	}
+
+	LightClusterData& clusters = mLightClusters[camera];
+	if (shader) {
+		// every cluster gets LIGHT_CLUSTER_MAX_LIGHTS indices
+		uint32_t clusterCount = LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y * LIGHT_CLUSTER_Z * clusterCamera.EyeCount;
+		VkDeviceSize alignment = device->Limits().minStorageBufferOffsetAlignment;
+		VkDeviceSize clustersSize = clusterCount * sizeof(GPULightCluster);
+		VkDeviceSize indicesSize = clusterCount * LIGHT_CLUSTER_MAX_LIGHTS * sizeof(uint32_t);
+		VkDeviceSize indexOffset = (clustersSize + alignment - 1) / alignment * alignment;
+		Buffer* buffer = device->GetTempBuffer("Light Clusters", indexOffset + indicesSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		Device::TempRange cameraRange = device->AllocateTemp(sizeof(GPULightClusterCamera));
+		memcpy(cameraRange.mData, &clusterCamera, sizeof(GPULightClusterCamera));
+
+		vkCmdBindPipeline(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, shader->mPipeline);
+		DescriptorSet* ds = device->GetTempDescriptorSet("Light Clusters", shader->mDescriptorSetLayouts[0]);
+		ds->CreateStorageBufferDescriptor(cameraRange.mBuffer, cameraRange.mOffset, sizeof(GPULightClusterCamera), shader->mDescriptorBindings.at("ClusterCamera").second.binding);
+		ds->CreateStorageBufferDescriptor(mLightBuffers[frameContextIndex], 0, mLightBuffers[frameContextIndex]->Size(), shader->mDescriptorBindings.at("Lights").second.binding);
+		ds->CreateStorageBufferDescriptor(buffer, 0, clustersSize, shader->mDescriptorBindings.at("LightClusters").second.binding);
+		ds->CreateStorageBufferDescriptor(buffer, indexOffset, indicesSize, shader->mDescriptorBindings.at("LightIndices").second.binding);
+		ds->CreateStorageBufferDescriptor(mLightOverflowBuffers[frameContextIndex], 0, sizeof(uint32_t), shader->mDescriptorBindings.at("LightOverflow").second.binding);
+		ds->FlushWrites();
+		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, shader->mPipelineLayout, 0, 1, *ds, 0, nullptr);
+		// one group per depth slice
+		vkCmdDispatch(*commandBuffer, LIGHT_CLUSTER_Z * clusterCamera.EyeCount, 1, 1);
+
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.buffer = *buffer;
+		barrier.size = VK_WHOLE_SIZE;
+		barrier.srcQueueFamilyIndex = barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(*commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+		clusters.mClusters = { buffer, 0, clustersSize, nullptr };
+		clusters.mIndices = { buffer, indexOffset, indicesSize, nullptr };
+	} else
+		BuildLightClustersCpu(device, clusterCamera, (const GPULight*)mLightBuffers[frameContextIndex]->MappedData(), clusters,
+			*(uint32_t*)mLightOverflowBuffers[frameContextIndex]->MappedData());
+
+	END_CMD_REGION(commandBuffer);
+	PROFILER_END;
+}
+
+void Scene::BuildLightClustersCpu(Device* device, const GPULightClusterCamera& camera, const GPULight* lights, LightClusterData& clusterData, uint32_t& overflow) {
+	struct SliceLight {
+		uint32_t mIndex;
+		float3 mPosition;
+		float mInvSqrRange;
+	};
+
+	uint32_t sliceCount = LIGHT_CLUSTER_Z * camera.EyeCount;
+	uint32_t clusterCount = LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y * sliceCount;
+	clusterData.mClusters = device->AllocateTemp(clusterCount * sizeof(GPULightCluster));
+	GPULightCluster* clusters = (GPULightCluster*)clusterData.mClusters.mData;
+
+	// one depth slice per job, the slice's lights are packed together and offset once every slice is done
+	vector<vector<uint32_t>> sliceIndices(sliceCount);
+	atomic<uint32_t> sliceOverflow(0);
+	mInstance->ThreadPool()->ParallelFor(sliceCount, [&](uint32_t s) {
+		uint32_t eye = s / LIGHT_CLUSTER_Z;
+		uint32_t z = s % LIGHT_CLUSTER_Z;
+		float z0 = camera.Near * powf(camera.Far / camera.Near, (float)z / LIGHT_CLUSTER_Z);
+		float z1 = camera.Near * powf(camera.Far / camera.Near, (float)(z + 1) / LIGHT_CLUSTER_Z);
+
+		// lights whose range overlaps the slice, suns overlap everything
+		vector<SliceLight> sliceLights;
+		for (uint32_t l = 0; l < camera.LightCount; l++) {
+			if (lights[l].Type == LIGHT_SUN) {
+				sliceLights.push_back({ l, 0.f, 0.f });
+				continue;
+			}
+			float3 p = (camera.View[eye] * float4(lights[l].WorldPosition - camera.Position, 1)).xyz;
+			float range = 1.f / sqrtf(lights[l].InvSqrRange);
+			if (p.z + range < z0 || p.z - range > z1) continue;
+			sliceLights.push_back({ l, p, lights[l].InvSqrRange });
+		}
+
+		vector<uint32_t>& indices = sliceIndices[s];
+		for (uint32_t y = 0; y < LIGHT_CLUSTER_Y; y++)
+			for (uint32_t x = 0; x < LIGHT_CLUSTER_X; x++) {
+				float3 mn, mx;
+				LightClusterBounds(camera, eye, x, y, z0, z1, mn, mx);
+
+				GPULightCluster& cluster = clusters[(s * LIGHT_CLUSTER_Y + y) * LIGHT_CLUSTER_X + x];
+				cluster.Offset = (uint32_t)indices.size();
+				cluster.Count = 0;
+				uint32_t clusterOverflow = 0;
+				for (const SliceLight& light : sliceLights) {
+					if (light.mInvSqrRange > 0) {
+						float3 d = light.mPosition - clamp(light.mPosition, mn, mx);
+						if (dot(d, d) * light.mInvSqrRange > 1) continue;
+					}
+					if (cluster.Count < LIGHT_CLUSTER_MAX_LIGHTS) {
+						indices.push_back(light.mIndex);
+						cluster.Count++;
+					} else
+						clusterOverflow++;
+				}
+				if (clusterOverflow) sliceOverflow += clusterOverflow;
+			}
+	});
+	overflow += sliceOverflow;
+
+	uint32_t indexCount = 0;
+	for (const vector<uint32_t>& indices : sliceIndices)
+		indexCount += (uint32_t)indices.size();
+	// never bind an empty range
+	clusterData.mIndices = device->AllocateTemp(max(indexCount, 1u) * sizeof(uint32_t));
+	uint32_t* dst = (uint32_t*)clusterData.mIndices.mData;
+	uint32_t offset = 0;
+	for (uint32_t s = 0; s < sliceCount; s++) {
+		for (uint32_t i = 0; i < LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y; i++)
+			clusters[s * LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y + i].Offset += offset;
+		if (sliceIndices[s].size()) memcpy(dst + offset, sliceIndices[s].data(), sliceIndices[s].size() * sizeof(uint32_t));
+		offset += (uint32_t)sliceIndices[s].size();
+	}
+	Profiler::AddCounter("Light Cluster Assignments", indexCount);
+}
+
+uint32_t Scene::Raycast(const Ray* worldRays, size_t count, ObjectBvh2::Hit* hits, bool any, uint32_t mask) {
+	// BVH() brings every object's transform and bounds up to date, so the intersections below only read object state
+	return BVH()->IntersectBatch(worldRays, count, hits, any, mask, mInstance->ThreadPool());
+}
+
 ObjectBvh2* Scene::BVH() {
 	if (mBvh && mBvhDirty) {
-		PROFILER_BEGIN("Build BVH");
-		Object** objs = new Object*[mObjects.size()];
-		for (uint32_t i = 0; i < mObjects.size(); i++)
-			objs[i] = mObjects[i].get();
-		mBvh->Build(objs, mObjects.size());
-		delete[] objs;
+		if (!mBvhRebuild) {
+			// only transforms changed, update the node bounds in place
+			PROFILER_BEGIN("Refit BVH");
+			float cost = mBvh->Refit();
+			mBvhRebuild = cost > mBvh->BuildCost() * BVH_REBUILD_THRESHOLD;
+			PROFILER_END;
+		}
+		if (mBvhRebuild) {
+			PROFILER_BEGIN("Build BVH");
+			vector<Object*> objs(mObjects.size());
+			for (uint32_t i = 0; i < mObjects.size(); i++)
+				objs[i] = mObjects[i].get();
+			mBvh->Build(objs.data(), (uint32_t)objs.size());
+			mBvhRebuild = false;
+			PROFILER_END;
+		}
 		mBvhDirty = false;
 		mLastBvhBuild = mInstance->FrameCount();
-		PROFILER_END;
 	}
 	return mBvh;
 }
\ No newline at end of file
@@ -12,10 +12,13 @@
 #include <Scene/Environment.hpp>
 #include <Scene/Light.hpp>
 #include <Scene/Object.hpp>
+#include <Scene/ShadowAtlas.hpp>
 #include <Util/Util.hpp>
 
 #include <functional>
+#include <map>
 
+class MeshRenderer;
 class Renderer;
 
 /// Holds scene Objects. In general, plugins will add objects during their lifetime,
@@ -38,9 +41,13 @@ public:
 		float scale, float directionalLightIntensity, float spotLightIntensity, float pointLightIntensity);
 
 
+	/// Renders the scene from camera. Uses the render list culled for the camera in PreFrame() if there is one for this frame and pass,
+	/// otherwise culls and sorts the scene serially
 	ENGINE_EXPORT void Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* framebuffer = nullptr, PassType pass = PASS_MAIN, bool clear = true);
 
 	inline Object* Raycast(const Ray& worldRay, float* t = nullptr, bool any = false, uint32_t mask = 0xFFFFFFFF) { return BVH()->Intersect(worldRay, t, any, mask); }
+	/// Raycasts many rays at once across the instance's thread pool. Returns the number of rays that hit
+	ENGINE_EXPORT uint32_t Raycast(const Ray* worldRays, size_t count, ObjectBvh2::Hit* hits, bool any = false, uint32_t mask = 0xFFFFFFFF);
 
 	/// Buffer of GPULight structs (defined in shadercompat.h)
 	inline Buffer* LightBuffer() const { return mLightBuffers[mInstance->Device()->FrameContextIndex()]; }
@@ -63,31 +70,171 @@ public:
 	inline void DrawGizmos(bool g) { mDrawGizmos = g; }
 	inline bool DrawGizmos() const { return mDrawGizmos; }
 
+	/// When enabled, opaque MeshRenderers are kept resident on the GPU, frustum culled per camera in a compute shader and drawn with one
+	/// multi-draw indirect call per material and set of mesh buffers, instead of being culled, sorted and batched on the CPU.
+	/// Other renderers still go through the CPU path
+	inline void GpuDriven(bool g) { mGpuDriven = g; }
+	inline bool GpuDriven() const { return mGpuDriven; }
+
+	/// Lights are assigned to a froxel grid for every camera rendered in PASS_MAIN, and shaders only evaluate the lights in
+	/// their fragment's cluster. When enabled the clusters are built in a compute shader, otherwise on the CPU across the thread pool
+	inline void GpuLightClusters(bool g) { mGpuLightClusters = g; }
+	inline bool GpuLightClusters() const { return mGpuLightClusters; }
+
 	ENGINE_EXPORT ObjectBvh2* BVH();
-	inline void BvhDirty(Object* reason) { mBvhDirty = true; }
-	// frame id of the last bvh build
+	inline void BvhDirty(Object* reason) { mBvhDirty = true; mSceneVersion++; }
+	// frame id of the last bvh build or refit
 	inline uint64_t LastBvhBuild() { return mLastBvhBuild; }
 
 private:
+	struct RenderKey {
+		uint64_t mKey;
+		Object* mObject;
+	};
+	struct RenderList {
+		std::vector<Object*> mObjects;
+		// scratch space used to sort mObjects
+		std::vector<RenderKey> mKeys[2];
+		PassType mPass;
+		// frame id the list was culled in
+		uint64_t mFrame;
+	};
+
+	struct GpuDraw {
+		// the first renderer of the draw, which binds the material and mesh that every renderer in the draw shares
+		MeshRenderer* mRenderer;
+		// the draw's instances start at mInstanceBase in the scene's instance buffer, and in each camera's culled instance buffer
+		uint32_t mInstanceBase;
+		uint32_t mInstanceCount;
+		// union of the layer masks of the draw's renderers
+		uint32_t mMask;
+	};
+	struct GpuBatch {
+		// the first renderer of the batch, every draw in the batch shares its material and mesh buffers
+		MeshRenderer* mRenderer;
+		// the batch's draws are consecutive in mGpuDraws
+		uint32_t mFirstDraw;
+		uint32_t mDrawCount;
+		// union of the layer masks of the batch's draws
+		uint32_t mMask;
+	};
+	struct CpuRenderer {
+		Renderer* mRenderer;
+		AABB mBounds;
+		uint32_t mMask;
+	};
+	// what the GPU scene was built from for a renderer, the GPU scene is rebuilt when it changes
+	struct GpuRendererState {
+		Renderer* mRenderer;
+		MeshRenderer* mMeshRenderer;
+		::Material* mMaterial;
+		::Mesh* mMesh;
+		uint32_t mMask;
+		bool mVisible;
+	};
+	struct ShadowTile {
+		ShadowAtlas::Tile mTile;
+		// resolution the tile was requested with, the atlas rounds it to a power of two and gives out smaller tiles when it's full
+		uint32_t mResolution;
+		// hash of the shadow camera and everything it rendered the last time the tile was rendered
+		size_t mKey;
+		// bit i is set when the tile is up to date in frame context i's copy of the atlas
+		uint32_t mValidFrameContexts;
+		bool mUsed;
+	};
+	struct ShadowRequest {
+		Light* mLight;
+		uint32_t mCascade;
+		// index of the GPULight that samples the shadow
+		uint32_t mLightIndex;
+		bool mOrtho;
+		float mSize;
+		float3 mPosition;
+		quaternion mRotation;
+		float mNear;
+		float mFar;
+		uint32_t mResolution;
+		ShadowTile* mTile;
+	};
+	struct LightClusterData {
+		// GPULightClusters and light indices of a camera, built in BuildLightClusters() in the frame the camera is rendered
+		Device::TempRange mClusters;
+		Device::TempRange mIndices;
+	};
+	struct GpuDrawList {
+		// GPUDrawCommands at offset 0, followed by the batches' draw counts and the culled instances
+		Buffer* mBuffer;
+		VkDeviceSize mCountOffset;
+		VkDeviceSize mInstanceOffset;
+		VkDeviceSize mInstanceSize;
+	};
+
 	friend class Stratum;
 	ENGINE_EXPORT void Update();
 	ENGINE_EXPORT void PreFrame(CommandBuffer* commandBuffer);
 	ENGINE_EXPORT Scene(::Instance* instance, ::AssetManager* assetManager, ::InputManager* inputManager, ::PluginManager* pluginManager);
 	
-	/// Used in PreFrame() to add a shadow camera to mShadowCameras
-	ENGINE_EXPORT void AddShadowCamera(uint32_t si, ShadowData* sd, bool ortho, float size, const float3& pos, const quaternion& rot, float near, float far);
+	/// Used in PreFrame() to add a shadow camera to mShadowCameras that renders into tile of the shadow atlas
+	ENGINE_EXPORT void AddShadowCamera(uint32_t si, ShadowData* sd, bool ortho, float size, const float3& pos, const quaternion& rot, float near, float far, const ShadowAtlas::Tile& tile);
+	/// Used in PreFrame() to give every shadow request a tile of the atlas, reusing the tiles of the last frame where the
+	/// resolution still matches. Requests that don't fit have mTile set to nullptr
+	ENGINE_EXPORT void AllocateShadowTiles(std::vector<ShadowRequest>& requests);
+	/// Hash of a shadow camera and the casters culled for it, a tile whose key is unchanged doesn't need to be rendered again
+	ENGINE_EXPORT size_t ShadowKey(const ShadowRequest& request, Camera* camera);
+
+	/// Used in PreFrame() to cull and sort the render lists of the first shadowCameraCount shadow cameras and every enabled camera across the thread pool
+	ENGINE_EXPORT void CullCameras(uint32_t shadowCameraCount);
+	/// Sorts a gathered render list by render queue, material, mesh and then front-to-back by distance from the camera
+	ENGINE_EXPORT static void SortRenderList(RenderList& list, const float3& cameraPosition, float cameraFar);
 
 	ENGINE_EXPORT void Render(CommandBuffer* commandBuffer, Camera* camera, Framebuffer* framebuffer, PassType pass, bool clear, std::vector<Object*>& renderList);
+	/// Records draws for objects, batching consecutive MeshRenderers that share a mesh and material into instanced draws
+	ENGINE_EXPORT void RecordRenderList(CommandBuffer* commandBuffer, Camera* camera, PassType pass, Object* const* objects, size_t count);
+	/// Splits renderList into chunks recorded into secondary command buffers across the thread pool, and executes them in order
+	ENGINE_EXPORT void RecordRenderListParallel(CommandBuffer* commandBuffer, Camera* camera, PassType pass, const std::vector<Object*>& renderList);
+	/// Writes a PER_OBJECT descriptor set that binds the instance slots, rangeSize bytes of slot indices at a dynamic offset,
+	/// and the lighting buffers for PASS_MAIN
+	ENGINE_EXPORT DescriptorSet* CreateInstanceDescriptorSet(Device* device, GraphicsShader* shader, Camera* camera, PassType pass, Buffer* indices, VkDeviceSize rangeSize);
+	/// Used in PreFrame() to copy the transforms of MeshRenderers that moved into their slots in mInstanceSlots, growing it if needed.
+	/// Must be recorded outside of a render pass
+	ENGINE_EXPORT void UpdateInstanceSlots(CommandBuffer* commandBuffer);
+
+	/// Used in PreFrame() to rebuild the GPU scene when renderers were added, removed, shown, hidden or changed their material,
+	/// mesh or layers, and otherwise to upload the bounds of the GPU-driven renderers that moved. Must be recorded outside of a render pass
+	ENGINE_EXPORT void UpdateGpuScene(CommandBuffer* commandBuffer);
+	/// Groups the renderers that can be GPU-driven into mGpuDraws and mGpuBatches and uploads their instances, bounds and draw commands,
+	/// and resolves the bounds of the remaining renderers into mCpuRenderers
+	ENGINE_EXPORT void BuildGpuScene(CommandBuffer* commandBuffer);
+	/// Used in place of the BVH when the scene is GPU-driven, only objects in mCpuRenderers are culled on the CPU
+	ENGINE_EXPORT void CullCpuRenderers(const float4 frustum[6], std::vector<Object*>& objects, uint32_t mask);
+	/// Records the compute dispatch that culls the GPU-driven instances for camera. Must be recorded outside of a render pass.
+	/// Returns false if there is nothing to draw this frame
+	ENGINE_EXPORT bool CullGpuScene(CommandBuffer* commandBuffer, Camera* camera, PassType pass, GpuDrawList& drawList);
+	ENGINE_EXPORT void DrawGpuScene(CommandBuffer* commandBuffer, Camera* camera, PassType pass, const GpuDrawList& drawList);
+
+	/// Assigns the lights gathered in PreFrame() to camera's light clusters, into mLightClusters[camera].
+	/// Must be recorded outside of a render pass
+	ENGINE_EXPORT void BuildLightClusters(CommandBuffer* commandBuffer, Camera* camera);
+	/// The CPU reference path of lightcluster.hlsl, writes the same clusters with their light lists packed together.
+	/// Lights left out of full clusters are added to overflow
+	ENGINE_EXPORT void BuildLightClustersCpu(Device* device, const GPULightClusterCamera& camera, const GPULight* lights, LightClusterData& clusters, uint32_t& overflow);
 
 	Mesh* mSkyboxCube;
 
 	ObjectBvh2* mBvh;
 	uint64_t mLastBvhBuild;
 	bool mBvhDirty;
+	// set when objects are added or removed, forcing a full rebuild instead of a refit
+	bool mBvhRebuild;
 
 	float2 mShadowTexelSize;
 
+	// number of shadow tiles rendered this frame, the rest were cached
 	uint32_t mShadowCount;
+	ShadowAtlas* mShadowAtlas;
+	std::map<std::pair<Light*, uint32_t>, ShadowTile> mShadowTiles;
+	// incremented whenever an object in the BVH moves, and when objects are added or removed
+	uint64_t mSceneVersion;
 
 	Buffer** mLightBuffers;
 	Buffer** mShadowBuffers;
@@ -97,6 +244,17 @@ private:
 	Texture** mShadowAtlases;
 
 	std::vector<Light*> mActiveLights;
+	// number of GPULights written to the light buffer this frame
+	uint32_t mGpuLightCount;
+
+	bool mGpuLightClusters;
+	Shader* mLightClusterShader;
+	// light clusters of every camera rendered in PASS_MAIN, cameras are rendered one after another but their draws can be
+	// recorded on other threads
+	std::unordered_map<Camera*, LightClusterData> mLightClusters;
+	// one uint per frame context, the number of lights left out of full clusters in the frame context's last frame
+	Buffer** mLightOverflowBuffers;
+	bool mLightOverflowReported;
 
 	::AssetManager* mAssetManager;
 	::Instance* mInstance;
@@ -107,6 +265,36 @@ private:
 	std::vector<Light*> mLights;
 	std::vector<Camera*> mCameras;
 	std::vector<Renderer*> mRenderers;
-	std::vector<Object*> mRenderList;
+	RenderList mRenderList;
+
+	// an InstanceBuffer for every MeshRenderer in the scene, which draws reference by slot index
+	Buffer* mInstanceSlots;
+	uint32_t mInstanceSlotCount;
+	std::vector<uint32_t> mFreeInstanceSlots;
+	// slot and GPU scene buffers that were outgrown, and the frame they were replaced in
+	std::vector<std::pair<Buffer*, uint64_t>> mRetiredInstanceSlots;
+	// MeshRenderers whose slot UpdateInstanceSlots() uploaded this frame
+	std::vector<MeshRenderer*> mMovedRenderers;
+	std::unordered_map<Camera*, RenderList> mRenderLists;
 	bool mDrawGizmos;
+
+	bool mGpuDriven;
+	Shader* mCullShader;
+	// frame id the GPU scene below was last updated in
+	uint64_t mGpuSceneFrame;
+	// set when objects are added or removed, so the GPU scene is rebuilt
+	bool mGpuSceneDirty;
+	std::vector<GpuDraw> mGpuDraws;
+	std::vector<GpuBatch> mGpuBatches;
+	std::vector<CpuRenderer> mCpuRenderers;
+	// one per renderer in mRenderers, in the same order
+	std::vector<GpuRendererState> mGpuRendererStates;
+	// resident instance slot indices and GPUInstanceBounds of every GPU-driven renderer, and the GPUDrawCommands of every draw
+	// with an instance count of 0, which each camera's culling copies and fills in
+	Buffer* mGpuInstances;
+	Buffer* mGpuBounds;
+	Buffer* mGpuDrawCommands;
+	// copy of mGpuBounds, so moved renderers only upload their own bounds
+	std::vector<GPUInstanceBounds> mGpuBoundsData;
+	uint32_t mGpuInstanceCount;
 };
\ No newline at end of file
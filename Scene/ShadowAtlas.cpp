@@ -0,0 +1,70 @@
+#include <Scene/ShadowAtlas.hpp>
+
+using namespace std;
+
+inline uint32_t PackTile(uint32_t x, uint32_t y) { return x | (y << 16); }
+
+ShadowAtlas::ShadowAtlas(uint32_t resolution, uint32_t minTileSize) : mResolution(resolution), mMinTileSize(minTileSize) {
+	uint32_t levels = 1;
+	while ((mResolution >> (levels - 1)) > mMinTileSize) levels++;
+	mFreeLists.resize(levels);
+	mFreeLists[0].insert(PackTile(0, 0));
+}
+
+bool ShadowAtlas::AllocateLevel(uint32_t level, Tile& tile) {
+	// find the smallest free tile that fits, then split it down to the requested level
+	int32_t l = (int32_t)level;
+	while (l >= 0 && mFreeLists[l].empty()) l--;
+	if (l < 0) return false;
+
+	// taking the lowest packed coordinate keeps tiles packed towards the top of the atlas
+	uint32_t packed = *mFreeLists[l].begin();
+	mFreeLists[l].erase(mFreeLists[l].begin());
+	uint32_t x = packed & 0xFFFF;
+	uint32_t y = packed >> 16;
+	while ((uint32_t)l < level) {
+		l++;
+		uint32_t s = mResolution >> l;
+		mFreeLists[l].insert(PackTile(x + s, y));
+		mFreeLists[l].insert(PackTile(x, y + s));
+		mFreeLists[l].insert(PackTile(x + s, y + s));
+	}
+
+	tile.mX = x;
+	tile.mY = y;
+	tile.mSize = mResolution >> level;
+	return true;
+}
+
+bool ShadowAtlas::Allocate(uint32_t size, Tile& tile) {
+	uint32_t level = 0;
+	while (level + 1 < mFreeLists.size() && (mResolution >> (level + 1)) >= size) level++;
+	for (int32_t l = (int32_t)level; l < (int32_t)mFreeLists.size(); l++)
+		if (AllocateLevel((uint32_t)l, tile)) return true;
+	return false;
+}
+
+void ShadowAtlas::Free(const Tile& tile) {
+	uint32_t level = 0;
+	while ((mResolution >> level) > tile.mSize) level++;
+
+	// merge with the three sibling tiles for as long as they are all free
+	uint32_t x = tile.mX;
+	uint32_t y = tile.mY;
+	while (level > 0) {
+		uint32_t s = mResolution >> level;
+		uint32_t px = x & ~(2 * s - 1);
+		uint32_t py = y & ~(2 * s - 1);
+		uint32_t siblings[4] = { PackTile(px, py), PackTile(px + s, py), PackTile(px, py + s), PackTile(px + s, py + s) };
+		bool free = true;
+		for (uint32_t i = 0; i < 4 && free; i++)
+			if (siblings[i] != PackTile(x, y) && !mFreeLists[level].count(siblings[i])) free = false;
+		if (!free) break;
+		for (uint32_t i = 0; i < 4; i++)
+			mFreeLists[level].erase(siblings[i]);
+		x = px;
+		y = py;
+		level--;
+	}
+	mFreeLists[level].insert(PackTile(x, y));
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <set>
+
+#include <Util/Util.hpp>
+
+/// Allocates square, power of two tiles of a shadow atlas as a quadtree: each level splits the tiles of the level above
+/// into four, and freed tiles merge back with their siblings. Not thread safe
+class ShadowAtlas {
+public:
+	struct Tile {
+		uint32_t mX;
+		uint32_t mY;
+		uint32_t mSize;
+	};
+
+	/// resolution and minTileSize must be powers of two
+	ENGINE_EXPORT ShadowAtlas(uint32_t resolution, uint32_t minTileSize);
+
+	/// Allocates a tile of at least size, or the largest smaller tile that fits down to the minimum tile size.
+	/// Returns false if the atlas is full
+	ENGINE_EXPORT bool Allocate(uint32_t size, Tile& tile);
+	ENGINE_EXPORT void Free(const Tile& tile);
+
+	inline uint32_t Resolution() const { return mResolution; }
+	inline uint32_t MinTileSize() const { return mMinTileSize; }
+
+private:
+	ENGINE_EXPORT bool AllocateLevel(uint32_t level, Tile& tile);
+
+	uint32_t mResolution;
+	uint32_t mMinTileSize;
+	// x | y << 16 of the free tiles of each level, level 0 is the whole atlas
+	std::vector<std::set<uint32_t>> mFreeLists;
+};
\ No newline at end of file
@@ -94,8 +94,8 @@ void SkinnedMeshRenderer::PreFrame(CommandBuffer* commandBuffer) {
 	// Skeleton
 	if (mRig.size()) {
 		// bind space -> object space
-		Buffer* poseBuffer = commandBuffer->Device()->GetTempBuffer(mName + " Pose", mRig.size() * sizeof(float4x4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
-		float4x4* skin = (float4x4*)poseBuffer->MappedData();
+		Device::TempRange pose = commandBuffer->Device()->AllocateTemp(mRig.size() * sizeof(float4x4));
+		float4x4* skin = (float4x4*)pose.mData;
 		for (uint32_t i = 0; i < mRig.size(); i++)
 			skin[i] = (WorldToObject() * mRig[i]->ObjectToWorld()) * mRig[i]->mInverseBind; // * vertex;
 
@@ -105,7 +105,7 @@ void SkinnedMeshRenderer::PreFrame(CommandBuffer* commandBuffer) {
 		DescriptorSet* ds = commandBuffer->Device()->GetTempDescriptorSet("Skinning", s->mDescriptorSetLayouts[0]);
 		ds->CreateStorageBufferDescriptor(mVertexBuffer,		   0, mVertexBuffer->Size(),     s->mDescriptorBindings.at("Vertices").second.binding);
 		ds->CreateStorageBufferDescriptor(m->WeightBuffer().get(), 0, m->WeightBuffer()->Size(), s->mDescriptorBindings.at("Weights").second.binding);
-		ds->CreateStorageBufferDescriptor(poseBuffer, 0, poseBuffer->Size(), s->mDescriptorBindings.at("Pose").second.binding);
+		ds->CreateStorageBufferDescriptor(pose.mBuffer, pose.mOffset, pose.mSize, s->mDescriptorBindings.at("Pose").second.binding);
 		ds->FlushWrites();
 		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, s->mPipelineLayout, 0, 1, *ds, 0, nullptr);
 
@@ -123,7 +123,7 @@ void SkinnedMeshRenderer::PreFrame(CommandBuffer* commandBuffer) {
 		0, 0, nullptr, 1, &barrier, 0, nullptr);
 }
 
-void SkinnedMeshRenderer::DrawInstanced(CommandBuffer* commandBuffer, Camera* camera, uint32_t instanceCount, VkDescriptorSet instanceDS, PassType pass) {
+void SkinnedMeshRenderer::DrawInstanced(CommandBuffer* commandBuffer, Camera* camera, uint32_t instanceCount, VkDescriptorSet instanceDS, uint32_t instanceOffset, PassType pass) {
 	::Mesh* mesh = MeshRenderer::Mesh();
 
 	VkCullModeFlags cull = (pass == PASS_DEPTH) ? VK_CULL_MODE_NONE : VK_CULL_MODE_FLAG_BITS_MAX_ENUM;
@@ -144,7 +144,7 @@ void SkinnedMeshRenderer::DrawInstanced(CommandBuffer* commandBuffer, Camera* ca
 		commandBuffer->PushConstant(shader, kp.first, &kp.second);
 	
 	if (instanceDS != VK_NULL_HANDLE)
-		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, &instanceDS, 0, nullptr);
+		vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, PER_OBJECT, 1, &instanceDS, 1, &instanceOffset);
 
 	commandBuffer->BindVertexBuffer(mVertexBuffer, 0, 0);
 	commandBuffer->BindIndexBuffer(mesh->IndexBuffer().get(), 0, mesh->IndexType());
@@ -152,7 +152,7 @@ void SkinnedMeshRenderer::DrawInstanced(CommandBuffer* commandBuffer, Camera* ca
 	vkCmdDrawIndexed(*commandBuffer, mesh->IndexCount(), instanceCount, mesh->BaseIndex(), mesh->BaseVertex(), 0);
 	commandBuffer->mTriangleCount += instanceCount * (mesh->IndexCount() / 3);
 
-	if (camera->StereoMode() != STEREO_NONE) {
+	if (camera->StereoMode() != STEREO_NONE && !camera->Multiview()) {
 		camera->SetStereo(commandBuffer, shader, EYE_RIGHT);
 		vkCmdDrawIndexed(*commandBuffer, mesh->IndexCount(), instanceCount, mesh->BaseIndex(), mesh->BaseVertex(), 0);
 		commandBuffer->mTriangleCount += instanceCount * (mesh->IndexCount() / 3);
@@ -16,7 +16,10 @@ public:
 	ENGINE_EXPORT virtual Bone* GetBone(const std::string& name) const;
 
 	ENGINE_EXPORT virtual void PreFrame(CommandBuffer* commandBuffer) override;
-	ENGINE_EXPORT virtual void DrawInstanced(CommandBuffer* commandBuffer, Camera* camera, uint32_t instanceCount, VkDescriptorSet instanceDS, PassType pass) override;
+	ENGINE_EXPORT virtual void DrawInstanced(CommandBuffer* commandBuffer, Camera* camera, uint32_t instanceCount, VkDescriptorSet instanceDS, uint32_t instanceOffset, PassType pass) override;
+	// skinned vertices are written to a per-renderer vertex buffer, which instanced draws can't share
+	inline virtual bool GpuDrivable() override { return false; }
+	inline virtual bool Deforming() override { return true; }
 
 	ENGINE_EXPORT bool Intersect(const Ray& ray, float* t, bool any) override;
 	ENGINE_EXPORT virtual void DrawGizmos(CommandBuffer* commandBuffer, Camera* camera) override;
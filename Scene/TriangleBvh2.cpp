@@ -1,58 +1,147 @@
 #include <Scene/TriangleBvh2.hpp>
 
-#include <Scene/Scene.hpp>
+#include <Util/ThreadPool.hpp>
 
 using namespace std;
 
-void TriangleBvh2::Build(void* vertices, uint32_t vertexCount, size_t vertexStride, void* indices, uint32_t indexCount, VkIndexType indexType) {
-	mTriangles.clear();
-	mNodes.clear();
+#define BVH_SAH_BIN_COUNT 16u
+// relative cost of traversing a node vs. intersecting a triangle
+#define BVH_SAH_TRAVERSAL_COST .5f
+// ranges larger than this are binned across the thread pool, and are never built as a single subtree task
+#define BVH_PARALLEL_THRESHOLD 16384u
+// number of rays per IntersectBatch task
+#define BVH_BATCH_SIZE 256
+
+struct Bin {
+	AABB mBounds;
+	uint32_t mCount;
+};
+static const AABB EmptyAABB(float3(1e30f), float3(-1e30f));
+
+inline uint32_t BinIndex(float c, float mn, float scale) {
+	return min(BVH_SAH_BIN_COUNT - 1, (uint32_t)((c - mn) * scale));
+}
+void BinRange(const vector<AABB>& aabbs, const vector<float3>& centroids, uint32_t start, uint32_t end, const AABB& bc, const float3& scale, Bin bins[3][BVH_SAH_BIN_COUNT]) {
+	for (uint32_t axis = 0; axis < 3; axis++)
+		for (uint32_t b = 0; b < BVH_SAH_BIN_COUNT; b++) {
+			bins[axis][b].mBounds = EmptyAABB;
+			bins[axis][b].mCount = 0;
+		}
+	for (uint32_t i = start; i < end; i++)
+		for (uint32_t axis = 0; axis < 3; axis++) {
+			if (scale[axis] <= 0) continue;
+			Bin& bin = bins[axis][BinIndex(centroids[i][axis], bc.mMin[axis], scale[axis])];
+			bin.mBounds.Encapsulate(aabbs[i]);
+			bin.mCount++;
+		}
+}
+void RangeBounds(const vector<AABB>& aabbs, const vector<float3>& centroids, uint32_t start, uint32_t end, AABB& bb, AABB& bc) {
+	bb = aabbs[start];
+	bc = AABB(centroids[start], centroids[start]);
+	for (uint32_t p = start + 1; p < end; ++p) {
+		bb.Encapsulate(aabbs[p]);
+		bc.Encapsulate(centroids[p]);
+	}
+}
 
-	mVertices.resize(vertexCount);
+uint32_t TriangleBvh2::Split(uint32_t start, uint32_t end, const AABB& bc, vector<AABB>& aabbs, vector<float3>& centroids, ThreadPool* threadPool) {
+	uint32_t nPrims = end - start;
+	float3 ext = bc.mMax - bc.mMin;
+	float3 scale;
+	for (uint32_t axis = 0; axis < 3; axis++)
+		scale[axis] = ext[axis] > 0 ? BVH_SAH_BIN_COUNT / ext[axis] : 0;
+
+	Bin bins[3][BVH_SAH_BIN_COUNT];
+	if (threadPool && nPrims > BVH_PARALLEL_THRESHOLD) {
+		// bin chunks of the range in parallel, then merge
+		uint32_t chunkCount = (nPrims + BVH_PARALLEL_THRESHOLD - 1) / BVH_PARALLEL_THRESHOLD;
+		vector<Bin> chunkBins(chunkCount * 3 * BVH_SAH_BIN_COUNT);
+		threadPool->ParallelFor(chunkCount, [&](uint32_t c) {
+			uint32_t cs = start + c * BVH_PARALLEL_THRESHOLD;
+			BinRange(aabbs, centroids, cs, min(cs + BVH_PARALLEL_THRESHOLD, end), bc, scale, (Bin(*)[BVH_SAH_BIN_COUNT])&chunkBins[c * 3 * BVH_SAH_BIN_COUNT]);
+		});
+		memcpy(bins, chunkBins.data(), sizeof(bins));
+		for (uint32_t c = 1; c < chunkCount; c++)
+			for (uint32_t b = 0; b < 3 * BVH_SAH_BIN_COUNT; b++) {
+				const Bin& src = chunkBins[c * 3 * BVH_SAH_BIN_COUNT + b];
+				Bin& dst = bins[b / BVH_SAH_BIN_COUNT][b % BVH_SAH_BIN_COUNT];
+				dst.mBounds.Encapsulate(src.mBounds);
+				dst.mCount += src.mCount;
+			}
+	} else
+		BinRange(aabbs, centroids, start, end, bc, scale, bins);
+
+	// sweep right to left, then left to right to evaluate every bin boundary
+	uint32_t splitDim = 0;
+	uint32_t splitBin = 0;
+	float splitCost = 1e30f;
+	float rightCost[BVH_SAH_BIN_COUNT];
+	for (uint32_t axis = 0; axis < 3; axis++) {
+		if (scale[axis] <= 0) continue;
+		AABB acc = EmptyAABB;
+		uint32_t count = 0;
+		for (uint32_t b = BVH_SAH_BIN_COUNT - 1; b > 0; b--) {
+			acc.Encapsulate(bins[axis][b].mBounds);
+			count += bins[axis][b].mCount;
+			rightCost[b] = count ? acc.SurfaceArea() * count : 0;
+		}
+		acc = EmptyAABB;
+		count = 0;
+		for (uint32_t b = 1; b < BVH_SAH_BIN_COUNT; b++) {
+			acc.Encapsulate(bins[axis][b - 1].mBounds);
+			count += bins[axis][b - 1].mCount;
+			if (count == 0 || count == nPrims) continue;
+			float cost = acc.SurfaceArea() * count + rightCost[b];
+			if (cost < splitCost) {
+				splitCost = cost;
+				splitDim = axis;
+				splitBin = b;
+			}
+		}
+	}
 
-	vector<AABB> aabbs;
+	// Partition the list of triangles on this split
+	uint32_t mid = start;
+	if (splitBin)
+		for (uint32_t i = start; i < end; ++i)
+			if (BinIndex(centroids[i][splitDim], bc.mMin[splitDim], scale[splitDim]) < splitBin) {
+				swap(mTriangles[i], mTriangles[mid]);
+				swap(aabbs[i], aabbs[mid]);
+				swap(centroids[i], centroids[mid]);
+				mid++;
+			}
 
-	for (uint32_t i = 0; i < vertexCount; i++)
-		mVertices[i] = *(float3*)((uint8_t*)vertices + vertexStride * i);
-
-	uint16_t* indices16 = (uint16_t*)indices;
-	uint32_t* indices32 = (uint32_t*)indices;
-
-	for (uint32_t i = 0; i < indexCount; i += 3) {
-		uint3 tri = indexType == VK_INDEX_TYPE_UINT16 ?
-			uint3(indices16[i], indices16[i+1], indices16[i+2]) :
-			uint3(indices32[i], indices32[i+1], indices32[i+2]);
-		mTriangles.push_back(tri);
-		float3 v0 = mVertices[tri.x];
-		float3 v1 = mVertices[tri.y];
-		float3 v2 = mVertices[tri.z];
-		aabbs.push_back(AABB(min(min(v0, v1), v2) - 1e-3f, max(max(v0, v1), v2) + 1e-3f));
-	}
+	// If we get a bad split, just choose the center...
+	if (mid == start || mid == end)
+		mid = start + (end - start) / 2;
+	return mid;
+}
 
+void TriangleBvh2::BuildRange(uint32_t start, uint32_t end, vector<AABB>& aabbs, vector<float3>& centroids, vector<Node>& nodes) {
 	struct BuildTask {
 		uint32_t mParentOffset;
 		uint32_t mStart;
 		uint32_t mEnd;
 	};
 
-	BuildTask todo[1024];
+	// grows with the depth of the tree, which a run of lopsided splits can take past any fixed size
+	vector<BuildTask> todo(64);
 	uint32_t stackptr = 0;
 	const uint32_t untouched = 0xffffffff;
 	const uint32_t touchedTwice = 0xfffffffd;
 
 	uint32_t nNodes = 0;
-	uint32_t nLeafs = 0;
 
 	Node node;
 
-	todo[stackptr].mStart = 0;
-	todo[stackptr].mEnd = mTriangles.size();
+	todo[stackptr].mStart = start;
+	todo[stackptr].mEnd = end;
 	todo[stackptr].mParentOffset = 0xfffffffc;
 	stackptr++;
 
 	while (stackptr > 0) {
 		// Pop the next item off of the stack
-		BuildTask& bnode(todo[--stackptr]);
+		BuildTask bnode = todo[--stackptr];
 		uint32_t start = bnode.mStart;
 		uint32_t end = bnode.mEnd;
 		uint32_t nPrims = end - start;
@@ -63,63 +152,34 @@ void TriangleBvh2::Build(void* vertices, uint32_t vertexCount, size_t vertexStri
 		node.mRightOffset = untouched;
 
 		// Calculate the bounding box for this node
-		AABB bb(aabbs[start]);
-		AABB bc(aabbs[start].Center(), aabbs[start].Center());
-		for (uint32_t p = start + 1; p < end; ++p) {
-			bb.Encapsulate(aabbs[p]);
-			bc.Encapsulate(aabbs[p].Center());
-		}
-		node.mBounds = bb;
+		AABB bc;
+		RangeBounds(aabbs, centroids, start, end, node.mBounds, bc);
 
 		// If the number of primitives at this point is less than the leaf
 		// size, then this will become a leaf. (Signified by rightOffset == 0)
-		if (nPrims <= mLeafSize) {
+		if (nPrims <= mLeafSize)
 			node.mRightOffset = 0;
-			nLeafs++;
-		}
 
-		mNodes.push_back(node);
+		nodes.push_back(node);
 
 		// Child touches parent...
 		// Special case: Don't do this for the root.
 		if (bnode.mParentOffset != 0xfffffffc) {
-			mNodes[bnode.mParentOffset].mRightOffset--;
+			nodes[bnode.mParentOffset].mRightOffset--;
 
 			// When this is the second touch, this is the right child.
 			// The right child sets up the offset for the flat tree.
-			if (mNodes[bnode.mParentOffset].mRightOffset == touchedTwice) {
-				mNodes[bnode.mParentOffset].mRightOffset = nNodes - 1 - bnode.mParentOffset;
+			if (nodes[bnode.mParentOffset].mRightOffset == touchedTwice) {
+				nodes[bnode.mParentOffset].mRightOffset = nNodes - 1 - bnode.mParentOffset;
 			}
 		}
 
 		// If this is a leaf, no need to subdivide.
 		if (node.mRightOffset == 0) continue;
 
-		// Set the split dimensions
-		uint32_t split_dim = 0;
-		float3 ext = bc.Extents();
-		if (ext.y > ext.x) {
-			split_dim = 1;
-			if (ext.z > ext.y) split_dim = 2;
-		} else
-			if (ext.z > ext.x) split_dim = 2;
-
-		// Split on the center of the longest axis
-		float split_coord = .5f * (bc.mMin[split_dim] + bc.mMax[split_dim]);
-
-		// Partition the list of objects on this split
-		uint32_t mid = start;
-		for (uint32_t i = start; i < end; ++i)
-			if (aabbs[i].Center()[split_dim] < split_coord) {
-				swap(mTriangles[i], mTriangles[mid]);
-				swap(aabbs[i], aabbs[mid]);
-				mid++;
-			}
-
-		// If we get a bad split, just choose the center...
-		if (mid == start || mid == end)
-			mid = start + (end - start) / 2;
+		uint32_t mid = Split(start, end, bc, aabbs, centroids, nullptr);
 
+		if (stackptr + 2 > todo.size()) todo.resize(2 * todo.size());
 		todo[stackptr].mStart = mid;
 		todo[stackptr].mEnd = end;
 		todo[stackptr].mParentOffset = nNodes - 1;
@@ -131,14 +191,201 @@ void TriangleBvh2::Build(void* vertices, uint32_t vertexCount, size_t vertexStri
 	}
 }
 
-bool TriangleBvh2::Intersect(const Ray& ray, float* t, bool any) {
-	if (mNodes.size() == 0) return false;
+void TriangleBvh2::Build(void* vertices, uint32_t vertexCount, size_t vertexStride, void* indices, uint32_t indexCount, VkIndexType indexType, ThreadPool* threadPool) {
+	mTriangles.clear();
+	mNodes.clear();
+	mNodes4.clear();
+	mStackSize = 0;
+	mStackSize4 = 0;
+
+	mVertices.resize(vertexCount);
+	mTriangles.resize(indexCount / 3);
+
+	vector<AABB> aabbs(mTriangles.size());
+	vector<float3> centroids(mTriangles.size());
+
+	uint32_t triangleCount = (uint32_t)mTriangles.size();
+	if (threadPool && triangleCount <= BVH_PARALLEL_THRESHOLD) threadPool = nullptr;
+
+	auto copyVertices = [&](uint32_t first, uint32_t last) {
+		for (uint32_t i = first; i < last; i++)
+			mVertices[i] = *(float3*)((uint8_t*)vertices + vertexStride * i);
+	};
+	auto copyTriangles = [&](uint32_t first, uint32_t last) {
+		uint16_t* indices16 = (uint16_t*)indices;
+		uint32_t* indices32 = (uint32_t*)indices;
+		for (uint32_t i = first; i < last; i++) {
+			uint3 tri = indexType == VK_INDEX_TYPE_UINT16 ?
+				uint3(indices16[3*i], indices16[3*i+1], indices16[3*i+2]) :
+				uint3(indices32[3*i], indices32[3*i+1], indices32[3*i+2]);
+			mTriangles[i] = tri;
+			float3 v0 = mVertices[tri.x];
+			float3 v1 = mVertices[tri.y];
+			float3 v2 = mVertices[tri.z];
+			aabbs[i] = AABB(min(min(v0, v1), v2) - 1e-3f, max(max(v0, v1), v2) + 1e-3f);
+			centroids[i] = aabbs[i].Center();
+		}
+	};
+
+	if (threadPool) {
+		threadPool->ParallelFor((vertexCount + BVH_PARALLEL_THRESHOLD - 1) / BVH_PARALLEL_THRESHOLD, [&](uint32_t c) {
+			copyVertices(c * BVH_PARALLEL_THRESHOLD, min((c + 1) * BVH_PARALLEL_THRESHOLD, vertexCount));
+		});
+		threadPool->ParallelFor((triangleCount + BVH_PARALLEL_THRESHOLD - 1) / BVH_PARALLEL_THRESHOLD, [&](uint32_t c) {
+			copyTriangles(c * BVH_PARALLEL_THRESHOLD, min((c + 1) * BVH_PARALLEL_THRESHOLD, triangleCount));
+		});
+	} else {
+		copyVertices(0, vertexCount);
+		copyTriangles(0, triangleCount);
+	}
+
+	if (triangleCount == 0) return;
+
+	mNodes.reserve(2 * triangleCount);
+
+	if (!threadPool) {
+		BuildRange(0, triangleCount, aabbs, centroids, mNodes);
+		#ifdef BVH_SIMD
+		CollapseBvh2(mNodes, 0, mNodes4);
+		mStackSize4 = Bvh4StackSize(mNodes4);
+		#endif
+		mStackSize = Bvh2StackSize(mNodes);
+		return;
+	}
 
-	float ht = 1.e20f;
-	float2 bary = 0;
-	int hitIndex = -1;
+	// Split the top levels on this thread (binning in parallel) until ranges are small enough to be handed out as subtree tasks.
+	// Node offsets are relative, so each subtree can be built into its own array and appended to the final array as-is.
+	struct TopNode {
+		AABB mBounds;
+		uint32_t mStart;
+		uint32_t mEnd;
+		uint32_t mChildren[2];
+		int32_t mSubtree; // index into subtrees, or -1 if this node was split on the top level
+	};
+	struct Subtree {
+		uint32_t mStart;
+		uint32_t mEnd;
+		vector<Node> mNodes;
+	};
+	vector<TopNode> topNodes;
+	vector<Subtree> subtrees;
 
-	uint32_t todo[64];
+	uint32_t subtreeSize = max(BVH_PARALLEL_THRESHOLD, triangleCount / (4 * (threadPool->ThreadCount() + 1)));
+
+	function<uint32_t(uint32_t, uint32_t)> splitTop = [&](uint32_t start, uint32_t end) {
+		uint32_t index = (uint32_t)topNodes.size();
+		topNodes.push_back({ AABB(), start, end, { 0, 0 }, -1 });
+
+		if (end - start <= subtreeSize) {
+			topNodes[index].mSubtree = (int32_t)subtrees.size();
+			subtrees.push_back({ start, end, {} });
+			return index;
+		}
+
+		uint32_t chunkCount = (end - start + BVH_PARALLEL_THRESHOLD - 1) / BVH_PARALLEL_THRESHOLD;
+		vector<pair<AABB, AABB>> chunkBounds(chunkCount);
+		threadPool->ParallelFor(chunkCount, [&](uint32_t c) {
+			uint32_t cs = start + c * BVH_PARALLEL_THRESHOLD;
+			RangeBounds(aabbs, centroids, cs, min(cs + BVH_PARALLEL_THRESHOLD, end), chunkBounds[c].first, chunkBounds[c].second);
+		});
+		AABB bb = chunkBounds[0].first;
+		AABB bc = chunkBounds[0].second;
+		for (uint32_t c = 1; c < chunkCount; c++) {
+			bb.Encapsulate(chunkBounds[c].first);
+			bc.Encapsulate(chunkBounds[c].second);
+		}
+		topNodes[index].mBounds = bb;
+
+		uint32_t mid = Split(start, end, bc, aabbs, centroids, threadPool);
+		uint32_t left = splitTop(start, mid);
+		uint32_t right = splitTop(mid, end);
+		topNodes[index].mChildren[0] = left;
+		topNodes[index].mChildren[1] = right;
+		return index;
+	};
+	splitTop(0, triangleCount);
+
+	threadPool->ParallelFor((uint32_t)subtrees.size(), [&](uint32_t i) {
+		subtrees[i].mNodes.reserve(2 * (subtrees[i].mEnd - subtrees[i].mStart));
+		BuildRange(subtrees[i].mStart, subtrees[i].mEnd, aabbs, centroids, subtrees[i].mNodes);
+	});
+
+	// Emit the top nodes depth-first, appending subtrees in place
+	function<void(uint32_t)> emit = [&](uint32_t index) {
+		const TopNode& tn = topNodes[index];
+		if (tn.mSubtree >= 0) {
+			vector<Node>& nodes = subtrees[tn.mSubtree].mNodes;
+			mNodes.insert(mNodes.end(), nodes.begin(), nodes.end());
+			return;
+		}
+		uint32_t ni = (uint32_t)mNodes.size();
+		// the right child's offset is known once the left subtree is emitted
+		mNodes.push_back({ tn.mBounds, tn.mStart, tn.mEnd - tn.mStart, 0 });
+		emit(tn.mChildren[0]);
+		mNodes[ni].mRightOffset = (uint32_t)mNodes.size() - ni;
+		emit(tn.mChildren[1]);
+	};
+	emit(0);
+
+	#ifdef BVH_SIMD
+	CollapseBvh2(mNodes, 0, mNodes4);
+	mStackSize4 = Bvh4StackSize(mNodes4);
+	#endif
+	mStackSize = Bvh2StackSize(mNodes);
+}
+
+void TriangleBvh2::Load(const Node* nodes, uint32_t nodeCount, const uint3* triangles, uint32_t triangleCount, const void* vertices, uint32_t vertexCount, size_t vertexStride) {
+	mNodes.assign(nodes, nodes + nodeCount);
+	mTriangles.assign(triangles, triangles + triangleCount);
+	mNodes4.clear();
+	mVertices.resize(vertexCount);
+	for (uint32_t i = 0; i < vertexCount; i++)
+		mVertices[i] = *(const float3*)((const uint8_t*)vertices + vertexStride * i);
+
+	#ifdef BVH_SIMD
+	if (mNodes.size()) CollapseBvh2(mNodes, 0, mNodes4);
+	mStackSize4 = Bvh4StackSize(mNodes4);
+	#endif
+	mStackSize = Bvh2StackSize(mNodes);
+}
+
+float TriangleBvh2::SAHCost() const {
+	if (mNodes.size() == 0) return 0;
+
+	float rootArea = mNodes[0].mBounds.SurfaceArea();
+	if (rootArea <= 0) return 0;
+
+	float cost = 0;
+	for (const Node& node : mNodes)
+		cost += node.mBounds.SurfaceArea() * (node.mRightOffset == 0 ? node.mCount : BVH_SAH_TRAVERSAL_COST);
+	return cost / rootArea;
+}
+
+bool TriangleBvh2::IntersectLeaf(const Node& leaf, const Ray& ray, Hit& hit, bool any) {
+	bool h = false;
+	for (uint32_t o = 0; o < leaf.mCount; ++o) {
+		uint3 tri = mTriangles[leaf.mStartIndex + o];
+		const float3& v0 = mVertices[tri.x];
+		const float3& v1 = mVertices[tri.y];
+		const float3& v2 = mVertices[tri.z];
+
+		float3 tuv;
+		if (!ray.Intersect(v0, v1, v2, &tuv) || tuv.x < 0) continue;
+
+		if (tuv.x < hit.mT) {
+			hit.mT = tuv.x;
+			hit.mBarycentric = float2(tuv.y, tuv.z);
+			hit.mTriangle = leaf.mStartIndex + o;
+			h = true;
+			if (any) return true;
+		}
+	}
+	return h;
+}
+
+bool TriangleBvh2::IntersectScalar(const Ray& ray, Hit& hit, bool any) {
+	BvhStack stack(mStackSize);
+	uint32_t* todo = stack.mData;
 	int stackptr = 0;
 
 	todo[stackptr] = 0;
@@ -150,28 +397,7 @@ bool TriangleBvh2::Intersect(const Ray& ray, float* t, bool any) {
 		const Node& node = mNodes[ni];
 
 		if (node.mRightOffset == 0) {
-			for (uint32_t o = 0; o < node.mCount; ++o) {
-				uint3 tri = mTriangles[node.mStartIndex + o];
-				const float3& v0 = mVertices[tri.x];
-				const float3& v1 = mVertices[tri.y];
-				const float3& v2 = mVertices[tri.z];
-
-				float3 tuv;
-				bool h = ray.Intersect(v0, v1, v2, &tuv);
-
-				if (!h || tuv.x < 0) continue;
-
-				if (tuv.x < ht) {
-					ht = tuv.x;
-					bary.x = tuv.y;
-					bary.y = tuv.z;
-					hitIndex = node.mStartIndex + o;
-					if (any) {
-						if (t) *t = ht;
-						return hitIndex;
-					}
-				}
-			}
+			if (IntersectLeaf(node, ray, hit, any) && any) return true;
 		} else {
 			uint32_t n0 = ni + 1;
 			uint32_t n1 = ni + node.mRightOffset;
@@ -192,6 +418,84 @@ bool TriangleBvh2::Intersect(const Ray& ray, float* t, bool any) {
 		}
 	}
 
-	if (t) *t = ht;
-	return hitIndex;
-}
\ No newline at end of file
+	return hit.mTriangle != 0xFFFFFFFF;
+}
+
+#ifdef BVH_SIMD
+bool TriangleBvh2::IntersectWide(const Ray& ray, Hit& hit, bool any) {
+	Bvh4Ray ray4(ray);
+
+	BvhStack stack(mStackSize4);
+	uint32_t* todo = stack.mData;
+	int stackptr = 0;
+
+	todo[stackptr] = 0;
+
+	while (stackptr >= 0) {
+		uint32_t ni = todo[stackptr];
+		stackptr--;
+
+		if (ni & BVH4_LEAF_BIT) {
+			if (IntersectLeaf(mNodes[ni & ~BVH4_LEAF_BIT], ray, hit, any) && any) return true;
+			continue;
+		}
+
+		const Bvh4Node& node = mNodes4[ni];
+		float tnear[4];
+		uint32_t mask = IntersectBvh4Node(node, ray4, hit.mT, tnear);
+		PushChildren(node, mask, tnear, todo, stackptr);
+	}
+
+	return hit.mTriangle != 0xFFFFFFFF;
+}
+#endif
+
+bool TriangleBvh2::Intersect(const Ray& ray, float* t, bool any) {
+	if (mNodes.size() == 0) return false;
+
+	Hit hit;
+	hit.mT = 1.e20f;
+	hit.mTriangle = 0xFFFFFFFF;
+	hit.mBarycentric = 0;
+
+	#ifdef BVH_SIMD
+	bool h = mNodes4.size() ? IntersectWide(ray, hit, any) : IntersectScalar(ray, hit, any);
+	#else
+	bool h = IntersectScalar(ray, hit, any);
+	#endif
+
+	if (t) *t = hit.mT;
+	return h;
+}
+
+uint32_t TriangleBvh2::IntersectBatch(const Ray* rays, size_t count, Hit* hits, bool any, ThreadPool* threadPool) {
+	for (size_t i = 0; i < count; i++) {
+		hits[i].mT = 1.e20f;
+		hits[i].mTriangle = 0xFFFFFFFF;
+		hits[i].mBarycentric = 0;
+	}
+	if (mNodes.size() == 0) return 0;
+
+	atomic<uint32_t> hitCount(0);
+	auto intersectRange = [&](size_t first, size_t last) {
+		uint32_t h = 0;
+		for (size_t i = first; i < last; i++) {
+			#ifdef BVH_SIMD
+			bool hit = mNodes4.size() ? IntersectWide(rays[i], hits[i], any) : IntersectScalar(rays[i], hits[i], any);
+			#else
+			bool hit = IntersectScalar(rays[i], hits[i], any);
+			#endif
+			if (hit) h++;
+		}
+		hitCount += h;
+	};
+
+	if (threadPool && count > BVH_BATCH_SIZE)
+		threadPool->ParallelFor((uint32_t)((count + BVH_BATCH_SIZE - 1) / BVH_BATCH_SIZE), [&](uint32_t b) {
+			intersectRange(b * BVH_BATCH_SIZE, min<size_t>((b + 1) * (size_t)BVH_BATCH_SIZE, count));
+		});
+	else
+		intersectRange(0, count);
+
+	return hitCount;
+}
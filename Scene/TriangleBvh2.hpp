@@ -1,7 +1,10 @@
 #pragma once
 
+#include <Scene/Bvh4.hpp>
 #include <Util/Util.hpp>
 
+class ThreadPool;
+
 class TriangleBvh2 {
 public:
 	struct Primitive {
@@ -15,22 +18,52 @@ public:
 		uint32_t mCount;
 		uint32_t mRightOffset; // 1st child is at node[index + 1], 2nd child is at node[index + mRightOffset]
 	};
+	struct Hit {
+		float mT;
+		// index of the triangle that was hit, or 0xFFFFFFFF
+		uint32_t mTriangle;
+		float2 mBarycentric;
+	};
 
-	inline TriangleBvh2(uint32_t leafSize = 4) : mLeafSize(leafSize) {};
+	inline TriangleBvh2(uint32_t leafSize = 4) : mStackSize(0), mStackSize4(0), mLeafSize(leafSize) {};
 	inline ~TriangleBvh2() {}
 
 	const std::vector<Node>& Nodes() const { return mNodes; }
+	const std::vector<uint3>& Triangles() const { return mTriangles; }
 	uint3 GetTriangle(uint32_t index) const { return mTriangles[index]; }
 	uint32_t TriangleCount() const { return mTriangles.size(); }
 
 	inline AABB Bounds() { return mNodes.size() ? mNodes[0].mBounds : AABB(); }
 
-	ENGINE_EXPORT void Build(void* vertices, uint32_t vertexCount, size_t vertexStride, void* indices, uint32_t indexCount, VkIndexType indexType);
+	/// Builds the tree using binned SAH splits. If a thread pool is supplied, large meshes are split across it:
+	/// the top levels are binned in parallel and the remaining subtrees are built concurrently
+	ENGINE_EXPORT void Build(void* vertices, uint32_t vertexCount, size_t vertexStride, void* indices, uint32_t indexCount, VkIndexType indexType, ThreadPool* threadPool = nullptr);
+	/// Restores a tree from the Nodes() and Triangles() of one built over the same vertices, without rebuilding it
+	ENGINE_EXPORT void Load(const Node* nodes, uint32_t nodeCount, const uint3* triangles, uint32_t triangleCount, const void* vertices, uint32_t vertexCount, size_t vertexStride);
+	ENGINE_EXPORT float SAHCost() const;
 
 	ENGINE_EXPORT bool Intersect(const Ray& ray, float* t, bool any);
+	/// Intersects many rays at once, split into groups across the thread pool if one is supplied. Returns the number of rays that hit
+	ENGINE_EXPORT uint32_t IntersectBatch(const Ray* rays, size_t count, Hit* hits, bool any = false, ThreadPool* threadPool = nullptr);
+	/// Traverses the binary tree without SIMD, the reference for the 4-wide traversal Intersect() uses. hit.mT must hold the maximum distance and hit.mTriangle 0xFFFFFFFF
+	ENGINE_EXPORT bool IntersectScalar(const Ray& ray, Hit& hit, bool any);
 
 private:
+	ENGINE_EXPORT void BuildRange(uint32_t start, uint32_t end, std::vector<AABB>& aabbs, std::vector<float3>& centroids, std::vector<Node>& nodes);
+	// Partitions [start, end) on the lowest cost SAH split and returns the index of the first primitive in the second half
+	ENGINE_EXPORT uint32_t Split(uint32_t start, uint32_t end, const AABB& centroidBounds, std::vector<AABB>& aabbs, std::vector<float3>& centroids, ThreadPool* threadPool);
+
+	ENGINE_EXPORT bool IntersectLeaf(const Node& leaf, const Ray& ray, Hit& hit, bool any);
+	#ifdef BVH_SIMD
+	ENGINE_EXPORT bool IntersectWide(const Ray& ray, Hit& hit, bool any);
+	#endif
+
 	std::vector<Node> mNodes;
+	// mNodes collapsed into a 4-wide tree for SIMD traversal
+	std::vector<Bvh4Node> mNodes4;
+	// traversal stack entries needed by mNodes and mNodes4, from Bvh2StackSize and Bvh4StackSize
+	uint32_t mStackSize;
+	uint32_t mStackSize4;
 
 	std::vector<uint3> mTriangles;
 	std::vector<float3> mVertices;
@@ -0,0 +1,35 @@
+#pragma kernel cull
+
+#include <include/shadercompat.h>
+
+[[vk::binding(0, 0)]] RWStructuredBuffer<uint> InstanceSlots				: register(u0);
+[[vk::binding(1, 0)]] RWStructuredBuffer<GPUInstanceBounds> Bounds			: register(u1);
+[[vk::binding(2, 0)]] RWStructuredBuffer<GPUDrawCommand> DrawCommands		: register(u2);
+[[vk::binding(3, 0)]] RWStructuredBuffer<uint> DrawCounts					: register(u3);
+[[vk::binding(4, 0)]] RWStructuredBuffer<uint> CulledInstances			: register(u4);
+
+[[vk::push_constant]] cbuffer PushConstants : register(b0) {
+	float4 Frustum[6];
+	uint InstanceCount;
+	uint PassMask;
+}
+
+[numthreads(64, 1, 1)]
+void cull(uint3 index : SV_DispatchThreadID) {
+	if (index.x >= InstanceCount) return;
+
+	GPUInstanceBounds bounds = Bounds[index.x];
+	if ((bounds.Mask & PassMask) == 0) return;
+
+	// same test as AABB::Intersects
+	float3 center = (bounds.Min + bounds.Max) * .5;
+	float3 extent = (bounds.Max - bounds.Min) * .5;
+	for (uint i = 0; i < 6; i++)
+		if (dot(center, Frustum[i].xyz) - Frustum[i].w <= -dot(extent, abs(Frustum[i].xyz))) return;
+
+	uint slot;
+	InterlockedAdd(DrawCommands[bounds.DrawIndex].InstanceCount, 1, slot);
+	// a batch's count ends at its last visible draw, draws before it that nobody adds an instance to stay at a count of 0
+	if (slot == 0) InterlockedMax(DrawCounts[DrawCommands[bounds.DrawIndex].Batch], DrawCommands[bounds.DrawIndex].BatchOffset + 1);
+	CulledInstances[DrawCommands[bounds.DrawIndex].FirstInstance + slot] = InstanceSlots[index.x];
+}
\ No newline at end of file
@@ -46,7 +46,8 @@ struct v2f {
 #endif
 };
 
-v2f vsmain(uint id : SV_VertexId) {
+v2f vsmain(uint id : SV_VertexId, uint viewIndex : SV_ViewID) {
+	StratumSetViewIndex(viewIndex);
 	uint g = id / 6;
 	uint c = id % 6;
 	
@@ -48,7 +48,9 @@ float3 rotate(float4 q, float3 v){
 v2f vsmain(
 	[[vk::location(0)]] float3 vertex : Position,  
 	[[vk::location(3)]] float2 texcoord : TEXCOORD0,
-	uint i : SV_InstanceID ) {
+	uint i : SV_InstanceID,
+	uint viewIndex : SV_ViewID ) {
+	StratumSetViewIndex(viewIndex);
 	Gizmo g = Gizmos[i];
 
 	float3 worldPos = g.Position + rotate(g.Rotation, vertex * g.Scale);
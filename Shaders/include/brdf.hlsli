@@ -99,6 +99,20 @@ float3 BRDFIndirect(MaterialInfo material, float3 N, float3 V, float nv, float3
 	return material.diffuse * diffuseLight + surfaceReduction * specularLight * FresnelLerp(material.specular, grazingTerm, nv);
 }
 
+#ifdef LIGHT_CLUSTERS
+// index of the light cluster that contains a camera-relative world position, see lightcluster.hlsl
+uint LightClusterIndex(float3 worldPos) {
+	float4 viewPos = mul(STRATUM_MATRIX_V, float4(worldPos, 1));
+	float4 clipPos = mul(STRATUM_MATRIX_P, viewPos);
+	float2 uv = (clipPos.xy / clipPos.w) * .5 + .5;
+	uint2 tile = (uint2)clamp(uv * float2(LIGHT_CLUSTER_X, LIGHT_CLUSTER_Y), 0, float2(LIGHT_CLUSTER_X - 1, LIGHT_CLUSTER_Y - 1));
+	float near = Camera.Viewport.z;
+	float far = Camera.Viewport.w;
+	uint slice = min((uint)(log(max(viewPos.z, near) / near) / log(far / near) * LIGHT_CLUSTER_Z), LIGHT_CLUSTER_Z - 1);
+	return ((STRATUM_EYE * LIGHT_CLUSTER_Z + slice) * LIGHT_CLUSTER_Y + tile.y) * LIGHT_CLUSTER_X + tile.x;
+}
+#endif
+
 float3 EvaluateLighting(MaterialInfo material, float3 worldPos, float3 normal, float3 view, float depth){
 	#ifdef SHOW_CASCADE_SPLITS
 	static const float4 CascadeSplitColors[4] = {
@@ -114,7 +128,14 @@ float3 EvaluateLighting(MaterialInfo material, float3 worldPos, float3 normal, f
 
 	float3 eval = 0;
 
+	#ifdef LIGHT_CLUSTERS
+	// only the lights assigned to this fragment's cluster
+	GPULightCluster cluster = LightClusters[LightClusterIndex(worldPos)];
+	for (uint ci = 0; ci < cluster.Count; ci++) {
+		uint l = LightIndices[cluster.Offset + ci];
+	#else
 	for (uint l = 0; l < LightCount; l++) {
+	#endif
 		float3 L;
 		float attenuation = LightAttenuation(l, Camera.Position, worldPos, normal, depth, L);
 
@@ -12,12 +12,21 @@
 #define LIGHT_BUFFER_BINDING 2
 #define SHADOW_ATLAS_BINDING 3
 #define SHADOW_BUFFER_BINDING 4
+#define LIGHT_CLUSTER_BINDING 5
+#define LIGHT_INDEX_BINDING 6
+#define INSTANCE_INDEX_BINDING 7
 #define BINDING_START 4
 
 #define LIGHT_SUN 0
 #define LIGHT_POINT 1
 #define LIGHT_SPOT 2
 
+// froxel grid that lights are assigned to, per eye. slices are spaced exponentially between the camera's near and far planes
+#define LIGHT_CLUSTER_X 16
+#define LIGHT_CLUSTER_Y 9
+#define LIGHT_CLUSTER_Z 24
+#define LIGHT_CLUSTER_MAX_LIGHTS 128
+
 #define STRATUM_PUSH_CONSTANTS \
 uint StereoEye; \
 float4 StereoClipTransform; \
@@ -25,14 +34,22 @@ float3 AmbientLight; \
 uint LightCount; \
 float2 ShadowTexelSize;
 
-#define STRATUM_MATRIX_V Camera.View[StereoEye]
-#define STRATUM_MATRIX_P Camera.Projection[StereoEye]
-#define STRATUM_MATRIX_VP Camera.ViewProjection[StereoEye]
+#ifndef __cplusplus
+// the multiview view index, entry points that use STRATUM_EYE set it from an SV_ViewID input with StratumSetViewIndex first
+static uint StratumViewIndex = 0;
+#endif
+#define StratumSetViewIndex(viewIndex) StratumViewIndex = viewIndex
+// the eye being rendered: StereoEye when each eye is drawn separately, or the view index when both eyes are drawn in one multiview pass
+#define STRATUM_EYE (StereoEye + StratumViewIndex)
+
+#define STRATUM_MATRIX_V Camera.View[STRATUM_EYE]
+#define STRATUM_MATRIX_P Camera.Projection[STRATUM_EYE]
+#define STRATUM_MATRIX_VP Camera.ViewProjection[STRATUM_EYE]
 #define StratumOffsetClipPosStereo(clipPos) clipPos.xy = clipPos.xy * StereoClipTransform.xy + StereoClipTransform.zw
 
+// the top three rows of an affine ObjectToWorld. WorldToObject isn't stored, normals are transformed with the cofactor matrix instead
 struct InstanceBuffer {
-	float4x4 ObjectToWorld;
-	float4x4 WorldToObject;
+	float4 ObjectToWorld[3];
 };
 
 struct CameraBuffer {
@@ -62,6 +79,24 @@ struct GPULight {
 	int2 pad;
 };
 
+// range of a cluster's light indices in the light index buffer
+struct GPULightCluster {
+	uint Offset;
+	uint Count;
+};
+
+// the camera that light clusters are built for, in the same camera-relative space as CameraBuffer
+struct GPULightClusterCamera {
+	float4x4 View[2];
+	float4x4 InvProjection[2];
+	float3 Position;
+	uint LightCount;
+	float Near;
+	float Far;
+	uint EyeCount;
+	uint pad;
+};
+
 struct ShadowData {
 	float4x4 WorldToShadow; // ViewProjection matrix for the shadow render
 	float4 ShadowST;
@@ -69,6 +104,25 @@ struct ShadowData {
 	float InvProj22;
 };
 
+// layout matches VkDrawIndexedIndirectCommand, followed by the draw's batch, the draws of a batch are drawn by one indirect call.
+// FirstInstance is the draw's first slot in the culled instance buffer, which SV_InstanceID includes
+struct GPUDrawCommand {
+	uint IndexCount;
+	uint InstanceCount;
+	uint FirstIndex;
+	int VertexOffset;
+	uint FirstInstance;
+	uint Batch;
+	uint BatchOffset; // index of the draw in its batch
+};
+
+struct GPUInstanceBounds {
+	float3 Min;
+	uint DrawIndex;
+	float3 Max;
+	uint Mask; // layer mask of the renderer, including the passes it draws in
+};
+
 struct VertexWeight {
 	float4 Weights;
 	uint4 Indices;
@@ -16,4 +16,19 @@ float3 ComputeView(float3 worldPos, float4 screenPos) {
 }
 float LinearDepth01(float screenPos_z) {
 	return screenPos_z / STRATUM_MATRIX_P[2][2] / (Camera.Viewport.w - Camera.Viewport.z);
+}
+
+float3 TransformPoint(InstanceBuffer instance, float3 p) {
+	return float3(dot(instance.ObjectToWorld[0], float4(p, 1)), dot(instance.ObjectToWorld[1], float4(p, 1)), dot(instance.ObjectToWorld[2], float4(p, 1)));
+}
+float3 TransformDirection(InstanceBuffer instance, float3 d) {
+	return float3(dot(instance.ObjectToWorld[0].xyz, d), dot(instance.ObjectToWorld[1].xyz, d), dot(instance.ObjectToWorld[2].xyz, d));
+}
+// multiplies by the cofactor matrix, which is the inverse transpose scaled by the determinant. the result isn't normalized
+float3 TransformNormal(InstanceBuffer instance, float3 n) {
+	float3 c0 = float3(instance.ObjectToWorld[0].x, instance.ObjectToWorld[1].x, instance.ObjectToWorld[2].x);
+	float3 c1 = float3(instance.ObjectToWorld[0].y, instance.ObjectToWorld[1].y, instance.ObjectToWorld[2].y);
+	float3 c2 = float3(instance.ObjectToWorld[0].z, instance.ObjectToWorld[1].z, instance.ObjectToWorld[2].z);
+	float3 r = n.x * cross(c1, c2) + n.y * cross(c2, c0) + n.z * cross(c0, c1);
+	return dot(c0, cross(c1, c2)) < 0 ? -r : r;
 }
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma kernel cluster
+
+#include <include/shadercompat.h>
+
+// lights that overlap a depth slice, more than this and the slice's clusters test every light
+#define LIGHT_SLICE_MAX_LIGHTS 2048
+
+[[vk::binding(0, 0)]] RWStructuredBuffer<GPULightClusterCamera> ClusterCamera	: register(u0);
+[[vk::binding(1, 0)]] RWStructuredBuffer<GPULight> Lights						: register(u1);
+[[vk::binding(2, 0)]] RWStructuredBuffer<GPULightCluster> LightClusters			: register(u2);
+[[vk::binding(3, 0)]] RWStructuredBuffer<uint> LightIndices						: register(u3);
+// number of lights that were left out of full clusters, read back by the CPU
+[[vk::binding(4, 0)]] RWStructuredBuffer<uint> LightOverflow					: register(u4);
+
+groupshared uint SliceLights[LIGHT_SLICE_MAX_LIGHTS];
+groupshared uint SliceLightCount;
+
+// point on the line through two view space points that is at view depth z
+float3 PointAtDepth(float3 p0, float3 p1, float z) {
+	return lerp(p0, p1, (z - p0.z) / (p1.z - p0.z));
+}
+
+// true if the light's range overlaps the view space box, suns overlap everything
+bool LightOverlaps(GPULightClusterCamera camera, uint eye, uint l, float3 mn, float3 mx) {
+	GPULight light = Lights[l];
+	if (light.Type == LIGHT_SUN) return true;
+	float3 p = mul(camera.View[eye], float4(light.WorldPosition - camera.Position, 1)).xyz;
+	float3 d = p - clamp(p, mn, mx);
+	return dot(d, d) * light.InvSqrRange <= 1;
+}
+
+// one group per depth slice and one thread per cluster in it, every cluster gets LIGHT_CLUSTER_MAX_LIGHTS slots in LightIndices
+[numthreads(LIGHT_CLUSTER_X, LIGHT_CLUSTER_Y, 1)]
+void cluster(uint3 group : SV_GroupID, uint3 thread : SV_GroupThreadID, uint threadIndex : SV_GroupIndex) {
+	GPULightClusterCamera camera = ClusterCamera[0];
+	uint x = thread.x;
+	uint y = thread.y;
+	uint z = group.x % LIGHT_CLUSTER_Z;
+	uint eye = group.x / LIGHT_CLUSTER_Z;
+	uint index = (group.x * LIGHT_CLUSTER_Y + y) * LIGHT_CLUSTER_X + x;
+
+	float z0 = camera.Near * pow(camera.Far / camera.Near, (float)z / LIGHT_CLUSTER_Z);
+	float z1 = camera.Near * pow(camera.Far / camera.Near, (float)(z + 1) / LIGHT_CLUSTER_Z);
+
+	// gather the lights whose range overlaps the slice's depth range first, so each cluster only tests those
+	if (threadIndex == 0) SliceLightCount = 0;
+	GroupMemoryBarrierWithGroupSync();
+	float3 sliceMin = float3(-1e20, -1e20, z0);
+	float3 sliceMax = float3(1e20, 1e20, z1);
+	for (uint l = threadIndex; l < camera.LightCount; l += LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y)
+		if (LightOverlaps(camera, eye, l, sliceMin, sliceMax)) {
+			uint i;
+			InterlockedAdd(SliceLightCount, 1, i);
+			if (i < LIGHT_SLICE_MAX_LIGHTS) SliceLights[i] = l;
+		}
+	GroupMemoryBarrierWithGroupSync();
+
+	// view space bounds of the froxel
+	float2 ndc0 = float2(x, y) / float2(LIGHT_CLUSTER_X, LIGHT_CLUSTER_Y) * 2 - 1;
+	float2 ndc1 = float2(x + 1, y + 1) / float2(LIGHT_CLUSTER_X, LIGHT_CLUSTER_Y) * 2 - 1;
+	float3 mn = 1e20;
+	float3 mx = -1e20;
+	for (uint i = 0; i < 4; i++) {
+		float2 ndc = float2((i & 1) ? ndc1.x : ndc0.x, (i & 2) ? ndc1.y : ndc0.y);
+		float4 n = mul(camera.InvProjection[eye], float4(ndc, 0, 1));
+		float4 f = mul(camera.InvProjection[eye], float4(ndc, 1, 1));
+		float3 p0 = PointAtDepth(n.xyz / n.w, f.xyz / f.w, z0);
+		float3 p1 = PointAtDepth(n.xyz / n.w, f.xyz / f.w, z1);
+		mn = min(mn, min(p0, p1));
+		mx = max(mx, max(p0, p1));
+	}
+
+	uint offset = index * LIGHT_CLUSTER_MAX_LIGHTS;
+	uint count = 0;
+	uint overflow = 0;
+	bool sliced = SliceLightCount <= LIGHT_SLICE_MAX_LIGHTS;
+	uint lightCount = sliced ? SliceLightCount : camera.LightCount;
+	for (uint j = 0; j < lightCount; j++) {
+		uint l = sliced ? SliceLights[j] : j;
+		if (!LightOverlaps(camera, eye, l, mn, mx)) continue;
+		if (count < LIGHT_CLUSTER_MAX_LIGHTS) {
+			LightIndices[offset + count] = l;
+			count++;
+		} else
+			overflow++;
+	}
+	if (overflow) InterlockedAdd(LightOverflow[0], overflow);
+
+	GPULightCluster c;
+	c.Offset = offset;
+	c.Count = count;
+	LightClusters[index] = c;
+}
\ No newline at end of file
@@ -33,7 +33,8 @@ struct v2f {
 	float2 canvasPos;
 };
 
-v2f vsmain(uint index : SV_VertexID) {
+v2f vsmain(uint index : SV_VertexID, uint viewIndex : SV_ViewID) {
+	StratumSetViewIndex(viewIndex);
 	float2 p = Vertices[index] * ScaleTranslate.xy + ScaleTranslate.zw;
 	v2f o;
 #ifdef SCREEN_SPACE
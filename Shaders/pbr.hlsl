@@ -5,7 +5,7 @@
 #pragma multi_compile ENABLE_SCATTERING ENVIRONMENT_TEXTURE
 
 #pragma multi_compile ALPHA_CLIP
-#pragma multi_compile TWO_SIDED
+#pragma specialize TWO_SIDED
 #pragma multi_compile TEXTURED
 
 #pragma render_queue 1000
@@ -22,9 +22,12 @@
 
 // per-object
 [[vk::binding(INSTANCE_BUFFER_BINDING, PER_OBJECT)]] StructuredBuffer<InstanceBuffer> Instances : register(t0);
+[[vk::binding(INSTANCE_INDEX_BINDING, PER_OBJECT)]] StructuredBuffer<uint> InstanceIndices : register(t35);
 [[vk::binding(LIGHT_BUFFER_BINDING, PER_OBJECT)]] StructuredBuffer<GPULight> Lights : register(t1);
 [[vk::binding(SHADOW_ATLAS_BINDING, PER_OBJECT)]] Texture2D<float> ShadowAtlas : register(t2);
 [[vk::binding(SHADOW_BUFFER_BINDING, PER_OBJECT)]] StructuredBuffer<ShadowData> Shadows : register(t3);
+[[vk::binding(LIGHT_CLUSTER_BINDING, PER_OBJECT)]] StructuredBuffer<GPULightCluster> LightClusters : register(t33);
+[[vk::binding(LIGHT_INDEX_BINDING, PER_OBJECT)]] StructuredBuffer<uint> LightIndices : register(t34);
 // per-camera
 [[vk::binding(CAMERA_BUFFER_BINDING, PER_CAMERA)]] ConstantBuffer<CameraBuffer> Camera : register(b1);
 // per-material
@@ -56,6 +59,7 @@
 };
 
 //#define SHOW_CASCADE_SPLITS
+#define LIGHT_CLUSTERS
 
 #include "include/util.hlsli"
 #include "include/shadow.hlsli"
@@ -80,25 +84,23 @@ v2f vsmain(
 	[[vk::location(2)]] float4 tangent : TANGENT,
 	[[vk::location(3)]] float2 texcoord : TEXCOORD0,
 	#endif
-	uint instance : SV_InstanceID ) {
+	uint instance : SV_InstanceID,
+	uint viewIndex : SV_ViewID ) {
+	StratumSetViewIndex(viewIndex);
 	v2f o;
 	
-	float4x4 ct = float4x4(
-		1,0,0,-Camera.Position.x,
-		0,1,0,-Camera.Position.y,
-		0,0,1,-Camera.Position.z,
-		0,0,0,1);
-	float4 worldPos = mul(mul(ct, Instances[instance].ObjectToWorld), float4(vertex, 1.0));
+	InstanceBuffer inst = Instances[InstanceIndices[instance]];
+	float4 worldPos = float4(TransformPoint(inst, vertex) - Camera.Position, 1);
 
 	o.position = mul(STRATUM_MATRIX_VP, worldPos);
 	StratumOffsetClipPosStereo(o.position);
 	o.worldPos = float4(worldPos.xyz, o.position.z);
 	
 	o.screenPos = ComputeScreenPos(o.position);
-	o.normal = mul(float4(normal, 1), Instances[instance].WorldToObject).xyz;
+	o.normal = TransformNormal(inst, normal);
 	
 	#ifdef TEXTURED
-	o.tangent = mul(tangent, Instances[instance].WorldToObject).xyz * tangent.w;
+	o.tangent = TransformDirection(inst, tangent.xyz) * tangent.w;
 	o.texcoord = texcoord * TextureST.xy + TextureST.zw;
 	#endif
 
@@ -115,8 +117,10 @@ float fsdepth(in float4 worldPos : TEXCOORD0) : SV_Target0 {
 }
 
 void fsmain(v2f i,
+	uint viewIndex : SV_ViewID,
 	out float4 color : SV_Target0,
 	out float4 depthNormal : SV_Target1) {
+	StratumSetViewIndex(viewIndex);
 	depthNormal = float4(normalize(cross(ddx(i.worldPos.xyz), ddy(i.worldPos.xyz))) * i.worldPos.w, 1);
 
 	float3 view = ComputeView(i.worldPos.xyz, i.screenPos);
@@ -128,9 +132,7 @@ void fsmain(v2f i,
 	#endif
 
 	float3 normal = normalize(i.normal);
-	#ifdef TWO_SIDED
-	if (dot(normal, view) < 0) normal = -normal;
-	#endif
+	if (TWO_SIDED && dot(normal, view) < 0) normal = -normal;
 
 	#ifdef TEXTURED
 	float4 bump = NormalTextures[TextureIndex].Sample(Sampler, i.texcoord);
@@ -90,7 +90,9 @@ void vsmain(
 	float3 vertex : POSITION,
 	out float4 position : SV_Position,
 	out float4 screenPos : TEXCOORD0,
-	out float3 viewRay : TEXCOORD1) {
+	out float3 viewRay : TEXCOORD1,
+	uint viewIndex : SV_ViewID) {
+	StratumSetViewIndex(viewIndex);
 	if (Camera.ProjParams.w) {
 		position = float4(vertex.xy, 0, 1);
 		viewRay = float3(STRATUM_MATRIX_V[0].z, STRATUM_MATRIX_V[1].z, STRATUM_MATRIX_V[2].z);
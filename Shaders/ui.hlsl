@@ -53,7 +53,8 @@ struct v2f {
 	#endif
 };
 
-v2f vsmain(uint index : SV_VertexID, uint instance : SV_InstanceID) {
+v2f vsmain(uint index : SV_VertexID, uint instance : SV_InstanceID, uint viewIndex : SV_ViewID) {
+	StratumSetViewIndex(viewIndex);
 	static const float2 positions[6] = {
 		float2(0,0),
 		float2(1,0),
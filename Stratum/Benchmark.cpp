@@ -0,0 +1,322 @@
+#include <chrono>
+#include <random>
+
+#include <Scene/TriangleBvh2.hpp>
+#include <Util/Profiler.hpp>
+#include <Util/ThreadPool.hpp>
+
+#include <assimp/scene.h>
+#include <assimp/cimport.h>
+#include <assimp/postprocess.h>
+
+using namespace std;
+
+// sample pairs recorded per frame by the profiler benchmark, small enough that the rings don't fill
+#define PROFILER_BENCHMARK_SAMPLES 4096
+#define PROFILER_BENCHMARK_FRAMES 256
+// the benchmark mesh is a rippled grid of this many quads on each side
+#define BVH_BENCHMARK_GRID 512
+#define BVH_BENCHMARK_RAYS (1024 * 1024)
+#define BVH_BENCHMARK_BUILDS 4
+
+// the models the build benchmark loads when none are given, relative to the bin directory the Assets folder is linked into
+const char* gBenchmarkModels[] = {
+	"Assets/Models/cornellbox.gltf",
+	"Assets/Models/room/CrohnsProtoRoom.gltf",
+	"Assets/uh60/uh60.fbx"
+};
+
+typedef chrono::duration<double, nano> nanoseconds_d;
+
+// records PROFILER_BENCHMARK_SAMPLES sample pairs per frame on the main thread and on every thread of the pool
+void BenchmarkProfiler(ThreadPool* threadPool) {
+	uint32_t label = Profiler::InternLabel("Benchmark");
+
+	auto start = chrono::high_resolution_clock::now();
+	for (uint32_t f = 0; f < PROFILER_BENCHMARK_FRAMES; f++) {
+		Profiler::FrameStart();
+		for (uint32_t i = 0; i < PROFILER_BENCHMARK_SAMPLES; i++) {
+			Profiler::BeginSample(label);
+			Profiler::EndSample();
+		}
+		Profiler::FrameEnd();
+	}
+	nanoseconds_d elapsed = chrono::high_resolution_clock::now() - start;
+	printf("Profiler, main thread: %.1f ns per sample\n", elapsed.count() / (PROFILER_BENCHMARK_FRAMES * PROFILER_BENCHMARK_SAMPLES));
+
+	uint32_t threadCount = threadPool->ThreadCount() + 1;
+	start = chrono::high_resolution_clock::now();
+	for (uint32_t f = 0; f < PROFILER_BENCHMARK_FRAMES; f++) {
+		Profiler::FrameStart();
+		threadPool->ParallelFor(threadCount, [&](uint32_t) {
+			for (uint32_t i = 0; i < PROFILER_BENCHMARK_SAMPLES; i++) {
+				Profiler::BeginSample(label);
+				Profiler::EndSample();
+			}
+		});
+		Profiler::FrameEnd();
+	}
+	elapsed = chrono::high_resolution_clock::now() - start;
+	printf("Profiler, %u threads: %.1f ns per sample per thread\n", threadCount, elapsed.count() / (PROFILER_BENCHMARK_FRAMES * PROFILER_BENCHMARK_SAMPLES));
+
+	// overfills the main thread's ring with nested samples, every recorded sample must still be closed
+	uint64_t dropped = Profiler::Counter("Profiler Dropped Samples");
+	Profiler::FrameStart();
+	for (uint32_t i = 0; i < PROFILER_EVENT_BUFFER_SIZE; i++) {
+		Profiler::BeginSample(label);
+		Profiler::BeginSample(label);
+		Profiler::EndSample();
+		Profiler::EndSample();
+	}
+	Profiler::FrameEnd();
+	const ProfilerSample* frame = Profiler::LastFrame();
+	// samples whose end event was lost are closed at the end of the frame
+	chrono::high_resolution_clock::time_point frameEnd = frame->mStartTime + frame->mDuration;
+	uint32_t unclosed = 0;
+	for (const ProfilerSample& s : frame->mChildren) {
+		if (s.mStartTime + s.mDuration == frameEnd) unclosed++;
+		for (const ProfilerSample& c : s.mChildren)
+			if (c.mStartTime + c.mDuration == frameEnd) unclosed++;
+	}
+	printf("Profiler, overfilled ring: %u of %u samples recorded, %llu dropped, %u missing their end\n",
+		(uint32_t)frame->mChildren.size(), PROFILER_EVENT_BUFFER_SIZE, (unsigned long long)(Profiler::Counter("Profiler Dropped Samples") - dropped), unclosed);
+}
+
+// a grid of quads, rippled so rays hit it at varying depths and the tree isn't flat
+void BenchmarkMesh(vector<float3>& vertices, vector<uint32_t>& indices) {
+	vertices.resize((BVH_BENCHMARK_GRID + 1) * (BVH_BENCHMARK_GRID + 1));
+	for (uint32_t y = 0; y <= BVH_BENCHMARK_GRID; y++)
+		for (uint32_t x = 0; x <= BVH_BENCHMARK_GRID; x++) {
+			float2 p = float2((float)x, (float)y) / BVH_BENCHMARK_GRID * 2 - 1;
+			vertices[y * (BVH_BENCHMARK_GRID + 1) + x] = float3(p.x, .1f * sinf(p.x * 20) * cosf(p.y * 15), p.y);
+		}
+	indices.clear();
+	indices.reserve(BVH_BENCHMARK_GRID * BVH_BENCHMARK_GRID * 6);
+	for (uint32_t y = 0; y < BVH_BENCHMARK_GRID; y++)
+		for (uint32_t x = 0; x < BVH_BENCHMARK_GRID; x++) {
+			uint32_t i = y * (BVH_BENCHMARK_GRID + 1) + x;
+			uint32_t quad[6] = { i, i + BVH_BENCHMARK_GRID + 1, i + 1, i + 1, i + BVH_BENCHMARK_GRID + 1, i + BVH_BENCHMARK_GRID + 2 };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+}
+
+// the whole model as one triangle list, with the node transforms applied like Scene::LoadModelScene does
+bool LoadBenchmarkModel(const string& filename, vector<float3>& vertices, vector<uint32_t>& indices) {
+	const aiScene* scene = aiImportFile(filename.c_str(), aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_PreTransformVertices | aiProcess_SortByPType);
+	if (!scene) {
+		fprintf_color(COLOR_YELLOW, stderr, "Failed to open %s: %s\n", filename.c_str(), aiGetErrorString());
+		return false;
+	}
+	vertices.clear();
+	indices.clear();
+	for (uint32_t m = 0; m < scene->mNumMeshes; m++) {
+		const aiMesh* mesh = scene->mMeshes[m];
+		if ((mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) == 0) continue;
+		uint32_t baseIndex = (uint32_t)vertices.size();
+		for (uint32_t i = 0; i < mesh->mNumVertices; i++)
+			vertices.push_back(float3((float)mesh->mVertices[i].x, (float)mesh->mVertices[i].y, (float)mesh->mVertices[i].z));
+		for (uint32_t i = 0; i < mesh->mNumFaces; i++) {
+			const aiFace& f = mesh->mFaces[i];
+			if (f.mNumIndices != 3) continue;
+			indices.push_back(baseIndex + f.mIndices[0]);
+			indices.push_back(baseIndex + f.mIndices[1]);
+			indices.push_back(baseIndex + f.mIndices[2]);
+		}
+	}
+	aiReleaseImport(scene);
+	return indices.size();
+}
+
+// the builder TriangleBvh2 used before the binned SAH one: splits the centroid bounds at the middle of their longest axis
+void BuildMidpoint(const vector<float3>& vertices, const vector<uint32_t>& indices, uint32_t leafSize, vector<TriangleBvh2::Node>& nodes, vector<uint3>& triangles) {
+	nodes.clear();
+	triangles.resize(indices.size() / 3);
+	vector<AABB> aabbs(triangles.size());
+	for (uint32_t i = 0; i < triangles.size(); i++) {
+		triangles[i] = uint3(indices[3 * i], indices[3 * i + 1], indices[3 * i + 2]);
+		float3 v0 = vertices[triangles[i].x];
+		float3 v1 = vertices[triangles[i].y];
+		float3 v2 = vertices[triangles[i].z];
+		aabbs[i] = AABB(min(min(v0, v1), v2) - 1e-3f, max(max(v0, v1), v2) + 1e-3f);
+	}
+
+	struct BuildTask {
+		uint32_t mParentOffset;
+		uint32_t mStart;
+		uint32_t mEnd;
+	};
+	const uint32_t untouched = 0xffffffff;
+	const uint32_t touchedTwice = 0xfffffffd;
+	const uint32_t root = 0xfffffffc;
+
+	vector<BuildTask> todo;
+	todo.push_back({ root, 0, (uint32_t)triangles.size() });
+	while (todo.size()) {
+		BuildTask task = todo.back();
+		todo.pop_back();
+
+		AABB bb(aabbs[task.mStart]);
+		AABB bc(aabbs[task.mStart].Center(), aabbs[task.mStart].Center());
+		for (uint32_t p = task.mStart + 1; p < task.mEnd; ++p) {
+			bb.Encapsulate(aabbs[p]);
+			bc.Encapsulate(aabbs[p].Center());
+		}
+
+		TriangleBvh2::Node node = {};
+		node.mBounds = bb;
+		node.mStartIndex = task.mStart;
+		node.mCount = task.mEnd - task.mStart;
+		node.mRightOffset = node.mCount <= leafSize ? 0 : untouched;
+		nodes.push_back(node);
+		uint32_t index = (uint32_t)nodes.size() - 1;
+
+		// the second child to touch its parent is the right one, and sets the parent's offset to it
+		if (task.mParentOffset != root) {
+			nodes[task.mParentOffset].mRightOffset--;
+			if (nodes[task.mParentOffset].mRightOffset == touchedTwice)
+				nodes[task.mParentOffset].mRightOffset = index - task.mParentOffset;
+		}
+		if (node.mRightOffset == 0) continue;
+
+		float3 ext = bc.Extents();
+		uint32_t axis = 0;
+		if (ext.y > ext.x) {
+			axis = 1;
+			if (ext.z > ext.y) axis = 2;
+		} else if (ext.z > ext.x)
+			axis = 2;
+		float split = .5f * (bc.mMin[axis] + bc.mMax[axis]);
+
+		uint32_t mid = task.mStart;
+		for (uint32_t i = task.mStart; i < task.mEnd; ++i)
+			if (aabbs[i].Center()[axis] < split) {
+				swap(triangles[i], triangles[mid]);
+				swap(aabbs[i], aabbs[mid]);
+				mid++;
+			}
+		if (mid == task.mStart || mid == task.mEnd)
+			mid = task.mStart + (task.mEnd - task.mStart) / 2;
+
+		todo.push_back({ index, mid, task.mEnd });
+		todo.push_back({ index, task.mStart, mid });
+	}
+}
+
+// builds each model's tree BVH_BENCHMARK_BUILDS times with the midpoint builder, and with the SAH builder on the main thread and
+// across the thread pool, reporting the fastest build and the tree's SAH cost
+void BenchmarkBuild(ThreadPool* threadPool, const vector<string>& models) {
+	for (const string& model : models) {
+		vector<float3> vertices;
+		vector<uint32_t> indices;
+		if (model.empty())
+			BenchmarkMesh(vertices, indices);
+		else if (!LoadBenchmarkModel(model, vertices, indices))
+			continue;
+		const char* name = model.empty() ? "grid" : model.c_str();
+
+		TriangleBvh2 bvh;
+		vector<TriangleBvh2::Node> nodes;
+		vector<uint3> triangles;
+		double best = numeric_limits<double>::max();
+		for (uint32_t i = 0; i < BVH_BENCHMARK_BUILDS; i++) {
+			auto start = chrono::high_resolution_clock::now();
+			BuildMidpoint(vertices, indices, 4, nodes, triangles);
+			chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+			best = min(best, elapsed.count());
+		}
+		bvh.Load(nodes.data(), (uint32_t)nodes.size(), triangles.data(), (uint32_t)triangles.size(), vertices.data(), (uint32_t)vertices.size(), sizeof(float3));
+		printf("Build, %s, %u triangles, midpoint: %.1f ms, %.2f Mtris/s, %u nodes, SAH cost %.2f\n", name, bvh.TriangleCount(),
+			best * 1e3, bvh.TriangleCount() / best * 1e-6, (uint32_t)bvh.Nodes().size(), bvh.SAHCost());
+
+		for (ThreadPool* pool : { (ThreadPool*)nullptr, threadPool }) {
+			best = numeric_limits<double>::max();
+			for (uint32_t i = 0; i < BVH_BENCHMARK_BUILDS; i++) {
+				auto start = chrono::high_resolution_clock::now();
+				bvh.Build(vertices.data(), (uint32_t)vertices.size(), sizeof(float3), indices.data(), (uint32_t)indices.size(), VK_INDEX_TYPE_UINT32, pool);
+				chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+				best = min(best, elapsed.count());
+			}
+			printf("Build, %s, %u triangles, SAH, %s (%u threads): %.1f ms, %.2f Mtris/s, %u nodes, SAH cost %.2f\n", name, bvh.TriangleCount(), pool ? "thread pool" : "main thread",
+				pool ? pool->ThreadCount() + 1 : 1, best * 1e3, bvh.TriangleCount() / best * 1e-6, (uint32_t)bvh.Nodes().size(), bvh.SAHCost());
+		}
+	}
+}
+
+// casts BVH_BENCHMARK_RAYS random rays through the benchmark mesh with the scalar and 4-wide traversals, then batched across the thread pool
+void BenchmarkRays(ThreadPool* threadPool) {
+	vector<float3> vertices;
+	vector<uint32_t> indices;
+	BenchmarkMesh(vertices, indices);
+	TriangleBvh2 bvh;
+	bvh.Build(vertices.data(), (uint32_t)vertices.size(), sizeof(float3), indices.data(), (uint32_t)indices.size(), VK_INDEX_TYPE_UINT32, threadPool);
+
+	// rays from above the mesh towards random points below it, so most of them hit
+	mt19937 rng(0);
+	uniform_real_distribution<float> distribution(-1.f, 1.f);
+	vector<Ray> rays(BVH_BENCHMARK_RAYS);
+	for (Ray& ray : rays) {
+		float3 origin(distribution(rng), 1.f, distribution(rng));
+		float3 target(distribution(rng), -.2f, distribution(rng));
+		ray = Ray(origin, normalize(target - origin));
+	}
+	vector<TriangleBvh2::Hit> hits(rays.size());
+
+	// the scalar and 4-wide traversals on the same rays, one ray at a time on the main thread
+	for (bool any : { false, true }) {
+		auto start = chrono::high_resolution_clock::now();
+		uint32_t hitCount = 0;
+		for (const Ray& ray : rays) {
+			TriangleBvh2::Hit hit;
+			hit.mT = 1.e20f;
+			hit.mTriangle = 0xFFFFFFFF;
+			hit.mBarycentric = 0;
+			if (bvh.IntersectScalar(ray, hit, any)) hitCount++;
+		}
+		chrono::duration<double> scalar = chrono::high_resolution_clock::now() - start;
+		printf("Rays, %u triangles, %s, scalar: %.2f Mrays/s (%u hits)\n", bvh.TriangleCount(), any ? "any hit" : "closest hit", rays.size() / scalar.count() * 1e-6, hitCount);
+
+		start = chrono::high_resolution_clock::now();
+		hitCount = 0;
+		for (const Ray& ray : rays) {
+			float t;
+			if (bvh.Intersect(ray, &t, any)) hitCount++;
+		}
+		chrono::duration<double> wide = chrono::high_resolution_clock::now() - start;
+		printf("Rays, %u triangles, %s, 4-wide: %.2f Mrays/s (%u hits), %.2fx\n", bvh.TriangleCount(), any ? "any hit" : "closest hit", rays.size() / wide.count() * 1e-6, hitCount, scalar.count() / wide.count());
+	}
+
+	// the same closest hit query batched, on the main thread and across the thread pool
+	for (ThreadPool* pool : { (ThreadPool*)nullptr, threadPool }) {
+		auto start = chrono::high_resolution_clock::now();
+		uint32_t hitCount = bvh.IntersectBatch(rays.data(), rays.size(), hits.data(), false, pool);
+		chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+		printf("Rays, %u triangles, closest hit, batched, %s (%u threads): %.2f Mrays/s (%u hits)\n", bvh.TriangleCount(), pool ? "thread pool" : "main thread",
+			pool ? pool->ThreadCount() + 1 : 1, rays.size() / elapsed.count() * 1e-6, hitCount);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	string benchmark = argc > 1 ? argv[1] : "";
+	if (benchmark != "" && benchmark != "profiler" && benchmark != "build" && benchmark != "rays") {
+		fprintf(stderr, "Usage: %s [profiler|build|rays] [model ...]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// an empty name is the generated grid
+	vector<string> models;
+	for (int i = 2; i < argc; i++)
+		models.push_back(argv[i]);
+	if (models.empty()) {
+		models.push_back("");
+		models.insert(models.end(), begin(gBenchmarkModels), end(gBenchmarkModels));
+	}
+
+	ThreadPool* threadPool = new ThreadPool();
+
+	if (benchmark == "" || benchmark == "profiler") BenchmarkProfiler(threadPool);
+	if (benchmark == "" || benchmark == "build") BenchmarkBuild(threadPool, models);
+	if (benchmark == "" || benchmark == "rays") BenchmarkRays(threadPool);
+
+	delete threadPool;
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
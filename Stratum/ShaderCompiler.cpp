@@ -6,11 +6,30 @@
 #include "ShaderCompiler.hpp"
 #include <shaderc/shaderc.hpp>
 #include <../spirv_cross.hpp>
+#include <Util/ThreadPool.hpp>
 
 using namespace std;
 using namespace shaderc;
 
+#define SHADER_CACHE_MAGIC 0x48435453 // STCH
+// bump when the compile options change, so modules compiled with the old ones aren't reused
+#define SHADER_CACHE_VERSION 1
+// once the cache directory grows past this, the least recently used modules are removed until it's 3/4 of this size
+#define SHADER_CACHE_MAX_SIZE (256 * 1024 * 1024)
+
 CompileOptions options;
+// identifies the compiler build, seeds every stage's cache key so modules from an older shaderc aren't reused
+uint64_t gCompilerHash = 0;
+
+// 64 bit FNV-1a, unlike std::hash it stays the same between builds so it can key the on-disk cache
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
 
 class Includer : public CompileOptions::IncluderInterface {
 public:
@@ -21,6 +40,9 @@ public:
 
 		shaderc_include_result* response = new shaderc_include_result();
 
+		// every stage is compiled with a copy of the same options, so the includer is shared by all threads
+		lock_guard lock(mMutex);
+
 		string& data = mFiles[fullpath];
 		if (data.empty() && !ReadFile(fullpath, data)) {
 			char* err = new char[128];
@@ -48,173 +70,281 @@ public:
 		if (data->user_data) delete[] (char*)data->user_data;
 		delete data;
 	}
-
 private:
+	mutex mMutex;
 	unordered_map<string, string> mFiles;
 	unordered_map<string, string> mFullPaths;
 };
 
-bool CompileStage(Compiler* compiler, const CompileOptions& options, const string& source, const string& filename, shaderc_shader_kind stage, const string& entryPoint,
-	CompiledVariant& dest, CompiledShader& destShader) {
-	
-	SpvCompilationResult result = compiler->CompileGlslToSpv(source.c_str(), source.length(), stage, filename.c_str(), entryPoint.c_str(), options);
-	
-	string error = result.GetErrorMessage();
-	if (error.size()) fprintf_color(COLOR_RED, stderr, "%s\n", error.c_str());
-	switch (result.GetCompilationStatus()) {
-	case shaderc_compilation_status_success:
-		// store SPIRV module
-		destShader.mModules.push_back({});
-		SpirvModule& m = destShader.mModules.back();
-		for (auto d = result.cbegin(); d != result.cend(); d++)
-			m.mSpirv.push_back(*d);
-
-		// assign SPIRV module
-		VkShaderStageFlagBits vkstage;
-		switch (stage) {
-		case shaderc_vertex_shader:
-			dest.mModules[0] = (uint32_t)destShader.mModules.size() - 1;
-			vkstage = VK_SHADER_STAGE_VERTEX_BIT;
-			break;
-		case shaderc_fragment_shader:
-			dest.mModules[1] = (uint32_t)destShader.mModules.size() - 1;
-			vkstage = VK_SHADER_STAGE_FRAGMENT_BIT;
-			break;
-		case shaderc_compute_shader:
-			dest.mModules[0] = (uint32_t)destShader.mModules.size() - 1;
-			vkstage = VK_SHADER_STAGE_COMPUTE_BIT;
-			break;
-		}
+/// One stage of a variant. Variants with a stage that has the same entry point and macros share its StageJob
+struct StageJob {
+	shaderc_shader_kind mStage;
+	string mEntryPoint;
+	vector<string> mMacros;
+
+	// hash of the stage, entry point and preprocessed source, modules with the same hash are identical
+	uint64_t mSourceHash;
+	SpirvModule mModule;
+	// descriptor bindings, push constants and workgroup size of the stage
+	CompiledVariant mReflection;
+	bool mCached;
+	bool mSuccess;
+};
 
-		spirv_cross::Compiler comp(m.mSpirv.data(), m.mSpirv.size());
-		spirv_cross::ShaderResources res = comp.get_shader_resources();
-		
-		#pragma region register resource bindings
-		auto registerResource = [&](const spirv_cross::Resource& res, VkDescriptorType type) {
-			auto& binding = dest.mDescriptorBindings[res.name];
-
-			binding.first = comp.get_decoration(res.id, spv::DecorationDescriptorSet);
-
-			binding.second.stageFlags |= vkstage;
-			binding.second.binding = comp.get_decoration(res.id, spv::DecorationBinding);
-			binding.second.descriptorCount = 1;
-			binding.second.descriptorType = type;
-		};
-
-		for (const auto& r : res.sampled_images)
-			registerResource(r, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-		for (const auto& r : res.separate_images)
-			if (comp.get_type(r.type_id).image.dim == spv::DimBuffer)
-				registerResource(r, VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER);
-			else
-				registerResource(r, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE);
-		for (const auto& r : res.storage_images)
-			if (comp.get_type(r.type_id).image.dim == spv::DimBuffer)
-				registerResource(r, VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER);
-			else
-				registerResource(r, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
-		for (const auto& r : res.storage_buffers)
-			registerResource(r, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-		for (const auto& r : res.separate_samplers)
-			registerResource(r, VK_DESCRIPTOR_TYPE_SAMPLER);
-		for (const auto& r : res.uniform_buffers)
-			registerResource(r, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-
-		for (const auto& r : res.push_constant_buffers) {
-			uint32_t index = 0;
-
-			const auto& type = comp.get_type(r.base_type_id);
-
-			if (type.basetype == spirv_cross::SPIRType::Struct) {
-				for (uint32_t i = 0; i < type.member_types.size(); i++) {
-					const auto& mtype = comp.get_type(type.member_types[i]);
-
-					const string name = comp.get_member_name(r.base_type_id, index);
-					
-					VkPushConstantRange range = {};
-					range.stageFlags = vkstage == VK_SHADER_STAGE_COMPUTE_BIT ? VK_SHADER_STAGE_COMPUTE_BIT : (VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
-					range.offset = comp.type_struct_member_offset(type, index);
-
-					switch (mtype.basetype) {
-					case spirv_cross::SPIRType::Boolean:
-					case spirv_cross::SPIRType::SByte:
-					case spirv_cross::SPIRType::UByte:
-						range.size = 1;
-						break;
-					case spirv_cross::SPIRType::Short:
-					case spirv_cross::SPIRType::UShort:
-					case spirv_cross::SPIRType::Half:
-						range.size = 2;
-						break;
-					case spirv_cross::SPIRType::Int:
-					case spirv_cross::SPIRType::UInt:
-					case spirv_cross::SPIRType::Float:
-						range.size = 4;
-						break;
-					case spirv_cross::SPIRType::Int64:
-					case spirv_cross::SPIRType::UInt64:
-					case spirv_cross::SPIRType::Double:
-						range.size = 8;
-						break;
-					case spirv_cross::SPIRType::Struct:
-						range.size = (uint32_t)comp.get_declared_struct_size(mtype);
-						break;
-					case spirv_cross::SPIRType::Unknown:
-					case spirv_cross::SPIRType::Void:
-					case spirv_cross::SPIRType::AtomicCounter:
-					case spirv_cross::SPIRType::Image:
-					case spirv_cross::SPIRType::SampledImage:
-					case spirv_cross::SPIRType::Sampler:
-					case spirv_cross::SPIRType::AccelerationStructureNV:
-						fprintf(stderr, "Unknown type for push constant: %s\n", name.c_str());
-						range.size = 0;
-						break;
-					}
+void ReflectStage(const SpirvModule& m, shaderc_shader_kind stage, const string& entryPoint, CompiledVariant& dest) {
+	VkShaderStageFlagBits vkstage;
+	switch (stage) {
+	case shaderc_vertex_shader:
+		vkstage = VK_SHADER_STAGE_VERTEX_BIT;
+		break;
+	case shaderc_fragment_shader:
+		vkstage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		break;
+	default:
+		vkstage = VK_SHADER_STAGE_COMPUTE_BIT;
+		break;
+	}
 
-					range.size *= mtype.columns * mtype.vecsize;
+	spirv_cross::Compiler comp(m.mSpirv.data(), m.mSpirv.size());
+	spirv_cross::ShaderResources res = comp.get_shader_resources();
+	
+	#pragma region register resource bindings
+	auto registerResource = [&](const spirv_cross::Resource& res, VkDescriptorType type) {
+		auto& binding = dest.mDescriptorBindings[res.name];
+
+		binding.first = comp.get_decoration(res.id, spv::DecorationDescriptorSet);
+
+		binding.second.stageFlags |= vkstage;
+		binding.second.binding = comp.get_decoration(res.id, spv::DecorationBinding);
+		binding.second.descriptorCount = 1;
+		binding.second.descriptorType = type;
+	};
+
+	for (const auto& r : res.sampled_images)
+		registerResource(r, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+	for (const auto& r : res.separate_images)
+		if (comp.get_type(r.type_id).image.dim == spv::DimBuffer)
+			registerResource(r, VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER);
+		else
+			registerResource(r, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE);
+	for (const auto& r : res.storage_images)
+		if (comp.get_type(r.type_id).image.dim == spv::DimBuffer)
+			registerResource(r, VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER);
+		else
+			registerResource(r, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+	for (const auto& r : res.storage_buffers)
+		registerResource(r, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+	for (const auto& r : res.separate_samplers)
+		registerResource(r, VK_DESCRIPTOR_TYPE_SAMPLER);
+	for (const auto& r : res.uniform_buffers)
+		registerResource(r, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+
+	for (const auto& r : res.push_constant_buffers) {
+		uint32_t index = 0;
+
+		const auto& type = comp.get_type(r.base_type_id);
+
+		if (type.basetype == spirv_cross::SPIRType::Struct) {
+			for (uint32_t i = 0; i < type.member_types.size(); i++) {
+				const auto& mtype = comp.get_type(type.member_types[i]);
+
+				const string name = comp.get_member_name(r.base_type_id, index);
+				
+				VkPushConstantRange range = {};
+				range.stageFlags = vkstage == VK_SHADER_STAGE_COMPUTE_BIT ? VK_SHADER_STAGE_COMPUTE_BIT : (VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+				range.offset = comp.type_struct_member_offset(type, index);
+
+				switch (mtype.basetype) {
+				case spirv_cross::SPIRType::Boolean:
+				case spirv_cross::SPIRType::SByte:
+				case spirv_cross::SPIRType::UByte:
+					range.size = 1;
+					break;
+				case spirv_cross::SPIRType::Short:
+				case spirv_cross::SPIRType::UShort:
+				case spirv_cross::SPIRType::Half:
+					range.size = 2;
+					break;
+				case spirv_cross::SPIRType::Int:
+				case spirv_cross::SPIRType::UInt:
+				case spirv_cross::SPIRType::Float:
+					range.size = 4;
+					break;
+				case spirv_cross::SPIRType::Int64:
+				case spirv_cross::SPIRType::UInt64:
+				case spirv_cross::SPIRType::Double:
+					range.size = 8;
+					break;
+				case spirv_cross::SPIRType::Struct:
+					range.size = (uint32_t)comp.get_declared_struct_size(mtype);
+					break;
+				case spirv_cross::SPIRType::Unknown:
+				case spirv_cross::SPIRType::Void:
+				case spirv_cross::SPIRType::AtomicCounter:
+				case spirv_cross::SPIRType::Image:
+				case spirv_cross::SPIRType::SampledImage:
+				case spirv_cross::SPIRType::Sampler:
+				case spirv_cross::SPIRType::AccelerationStructureNV:
+					fprintf(stderr, "Unknown type for push constant: %s\n", name.c_str());
+					range.size = 0;
+					break;
+				}
 
-					vector<pair<string, VkPushConstantRange>> ranges;
-					ranges.push_back(make_pair(name, range));
+				range.size *= mtype.columns * mtype.vecsize;
 
-					for (uint32_t dim : mtype.array) {
-						for (auto& r : ranges)
-							r.second.size *= dim;
-						// TODO: support individual element ranges
-						//uint32_t sz = ranges.size();
-						//for (uint32_t j = 0; j < sz; j++)
-						//	for (uint32_t c = 0; c < dim; c++)
-						//		ranges.push_back(make_pair(ranges[j].first + "[" + to_string(c) + "]", range));
-					}
+				vector<pair<string, VkPushConstantRange>> ranges;
+				ranges.push_back(make_pair(name, range));
 
+				for (uint32_t dim : mtype.array) {
 					for (auto& r : ranges)
-						dest.mPushConstants[r.first] = r.second;
-
-					index++;
-				}
-			} else
-				fprintf(stderr, "Push constant data is not a struct! Reflection will not work.\n");
-		}
-		#pragma endregion
-		
-		if (vkstage == VK_SHADER_STAGE_COMPUTE_BIT) {
-			auto entryPoints = comp.get_entry_points_and_stages();
-			for (const auto& e : entryPoints) {
-				if (e.name == entryPoint) {
-					auto& ep = comp.get_entry_point(e.name, e.execution_model);
-					dest.mWorkgroupSize[0] = ep.workgroup_size.x;
-					dest.mWorkgroupSize[1] = ep.workgroup_size.y;
-					dest.mWorkgroupSize[2] = ep.workgroup_size.z;
+						r.second.size *= dim;
+					// TODO: support individual element ranges
+					//uint32_t sz = ranges.size();
+					//for (uint32_t j = 0; j < sz; j++)
+					//	for (uint32_t c = 0; c < dim; c++)
+					//		ranges.push_back(make_pair(ranges[j].first + "[" + to_string(c) + "]", range));
 				}
+
+				for (auto& r : ranges)
+					dest.mPushConstants[r.first] = r.second;
+
+				index++;
 			}
 		} else
-			dest.mWorkgroupSize = 0;
+			fprintf(stderr, "Push constant data is not a struct! Reflection will not work.\n");
+	}
+	#pragma endregion
+	
+	if (vkstage == VK_SHADER_STAGE_COMPUTE_BIT) {
+		auto entryPoints = comp.get_entry_points_and_stages();
+		for (const auto& e : entryPoints) {
+			if (e.name == entryPoint) {
+				auto& ep = comp.get_entry_point(e.name, e.execution_model);
+				dest.mWorkgroupSize[0] = ep.workgroup_size.x;
+				dest.mWorkgroupSize[1] = ep.workgroup_size.y;
+				dest.mWorkgroupSize[2] = ep.workgroup_size.z;
+			}
+		}
+	} else
+		dest.mWorkgroupSize = 0;
+}
 
-		return true;
+bool ReadCachedModule(const fs::path& path, SpirvModule& module) {
+	ifstream file(path, ios::binary);
+	if (!file.is_open()) return false;
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	file.read(reinterpret_cast<char*>(&magic), sizeof(uint32_t));
+	file.read(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+	if (!file || magic != SHADER_CACHE_MAGIC || version != SHADER_CACHE_VERSION) return false;
+	module.Read(file);
+	return file && module.mSpirv.size();
+}
+void WriteCachedModule(const fs::path& path, SpirvModule& module, uint32_t jobIndex) {
+	// two jobs can produce the same module, each writes its own file and renames it into place
+	fs::path tmp = path;
+	tmp += ".tmp" + to_string(jobIndex);
+	ofstream file(tmp, ios::binary);
+	if (!file.is_open()) return;
+	uint32_t magic = SHADER_CACHE_MAGIC;
+	uint32_t version = SHADER_CACHE_VERSION;
+	file.write(reinterpret_cast<char*>(&magic), sizeof(uint32_t));
+	file.write(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+	module.Write(file);
+	file.close();
+
+	error_code ec;
+	fs::rename(tmp, path, ec);
+	if (ec) fs::remove(tmp, ec);
+}
+
+// the SPIR-V version shaderc targets and the module it produces for a trivial shader, whose header carries the glslang generator version
+uint64_t CompilerHash() {
+	unsigned int spvVersion = 0, spvRevision = 0;
+	shaderc_get_spv_version(&spvVersion, &spvRevision);
+	uint64_t hash = HashBytes(&spvVersion, sizeof(unsigned int));
+	hash = HashBytes(&spvRevision, sizeof(unsigned int), hash);
+
+	const char* probe = "float4 main() : SV_Target { return 0; }";
+	Compiler compiler;
+	SpvCompilationResult result = compiler.CompileGlslToSpv(probe, strlen(probe), shaderc_fragment_shader, "probe", "main", options);
+	if (result.GetCompilationStatus() == shaderc_compilation_status_success)
+		hash = HashBytes(result.cbegin(), (result.cend() - result.cbegin()) * sizeof(uint32_t), hash);
+	return hash;
+}
+
+// removes the least recently written modules once the cache directory is larger than SHADER_CACHE_MAX_SIZE
+void TrimCache(const fs::path& cacheDirectory) {
+	error_code ec;
+	vector<pair<fs::file_time_type, fs::path>> files;
+	uintmax_t totalSize = 0;
+	for (const fs::directory_entry& entry : fs::directory_iterator(cacheDirectory, ec)) {
+		if (!fs::is_regular_file(entry.path(), ec) || entry.path().extension() != ".spv") continue;
+		uintmax_t size = fs::file_size(entry.path(), ec);
+		if (ec) continue;
+		totalSize += size;
+		files.push_back(make_pair(fs::last_write_time(entry.path(), ec), entry.path()));
 	}
-	return false;
+	if (totalSize <= SHADER_CACHE_MAX_SIZE) return;
+
+	sort(files.begin(), files.end());
+	uint32_t removed = 0;
+	for (const auto& f : files) {
+		if (totalSize <= SHADER_CACHE_MAX_SIZE / 4 * 3) break;
+		// another compiler may be reading or replacing the file, a failed removal is left for the next trim
+		uintmax_t size = fs::file_size(f.second, ec);
+		if (ec || !fs::remove(f.second, ec)) continue;
+		totalSize -= size;
+		removed++;
+	}
+	printf("Removed %u modules from the shader cache\n", removed);
 }
 
-CompiledShader* Compile(shaderc::Compiler* compiler, const string& filename) {
+void CompileStage(StageJob& job, uint32_t jobIndex, const string& source, const string& filename, const fs::path& cacheDirectory) {
+	// a shaderc::Compiler is only used by one thread at a time
+	thread_local Compiler compiler;
+
+	CompileOptions stageOptions = options;
+	for (const string& m : job.mMacros)
+		stageOptions.AddMacroDefinition(m);
+
+	PreprocessedSourceCompilationResult preprocessed = compiler.PreprocessGlsl(source.c_str(), source.length(), job.mStage, filename.c_str(), stageOptions);
+	if (preprocessed.GetCompilationStatus() != shaderc_compilation_status_success) {
+		fprintf_color(COLOR_RED, stderr, "%s\n", preprocessed.GetErrorMessage().c_str());
+		return;
+	}
+	string preprocessedSource(preprocessed.cbegin(), preprocessed.cend());
+
+	job.mSourceHash = HashBytes(&job.mStage, sizeof(shaderc_shader_kind), gCompilerHash);
+	job.mSourceHash = HashBytes(job.mEntryPoint.c_str(), job.mEntryPoint.length() + 1, job.mSourceHash);
+	job.mSourceHash = HashBytes(preprocessedSource.data(), preprocessedSource.length(), job.mSourceHash);
+
+	char cacheName[32];
+	snprintf(cacheName, 32, "%016llx.spv", (unsigned long long)job.mSourceHash);
+	fs::path cachePath = cacheDirectory / cacheName;
+
+	job.mCached = ReadCachedModule(cachePath, job.mModule);
+	if (job.mCached) {
+		// TrimCache removes the least recently used modules first
+		error_code ec;
+		fs::last_write_time(cachePath, fs::file_time_type::clock::now(), ec);
+	} else {
+		job.mModule.mSpirv.clear();
+
+		// the preprocessed source keeps #line directives, so errors still point into the original files
+		SpvCompilationResult result = compiler.CompileGlslToSpv(preprocessedSource.c_str(), preprocessedSource.length(), job.mStage, filename.c_str(), job.mEntryPoint.c_str(), stageOptions);
+		string error = result.GetErrorMessage();
+		if (error.size()) fprintf_color(COLOR_RED, stderr, "%s\n", error.c_str());
+		if (result.GetCompilationStatus() != shaderc_compilation_status_success) return;
+
+		job.mModule.mSpirv.assign(result.cbegin(), result.cend());
+		WriteCachedModule(cachePath, job.mModule, jobIndex);
+	}
+
+	ReflectStage(job.mModule, job.mStage, job.mEntryPoint, job.mReflection);
+	job.mSuccess = true;
+}
+CompiledShader* Compile(ThreadPool* threadPool, const string& filename, const fs::path& cacheDirectory) {
 	string source;
 	if (!ReadFile(filename, source)) {
 		fprintf_color(COLOR_RED, stderr, "Failed to read %s!\n", filename.c_str());
@@ -266,7 +396,14 @@ CompiledShader* Compile(shaderc::Compiler* compiler, const string& filename) {
 						}
 						++it;
 					}
-				
+
+				} else if (*it == "specialize") {
+					if (++it == words.end()) break;
+					// keywords that are specialization constants instead of compiled variants
+					for (; it != words.end(); ++it)
+						if (find(result->mSpecializationKeywords.begin(), result->mSpecializationKeywords.end(), *it) == result->mSpecializationKeywords.end())
+							result->mSpecializationKeywords.push_back(*it);
+
 				} else if (*it == "vertex") {
 					if (++it == words.end()) return nullptr;
 					string ep = *it;
@@ -419,62 +556,91 @@ CompiledShader* Compile(shaderc::Compiler* compiler, const string& filename) {
 		}
 	}
 
-	for (const auto& variant : variants) {
-		auto variantOptions = options;
+	for (const auto& variant : variants)
+		for (const string& kw : result->mSpecializationKeywords)
+			if (variant.count(kw)) {
+				fprintf_color(COLOR_RED, stderr, "%s is both a multi_compile and a specialize keyword\n", kw.c_str());
+				return nullptr;
+			}
 
-		vector<string> keywords;
-		for (const auto& kw : variant) {
-			if (kw.empty()) continue;
-			keywords.push_back(kw);
-			variantOptions.AddMacroDefinition(kw);
+	// specialize keywords are declared as bool specialization constants, numbered in the order they're declared, so the
+	// shader can branch on them. #line keeps error line numbers pointing into the file
+	if (result->mSpecializationKeywords.size()) {
+		string declarations = "";
+		for (uint32_t i = 0; i < result->mSpecializationKeywords.size(); i++)
+			declarations += "[[vk::constant_id(" + to_string(i) + ")]] const bool " + result->mSpecializationKeywords[i] + " = false;\n";
+		source = declarations + "#line 1\n" + source;
+	}
+
+	/// applies array and static_sampler pragmas
+	auto UpdateBindings = [&](CompiledVariant& input) {
+		for (auto& b : input.mDescriptorBindings) {
+			for (const auto& s : staticSamplers)
+				if (s.first == b.first) {
+					input.mStaticSamplers.emplace(s.first, s.second);
+					break;
+				}
+			for (const auto& s : arrays)
+				if (s.first == b.first) {
+					b.second.second.descriptorCount = s.second;
+					break;
+				}
 		}
+	};
+
+	// collect the stages of every variant, stages with the same entry point and macros are only compiled once
+	vector<StageJob> jobs;
+	unordered_map<string, uint32_t> jobIndices;
+	auto AddStage = [&](shaderc_shader_kind stage, const string& entryPoint, const vector<string>& macros) {
+		string key = to_string(stage) + " " + entryPoint;
+		for (const string& m : macros) key += " " + m;
+		auto it = jobIndices.find(key);
+		if (it != jobIndices.end()) return it->second;
+
+		StageJob job = {};
+		job.mStage = stage;
+		job.mEntryPoint = entryPoint;
+		job.mMacros = macros;
+		jobs.push_back(job);
+		jobIndices.emplace(key, (uint32_t)jobs.size() - 1);
+		return (uint32_t)jobs.size() - 1;
+	};
+
+	// mModules holds job indices until the jobs have run
+	vector<CompiledVariant> compiledVariants;
 
-		/// applies array and static_sampler pragmas
-		auto UpdateBindings = [&](CompiledVariant& input) {
-			for (auto& b : input.mDescriptorBindings) {
-				for (const auto& s : staticSamplers)
-					if (s.first == b.first) {
-						input.mStaticSamplers.emplace(s.first, s.second);
-						break;
-					}
-				for (const auto& s : arrays)
-					if (s.first == b.first) {
-						b.second.second.descriptorCount = s.second;
-						break;
-					}
-			}
-		};
+	for (const auto& variant : variants) {
+		vector<string> keywords;
+		for (const auto& kw : variant)
+			if (!kw.empty()) keywords.push_back(kw);
 
 		if (kernels.size()) {
-			auto stageOptions = variantOptions;
-			stageOptions.AddMacroDefinition("SHADER_STAGE_COMPUTE");
+			vector<string> macros = keywords;
+			macros.push_back("SHADER_STAGE_COMPUTE");
 			for (const auto& k : kernels) {
 				// compile all kernels for this variant
 				CompiledVariant v = {};
 				v.mPass = (PassType)0;
 				v.mKeywords = keywords;
 				v.mEntryPoints[0] = k;
-				if (!CompileStage(compiler, stageOptions, source, filename, shaderc_compute_shader, k, v, *result)) return nullptr;
-				UpdateBindings(v);
-				result->mVariants.push_back(v);
+				v.mModules[0] = AddStage(shaderc_compute_shader, k, macros);
+				compiledVariants.push_back(v);
 			}
 		} else {
-			unordered_map<string, uint32_t> compiled;
-
 			for (auto& stagep : passes) {
-				auto vsOptions = variantOptions;
-				auto fsOptions = variantOptions;
-				vsOptions.AddMacroDefinition("SHADER_STAGE_VERTEX");
-				fsOptions.AddMacroDefinition("SHADER_STAGE_FRAGMENT");
+				vector<string> vsMacros = keywords;
+				vector<string> fsMacros = keywords;
+				vsMacros.push_back("SHADER_STAGE_VERTEX");
+				fsMacros.push_back("SHADER_STAGE_FRAGMENT");
 				// compile all passes for this variant
 				switch (stagep.first) {
 				case PASS_MAIN:
-					vsOptions.AddMacroDefinition("PASS_MAIN");
-					fsOptions.AddMacroDefinition("PASS_MAIN");
+					vsMacros.push_back("PASS_MAIN");
+					fsMacros.push_back("PASS_MAIN");
 					break;
 				case PASS_DEPTH:
-					vsOptions.AddMacroDefinition("PASS_DEPTH");
-					fsOptions.AddMacroDefinition("PASS_DEPTH");
+					vsMacros.push_back("PASS_DEPTH");
+					fsMacros.push_back("PASS_DEPTH");
 					break;
 				}
 
@@ -497,28 +663,58 @@ CompiledShader* Compile(shaderc::Compiler* compiler, const string& filename) {
 				v.mPass = stagep.first;
 				v.mEntryPoints[0] = vs;
 				v.mEntryPoints[1] = fs;
+				v.mModules[0] = AddStage(shaderc_vertex_shader, vs, vsMacros);
+				v.mModules[1] = AddStage(shaderc_fragment_shader, fs, fsMacros);
+				compiledVariants.push_back(v);
+			}
+		}
+	}
 
-				// Don't recompile shared stages
-				//if (compiled.count(vs)) {
-				//	v.mModules[0] = compiled.at(vs);
-				//} else {
-					if (!CompileStage(compiler, vsOptions, source, filename, shaderc_vertex_shader, vs, v, *result)) return nullptr;
-				//	compiled.emplace(vs, v.mModules[0]);
-				//}
-				
-				//if (compiled.count(fs)) {
-				//	v.mModules[1] = compiled.at(fs);
-				//} else {
-					if (!CompileStage(compiler, fsOptions, source, filename, shaderc_fragment_shader, fs, v, *result)) return nullptr;
-				//	compiled.emplace(fs, v.mModules[1]);
-				//}
+	threadPool->ParallelFor((uint32_t)jobs.size(), [&](uint32_t i) {
+		CompileStage(jobs[i], i, source, filename, cacheDirectory);
+	});
 
-				UpdateBindings(v);
+	for (const StageJob& job : jobs)
+		if (!job.mSuccess) {
+			delete result;
+			return nullptr;
+		}
 
-				result->mVariants.push_back(v);
+	// stages with identical preprocessed source (ie. a macro they don't use differs) share one module
+	unordered_map<uint64_t, uint32_t> moduleIndices;
+	vector<uint32_t> jobModules(jobs.size());
+	uint32_t cachedCount = 0;
+	for (uint32_t i = 0; i < jobs.size(); i++) {
+		if (jobs[i].mCached) cachedCount++;
+		auto it = moduleIndices.find(jobs[i].mSourceHash);
+		if (it == moduleIndices.end()) {
+			it = moduleIndices.emplace(jobs[i].mSourceHash, (uint32_t)result->mModules.size()).first;
+			result->mModules.push_back(jobs[i].mModule);
+		}
+		jobModules[i] = it->second;
+	}
+
+	for (CompiledVariant& v : compiledVariants) {
+		uint32_t stageCount = v.mPass == (PassType)0 ? 1 : 2;
+		v.mWorkgroupSize = jobs[v.mModules[0]].mReflection.mWorkgroupSize;
+		for (uint32_t s = 0; s < stageCount; s++) {
+			const CompiledVariant& reflection = jobs[v.mModules[s]].mReflection;
+			for (const auto& b : reflection.mDescriptorBindings) {
+				auto& binding = v.mDescriptorBindings[b.first];
+				VkShaderStageFlags stageFlags = binding.second.stageFlags | b.second.second.stageFlags;
+				binding = b.second;
+				binding.second.stageFlags = stageFlags;
 			}
+			for (const auto& p : reflection.mPushConstants)
+				v.mPushConstants[p.first] = p.second;
+			v.mModules[s] = jobModules[v.mModules[s]];
 		}
+		UpdateBindings(v);
+		result->mVariants.push_back(v);
 	}
+
+	printf("%u variants, %u specialization keywords, %u stages (%u from cache), %u modules\n",
+		(uint32_t)result->mVariants.size(), (uint32_t)result->mSpecializationKeywords.size(), (uint32_t)jobs.size(), cachedCount, (uint32_t)result->mModules.size());
 	return result;
 }
 
@@ -526,37 +722,55 @@ int main(int argc, char* argv[]) {
 	char* inputFile;
 	char* outputFile;
 
-	if (argc < 2) {
-		//*
-		fprintf(stderr, "Usage: %s <input> <output>\n", argv[0]);
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <input> <output> [cache directory]\n", argv[0]);
 		return EXIT_FAILURE;
-		/*/
-		inputFile = "E:/Projects/Vulkan/Stratum/Shaders/pbr.hlsl";
-		outputFile = "Shaders/pbr.stm";
-		//*/
 	} else {
 		inputFile = argv[1];
 		outputFile = argv[2];
 	}
 
+	// compiled modules are cached next to the engine's pipeline cache by default
+	fs::path cacheDirectory = argc > 3 ? fs::path(argv[3]) : fs::path(outputFile).parent_path().parent_path() / "Cache" / "Shaders";
+	error_code ec;
+	fs::create_directories(cacheDirectory, ec);
+
 	printf("Compiling %s\n", inputFile);
+	auto start = chrono::high_resolution_clock::now();
 	
 	options.SetIncluder(make_unique<Includer>());
 	options.SetSourceLanguage(shaderc_source_language_hlsl);
+	gCompilerHash = CompilerHash();
 
-	Compiler* compiler = new Compiler();
-	CompiledShader* shader = Compile(compiler, inputFile);
+	ThreadPool* threadPool = new ThreadPool();
+	CompiledShader* shader = Compile(threadPool, inputFile, cacheDirectory);
+	delete threadPool;
+	TrimCache(cacheDirectory);
 	
 	if (!shader) return EXIT_FAILURE;
 
-	// write shader
-	ofstream output(outputFile, ios::binary);
+	// write shader. A running engine may have the .stm mapped, truncating it in place would crash it, so the new file is written
+	// next to it and renamed over it. The mapping keeps the old file's contents
+	fs::path tmp = outputFile;
+	tmp += ".tmp";
+	ofstream output(tmp, ios::binary);
 	shader->Write(output);
 	output.close();
-
 	delete shader;
 
-	delete compiler;
+	if (!output) {
+		fprintf(stderr, "Could not write %s\n", tmp.string().c_str());
+		fs::remove(tmp, ec);
+		return EXIT_FAILURE;
+	}
+	fs::rename(tmp, outputFile, ec);
+	if (ec) {
+		fprintf(stderr, "Could not replace %s: %s\n", outputFile, ec.message().c_str());
+		fs::remove(tmp, ec);
+		return EXIT_FAILURE;
+	}
 
+	uintmax_t size = fs::file_size(outputFile, ec);
+	printf("Compiled %s in %.2fs, %.1f KiB\n", inputFile, chrono::duration_cast<chrono::duration<float>>(chrono::high_resolution_clock::now() - start).count(), ec ? 0.f : size / 1024.f);
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
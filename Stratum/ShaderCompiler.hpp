@@ -3,16 +3,65 @@
 #include <fstream>
 #include <Util/Util.hpp>
 
+#define COMPILED_SHADER_MAGIC 0x204D5453 // "STM "
+// increment whenever the layout of CompiledShader, CompiledVariant or SpirvModule changes
+#define COMPILED_SHADER_VERSION 1
+
+/// Reads a compiled shader in place, so the SPIR-V in it can be used without copying it out
+struct MemoryStream {
+	const uint8_t* mData;
+	size_t mSize;
+	size_t mOffset;
+	// set once a read goes past the end
+	bool mFailed;
+
+	inline MemoryStream(const uint8_t* data, size_t size) : mData(data), mSize(size), mOffset(0), mFailed(false) {}
+
+	inline MemoryStream& read(char* dest, size_t size) {
+		if (mFailed || size > mSize - mOffset) {
+			memset(dest, 0, size);
+			mFailed = true;
+			return *this;
+		}
+		memcpy(dest, mData + mOffset, size);
+		mOffset += size;
+		return *this;
+	}
+	/// Skips size bytes and returns a pointer to them, or nullptr if there aren't enough bytes left
+	inline const uint8_t* Skip(size_t size) {
+		if (mFailed || size > mSize - mOffset) {
+			mFailed = true;
+			return nullptr;
+		}
+		const uint8_t* data = mData + mOffset;
+		mOffset += size;
+		return data;
+	}
+	inline explicit operator bool() const { return !mFailed; }
+};
+
 struct SpirvModule {
 	std::vector<uint32_t> mSpirv;
+	// points into the stream's memory instead of mSpirv when the module was read from a MemoryStream
+	const uint32_t* mMappedSpirv;
+	uint32_t mMappedSize;
 
-	inline SpirvModule() {}
+	inline SpirvModule() : mMappedSpirv(nullptr), mMappedSize(0) {}
 	inline void Read(std::ifstream& file) {
 		uint32_t l;
 		file.read(reinterpret_cast<char*>(&l), sizeof(uint32_t));
 		mSpirv.resize(l);
 		file.read(reinterpret_cast<char*>(mSpirv.data()), mSpirv.size() * sizeof(uint32_t));
 	}
+	inline void Read(MemoryStream& stream) {
+		uint32_t l;
+		stream.read(reinterpret_cast<char*>(&l), sizeof(uint32_t));
+		mMappedSpirv = reinterpret_cast<const uint32_t*>(stream.Skip(l * sizeof(uint32_t)));
+		mMappedSize = mMappedSpirv ? l : 0;
+	}
+	inline const uint32_t* Data() const { return mMappedSpirv ? mMappedSpirv : mSpirv.data(); }
+	/// Size in words
+	inline size_t Size() const { return mMappedSpirv ? mMappedSize : mSpirv.size(); }
 	inline void Write(std::ofstream& file) {
 		uint32_t l = (uint32_t)mSpirv.size();
 		file.write(reinterpret_cast<char*>(&l), sizeof(uint32_t));
@@ -35,7 +84,8 @@ struct CompiledVariant {
 	std::vector<std::string> mKeywords;
 
 	inline CompiledVariant() {}
-	inline void Read(std::ifstream& file) {
+	template<typename Stream>
+	inline void Read(Stream& file) {
 		uint32_t c;
 		file.read(reinterpret_cast<char*>(&c), sizeof(uint32_t));
 		for (uint32_t i = 0; i < c; i++) {
@@ -160,6 +210,8 @@ struct CompiledVariant {
 };
 
 struct CompiledShader {
+	// COMPILED_SHADER_VERSION when the shader was read from a .stm written by the current ShaderCompiler, 0 if it's from another version
+	uint32_t mVersion;
 	std::vector<SpirvModule> mModules;
 	std::vector<CompiledVariant> mVariants;
 
@@ -169,9 +221,20 @@ struct CompiledShader {
 	VkPolygonMode mFillMode;
 	BlendMode mBlendMode;
 	VkPipelineDepthStencilStateCreateInfo mDepthStencilState;
+	// keywords that select specialization constants instead of variants, the constant id is the index
+	std::vector<std::string> mSpecializationKeywords;
+
+	inline CompiledShader() : mVersion(COMPILED_SHADER_VERSION) {}
+	/// file is a std::ifstream, or a MemoryStream to leave the SPIR-V in place. Nothing past the header is read if the
+	/// file was written by another version of the ShaderCompiler
+	template<typename Stream>
+	inline CompiledShader(Stream& file) : mVersion(0) {
+		uint32_t magic = 0, version = 0;
+		file.read(reinterpret_cast<char*>(&magic), sizeof(uint32_t));
+		file.read(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+		if (magic != COMPILED_SHADER_MAGIC || version != COMPILED_SHADER_VERSION) return;
+		mVersion = version;
 
-	inline CompiledShader() {}
-	inline CompiledShader(std::ifstream& file) {
 		uint32_t mc;
 		file.read(reinterpret_cast<char*>(&mc), sizeof(uint32_t));
 		mModules.resize(mc);
@@ -190,9 +253,24 @@ struct CompiledShader {
 		file.read(reinterpret_cast<char*>(&mFillMode), sizeof(VkPolygonMode));
 		file.read(reinterpret_cast<char*>(&mBlendMode), sizeof(BlendMode));
 		file.read(reinterpret_cast<char*>(&mDepthStencilState), sizeof(VkPipelineDepthStencilStateCreateInfo));
+
+		uint32_t sc;
+		file.read(reinterpret_cast<char*>(&sc), sizeof(uint32_t));
+		mSpecializationKeywords.resize(sc);
+		for (uint32_t i = 0; i < sc; i++) {
+			uint32_t l;
+			file.read(reinterpret_cast<char*>(&l), sizeof(uint32_t));
+			mSpecializationKeywords[i].resize(l);
+			if (l) file.read(mSpecializationKeywords[i].data(), l);
+		}
 	}
 
 	inline void Write(std::ofstream& file) {
+		uint32_t magic = COMPILED_SHADER_MAGIC;
+		uint32_t version = COMPILED_SHADER_VERSION;
+		file.write(reinterpret_cast<char*>(&magic), sizeof(uint32_t));
+		file.write(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+
 		uint32_t mc = (uint32_t)mModules.size();
 		file.write(reinterpret_cast<char*>(&mc), sizeof(uint32_t));
 		for (SpirvModule& m : mModules)
@@ -209,5 +287,13 @@ struct CompiledShader {
 		file.write(reinterpret_cast<char*>(&mFillMode), sizeof(VkPolygonMode));
 		file.write(reinterpret_cast<char*>(&mBlendMode), sizeof(BlendMode));
 		file.write(reinterpret_cast<char*>(&mDepthStencilState), sizeof(VkPipelineDepthStencilStateCreateInfo));
+
+		uint32_t sc = (uint32_t)mSpecializationKeywords.size();
+		file.write(reinterpret_cast<char*>(&sc), sizeof(uint32_t));
+		for (std::string& kw : mSpecializationKeywords) {
+			uint32_t l = (uint32_t)kw.length();
+			file.write(reinterpret_cast<char*>(&l), sizeof(uint32_t));
+			if (l) file.write(kw.data(), kw.length());
+		}
 	}
 };
\ No newline at end of file
@@ -30,6 +30,9 @@ private:
 		shared_ptr<CommandBuffer> commandBuffer = mScene->Instance()->Device()->GetCommandBuffer();
 		PROFILER_END;
 
+		// times the whole frame on the GPU, for the frame's root profiler sample
+		BEGIN_CMD_REGION(commandBuffer.get(), "Frame");
+
 		mScene->PreFrame(commandBuffer.get());
 
 		PROFILER_BEGIN("Render Cameras");
@@ -72,6 +75,8 @@ private:
 				camera->PostRender(commandBuffer.get());
 		PROFILER_END;
 
+		END_CMD_REGION(commandBuffer.get());
+
 		PROFILER_BEGIN("Execute CommandBuffer");
 		mInstance->Device()->Execute(commandBuffer);
 		PROFILER_END;
@@ -114,6 +119,10 @@ public:
 			mInstance->Window()->AcquireNextImage();
 			PROFILER_END;
 
+			PROFILER_BEGIN("Finish Uploads");
+			mAssetManager->Update();
+			PROFILER_END;
+
 			mScene->Update();
 			Render();
 
@@ -0,0 +1,619 @@
+#include <cfloat>
+#include <chrono>
+
+#include <Content/Ktx2.hpp>
+#include <Util/ThreadPool.hpp>
+#include <ThirdParty/stb_image.h>
+
+using namespace std;
+
+// images converted when a directory is given
+static const char* ImageExtensions[] = { ".png", ".jpg", ".jpeg", ".tga", ".bmp", ".psd", ".gif", ".hdr" };
+// images whose names end with these hold data rather than color, and are converted linear unless -srgb is given
+static const char* LinearSuffixes[] = { "_n", "_nrm", "_normal", "_normals", "_bump", "_height", "_disp", "_displacement", "_mask", "_rough", "_roughness", "_metal", "_metallic", "_orm", "_ao", "_occlusion", "_spec", "_specular", "_gloss" };
+
+// BC7 mode 6 and BC6H mode 11 interpolation weights of 4 bit indices, in 64ths
+static const uint32_t Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct Image {
+	uint32_t mWidth;
+	uint32_t mHeight;
+	vector<float4> mPixels;
+};
+
+enum BlockFormat { BC1, BC3, BC4, BC5, BC6H, BC7 };
+
+// writes fields into a zeroed block, starting at the least significant bit
+struct BitWriter {
+	uint8_t* mData;
+	uint32_t mOffset;
+
+	inline void Write(uint32_t value, uint32_t bits) {
+		for (uint32_t i = 0; i < bits; i++, mOffset++)
+			if ((value >> i) & 1) mData[mOffset / 8] |= 1 << (mOffset % 8);
+	}
+};
+
+inline float SrgbToLinear(float c) {
+	return c <= .04045f ? c / 12.92f : powf((c + .055f) / 1.055f, 2.4f);
+}
+inline float LinearToSrgb(float c) {
+	c = clamp(c, 0.f, 1.f);
+	return c <= .0031308f ? c * 12.92f : 1.055f * powf(c, 1 / 2.4f) - .055f;
+}
+
+// positive half float bits of f, which compare the same as their values
+inline uint16_t FloatToHalf(float f) {
+	if (!(f > 0)) return 0;
+	if (f >= 65504.f) return 0x7BFF;
+	if (f < 6.1035156e-5f) return (uint16_t)(f * 16777216.f + .5f);
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(float));
+	uint32_t exponent = ((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = ((bits & 0x7FFFFF) + 0x1000) >> 13;
+	if (mantissa == 0x400) {
+		mantissa = 0;
+		if (++exponent >= 31) return 0x7BFF;
+	}
+	return (uint16_t)((exponent << 10) | mantissa);
+}
+
+// finds the extremes of the line through the first channelCount channels of the pixels that fits them best
+void FitLine(const float4* pixels, uint32_t channelCount, float4& e0, float4& e1) {
+	float4 mean = 0;
+	for (uint32_t i = 0; i < 16; i++) mean += pixels[i];
+	mean /= 16.f;
+
+	float covariance[4][4] = {};
+	for (uint32_t i = 0; i < 16; i++) {
+		float4 d = pixels[i] - mean;
+		for (uint32_t r = 0; r < channelCount; r++)
+			for (uint32_t c = 0; c < channelCount; c++)
+				covariance[r][c] += d.v[r] * d.v[c];
+	}
+
+	// power iteration for the principal axis
+	float4 axis = 0;
+	for (uint32_t c = 0; c < channelCount; c++) axis.v[c] = 1;
+	for (uint32_t k = 0; k < 8; k++) {
+		float4 next = 0;
+		for (uint32_t r = 0; r < channelCount; r++)
+			for (uint32_t c = 0; c < channelCount; c++)
+				next.v[r] += covariance[r][c] * axis.v[c];
+		float len = sqrtf(dot(next, next));
+		if (len < 1e-12f) break;
+		axis = next / len;
+	}
+
+	float tmin = 0, tmax = 0;
+	for (uint32_t i = 0; i < 16; i++) {
+		float t = 0;
+		for (uint32_t c = 0; c < channelCount; c++) t += (pixels[i].v[c] - mean.v[c]) * axis.v[c];
+		tmin = min(tmin, t);
+		tmax = max(tmax, t);
+	}
+	e0 = e1 = mean;
+	for (uint32_t c = 0; c < channelCount; c++) {
+		e0.v[c] += axis.v[c] * tmin;
+		e1.v[c] += axis.v[c] * tmax;
+	}
+}
+
+inline uint16_t To565(const float4& c) {
+	uint32_t r = (uint32_t)(clamp(c.r, 0.f, 1.f) * 31 + .5f);
+	uint32_t g = (uint32_t)(clamp(c.g, 0.f, 1.f) * 63 + .5f);
+	uint32_t b = (uint32_t)(clamp(c.b, 0.f, 1.f) * 31 + .5f);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+inline float4 From565(uint16_t c) {
+	return float4(((c >> 11) & 31) / 31.f, ((c >> 5) & 63) / 63.f, (c & 31) / 31.f, 1);
+}
+
+// 4 color BC1 block, which is also the color half of BC3
+void EncodeBC1(const float4* pixels, uint8_t* block) {
+	float4 e0, e1;
+	FitLine(pixels, 3, e0, e1);
+	uint16_t c0 = To565(e1);
+	uint16_t c1 = To565(e0);
+	// c0 > c1 selects the 4 color mode in BC1
+	if (c0 < c1) swap(c0, c1);
+
+	uint32_t indices = 0;
+	if (c0 != c1) {
+		float4 palette[4];
+		palette[0] = From565(c0);
+		palette[1] = From565(c1);
+		palette[2] = (palette[0] * 2 + palette[1]) / 3.f;
+		palette[3] = (palette[0] + palette[1] * 2) / 3.f;
+		for (uint32_t i = 0; i < 16; i++) {
+			uint32_t best = 0;
+			float bestError = FLT_MAX;
+			for (uint32_t k = 0; k < 4; k++) {
+				float3 d = pixels[i].rgb - palette[k].rgb;
+				float error = dot(d, d);
+				if (error < bestError) {
+					bestError = error;
+					best = k;
+				}
+			}
+			indices |= best << (2 * i);
+		}
+	}
+	memcpy(block, &c0, sizeof(uint16_t));
+	memcpy(block + 2, &c1, sizeof(uint16_t));
+	memcpy(block + 4, &indices, sizeof(uint32_t));
+}
+
+// 8 value BC4 block of one channel, which is also the alpha half of BC3 and each half of BC5
+void EncodeBC4(const float4* pixels, uint32_t channel, uint8_t* block) {
+	float mn = 1, mx = 0;
+	for (uint32_t i = 0; i < 16; i++) {
+		float v = clamp(pixels[i].v[channel], 0.f, 1.f);
+		mn = min(mn, v);
+		mx = max(mx, v);
+	}
+	uint32_t a0 = (uint32_t)(mx * 255 + .5f);
+	uint32_t a1 = (uint32_t)(mn * 255 + .5f);
+
+	uint64_t bits = a0 | (a1 << 8);
+	if (a0 > a1) {
+		float palette[8] = { (float)a0, (float)a1 };
+		for (uint32_t k = 2; k < 8; k++) palette[k] = (float)(((8 - k) * a0 + (k - 1) * a1) / 7);
+		for (uint32_t i = 0; i < 16; i++) {
+			float v = clamp(pixels[i].v[channel], 0.f, 1.f) * 255;
+			uint64_t best = 0;
+			float bestError = FLT_MAX;
+			for (uint32_t k = 0; k < 8; k++) {
+				float error = fabsf(v - palette[k]);
+				if (error < bestError) {
+					bestError = error;
+					best = k;
+				}
+			}
+			bits |= best << (16 + 3 * i);
+		}
+	}
+	memcpy(block, &bits, sizeof(uint64_t));
+}
+
+// quantizes an endpoint to 7 bits per channel and the p-bit shared by its channels that fits it best
+void QuantizeBC7(const float4& e, uint32_t q[4], uint32_t& p) {
+	float bestError = FLT_MAX;
+	for (uint32_t pbit = 0; pbit < 2; pbit++) {
+		uint32_t qp[4];
+		float error = 0;
+		for (uint32_t c = 0; c < 4; c++) {
+			float v = clamp(e.v[c], 0.f, 1.f) * 255;
+			qp[c] = (uint32_t)clamp(floorf((v - pbit) / 2 + .5f), 0.f, 127.f);
+			float d = (float)((qp[c] << 1) | pbit) - v;
+			error += d * d;
+		}
+		if (error < bestError) {
+			bestError = error;
+			memcpy(q, qp, sizeof(qp));
+			p = pbit;
+		}
+	}
+}
+
+// BC7 mode 6: a single RGBA line with 7 bit endpoints, a p-bit per endpoint and 4 bit indices
+void EncodeBC7(const float4* pixels, uint8_t* block) {
+	float4 e0, e1;
+	FitLine(pixels, 4, e0, e1);
+	uint32_t q[2][4], p[2];
+	QuantizeBC7(e0, q[0], p[0]);
+	QuantizeBC7(e1, q[1], p[1]);
+
+	float4 palette[16];
+	for (uint32_t k = 0; k < 16; k++)
+		for (uint32_t c = 0; c < 4; c++) {
+			uint32_t a = (q[0][c] << 1) | p[0];
+			uint32_t b = (q[1][c] << 1) | p[1];
+			palette[k].v[c] = (float)(((64 - Weights4[k]) * a + Weights4[k] * b + 32) >> 6);
+		}
+	uint32_t indices[16];
+	for (uint32_t i = 0; i < 16; i++) {
+		float4 v = clamp(pixels[i], float4(0), float4(1)) * 255;
+		float bestError = FLT_MAX;
+		for (uint32_t k = 0; k < 16; k++) {
+			float4 d = v - palette[k];
+			float error = dot(d, d);
+			if (error < bestError) {
+				bestError = error;
+				indices[i] = k;
+			}
+		}
+	}
+	// the anchor index is stored without its high bit
+	if (indices[0] & 8) {
+		swap(q[0], q[1]);
+		swap(p[0], p[1]);
+		for (uint32_t i = 0; i < 16; i++) indices[i] = 15 - indices[i];
+	}
+
+	memset(block, 0, 16);
+	BitWriter writer = { block, 0 };
+	writer.Write(1 << 6, 7);
+	for (uint32_t c = 0; c < 4; c++) {
+		writer.Write(q[0][c], 7);
+		writer.Write(q[1][c], 7);
+	}
+	writer.Write(p[0], 1);
+	writer.Write(p[1], 1);
+	writer.Write(indices[0], 3);
+	for (uint32_t i = 1; i < 16; i++) writer.Write(indices[i], 4);
+}
+
+inline uint32_t UnquantizeBC6H(uint32_t q) {
+	if (q == 0) return 0;
+	if (q == 1023) return 0xFFFF;
+	return ((q << 16) + 0x8000) >> 10;
+}
+
+// BC6H mode 11: a single unsigned RGB line with 10 bit endpoints and 4 bit indices. Endpoints are fit to the half float bits of the
+// pixels, which is roughly logarithmic and how the hardware interpolates
+void EncodeBC6H(const float4* pixels, uint8_t* block) {
+	float4 halves[16];
+	for (uint32_t i = 0; i < 16; i++)
+		for (uint32_t c = 0; c < 3; c++)
+			halves[i].v[c] = FloatToHalf(pixels[i].v[c]);
+
+	float4 e[2];
+	FitLine(halves, 3, e[0], e[1]);
+	uint32_t q[2][3];
+	for (uint32_t j = 0; j < 2; j++)
+		for (uint32_t c = 0; c < 3; c++)
+			// the decoder scales unquantized values by 31/64, so a half value h comes from q = h / 31
+			q[j][c] = (uint32_t)clamp(e[j].v[c] / 31 + .5f, 0.f, 1023.f);
+
+	float4 palette[16];
+	for (uint32_t k = 0; k < 16; k++)
+		for (uint32_t c = 0; c < 3; c++) {
+			uint32_t v = ((64 - Weights4[k]) * UnquantizeBC6H(q[0][c]) + Weights4[k] * UnquantizeBC6H(q[1][c]) + 32) >> 6;
+			palette[k].v[c] = (float)((v * 31) >> 6);
+		}
+	uint32_t indices[16];
+	for (uint32_t i = 0; i < 16; i++) {
+		float bestError = FLT_MAX;
+		for (uint32_t k = 0; k < 16; k++) {
+			float3 d = halves[i].rgb - palette[k].rgb;
+			float error = dot(d, d);
+			if (error < bestError) {
+				bestError = error;
+				indices[i] = k;
+			}
+		}
+	}
+	if (indices[0] & 8) {
+		swap(q[0], q[1]);
+		for (uint32_t i = 0; i < 16; i++) indices[i] = 15 - indices[i];
+	}
+
+	memset(block, 0, 16);
+	BitWriter writer = { block, 0 };
+	writer.Write(0x03, 5);
+	for (uint32_t j = 0; j < 2; j++)
+		for (uint32_t c = 0; c < 3; c++)
+			writer.Write(q[j][c], 10);
+	writer.Write(indices[0], 3);
+	for (uint32_t i = 1; i < 16; i++) writer.Write(indices[i], 4);
+}
+
+// halves the image with a box filter, in linear space
+Image Downsample(const Image& src) {
+	Image dst;
+	dst.mWidth = max(src.mWidth / 2, 1u);
+	dst.mHeight = max(src.mHeight / 2, 1u);
+	dst.mPixels.resize(dst.mWidth * dst.mHeight);
+	for (uint32_t y = 0; y < dst.mHeight; y++)
+		for (uint32_t x = 0; x < dst.mWidth; x++) {
+			uint32_t x0 = min(2 * x, src.mWidth - 1), x1 = min(2 * x + 1, src.mWidth - 1);
+			uint32_t y0 = min(2 * y, src.mHeight - 1), y1 = min(2 * y + 1, src.mHeight - 1);
+			dst.mPixels[y * dst.mWidth + x] = (
+				src.mPixels[y0 * src.mWidth + x0] + src.mPixels[y0 * src.mWidth + x1] +
+				src.mPixels[y1 * src.mWidth + x0] + src.mPixels[y1 * src.mWidth + x1]) * .25f;
+		}
+	return dst;
+}
+
+// compresses every 4x4 block of the image, replicating the edge pixels into blocks that overhang it
+vector<uint8_t> Compress(ThreadPool* threadPool, const Image& image, BlockFormat format, bool srgb) {
+	uint32_t blocksX = (image.mWidth + 3) / 4;
+	uint32_t blocksY = (image.mHeight + 3) / 4;
+	uint32_t blockSize = (format == BC1 || format == BC4) ? 8 : 16;
+	vector<uint8_t> data(blocksX * blocksY * blockSize);
+
+	threadPool->ParallelFor(blocksY, [&](uint32_t by) {
+		for (uint32_t bx = 0; bx < blocksX; bx++) {
+			float4 pixels[16];
+			for (uint32_t i = 0; i < 16; i++) {
+				uint32_t x = min(bx * 4 + i % 4, image.mWidth - 1);
+				uint32_t y = min(by * 4 + i / 4, image.mHeight - 1);
+				pixels[i] = image.mPixels[y * image.mWidth + x];
+				if (srgb)
+					for (uint32_t c = 0; c < 3; c++)
+						pixels[i].v[c] = LinearToSrgb(pixels[i].v[c]);
+			}
+			uint8_t* block = data.data() + (by * blocksX + bx) * blockSize;
+			switch (format) {
+			case BC1:
+				EncodeBC1(pixels, block);
+				break;
+			case BC3:
+				EncodeBC4(pixels, 3, block);
+				EncodeBC1(pixels, block + 8);
+				break;
+			case BC4:
+				EncodeBC4(pixels, 0, block);
+				break;
+			case BC5:
+				EncodeBC4(pixels, 0, block);
+				EncodeBC4(pixels, 1, block + 8);
+				break;
+			case BC6H:
+				EncodeBC6H(pixels, block);
+				break;
+			case BC7:
+				EncodeBC7(pixels, block);
+				break;
+			}
+		}
+	});
+	return data;
+}
+
+VkFormat VulkanFormat(BlockFormat format, bool srgb) {
+	switch (format) {
+	case BC1: return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	case BC3: return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+	case BC4: return VK_FORMAT_BC4_UNORM_BLOCK;
+	case BC5: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case BC6H: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+	default: return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+	}
+}
+
+// the data format descriptor: a basic descriptor block with a sample for each channel group of the block
+vector<uint32_t> DataFormatDescriptor(BlockFormat format, bool srgb) {
+	struct Sample {
+		uint32_t mBitOffset;
+		uint32_t mBitLength;
+		uint32_t mChannel;
+		uint32_t mUpper;
+	};
+	vector<Sample> samples;
+	uint32_t model;
+	switch (format) {
+	case BC1:
+		model = KHR_DF_MODEL_BC1A;
+		samples.push_back({ 0, 64, KHR_DF_CHANNEL_COLOR, 0xFFFFFFFF });
+		break;
+	case BC3:
+		model = KHR_DF_MODEL_BC3;
+		// alpha is never sRGB encoded
+		samples.push_back({ 0, 64, KHR_DF_CHANNEL_ALPHA | (srgb ? 0x10u : 0), 0xFFFFFFFF });
+		samples.push_back({ 64, 64, KHR_DF_CHANNEL_COLOR, 0xFFFFFFFF });
+		break;
+	case BC4:
+		model = KHR_DF_MODEL_BC4;
+		samples.push_back({ 0, 64, KHR_DF_CHANNEL_COLOR, 0xFFFFFFFF });
+		break;
+	case BC5:
+		model = KHR_DF_MODEL_BC5;
+		samples.push_back({ 0, 64, KHR_DF_CHANNEL_COLOR, 0xFFFFFFFF });
+		samples.push_back({ 64, 64, KHR_DF_CHANNEL_GREEN, 0xFFFFFFFF });
+		break;
+	case BC6H:
+		model = KHR_DF_MODEL_BC6H;
+		samples.push_back({ 0, 128, KHR_DF_CHANNEL_COLOR | KHR_DF_SAMPLE_DATATYPE_FLOAT, 0x3F800000 });
+		break;
+	default:
+		model = KHR_DF_MODEL_BC7;
+		samples.push_back({ 0, 128, KHR_DF_CHANNEL_COLOR, 0xFFFFFFFF });
+		break;
+	}
+
+	uint32_t blockSize = 24 + 16 * (uint32_t)samples.size();
+	vector<uint32_t> dfd;
+	dfd.push_back(4 + blockSize);
+	dfd.push_back(0); // Khronos vendor, basic descriptor type
+	dfd.push_back(2 | (blockSize << 16));
+	dfd.push_back(model | (KHR_DF_PRIMARIES_BT709 << 8) | ((srgb ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR) << 16));
+	dfd.push_back(3 | (3 << 8)); // 4x4x1x1 texel blocks, stored minus one
+	dfd.push_back((format == BC1 || format == BC4) ? 8 : 16);
+	dfd.push_back(0);
+	for (const Sample& s : samples) {
+		dfd.push_back(s.mBitOffset | ((s.mBitLength - 1) << 16) | (s.mChannel << 24));
+		dfd.push_back(0);
+		dfd.push_back(0);
+		dfd.push_back(s.mUpper);
+	}
+	return dfd;
+}
+
+bool WriteKtx2(const fs::path& filename, const Image& image, const vector<vector<uint8_t>>& levels, BlockFormat format, bool srgb) {
+	vector<uint32_t> dfd = DataFormatDescriptor(format, srgb);
+
+	Ktx2Header header = {};
+	memcpy(header.mIdentifier, Ktx2Identifier, KTX2_IDENTIFIER_SIZE);
+	header.mFormat = VulkanFormat(format, srgb);
+	header.mTypeSize = 1;
+	header.mPixelWidth = image.mWidth;
+	header.mPixelHeight = image.mHeight;
+	header.mFaceCount = 1;
+	header.mLevelCount = (uint32_t)levels.size();
+	header.mDfdByteOffset = (uint32_t)(sizeof(Ktx2Header) + sizeof(Ktx2Level) * levels.size());
+	header.mDfdByteLength = (uint32_t)(dfd.size() * sizeof(uint32_t));
+
+	// the level index starts with the largest level, but the level data is stored smallest first
+	vector<Ktx2Level> index(levels.size());
+	uint64_t offset = header.mDfdByteOffset + header.mDfdByteLength;
+	for (uint32_t i = (uint32_t)levels.size(); i-- > 0;) {
+		offset = AlignUp(offset, 16);
+		index[i].mByteOffset = offset;
+		index[i].mByteLength = levels[i].size();
+		index[i].mUncompressedByteLength = levels[i].size();
+		offset += levels[i].size();
+	}
+
+	// written to a temporary file first so a partially written texture is never loaded
+	fs::path tmp = filename;
+	tmp += ".tmp";
+	ofstream output(tmp, ios::binary);
+	if (!output.is_open()) {
+		fprintf_color(COLOR_RED, stderr, "Error: Failed to open %s\n", tmp.string().c_str());
+		return false;
+	}
+	output.write((const char*)&header, sizeof(Ktx2Header));
+	output.write((const char*)index.data(), sizeof(Ktx2Level) * index.size());
+	output.write((const char*)dfd.data(), header.mDfdByteLength);
+	uint64_t position = header.mDfdByteOffset + header.mDfdByteLength;
+	static const char padding[16] = {};
+	for (uint32_t i = (uint32_t)levels.size(); i-- > 0;) {
+		output.write(padding, index[i].mByteOffset - position);
+		output.write((const char*)levels[i].data(), levels[i].size());
+		position = index[i].mByteOffset + index[i].mByteLength;
+	}
+	output.close();
+	if (output.fail()) {
+		fprintf_color(COLOR_RED, stderr, "Error: Failed to write %s\n", tmp.string().c_str());
+		return false;
+	}
+
+	error_code ec;
+	fs::rename(tmp, filename, ec);
+	if (ec) {
+		fprintf_color(COLOR_RED, stderr, "Error: Failed to write %s\n", filename.string().c_str());
+		fs::remove(tmp, ec);
+		return false;
+	}
+	return true;
+}
+
+bool IsLinearName(const fs::path& file) {
+	string stem = file.stem().string();
+	transform(stem.begin(), stem.end(), stem.begin(), ::tolower);
+	for (const char* suffix : LinearSuffixes) {
+		size_t length = strlen(suffix);
+		if (stem.length() > length && stem.compare(stem.length() - length, length, suffix) == 0) return true;
+	}
+	return false;
+}
+
+bool Convert(ThreadPool* threadPool, const fs::path& input, const fs::path& output, int32_t format, bool linear) {
+	string filename = input.string();
+	int32_t x, y, channels;
+	if (!stbi_info(filename.c_str(), &x, &y, &channels)) {
+		fprintf_color(COLOR_RED, stderr, "Error: Failed to load %s: %s\n", filename.c_str(), stbi_failure_reason());
+		return false;
+	}
+	// HDR and 16 bit images are never sRGB, the same as when Texture loads them. BC4 and BC5 only store linear data
+	bool hdr = stbi_is_hdr(filename.c_str());
+	BlockFormat blockFormat = format < 0 ? (hdr ? BC6H : BC7) : (BlockFormat)format;
+	bool srgb = !linear && !hdr && !stbi_is_16_bit(filename.c_str()) && blockFormat != BC4 && blockFormat != BC5;
+
+	Image image;
+	image.mWidth = x;
+	image.mHeight = y;
+	image.mPixels.resize(x * y);
+	if (hdr) {
+		float* pixels = stbi_loadf(filename.c_str(), &x, &y, &channels, 4);
+		if (!pixels) {
+			fprintf_color(COLOR_RED, stderr, "Error: Failed to load %s: %s\n", filename.c_str(), stbi_failure_reason());
+			return false;
+		}
+		memcpy(image.mPixels.data(), pixels, image.mPixels.size() * sizeof(float4));
+		stbi_image_free(pixels);
+	} else {
+		uint16_t* pixels = stbi_load_16(filename.c_str(), &x, &y, &channels, 4);
+		if (!pixels) {
+			fprintf_color(COLOR_RED, stderr, "Error: Failed to load %s: %s\n", filename.c_str(), stbi_failure_reason());
+			return false;
+		}
+		for (size_t i = 0; i < image.mPixels.size(); i++)
+			for (uint32_t c = 0; c < 4; c++) {
+				float v = pixels[4 * i + c] / 65535.f;
+				image.mPixels[i].v[c] = (srgb && c < 3) ? SrgbToLinear(v) : v;
+			}
+		stbi_image_free(pixels);
+	}
+
+	vector<vector<uint8_t>> levels;
+	Image level = image;
+	while (true) {
+		levels.push_back(Compress(threadPool, level, blockFormat, srgb));
+		if (level.mWidth == 1 && level.mHeight == 1) break;
+		level = Downsample(level);
+	}
+
+	// the runtime only loads the file for textures requested with the same encoding, and loads the image otherwise
+	return WriteKtx2(output, image, levels, blockFormat, srgb);
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <input image or directory> [output] [-format bc1|bc3|bc4|bc5|bc6h|bc7] [-linear|-srgb]\n", argv[0]);
+		fprintf(stderr, "Images are converted as sRGB color, except ones named like data (normal, mask, roughness...) which are converted linear\n");
+		return EXIT_FAILURE;
+	}
+
+	fs::path input = argv[1];
+	fs::path output;
+	int32_t format = -1;
+	bool forceLinear = false;
+	bool forceSrgb = false;
+	for (int i = 2; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "-linear")
+			forceLinear = true;
+		else if (arg == "-srgb")
+			forceSrgb = true;
+		else if (arg == "-format" && i + 1 < argc) {
+			static const char* formats[] = { "bc1", "bc3", "bc4", "bc5", "bc6h", "bc7" };
+			string name = argv[++i];
+			for (uint32_t j = 0; j < 6; j++)
+				if (name == formats[j]) format = j;
+			if (format < 0) {
+				fprintf_color(COLOR_RED, stderr, "Error: Unknown format %s\n", name.c_str());
+				return EXIT_FAILURE;
+			}
+		} else
+			output = arg;
+	}
+
+	// converted textures are written next to their images, where AssetManager looks for them
+	vector<pair<fs::path, fs::path>> files;
+	if (fs::is_directory(input)) {
+		for (const auto& entry : fs::recursive_directory_iterator(input)) {
+			if (!fs::is_regular_file(entry.path())) continue;
+			string extension = entry.path().extension().string();
+			transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+			if (find_if(begin(ImageExtensions), end(ImageExtensions), [&](const char* e) { return extension == e; }) == end(ImageExtensions)) continue;
+			fs::path ktx2 = entry.path();
+			ktx2.replace_extension(".ktx2");
+			// skip textures that are up to date
+			if (fs::exists(ktx2) && fs::last_write_time(ktx2) >= fs::last_write_time(entry.path())) continue;
+			files.push_back(make_pair(entry.path(), ktx2));
+		}
+	} else {
+		if (output.empty()) {
+			output = input;
+			output.replace_extension(".ktx2");
+		}
+		files.push_back(make_pair(input, output));
+	}
+
+	ThreadPool* threadPool = new ThreadPool();
+	int result = EXIT_SUCCESS;
+	for (const auto& file : files) {
+		bool linear = forceLinear || (!forceSrgb && IsLinearName(file.first));
+		printf("Converting %s%s\n", file.first.string().c_str(), linear ? " (linear)" : "");
+		auto start = chrono::high_resolution_clock::now();
+		if (Convert(threadPool, file.first, file.second, format, linear))
+			printf("Converted %s in %.2fs\n", file.first.string().c_str(), chrono::duration_cast<chrono::duration<float>>(chrono::high_resolution_clock::now() - start).count());
+		else
+			result = EXIT_FAILURE;
+	}
+	delete threadPool;
+	return result;
+}
\ No newline at end of file
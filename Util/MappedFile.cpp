@@ -0,0 +1,48 @@
+#include <Util/MappedFile.hpp>
+
+#ifndef WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef WINDOWS
+MappedFile::MappedFile(const string& filename) : mData(nullptr), mSize(0), mFile(INVALID_HANDLE_VALUE), mMapping(NULL) {
+	mFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mFile == INVALID_HANDLE_VALUE) return;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0) return;
+	mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mMapping) return;
+	mData = (const uint8_t*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+	if (mData) mSize = (size_t)size.QuadPart;
+}
+MappedFile::~MappedFile() {
+	if (mData) UnmapViewOfFile(mData);
+	if (mMapping) CloseHandle(mMapping);
+	if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+}
+#else
+MappedFile::MappedFile(const string& filename) : mData(nullptr), mSize(0) {
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			mData = (const uint8_t*)data;
+			mSize = (size_t)st.st_size;
+		}
+	}
+	// the mapping keeps the file referenced
+	close(fd);
+}
+MappedFile::~MappedFile() {
+	if (mData) munmap((void*)mData, mSize);
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+/// A read-only memory mapping of a whole file. Pages are read in by the OS as they're touched, and since they're backed
+/// by the file they can be dropped again under memory pressure
+class MappedFile {
+public:
+	/// Check IsOpen() to see if the file could be mapped
+	ENGINE_EXPORT MappedFile(const std::string& filename);
+	ENGINE_EXPORT ~MappedFile();
+
+	inline bool IsOpen() const { return mData != nullptr; }
+	inline const uint8_t* Data() const { return mData; }
+	inline size_t Size() const { return mSize; }
+
+private:
+	const uint8_t* mData;
+	size_t mSize;
+	#ifdef WINDOWS
+	HANDLE mFile;
+	HANDLE mMapping;
+	#endif
+};
\ No newline at end of file
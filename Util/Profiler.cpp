@@ -4,44 +4,327 @@
 
 using namespace std;
 
-ProfilerSample  Profiler::mFrames[PROFILER_FRAME_COUNT];
-ProfilerSample* Profiler::mCurrentSample = nullptr;
+#define END_EVENT_BIT 0x80000000u
+
+ProfilerSample Profiler::mFrames[PROFILER_FRAME_COUNT];
+vector<Profiler::Event> Profiler::mThreadEvents[PROFILER_FRAME_COUNT];
 uint64_t Profiler::mCurrentFrame = 0;
+Profiler::ThreadBuffer* Profiler::mMainThread = nullptr;
+vector<Profiler::PendingGpuTime> Profiler::mPendingGpuTimes;
+string Profiler::mTraceRequest;
+uint32_t Profiler::mTraceRequestFrames = 0;
+mutex Profiler::mTraceRequestMutex;
+mutex Profiler::mThreadMutex;
+vector<Profiler::ThreadBuffer*> Profiler::mThreadBuffers;
+uint32_t Profiler::mThreadCount = 0;
+mutex Profiler::mLabelMutex;
+unordered_map<string, uint32_t> Profiler::mLabelIds;
+vector<string> Profiler::mLabels;
+map<string, uint64_t> Profiler::mCounters;
+mutex Profiler::mCounterMutex;
 const std::chrono::high_resolution_clock Profiler::mTimer;
 
-void Profiler::BeginSample(const string& label) {
-	mCurrentSample->mChildren.push_back({});
-	ProfilerSample* s = &mCurrentSample->mChildren.back();
-	memset(s, 0, sizeof(ProfilerSample));
-	
-	strncpy(s->mLabel, label.c_str(), PROFILER_LABEL_SIZE);
-	s->mParent = mCurrentSample;
-	s->mStartTime = mTimer.now();
-	s->mChildren = {};
+inline void WriteJsonString(ostream& stream, const char* str) {
+	stream << '"';
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') stream << '\\' << *str;
+		else if ((unsigned char)*str < 0x20) stream << ' ';
+		else stream << *str;
+	}
+	stream << '"';
+}
+
+Profiler::ThreadBuffer* Profiler::CurrentThreadBuffer() {
+	// marks the buffer as exited when its thread ends, FrameEnd() frees it once it has been drained
+	struct Owner {
+		ThreadBuffer* mBuffer = nullptr;
+		inline ~Owner() { if (mBuffer) mBuffer->mExited = true; }
+	};
+	thread_local Owner owner;
+	if (!owner.mBuffer) {
+		ThreadBuffer* buffer = new ThreadBuffer();
+		buffer->mHead = 0;
+		buffer->mTail = 0;
+		buffer->mExited = false;
+		buffer->mDepth = 0;
+		buffer->mChildCount[0] = 0;
+		buffer->mOpenEvents = 0;
+		buffer->mDropped = 0;
+		lock_guard lock(mThreadMutex);
+		buffer->mThread = mThreadCount++;
+		mThreadBuffers.push_back(buffer);
+		owner.mBuffer = buffer;
+	}
+	return owner.mBuffer;
+}
 
-	mCurrentSample =  s;
+uint32_t Profiler::InternLabel(const string& label) {
+	lock_guard lock(mLabelMutex);
+	auto it = mLabelIds.find(label);
+	if (it != mLabelIds.end()) return it->second;
+	uint32_t id = (uint32_t)mLabels.size();
+	mLabels.push_back(label);
+	mLabelIds.emplace(label, id);
+	return id;
+}
+
+bool Profiler::Record(ThreadBuffer* buffer, uint32_t label, uint64_t reserve) {
+	uint64_t head = buffer->mHead.load(memory_order_relaxed);
+	// the ring fills up until FrameEnd() drains it
+	if (PROFILER_EVENT_BUFFER_SIZE - (head - buffer->mTail.load(memory_order_acquire)) < reserve) return false;
+	Event& e = buffer->mEvents[head % PROFILER_EVENT_BUFFER_SIZE];
+	e.mTime = mTimer.now();
+	e.mLabel = label;
+	buffer->mHead.store(head + 1, memory_order_release);
+	return true;
+}
+
+void Profiler::BeginSample(uint32_t label) {
+	ThreadBuffer* buffer = CurrentThreadBuffer();
+	if (buffer->mDepth < PROFILER_MAX_DEPTH) {
+		buffer->mPath[buffer->mDepth] = buffer->mChildCount[buffer->mDepth]++;
+		buffer->mChildCount[buffer->mDepth + 1] = 0;
+		// keeps a slot for this sample's end and the ends of the samples it's nested in
+		buffer->mRecorded[buffer->mDepth] = Record(buffer, label, buffer->mOpenEvents + 2);
+		if (buffer->mRecorded[buffer->mDepth])
+			buffer->mOpenEvents++;
+		else
+			buffer->mDropped.fetch_add(1, memory_order_relaxed);
+	}
+	buffer->mDepth++;
+}
+void Profiler::BeginSample(const string& label) {
+	BeginSample(InternLabel(label));
 }
 void Profiler::EndSample() {
-	if (!mCurrentSample->mParent) {
-		fprintf_color(COLOR_RED, stderr, "Error: Attempt to end nonexistant Profiler sample!");
-		throw;
+	ThreadBuffer* buffer = CurrentThreadBuffer();
+	// ends of samples that began before FrameStart() reset the main thread
+	if (!buffer->mDepth) return;
+	buffer->mDepth--;
+	if (buffer->mDepth >= PROFILER_MAX_DEPTH || !buffer->mRecorded[buffer->mDepth]) return;
+	Record(buffer, END_EVENT_BIT, 1);
+	buffer->mOpenEvents--;
+}
+
+void Profiler::Drain(ThreadBuffer* buffer, vector<Event>& events) {
+	uint64_t tail = buffer->mTail.load(memory_order_relaxed);
+	uint64_t head = buffer->mHead.load(memory_order_acquire);
+	for (; tail < head; tail++) {
+		events.push_back(buffer->mEvents[tail % PROFILER_EVENT_BUFFER_SIZE]);
+		events.back().mThread = buffer->mThread;
+	}
+	buffer->mTail.store(head, memory_order_release);
+}
+
+void Profiler::BuildFrame(ProfilerSample& frame, const vector<Event>& events, chrono::high_resolution_clock::time_point end) {
+	lock_guard lock(mLabelMutex);
+	ProfilerSample* current = &frame;
+	for (const Event& e : events) {
+		if (e.mLabel & END_EVENT_BIT) {
+			// ends of samples that began before the frame started
+			if (current == &frame) continue;
+			current->mDuration = e.mTime - current->mStartTime;
+			current = current->mParent;
+		} else {
+			current->mChildren.push_back({});
+			ProfilerSample* s = &current->mChildren.back();
+			strncpy(s->mLabel, mLabels[e.mLabel].c_str(), PROFILER_LABEL_SIZE);
+			s->mLabel[PROFILER_LABEL_SIZE - 1] = '\0';
+			s->mParent = current;
+			s->mStartTime = e.mTime;
+			current = s;
+		}
+	}
+	// samples still open when the frame ended
+	for (; current != &frame; current = current->mParent)
+		current->mDuration = end - current->mStartTime;
+
+	// adding children moves their closed siblings, so the parents are fixed up once the tree is complete
+	vector<ProfilerSample*> samples = { &frame };
+	while (samples.size()) {
+		ProfilerSample* s = samples.back();
+		samples.pop_back();
+		for (ProfilerSample& c : s->mChildren) {
+			c.mParent = s;
+			samples.push_back(&c);
+		}
 	}
-	mCurrentSample->mDuration += mTimer.now() - mCurrentSample->mStartTime;
-	mCurrentSample = mCurrentSample->mParent;
 }
 
 void Profiler::FrameStart() {
-	int i = mCurrentFrame % PROFILER_FRAME_COUNT;
+	string traceRequest;
+	uint32_t traceFrames;
+	{
+		lock_guard lock(mTraceRequestMutex);
+		traceRequest.swap(mTraceRequest);
+		traceFrames = mTraceRequestFrames;
+	}
+	if (!traceRequest.empty()) WriteTrace(traceRequest, traceFrames);
+
+	uint64_t i = mCurrentFrame % PROFILER_FRAME_COUNT;
+	ThreadBuffer* buffer = CurrentThreadBuffer();
+	// samples taken on this thread between frames don't belong to any frame
+	mThreadEvents[i].clear();
+	Drain(buffer, mThreadEvents[i]);
+	mThreadEvents[i].clear();
+	buffer->mDepth = 0;
+	buffer->mChildCount[0] = 0;
+	buffer->mOpenEvents = 0;
+	mMainThread = buffer;
+
 	sprintf(mFrames[i].mLabel, "Frame  %llu", mCurrentFrame);
 	mFrames[i].mParent = nullptr;
 	mFrames[i].mStartTime = mTimer.now();
 	mFrames[i].mDuration = chrono::nanoseconds::zero();
+	mFrames[i].mGpuDuration = chrono::nanoseconds::zero();
 	mFrames[i].mChildren.clear();
-	mCurrentSample = &mFrames[i];
 }
 void Profiler::FrameEnd() {
-	int i = mCurrentFrame % PROFILER_FRAME_COUNT;
-	mFrames[i].mDuration = mTimer.now() - mFrames[i].mStartTime;
+	uint64_t i = mCurrentFrame % PROFILER_FRAME_COUNT;
+	chrono::high_resolution_clock::time_point end = mTimer.now();
+	mFrames[i].mDuration = end - mFrames[i].mStartTime;
+
+	if (mMainThread) {
+		vector<Event> events;
+		Drain(mMainThread, events);
+		BuildFrame(mFrames[i], events, end);
+	}
+
+	uint64_t dropped = 0;
+	{
+		lock_guard lock(mThreadMutex);
+		for (auto it = mThreadBuffers.begin(); it != mThreadBuffers.end();) {
+			ThreadBuffer* buffer = *it;
+			dropped += buffer->mDropped.exchange(0, memory_order_relaxed);
+			if (buffer == mMainThread) {
+				it++;
+				continue;
+			}
+			// checked before draining, so every event the thread recorded before exiting is drained
+			bool exited = buffer->mExited;
+			Drain(buffer, mThreadEvents[i]);
+			if (exited) {
+				delete buffer;
+				it = mThreadBuffers.erase(it);
+			} else
+				it++;
+		}
+	}
+
+	if (dropped) AddCounter("Profiler Dropped Samples", dropped);
+
 	mCurrentFrame++;
-	mCurrentSample = nullptr;
+
+	for (const PendingGpuTime& p : mPendingGpuTimes)
+		AddGpuTime(p.mFrame, p.mPath, p.mDuration);
+	mPendingGpuTimes.clear();
+}
+
+void Profiler::AddCounter(const string& name, uint64_t value) {
+	lock_guard lock(mCounterMutex);
+	mCounters[name] += value;
+}
+void Profiler::SetCounter(const string& name, uint64_t value) {
+	lock_guard lock(mCounterMutex);
+	mCounters[name] = value;
+}
+uint64_t Profiler::Counter(const string& name) {
+	lock_guard lock(mCounterMutex);
+	auto it = mCounters.find(name);
+	return it == mCounters.end() ? 0 : it->second;
+}
+map<string, uint64_t> Profiler::Counters() {
+	lock_guard lock(mCounterMutex);
+	return mCounters;
+}
+
+bool Profiler::CurrentSamplePath(uint64_t& frame, vector<uint32_t>& path) {
+	ThreadBuffer* buffer = CurrentThreadBuffer();
+	if (buffer != mMainThread) return false;
+	frame = mCurrentFrame;
+	path.assign(buffer->mPath, buffer->mPath + min(buffer->mDepth, (uint32_t)PROFILER_MAX_DEPTH));
+	return true;
+}
+void Profiler::AddGpuTime(uint64_t frame, const vector<uint32_t>& path, chrono::nanoseconds duration) {
+	// the frame's tree is built in FrameEnd()
+	if (frame >= mCurrentFrame) {
+		if (frame == mCurrentFrame) mPendingGpuTimes.push_back({ frame, path, duration });
+		return;
+	}
+	// the frame's slot is reused PROFILER_FRAME_COUNT frames later
+	if (mCurrentFrame - frame >= PROFILER_FRAME_COUNT) return;
+	ProfilerSample* s = &mFrames[frame % PROFILER_FRAME_COUNT];
+	for (uint32_t i : path) {
+		if (i >= s->mChildren.size()) return;
+		s = &s->mChildren[i];
+	}
+	s->mGpuDuration += duration;
+}
+
+void Profiler::RequestTrace(const string& filename, uint32_t frameCount) {
+	lock_guard lock(mTraceRequestMutex);
+	mTraceRequest = filename;
+	mTraceRequestFrames = frameCount;
+}
+
+bool Profiler::WriteTrace(const string& filename, uint32_t frameCount) {
+	ofstream file(filename);
+	if (!file.is_open()) {
+		fprintf_color(COLOR_RED, stderr, "Error: Failed to open %s\n", filename.c_str());
+		return false;
+	}
+
+	frameCount = (uint32_t)min<uint64_t>(min(frameCount, (uint32_t)PROFILER_FRAME_COUNT - 1), mCurrentFrame);
+	uint64_t firstFrame = mCurrentFrame - frameCount;
+	chrono::high_resolution_clock::time_point origin = mFrames[firstFrame % PROFILER_FRAME_COUNT].mStartTime;
+	auto Timestamp = [&](chrono::high_resolution_clock::time_point t) { return chrono::duration<double, micro>(t - origin).count(); };
+	uint32_t mainThread = mMainThread ? mMainThread->mThread : 0;
+	// samples open on each thread, ends of samples that began before the first frame are skipped and samples still open are closed at the end
+	unordered_map<uint32_t, uint32_t> openSamples;
+	chrono::high_resolution_clock::time_point end = origin;
+
+	lock_guard lock(mLabelMutex);
+	file << fixed;
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << mainThread << ",\"args\":{\"name\":\"Main\"}}";
+
+	for (uint64_t f = firstFrame; f < mCurrentFrame; f++) {
+		// the main thread's samples, as complete events with their GPU time
+		vector<const ProfilerSample*> samples = { &mFrames[f % PROFILER_FRAME_COUNT] };
+		while (samples.size()) {
+			const ProfilerSample* s = samples.back();
+			samples.pop_back();
+			file << ",\n{\"name\":";
+			WriteJsonString(file, s->mLabel);
+			file << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << mainThread << ",\"ts\":" << Timestamp(s->mStartTime) << ",\"dur\":" << chrono::duration<double, micro>(s->mDuration).count();
+			if (s->mGpuDuration.count()) file << ",\"args\":{\"gpu_ms\":" << chrono::duration<double, milli>(s->mGpuDuration).count() << "}";
+			file << "}";
+			for (const ProfilerSample& c : s->mChildren)
+				samples.push_back(&c);
+		}
+		const ProfilerSample& frame = mFrames[f % PROFILER_FRAME_COUNT];
+		end = max(end, frame.mStartTime + frame.mDuration);
+
+		// every other thread's samples, as begin/end events
+		for (const Event& e : mThreadEvents[f % PROFILER_FRAME_COUNT]) {
+			uint32_t& open = openSamples[e.mThread];
+			if (e.mLabel & END_EVENT_BIT) {
+				if (!open) continue;
+				open--;
+				file << ",\n{\"ph\":\"E\"";
+			} else {
+				open++;
+				file << ",\n{\"name\":";
+				WriteJsonString(file, mLabels[e.mLabel].c_str());
+				file << ",\"ph\":\"B\"";
+			}
+			file << ",\"pid\":0,\"tid\":" << e.mThread << ",\"ts\":" << Timestamp(e.mTime) << "}";
+			end = max(end, e.mTime);
+		}
+	}
+	for (auto&[thread, open] : openSamples)
+		for (; open; open--)
+			file << ",\n{\"ph\":\"E\",\"pid\":0,\"tid\":" << thread << ",\"ts\":" << Timestamp(end) << "}";
+	file << "\n]}";
+	return true;
 }
\ No newline at end of file
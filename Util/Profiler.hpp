@@ -3,43 +3,139 @@
 #define PROFILER_ENABLE
 
 #ifdef PROFILER_ENABLE
-#define PROFILER_BEGIN(label) Profiler::BeginSample(label)
+// the label is interned once per call site, so recording a sample doesn't allocate or lock. label must be the same every time
+#define PROFILER_BEGIN(label) Profiler::BeginSample([]() { static const uint32_t id = Profiler::InternLabel(label); return id; }())
 #define PROFILER_END Profiler::EndSample()
 #else
-#define PROFILER_BEGIN(label) 
+#define PROFILER_BEGIN(label)
 #define PROFILER_END
 #endif
 
 #define PROFILER_FRAME_COUNT 512
 #define PROFILER_LABEL_SIZE 64
+// begin/end events each thread can record before FrameEnd() drains them. Samples that begin once the ring is full are dropped and
+// counted in the "Profiler Dropped Samples" counter at the end of the frame, space is kept for the end of every sample that was recorded
+#define PROFILER_EVENT_BUFFER_SIZE 16384
+// deepest sample that CurrentSamplePath() can identify
+#define PROFILER_MAX_DEPTH 64
 
 #include <Util/Util.hpp>
+#include <atomic>
 #include <chrono>
 #include <list>
+#include <map>
 
 struct ProfilerSample {
 	char mLabel[PROFILER_LABEL_SIZE];
 	ProfilerSample* mParent;
 	std::chrono::high_resolution_clock::time_point mStartTime;
 	std::chrono::nanoseconds mDuration;
+	// time spent on the GPU by command regions recorded while this sample was open, added MaxFramesInFlight frames later
+	std::chrono::nanoseconds mGpuDuration;
 	std::vector<ProfilerSample> mChildren;
 };
 
+/// Samples are recorded as fixed-size begin/end events into a lock-free ring buffer owned by the recording thread.
+/// FrameEnd() drains every thread's ring: the thread that called FrameStart() is built into the frame's ProfilerSample tree,
+/// and the events of other threads are kept for WriteTrace(). Samples deeper than PROFILER_MAX_DEPTH are not recorded
 class Profiler {
 public:
+	/// Returns the id of label, adding it to the label table if it's new. Takes a lock, PROFILER_BEGIN calls it once per call site
+	ENGINE_EXPORT static uint32_t InternLabel(const std::string& label);
+	ENGINE_EXPORT static void BeginSample(uint32_t label);
+	/// Interns label on every call, prefer PROFILER_BEGIN or InternLabel() for labels that are used repeatedly
 	ENGINE_EXPORT static void BeginSample(const std::string& label);
 	ENGINE_EXPORT static void EndSample();
 
 	ENGINE_EXPORT static void FrameStart();
 	ENGINE_EXPORT static void FrameEnd();
 
+	/// Adds value to a named counter. Counters accumulate from startup and can be added to from any thread
+	ENGINE_EXPORT static void AddCounter(const std::string& name, uint64_t value = 1);
+	/// Replaces the value of a named counter, for counters that measure an amount rather than count events
+	ENGINE_EXPORT static void SetCounter(const std::string& name, uint64_t value);
+	/// Returns the value of a counter, or 0 if nothing has been added to it
+	ENGINE_EXPORT static uint64_t Counter(const std::string& name);
+	/// Returns a copy of every counter, sorted by name
+	ENGINE_EXPORT static std::map<std::string, uint64_t> Counters();
+
+	/// Gets the frame and the child indices from the frame's root down to the innermost open sample, which stay valid after the
+	/// sample ends. Returns false when called from a thread other than the one that called FrameStart()
+	ENGINE_EXPORT static bool CurrentSamplePath(uint64_t& frame, std::vector<uint32_t>& path);
+	/// Adds GPU time to the sample at path in frame, as returned by CurrentSamplePath(). Ignored if the frame has been overwritten.
+	/// Must be called from the thread that calls FrameStart()
+	ENGINE_EXPORT static void AddGpuTime(uint64_t frame, const std::vector<uint32_t>& path, std::chrono::nanoseconds duration);
+
+	/// Writes the last frameCount frames in the Chrome trace event format, which chrome://tracing and Perfetto open.
+	/// Must be called between frames, from the thread that calls FrameStart(). Returns false if the file can't be written
+	ENGINE_EXPORT static bool WriteTrace(const std::string& filename, uint32_t frameCount = PROFILER_FRAME_COUNT - 1);
+	/// Writes a trace with WriteTrace() at the next FrameStart(), so it can be called while a frame is being recorded
+	ENGINE_EXPORT static void RequestTrace(const std::string& filename, uint32_t frameCount = PROFILER_FRAME_COUNT - 1);
+
 	inline static const uint64_t CurrentFrameIndex() { return (mCurrentFrame + PROFILER_FRAME_COUNT - 1) % PROFILER_FRAME_COUNT; }
 	inline static const ProfilerSample* Frames() { return mFrames; }
 	inline static const ProfilerSample* LastFrame() { return &mFrames[CurrentFrameIndex()]; }
 
 private:
+	struct Event {
+		std::chrono::high_resolution_clock::time_point mTime;
+		// label id, with the high bit set for end events
+		uint32_t mLabel;
+		uint32_t mThread;
+	};
+	// single producer (the owning thread), single consumer (FrameEnd) ring of events
+	struct ThreadBuffer {
+		Event mEvents[PROFILER_EVENT_BUFFER_SIZE];
+		std::atomic<uint64_t> mHead;
+		std::atomic<uint64_t> mTail;
+		uint32_t mThread;
+		// set when the owning thread exits, the buffer is deleted once it has been drained
+		std::atomic<bool> mExited;
+
+		// child index of each open sample, for CurrentSamplePath()
+		uint32_t mDepth;
+		uint32_t mPath[PROFILER_MAX_DEPTH];
+		uint32_t mChildCount[PROFILER_MAX_DEPTH + 1];
+		// whether the begin event of each open sample was recorded, and how many open samples were, whose end events need a slot
+		bool mRecorded[PROFILER_MAX_DEPTH];
+		uint32_t mOpenEvents;
+		// samples dropped since the last FrameEnd(), which adds them to the "Profiler Dropped Samples" counter
+		std::atomic<uint64_t> mDropped;
+	};
+	struct PendingGpuTime {
+		uint64_t mFrame;
+		std::vector<uint32_t> mPath;
+		std::chrono::nanoseconds mDuration;
+	};
+
+	ENGINE_EXPORT static ThreadBuffer* CurrentThreadBuffer();
+	// records an event if at least reserve slots are free in buffer's ring, returns false if it was dropped
+	ENGINE_EXPORT static bool Record(ThreadBuffer* buffer, uint32_t label, uint64_t reserve);
+	// moves the events in buffer's ring into events
+	ENGINE_EXPORT static void Drain(ThreadBuffer* buffer, std::vector<Event>& events);
+	ENGINE_EXPORT static void BuildFrame(ProfilerSample& frame, const std::vector<Event>& events, std::chrono::high_resolution_clock::time_point end);
+
 	ENGINE_EXPORT static const std::chrono::high_resolution_clock mTimer;
 	ENGINE_EXPORT static ProfilerSample mFrames[PROFILER_FRAME_COUNT];
-	ENGINE_EXPORT static ProfilerSample* mCurrentSample;
+	// events recorded by threads other than the main thread during each frame
+	ENGINE_EXPORT static std::vector<Event> mThreadEvents[PROFILER_FRAME_COUNT];
 	ENGINE_EXPORT static uint64_t mCurrentFrame;
+	// the thread that called FrameStart(), which the ProfilerSample trees are built from
+	ENGINE_EXPORT static ThreadBuffer* mMainThread;
+	ENGINE_EXPORT static std::vector<PendingGpuTime> mPendingGpuTimes;
+	// set by RequestTrace(), written and cleared at the next FrameStart()
+	ENGINE_EXPORT static std::string mTraceRequest;
+	ENGINE_EXPORT static uint32_t mTraceRequestFrames;
+	ENGINE_EXPORT static std::mutex mTraceRequestMutex;
+
+	ENGINE_EXPORT static std::mutex mThreadMutex;
+	ENGINE_EXPORT static std::vector<ThreadBuffer*> mThreadBuffers;
+	ENGINE_EXPORT static uint32_t mThreadCount;
+
+	ENGINE_EXPORT static std::mutex mLabelMutex;
+	ENGINE_EXPORT static std::unordered_map<std::string, uint32_t> mLabelIds;
+	ENGINE_EXPORT static std::vector<std::string> mLabels;
+
+	ENGINE_EXPORT static std::map<std::string, uint64_t> mCounters;
+	ENGINE_EXPORT static std::mutex mCounterMutex;
 };
\ No newline at end of file
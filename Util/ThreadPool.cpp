@@ -0,0 +1,107 @@
+#include <Util/ThreadPool.hpp>
+
+using namespace std;
+
+// set on the background threads, which run the background queue instead of the foreground one
+static thread_local bool gBackgroundThread = false;
+
+ThreadPool::ThreadPool(uint32_t threadCount, uint32_t backgroundThreadCount) : mStop(false) {
+	if (threadCount == 0) threadCount = max(thread::hardware_concurrency(), 1u) - 1;
+	if (backgroundThreadCount == ~0u) backgroundThreadCount = threadCount ? max(threadCount / 2, 1u) : 0;
+	for (uint32_t i = 0; i < threadCount; i++)
+		mThreads.push_back(thread(&ThreadPool::WorkerThread, this, false));
+	for (uint32_t i = 0; i < backgroundThreadCount; i++)
+		mBackgroundThreads.push_back(thread(&ThreadPool::WorkerThread, this, true));
+}
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<mutex> lock(mMutex);
+		mStop = true;
+	}
+	mCondition.notify_all();
+	mBackgroundCondition.notify_all();
+	for (thread& t : mThreads)
+		t.join();
+	for (thread& t : mBackgroundThreads)
+		t.join();
+}
+
+bool ThreadPool::RunPendingTask() {
+	deque<function<void()>>& tasks = gBackgroundThread ? mBackgroundTasks : mTasks;
+	function<void()> task;
+	{
+		lock_guard<mutex> lock(mMutex);
+		if (tasks.empty()) return false;
+		task = move(tasks.front());
+		tasks.pop_front();
+	}
+	task();
+	return true;
+}
+
+void ThreadPool::WorkerThread(bool background) {
+	gBackgroundThread = background;
+	deque<function<void()>>& tasks = background ? mBackgroundTasks : mTasks;
+	condition_variable& condition = background ? mBackgroundCondition : mCondition;
+	while (true) {
+		function<void()> task;
+		{
+			unique_lock<mutex> lock(mMutex);
+			condition.wait(lock, [&]() { return mStop || !tasks.empty(); });
+			if (mStop && tasks.empty()) return;
+			task = move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+void ThreadPool::ParallelFor(uint32_t count, const function<void(uint32_t)>& func) {
+	if (count == 0) return;
+	// helpers of a background ParallelFor stay on the background threads
+	vector<thread>& threads = gBackgroundThread ? mBackgroundThreads : mThreads;
+	if (count == 1 || threads.empty()) {
+		for (uint32_t i = 0; i < count; i++)
+			func(i);
+		return;
+	}
+
+	// indices are claimed from a shared counter, the state is kept alive by any helper that starts after we return
+	struct ParallelForState {
+		const function<void(uint32_t)>* mFunc;
+		atomic<uint32_t> mNext;
+		atomic<uint32_t> mDone;
+		uint32_t mCount;
+	};
+	shared_ptr<ParallelForState> state = make_shared<ParallelForState>();
+	state->mFunc = &func;
+	state->mNext = 0;
+	state->mDone = 0;
+	state->mCount = count;
+
+	auto work = [state]() {
+		uint32_t i;
+		while ((i = state->mNext++) < state->mCount) {
+			(*state->mFunc)(i);
+			state->mDone++;
+		}
+	};
+
+	// the calling thread is one of the background threads
+	uint32_t helpers = min(count - 1, (uint32_t)threads.size() - (gBackgroundThread ? 1 : 0));
+	deque<function<void()>>& tasks = gBackgroundThread ? mBackgroundTasks : mTasks;
+	condition_variable& condition = gBackgroundThread ? mBackgroundCondition : mCondition;
+	if (helpers) {
+		{
+			lock_guard<mutex> lock(mMutex);
+			for (uint32_t i = 0; i < helpers; i++)
+				tasks.push_back(work);
+		}
+		if (helpers == 1) condition.notify_one();
+		else condition.notify_all();
+	}
+
+	work();
+	while (state->mDone < count)
+		if (!RunPendingTask()) this_thread::yield();
+}
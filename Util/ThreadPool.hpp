@@ -0,0 +1,91 @@
+#pragma once
+
+#include <Util/Util.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+
+/// Fixed-size pool of worker threads.
+/// Threads that wait on the pool (ParallelFor, Wait) execute queued tasks while waiting, so tasks may safely
+/// use the pool recursively.
+/// Work that may take longer than a frame (asset loads, pipeline creation) goes on a separate background queue that
+/// only the background threads run, so a frame-critical ParallelFor never picks it up while it waits.
+class ThreadPool {
+public:
+	/// threadCount = 0 uses one worker per hardware thread, minus the calling thread.
+	/// backgroundThreadCount = ~0u uses one background thread per two workers
+	ENGINE_EXPORT ThreadPool(uint32_t threadCount = 0, uint32_t backgroundThreadCount = ~0u);
+	ENGINE_EXPORT ~ThreadPool();
+
+	inline uint32_t ThreadCount() const { return (uint32_t)mThreads.size(); }
+	inline uint32_t BackgroundThreadCount() const { return (uint32_t)mBackgroundThreads.size(); }
+
+	template<typename F>
+	inline std::future<std::invoke_result_t<F>> Enqueue(F&& func) {
+		auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(func));
+		std::future<std::invoke_result_t<F>> result = task->get_future();
+		if (mThreads.empty()) {
+			(*task)();
+			return result;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mTasks.push_back([task]() { (*task)(); });
+		}
+		mCondition.notify_one();
+		return result;
+	}
+	/// Queues func on the background threads. Waits and ParallelFor on the worker threads never run background tasks
+	template<typename F>
+	inline std::future<std::invoke_result_t<F>> EnqueueBackground(F&& func) {
+		auto task = std::make_shared<std::packaged_task<std::invoke_result_t<F>()>>(std::forward<F>(func));
+		std::future<std::invoke_result_t<F>> result = task->get_future();
+		if (mBackgroundThreads.empty()) {
+			(*task)();
+			return result;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mBackgroundTasks.push_back([task]() { (*task)(); });
+		}
+		mBackgroundCondition.notify_one();
+		return result;
+	}
+
+	/// Blocks until the future is ready, executing queued tasks in the meantime.
+	/// Background threads execute background tasks, every other thread executes foreground tasks
+	template<typename T>
+	inline T Wait(std::future<T>& future) {
+		while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			if (!RunPendingTask()) std::this_thread::yield();
+		return future.get();
+	}
+	/// Blocks until the future is ready, executing queued tasks in the meantime.
+	/// Background threads execute background tasks, every other thread executes foreground tasks
+	template<typename T>
+	inline T Wait(const std::shared_future<T>& future) {
+		while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			if (!RunPendingTask()) std::this_thread::yield();
+		return future.get();
+	}
+
+	/// Calls func(i) for every i in [0, count) across the pool and the calling thread, returns once all calls complete.
+	/// Called from a background thread, the calls are spread across the background threads instead
+	ENGINE_EXPORT void ParallelFor(uint32_t count, const std::function<void(uint32_t)>& func);
+
+private:
+	ENGINE_EXPORT bool RunPendingTask();
+	ENGINE_EXPORT void WorkerThread(bool background);
+
+	std::vector<std::thread> mThreads;
+	std::vector<std::thread> mBackgroundThreads;
+	std::deque<std::function<void()>> mTasks;
+	std::deque<std::function<void()>> mBackgroundTasks;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	std::condition_variable mBackgroundCondition;
+	bool mStop;
+};
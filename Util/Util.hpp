@@ -14,6 +14,7 @@
 
 #include <stdexcept>
 #include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -323,6 +324,28 @@ inline bool IsPowerOfTwo(T value) {
 	return 0 == (value & (value - 1));
 }
 
+// Hands out integer ids, reusing released ones so the ids in use stay as small as the number of live objects. Thread safe
+class IdPool {
+public:
+	inline IdPool() : mNext(0) {}
+	inline uint32_t Allocate() {
+		std::lock_guard lock(mMutex);
+		if (mFree.empty()) return mNext++;
+		uint32_t id = mFree.back();
+		mFree.pop_back();
+		return id;
+	}
+	inline void Release(uint32_t id) {
+		std::lock_guard lock(mMutex);
+		mFree.push_back(id);
+	}
+
+private:
+	std::mutex mMutex;
+	std::vector<uint32_t> mFree;
+	uint32_t mNext;
+};
+
 
 // Defines a vertex input. Hashes itself once at creation, then remains immutable.
 // Note: Meshes store a pointer to one of these, but do not handle creation/deletion.